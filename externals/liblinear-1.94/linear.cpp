@@ -4,6 +4,9 @@
 #include <string.h>
 #include <stdarg.h>
 #include <locale.h>
+#include <pthread.h>
+#include <time.h>
+#include <emmintrin.h>
 #include "linear.h"
 #include "tron.h"
 typedef signed char schar;
@@ -44,10 +47,356 @@ static void info(const char *fmt,...)
 static void info(const char *fmt,...) {}
 #endif
 
+static double wall_seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double) t.tv_sec + 1e-9*(double) t.tv_nsec;
+}
+
+// Time and iteration budget of one train() call. Solvers ask proceed()
+// before every outer iteration (a pass over the data, a Newton or a trust
+// region step), so they stop with the solution they have reached, and it
+// calls param->checkpoint with the model so far every checkpoint_seconds.
+class train_budget : public solver_budget
+{
+public:
+	train_budget(const parameter *param, model *model_, int w_size);
+	// Solving column k of model_->w starts and gets an equal share of the
+	// time left with the next columns_left-1 ones. k < 0 means that the
+	// solver works on model_->w itself.
+	void start(int k, int columns_left);
+	int max_iter(int solver_max_iter) const
+	{
+		return param->max_iter > 0 ? param->max_iter : solver_max_iter;
+	}
+	bool proceed(const double *w);
+
+private:
+	const parameter *param;
+	model *model_;
+	int w_size;
+	int column;
+	double end;
+	double deadline;
+	double next_checkpoint;
+};
+
+train_budget::train_budget(const parameter *param, model *model_, int w_size)
+{
+	this->param = param;
+	this->model_ = model_;
+	this->w_size = w_size;
+	column = -1;
+	double now = wall_seconds();
+	end = param->max_seconds > 0 ? now + param->max_seconds : INF;
+	deadline = end;
+	next_checkpoint = now + param->checkpoint_seconds;
+}
+
+void train_budget::start(int k, int columns_left)
+{
+	column = k;
+	if(end < INF)
+	{
+		double now = wall_seconds();
+		deadline = now + (end - now)/max(columns_left, 1);
+	}
+}
+
+bool train_budget::proceed(const double *w)
+{
+	if(param->checkpoint == NULL && end == INF)
+		return true;
+	double now = wall_seconds();
+	if(param->checkpoint != NULL && now >= next_checkpoint)
+	{
+		int nr_w = (model_->nr_class == 2 && param->solver_type != MCSVM_CS) ? 1 : model_->nr_class;
+		if(column >= 0 && w != model_->w)
+			for(int j=0;j<w_size;j++)
+				model_->w[j*nr_w+column] = w[j];
+		param->checkpoint(model_, param->checkpoint_arg);
+		next_checkpoint = now + param->checkpoint_seconds;
+	}
+	if(now >= deadline)
+	{
+		info("\nWARNING: time budget is over, the solution so far is used\n");
+		return false;
+	}
+	return true;
+}
+
+// Threads which live as long as the pool and run one task after another.
+// run() calls task(arg, t) for every t < nr_thread at once: t == 0 in the
+// calling thread, the others in the pool, and returns when all are done.
+// A thread which cannot be created has its calls made by the caller, so
+// every t is always run. Solvers keep one pool for the whole solve and
+// do not create threads per iteration.
+class thread_pool
+{
+public:
+	thread_pool(int nr_thread);
+	~thread_pool();
+
+	int size() const { return nr_thread; }
+	void run(void (*task)(void *, int), void *arg);
+
+private:
+	thread_pool(const thread_pool &);
+	thread_pool &operator=(const thread_pool &);
+
+	struct worker
+	{
+		thread_pool *pool;
+		int t;
+		pthread_t thread;
+		bool started;
+	};
+	static void *work(void *arg);
+
+	int nr_thread;
+	worker *workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	void (*task)(void *, int);
+	void *arg;
+	// number of run() calls, a thread starts the task when it changes
+	unsigned long generation;
+	// started threads which have not finished the task
+	int busy;
+	bool stop;
+};
+
+thread_pool::thread_pool(int nr_thread)
+{
+	this->nr_thread = max(nr_thread, 1);
+	task = NULL;
+	arg = NULL;
+	generation = 0;
+	busy = 0;
+	stop = false;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&start_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+	workers = new worker[this->nr_thread];
+	for(int t=1;t<this->nr_thread;t++)
+	{
+		workers[t].pool = this;
+		workers[t].t = t;
+		workers[t].started = pthread_create(&workers[t].thread, NULL, work, &workers[t]) == 0;
+	}
+}
+
+thread_pool::~thread_pool()
+{
+	pthread_mutex_lock(&mutex);
+	stop = true;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&mutex);
+	for(int t=1;t<nr_thread;t++)
+		if(workers[t].started)
+			pthread_join(workers[t].thread, NULL);
+	delete[] workers;
+	pthread_cond_destroy(&done_cond);
+	pthread_cond_destroy(&start_cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+void *thread_pool::work(void *arg)
+{
+	const worker *w = (const worker *) arg;
+	thread_pool *pool = w->pool;
+	unsigned long seen = 0;
+	for(;;)
+	{
+		pthread_mutex_lock(&pool->mutex);
+		while(!pool->stop && pool->generation == seen)
+			pthread_cond_wait(&pool->start_cond, &pool->mutex);
+		if(pool->stop)
+		{
+			pthread_mutex_unlock(&pool->mutex);
+			return NULL;
+		}
+		seen = pool->generation;
+		void (*task)(void *, int) = pool->task;
+		void *task_arg = pool->arg;
+		pthread_mutex_unlock(&pool->mutex);
+
+		task(task_arg, w->t);
+
+		pthread_mutex_lock(&pool->mutex);
+		if(--pool->busy == 0)
+			pthread_cond_signal(&pool->done_cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+void thread_pool::run(void (*task)(void *, int), void *arg)
+{
+	int t;
+	pthread_mutex_lock(&mutex);
+	this->task = task;
+	this->arg = arg;
+	busy = 0;
+	for(t=1;t<nr_thread;t++)
+		busy += workers[t].started;
+	generation++;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&mutex);
+
+	task(arg, 0);
+	for(t=1;t<nr_thread;t++)
+		if(!workers[t].started)
+			task(arg, t);
+
+	pthread_mutex_lock(&mutex);
+	while(busy > 0)
+		pthread_cond_wait(&done_cond, &mutex);
+	pthread_mutex_unlock(&mutex);
+}
+
+// Products of the data matrix with a vector for the primal solvers,
+// computed by the nr_thread threads of a thread_pool.
+//
+// Rows are split into contiguous chunks whose bounds depend only on
+// the number of rows and threads. Every row of Xv is one dot product,
+// so it does not depend on the split. For X^T v every chunk sums its
+// rows into its own buffer and the buffers are added in chunk order,
+// so the result is the same in every run with the same nr_thread.
+// With one thread the products are the same as in the serial code.
+
+class parallel_products
+{
+public:
+	parallel_products(const problem *prob, int nr_thread);
+	~parallel_products();
+
+	// Xv[k] = x_{I[k]}^T v for k < size, I == NULL means I[k] = k
+	void Xv(const int *I, int size, const double *v, double *Xv);
+	// XTv = sum_k v[k] x_{I[k]}
+	void XTv(const int *I, int size, const double *v, double *XTv);
+
+private:
+	struct chunk
+	{
+		const int *I;
+		int begin, end;
+		const double *v;
+		double *out;
+		bool transpose;
+	};
+	static void run_chunk(void *arg, int t);
+	void run(const int *I, int size, const double *v, double *out, bool transpose);
+
+	const problem *prob;
+	int nr_thread;
+	int w_size;
+	double *buffer;
+	thread_pool pool;
+	// chunks of the current product, the first nr_chunk are used
+	chunk *chunks;
+	int nr_chunk;
+};
+
+parallel_products::parallel_products(const problem *prob, int nr_thread):
+	pool(nr_thread)
+{
+	this->prob = prob;
+	this->nr_thread = pool.size();
+	w_size = prob->n;
+	buffer = NULL;
+	if(this->nr_thread > 1)
+		buffer = new double[(size_t) (this->nr_thread-1)*w_size];
+	chunks = new chunk[this->nr_thread];
+	nr_chunk = 0;
+}
+
+parallel_products::~parallel_products()
+{
+	delete[] buffer;
+	delete[] chunks;
+}
+
+void parallel_products::run_chunk(void *arg, int t)
+{
+	const parallel_products *self = (const parallel_products *) arg;
+	if(t >= self->nr_chunk)
+		return;
+	const chunk *c = &self->chunks[t];
+	feature_node **x = self->prob->x;
+	int k;
+
+	if(!c->transpose)
+	{
+		for(k=c->begin;k<c->end;k++)
+		{
+			feature_node *s=x[c->I ? c->I[k] : k];
+			double sum=0;
+			while(s->index!=-1)
+			{
+				sum+=c->v[s->index-1]*s->value;
+				s++;
+			}
+			c->out[k]=sum;
+		}
+		return;
+	}
+
+	for(k=0;k<self->w_size;k++)
+		c->out[k]=0;
+	for(k=c->begin;k<c->end;k++)
+	{
+		feature_node *s=x[c->I ? c->I[k] : k];
+		while(s->index!=-1)
+		{
+			c->out[s->index-1]+=c->v[k]*s->value;
+			s++;
+		}
+	}
+}
+
+void parallel_products::run(const int *I, int size, const double *v, double *out, bool transpose)
+{
+	nr_chunk = max(min(nr_thread, size), 1);
+	int t;
+
+	for(t=0;t<nr_chunk;t++)
+	{
+		chunks[t].I = I;
+		chunks[t].begin = (int) ((long long) size*t/nr_chunk);
+		chunks[t].end = (int) ((long long) size*(t+1)/nr_chunk);
+		chunks[t].v = v;
+		chunks[t].out = (!transpose || t == 0) ? out : buffer + (size_t) (t-1)*w_size;
+		chunks[t].transpose = transpose;
+	}
+
+	// chunk t runs in thread t of the pool, chunk 0 in the calling thread
+	pool.run(run_chunk, this);
+
+	if(transpose)
+		for(t=1;t<nr_chunk;t++)
+		{
+			const double *part = chunks[t].out;
+			for(int j=0;j<w_size;j++)
+				out[j] += part[j];
+		}
+}
+
+void parallel_products::Xv(const int *I, int size, const double *v, double *Xv)
+{
+	run(I, size, v, Xv, false);
+}
+
+void parallel_products::XTv(const int *I, int size, const double *v, double *XTv)
+{
+	run(I, size, v, XTv, true);
+}
+
 class l2r_lr_fun: public function
 {
 public:
-	l2r_lr_fun(const problem *prob, double *C);
+	l2r_lr_fun(const problem *prob, double *C, int nr_thread);
 	~l2r_lr_fun();
 
 	double fun(double *w);
@@ -64,9 +413,11 @@ private:
 	double *z;
 	double *D;
 	const problem *prob;
+	parallel_products products;
 };
 
-l2r_lr_fun::l2r_lr_fun(const problem *prob, double *C)
+l2r_lr_fun::l2r_lr_fun(const problem *prob, double *C, int nr_thread):
+	products(prob, nr_thread)
 {
 	int l=prob->l;
 
@@ -152,46 +503,18 @@ void l2r_lr_fun::Hv(double *s, double *Hs)
 
 void l2r_lr_fun::Xv(double *v, double *Xv)
 {
-	int i;
-	int l=prob->l;
-	feature_node **x=prob->x;
-
-	for(i=0;i<l;i++)
-	{
-		feature_node *s=x[i];
-		Xv[i]=0;
-		while(s->index!=-1)
-		{
-			Xv[i]+=v[s->index-1]*s->value;
-			s++;
-		}
-	}
+	products.Xv(NULL, prob->l, v, Xv);
 }
 
 void l2r_lr_fun::XTv(double *v, double *XTv)
 {
-	int i;
-	int l=prob->l;
-	int w_size=get_nr_variable();
-	feature_node **x=prob->x;
-
-	for(i=0;i<w_size;i++)
-		XTv[i]=0;
-	for(i=0;i<l;i++)
-	{
-		feature_node *s=x[i];
-		while(s->index!=-1)
-		{
-			XTv[s->index-1]+=v[i]*s->value;
-			s++;
-		}
-	}
+	products.XTv(NULL, prob->l, v, XTv);
 }
 
 class l2r_l2_svc_fun: public function
 {
 public:
-	l2r_l2_svc_fun(const problem *prob, double *C);
+	l2r_l2_svc_fun(const problem *prob, double *C, int nr_thread);
 	~l2r_l2_svc_fun();
 
 	double fun(double *w);
@@ -211,9 +534,11 @@ protected:
 	int *I;
 	int sizeI;
 	const problem *prob;
+	parallel_products products;
 };
 
-l2r_l2_svc_fun::l2r_l2_svc_fun(const problem *prob, double *C)
+l2r_l2_svc_fun::l2r_l2_svc_fun(const problem *prob, double *C, int nr_thread):
+	products(prob, nr_thread)
 {
 	int l=prob->l;
 
@@ -300,62 +625,23 @@ void l2r_l2_svc_fun::Hv(double *s, double *Hs)
 
 void l2r_l2_svc_fun::Xv(double *v, double *Xv)
 {
-	int i;
-	int l=prob->l;
-	feature_node **x=prob->x;
-
-	for(i=0;i<l;i++)
-	{
-		feature_node *s=x[i];
-		Xv[i]=0;
-		while(s->index!=-1)
-		{
-			Xv[i]+=v[s->index-1]*s->value;
-			s++;
-		}
-	}
+	products.Xv(NULL, prob->l, v, Xv);
 }
 
 void l2r_l2_svc_fun::subXv(double *v, double *Xv)
 {
-	int i;
-	feature_node **x=prob->x;
-
-	for(i=0;i<sizeI;i++)
-	{
-		feature_node *s=x[I[i]];
-		Xv[i]=0;
-		while(s->index!=-1)
-		{
-			Xv[i]+=v[s->index-1]*s->value;
-			s++;
-		}
-	}
+	products.Xv(I, sizeI, v, Xv);
 }
 
 void l2r_l2_svc_fun::subXTv(double *v, double *XTv)
 {
-	int i;
-	int w_size=get_nr_variable();
-	feature_node **x=prob->x;
-
-	for(i=0;i<w_size;i++)
-		XTv[i]=0;
-	for(i=0;i<sizeI;i++)
-	{
-		feature_node *s=x[I[i]];
-		while(s->index!=-1)
-		{
-			XTv[s->index-1]+=v[i]*s->value;
-			s++;
-		}
-	}
+	products.XTv(I, sizeI, v, XTv);
 }
 
 class l2r_l2_svr_fun: public l2r_l2_svc_fun
 {
 public:
-	l2r_l2_svr_fun(const problem *prob, double *C, double p);
+	l2r_l2_svr_fun(const problem *prob, double *C, double p, int nr_thread);
 
 	double fun(double *w);
 	void grad(double *w, double *g);
@@ -364,8 +650,8 @@ private:
 	double p;
 };
 
-l2r_l2_svr_fun::l2r_l2_svr_fun(const problem *prob, double *C, double p):
-	l2r_l2_svc_fun(prob, C)
+l2r_l2_svr_fun::l2r_l2_svr_fun(const problem *prob, double *C, double p, int nr_thread):
+	l2r_l2_svc_fun(prob, C, nr_thread)
 {
 	this->p = p;
 }
@@ -456,7 +742,7 @@ void l2r_l2_svr_fun::grad(double *w, double *g)
 class Solver_MCSVM_CS
 {
 	public:
-		Solver_MCSVM_CS(const problem *prob, int nr_class, double *C, double eps=0.1, int max_iter=100000);
+		Solver_MCSVM_CS(const problem *prob, int nr_class, double *C, train_budget *budget, double eps=0.1);
 		~Solver_MCSVM_CS();
 		void Solve(double *w);
 	private:
@@ -466,17 +752,19 @@ class Solver_MCSVM_CS
 		int w_size, l;
 		int nr_class;
 		int max_iter;
+		train_budget *budget;
 		double eps;
 		const problem *prob;
 };
 
-Solver_MCSVM_CS::Solver_MCSVM_CS(const problem *prob, int nr_class, double *weighted_C, double eps, int max_iter)
+Solver_MCSVM_CS::Solver_MCSVM_CS(const problem *prob, int nr_class, double *weighted_C, train_budget *budget, double eps)
 {
 	this->w_size = prob->n;
 	this->l = prob->l;
 	this->nr_class = nr_class;
 	this->eps = eps;
-	this->max_iter = max_iter;
+	this->max_iter = budget->max_iter(100000);
+	this->budget = budget;
 	this->prob = prob;
 	this->B = new double[nr_class];
 	this->G = new double[nr_class];
@@ -581,7 +869,7 @@ void Solver_MCSVM_CS::Solve(double *w)
 		index[i] = i;
 	}
 
-	while(iter < max_iter)
+	while(iter < max_iter && budget->proceed(w))
 	{
 		double stopping = -INF;
 		for(i=0;i<active_size;i++)
@@ -745,6 +1033,291 @@ void Solver_MCSVM_CS::Solve(double *w)
 	delete [] active_size_i;
 }
 
+// Row access for the dual coordinate descent solvers.
+//
+// sparse_rows walks feature_node lists of the problem in the same order
+// as the original loops did. dense_rows is used when every instance has
+// all features 1..n in order and every value is exactly representable as
+// float (e.g. dense image descriptors): x_i are kept as contiguous float
+// rows and dot products and updates of w run with SSE2. Both give the
+// same algorithm (same random order and shrinking), dense sums differ
+// only in rounding.
+//
+// atomic_dot and atomic_axpy are used by the parallel solver: every
+// element of w is read with a relaxed atomic load and updated with
+// compare-and-swap, so concurrent updates of the same feature by
+// different threads are never lost. A compare-and-swap per feature is
+// much slower than the SSE axpy, so the parallel solver pays off only
+// when dot products, not updates, dominate.
+//
+// shuffle_block() > 1 asks the solvers to shuffle blocks of rows that
+// are neighbours in memory (see shuffle_index), for rows of a matrix
+// mapped from disk.
+
+static inline int random_int(unsigned int *seed)
+{
+	return seed ? rand_r(seed) : rand();
+}
+
+static int compare_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+// Random order of index[0..size). With block <= 1 it is the usual
+// shuffle. Otherwise indices are sorted, split into runs of block
+// consecutive ones, and both the runs and the indices inside every run
+// are shuffled, so each run touches a few neighbouring pages.
+static void shuffle_index(int *index, int size, int block, unsigned int *seed)
+{
+	int i;
+	if(block <= 1)
+	{
+		for (i=0; i<size; i++)
+		{
+			int j = i+random_int(seed)%(size-i);
+			swap(index[i], index[j]);
+		}
+		return;
+	}
+
+	qsort(index, (size_t)size, sizeof(int), compare_int);
+	int nr_run = (size+block-1)/block;
+	int *run = new int[nr_run];
+	int *sorted = new int[size];
+	memcpy(sorted, index, sizeof(int)*(size_t)size);
+	for (i=0; i<nr_run; i++)
+		run[i] = i;
+	for (i=0; i<nr_run; i++)
+		swap(run[i], run[i+random_int(seed)%(nr_run-i)]);
+	int k = 0;
+	for (i=0; i<nr_run; i++)
+	{
+		int begin = run[i]*block;
+		int end = min(begin+block, size);
+		int *part = index+k;
+		memcpy(part, sorted+begin, sizeof(int)*(size_t)(end-begin));
+		for (int j=0; j<end-begin; j++)
+			swap(part[j], part[j+random_int(seed)%(end-begin-j)]);
+		k += end-begin;
+	}
+	delete [] run;
+	delete [] sorted;
+}
+
+static inline double atomic_load(const double *p)
+{
+	double value;
+	__atomic_load(p, &value, __ATOMIC_RELAXED);
+	return value;
+}
+
+static inline void atomic_add(double *p, double a)
+{
+	double old, sum;
+	__atomic_load(p, &old, __ATOMIC_RELAXED);
+	do
+		sum = old + a;
+	while (!__atomic_compare_exchange(p, &old, &sum, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+class sparse_rows
+{
+public:
+	sparse_rows(const problem *prob): prob(prob) {}
+
+	int shuffle_block() const { return 1; }
+
+	// init + sum x_ij^2
+	double sqnorm(int i, double init) const
+	{
+		const feature_node *xi = prob->x[i];
+		while (xi->index != -1)
+		{
+			init += xi->value*xi->value;
+			xi++;
+		}
+		return init;
+	}
+
+	// w^T x_i
+	double dot(int i, const double *w) const
+	{
+		double sum = 0;
+		const feature_node *xi = prob->x[i];
+		while (xi->index != -1)
+		{
+			sum += w[xi->index-1]*xi->value;
+			xi++;
+		}
+		return sum;
+	}
+
+	// w += a*x_i
+	void axpy(int i, double a, double *w) const
+	{
+		const feature_node *xi = prob->x[i];
+		while (xi->index != -1)
+		{
+			w[xi->index-1] += a*xi->value;
+			xi++;
+		}
+	}
+
+	double atomic_dot(int i, const double *w) const
+	{
+		double sum = 0;
+		const feature_node *xi = prob->x[i];
+		while (xi->index != -1)
+		{
+			sum += atomic_load(&w[xi->index-1])*xi->value;
+			xi++;
+		}
+		return sum;
+	}
+
+	void atomic_axpy(int i, double a, double *w) const
+	{
+		const feature_node *xi = prob->x[i];
+		while (xi->index != -1)
+		{
+			atomic_add(&w[xi->index-1], a*xi->value);
+			xi++;
+		}
+	}
+
+private:
+	const problem *prob;
+};
+
+class dense_rows
+{
+public:
+	dense_rows(): x(NULL), rows(NULL), n(0), block(1) {}
+	~dense_rows() { delete [] x; delete [] rows; }
+
+	// Copy the problem to float rows, false if it is not dense
+	bool load(const problem *prob)
+	{
+		n = prob->n;
+		if (n <= 0)
+			return false;
+		for (int i=0; i<prob->l; i++)
+		{
+			const feature_node *xi = prob->x[i];
+			for (int j=0; j<n; j++)
+				if (xi[j].index != j+1 || (double)(float)xi[j].value != xi[j].value)
+					return false;
+			if (xi[n].index != -1)
+				return false;
+		}
+		int stride = (n+3)/4*4;
+		x = new float[(size_t)prob->l*stride];
+		rows = new const float *[prob->l];
+		for (int i=0; i<prob->l; i++)
+		{
+			float *row = x + (size_t)i*stride;
+			for (int j=0; j<n; j++)
+				row[j] = (float)prob->x[i][j].value;
+			for (int j=n; j<stride; j++)
+				row[j] = 0;
+			rows[i] = row;
+		}
+		return true;
+	}
+
+	// Use rows of an external matrix: row i is data + i*stride
+	void attach(const float *data, size_t stride, int l, int n, int block)
+	{
+		this->n = n;
+		this->block = max(block, 1);
+		rows = new const float *[l];
+		for (int i=0; i<l; i++)
+			rows[i] = data + (size_t)i*stride;
+	}
+
+	// Rows perm[0..l) of another set of rows
+	void select(const dense_rows &other, const int *perm, int l)
+	{
+		n = other.n;
+		block = other.block;
+		rows = new const float *[l];
+		for (int i=0; i<l; i++)
+			rows[i] = other.rows[perm[i]];
+	}
+
+	int shuffle_block() const { return block; }
+
+	double sqnorm(int i, double init) const
+	{
+		const float *xi = row(i);
+		for (int j=0; j<n; j++)
+			init += (double)xi[j]*xi[j];
+		return init;
+	}
+
+	double dot(int i, const double *w) const
+	{
+		const float *xi = row(i);
+		__m128d sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+		int j = 0;
+		for (; j+4<=n; j+=4)
+		{
+			__m128 v = _mm_loadu_ps(xi+j);
+			sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_cvtps_pd(v), _mm_loadu_pd(w+j)));
+			sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), _mm_loadu_pd(w+j+2)));
+		}
+		double part[2];
+		_mm_storeu_pd(part, _mm_add_pd(sum0, sum1));
+		double sum = part[0] + part[1];
+		for (; j<n; j++)
+			sum += w[j]*xi[j];
+		return sum;
+	}
+
+	void axpy(int i, double a, double *w) const
+	{
+		const float *xi = row(i);
+		__m128d va = _mm_set1_pd(a);
+		int j = 0;
+		for (; j+4<=n; j+=4)
+		{
+			__m128 v = _mm_loadu_ps(xi+j);
+			_mm_storeu_pd(w+j, _mm_add_pd(_mm_loadu_pd(w+j), _mm_mul_pd(va, _mm_cvtps_pd(v))));
+			_mm_storeu_pd(w+j+2, _mm_add_pd(_mm_loadu_pd(w+j+2), _mm_mul_pd(va, _mm_cvtps_pd(_mm_movehl_ps(v, v)))));
+		}
+		for (; j<n; j++)
+			w[j] += a*xi[j];
+	}
+
+	double atomic_dot(int i, const double *w) const
+	{
+		const float *xi = row(i);
+		double sum = 0;
+		for (int j=0; j<n; j++)
+			sum += atomic_load(&w[j])*xi[j];
+		return sum;
+	}
+
+	void atomic_axpy(int i, double a, double *w) const
+	{
+		const float *xi = row(i);
+		for (int j=0; j<n; j++)
+			atomic_add(&w[j], a*xi[j]);
+	}
+
+private:
+	dense_rows(const dense_rows &);
+	dense_rows &operator=(const dense_rows &);
+
+	const float *row(int i) const { return rows[i]; }
+
+	float *x;
+	const float **rows;
+	int n;
+	int block;
+};
+
 // A coordinate descent algorithm for 
 // L1-loss and L2-loss SVM dual problems
 //
@@ -754,6 +1327,9 @@ void Solver_MCSVM_CS::Solve(double *w)
 //  where Qij = yi yj xi^T xj and
 //  D is a diagonal matrix 
 //
+// With a proximal center c the primal regularizer is 0.5||w - c||^2,
+// then w = c + sum_i y_i alpha_i x_i and e_i becomes 1 - y_i c^T x_i.
+//
 // In L1-SVM case:
 // 		upper_bound_i = Cp if y_i = 1
 // 		upper_bound_i = Cn if y_i = -1
@@ -775,16 +1351,58 @@ void Solver_MCSVM_CS::Solve(double *w)
 #define GETI(i) (y[i]+1)
 // To support weights for instances, use GETI(i) (i)
 
+// Dual variables that correspond to a given w by the optimality
+// conditions, used to resume training from an existing model:
+// alpha_i = upper_bound_i if y_i w^T x_i < 1 (L1-loss),
+// alpha_i = max(0, 1 - y_i w^T x_i)/D_ii (L2-loss).
+// New instances which the model does not fit get large alpha, so alpha
+// is then scaled by t in [0, 1] which minimizes the dual objective
+// f(t alpha) = t^2/2 (||w(alpha)||^2 + alpha^T D alpha) - t e^T alpha.
+// The result is never worse than alpha = 0.
+
+template <class Rows>
+static void init_alpha_l1l2_svc(const Rows &rows, int l, int w_size, const schar *y, const double *w,
+	const double *center, const double *diag, const double *upper_bound, double *alpha)
+{
+	int i;
+	for(i=0; i<l; i++)
+	{
+		double margin = 1 - y[i]*rows.dot(i, w);
+		if(diag[GETI(i)] > 0)
+			alpha[i] = max(margin, 0.0)/diag[GETI(i)];
+		else
+			alpha[i] = margin > 0 ? upper_bound[GETI(i)] : 0;
+	}
+
+	double *w_alpha = new double[w_size];
+	double linear = 0, quadratic = 0;
+	for(i=0; i<w_size; i++)
+		w_alpha[i] = 0;
+	for(i=0; i<l; i++)
+	{
+		rows.axpy(i, y[i]*alpha[i], w_alpha);
+		linear += alpha[i]*(center ? 1 - y[i]*rows.dot(i, center) : 1);
+		quadratic += diag[GETI(i)]*alpha[i]*alpha[i];
+	}
+	for(i=0; i<w_size; i++)
+		quadratic += w_alpha[i]*w_alpha[i];
+	double t = quadratic > 0 ? min(linear/quadratic, 1.0) : 0;
+	for(i=0; i<l; i++)
+		alpha[i] *= t;
+	delete [] w_alpha;
+}
+
+template <class Rows>
 static void solve_l2r_l1l2_svc(
-	const problem *prob, double *w, double eps,
-	double Cp, double Cn, int solver_type)
+	const problem *prob, const Rows &rows, double *w, double eps,
+	double Cp, double Cn, int solver_type, bool warm_start, const double *center, train_budget *budget)
 {
 	int l = prob->l;
 	int w_size = prob->n;
 	int i, s, iter = 0;
 	double C, d, G;
 	double *QD = new double[l];
-	int max_iter = 1000;
+	int max_iter = budget->max_iter(1000);
 	int *index = new int[l];
 	double *alpha = new double[l];
 	schar *y = new schar[l];
@@ -821,49 +1439,34 @@ static void solve_l2r_l1l2_svc(
 
 	// Initial alpha can be set here. Note that
 	// 0 <= alpha[i] <= upper_bound[GETI(i)]
-	for(i=0; i<l; i++)
-		alpha[i] = 0;
+	if(warm_start)
+		init_alpha_l1l2_svc(rows, l, w_size, y, w, center, diag, upper_bound, alpha);
+	else
+		for(i=0; i<l; i++)
+			alpha[i] = 0;
 
 	for(i=0; i<w_size; i++)
-		w[i] = 0;
+		w[i] = center ? center[i] : 0;
 	for(i=0; i<l; i++)
 	{
-		QD[i] = diag[GETI(i)];
-
-		feature_node *xi = prob->x[i];
-		while (xi->index != -1)
-		{
-			double val = xi->value;
-			QD[i] += val*val;
-			w[xi->index-1] += y[i]*alpha[i]*val;
-			xi++;
-		}
+		QD[i] = rows.sqnorm(i, diag[GETI(i)]);
+		rows.axpy(i, y[i]*alpha[i], w);
 		index[i] = i;
 	}
 
-	while (iter < max_iter)
+	while (iter < max_iter && budget->proceed(w))
 	{
 		PGmax_new = -INF;
 		PGmin_new = INF;
 
-		for (i=0; i<active_size; i++)
-		{
-			int j = i+rand()%(active_size-i);
-			swap(index[i], index[j]);
-		}
+		shuffle_index(index, active_size, rows.shuffle_block(), NULL);
 
 		for (s=0; s<active_size; s++)
 		{
 			i = index[s];
-			G = 0;
 			schar yi = y[i];
 
-			feature_node *xi = prob->x[i];
-			while(xi->index!= -1)
-			{
-				G += w[xi->index-1]*(xi->value);
-				xi++;
-			}
+			G = rows.dot(i, w);
 			G = G*yi-1;
 
 			C = upper_bound[GETI(i)];
@@ -905,12 +1508,7 @@ static void solve_l2r_l1l2_svc(
 				double alpha_old = alpha[i];
 				alpha[i] = min(max(alpha[i] - G/QD[i], 0.0), C);
 				d = (alpha[i] - alpha_old)*yi;
-				xi = prob->x[i];
-				while (xi->index != -1)
-				{
-					w[xi->index-1] += d*xi->value;
-					xi++;
-				}
+				rows.axpy(i, d, w);
 			}
 		}
 
@@ -948,10 +1546,10 @@ static void solve_l2r_l1l2_svc(
 	double v = 0;
 	int nSV = 0;
 	for(i=0; i<w_size; i++)
-		v += w[i]*w[i];
+		v += center ? (w[i]-center[i])*(w[i]-center[i]) : w[i]*w[i];
 	for(i=0; i<l; i++)
 	{
-		v += alpha[i]*(alpha[i]*diag[GETI(i)] - 2);
+		v += alpha[i]*(alpha[i]*diag[GETI(i)] - 2*(center ? 1 - y[i]*rows.dot(i, center) : 1));
 		if(alpha[i] > 0)
 			++nSV;
 	}
@@ -964,6 +1562,260 @@ static void solve_l2r_l1l2_svc(
 	delete [] index;
 }
 
+// Parallel version of the solver above (PASSCoDe, Hsieh et al., ICML 2015).
+//
+// Instances are shuffled once and split into nr_thread blocks. In every
+// outer iteration each thread runs the loop of the serial solver over
+// its own block: it shuffles and shrinks its active set, and only it
+// changes alpha_i of its instances. w is shared: it is read with
+// atomic_dot and updated with atomic_axpy, so w = sum_i y_i alpha_i x_i
+// holds up to rounding. The threads of a thread_pool live for the whole
+// solve, every outer iteration is one run of the pool, which is also the
+// barrier between iterations. Projected gradients of all threads give the same
+// stopping condition as the serial solver, including the final check
+// on all instances after shrinking.
+
+template <class Rows>
+struct dcd_block
+{
+	const Rows *rows;
+	const schar *y;
+	const double *QD;
+	const double *diag;
+	const double *upper_bound;
+	double *alpha;
+	double *w;
+	int *index;
+	int size;
+	int active_size;
+	unsigned int seed;
+	double PGmax_old, PGmin_old;
+	double PGmax_new, PGmin_new;
+};
+
+template <class Rows>
+static void run_dcd_block(void *arg, int t)
+{
+	dcd_block<Rows> *b = (dcd_block<Rows> *) arg + t;
+	const schar *y = b->y;
+	int *index = b->index;
+	double *alpha = b->alpha;
+	int i, s;
+	double C, G, PG;
+
+	b->PGmax_new = -INF;
+	b->PGmin_new = INF;
+
+	shuffle_index(index, b->active_size, b->rows->shuffle_block(), &b->seed);
+
+	for (s=0; s<b->active_size; s++)
+	{
+		i = index[s];
+		schar yi = y[i];
+
+		G = b->rows->atomic_dot(i, b->w);
+		G = G*yi-1;
+
+		C = b->upper_bound[GETI(i)];
+		G += alpha[i]*b->diag[GETI(i)];
+
+		PG = 0;
+		if (alpha[i] == 0)
+		{
+			if (G > b->PGmax_old)
+			{
+				b->active_size--;
+				swap(index[s], index[b->active_size]);
+				s--;
+				continue;
+			}
+			else if (G < 0)
+				PG = G;
+		}
+		else if (alpha[i] == C)
+		{
+			if (G < b->PGmin_old)
+			{
+				b->active_size--;
+				swap(index[s], index[b->active_size]);
+				s--;
+				continue;
+			}
+			else if (G > 0)
+				PG = G;
+		}
+		else
+			PG = G;
+
+		b->PGmax_new = max(b->PGmax_new, PG);
+		b->PGmin_new = min(b->PGmin_new, PG);
+
+		if(fabs(PG) > 1.0e-12)
+		{
+			double alpha_old = alpha[i];
+			alpha[i] = min(max(alpha[i] - G/b->QD[i], 0.0), C);
+			b->rows->atomic_axpy(i, (alpha[i] - alpha_old)*yi, b->w);
+		}
+	}
+}
+
+template <class Rows>
+static void solve_l2r_l1l2_svc_parallel(
+	const problem *prob, const Rows &rows, double *w, double eps,
+	double Cp, double Cn, int solver_type, int nr_thread, bool warm_start, const double *center,
+	train_budget *budget)
+{
+	int l = prob->l;
+	int w_size = prob->n;
+	int i, t, iter = 0;
+	double *QD = new double[l];
+	int max_iter = budget->max_iter(1000);
+	int *index = new int[l];
+	double *alpha = new double[l];
+	schar *y = new schar[l];
+	nr_thread = min(nr_thread, l);
+	dcd_block<Rows> *blocks = new dcd_block<Rows>[nr_thread];
+	thread_pool pool(nr_thread);
+
+	double PGmax_old = INF;
+	double PGmin_old = -INF;
+	double PGmax_new, PGmin_new;
+
+	// default solver_type: L2R_L2LOSS_SVC_DUAL
+	double diag[3] = {0.5/Cn, 0, 0.5/Cp};
+	double upper_bound[3] = {INF, 0, INF};
+	if(solver_type == L2R_L1LOSS_SVC_DUAL)
+	{
+		diag[0] = 0;
+		diag[2] = 0;
+		upper_bound[0] = Cn;
+		upper_bound[2] = Cp;
+	}
+
+	for(i=0; i<l; i++)
+		y[i] = prob->y[i] > 0 ? +1 : -1;
+
+	if(warm_start)
+		init_alpha_l1l2_svc(rows, l, w_size, y, w, center, diag, upper_bound, alpha);
+	else
+		for(i=0; i<l; i++)
+			alpha[i] = 0;
+
+	for(i=0; i<w_size; i++)
+		w[i] = center ? center[i] : 0;
+	for(i=0; i<l; i++)
+	{
+		QD[i] = rows.sqnorm(i, diag[GETI(i)]);
+		rows.axpy(i, y[i]*alpha[i], w);
+		index[i] = i;
+	}
+	shuffle_index(index, l, rows.shuffle_block(), NULL);
+
+	for (t=0; t<nr_thread; t++)
+	{
+		int begin = (int) ((long long) l*t/nr_thread);
+		int end = (int) ((long long) l*(t+1)/nr_thread);
+		blocks[t].rows = &rows;
+		blocks[t].y = y;
+		blocks[t].QD = QD;
+		blocks[t].diag = diag;
+		blocks[t].upper_bound = upper_bound;
+		blocks[t].alpha = alpha;
+		blocks[t].w = w;
+		blocks[t].index = index + begin;
+		blocks[t].size = end - begin;
+		blocks[t].active_size = end - begin;
+		blocks[t].seed = (unsigned int) rand();
+	}
+
+	while (iter < max_iter && budget->proceed(w))
+	{
+		for (t=0; t<nr_thread; t++)
+		{
+			blocks[t].PGmax_old = PGmax_old;
+			blocks[t].PGmin_old = PGmin_old;
+		}
+		pool.run(run_dcd_block<Rows>, blocks);
+
+		PGmax_new = -INF;
+		PGmin_new = INF;
+		int active_size = 0;
+		for (t=0; t<nr_thread; t++)
+		{
+			PGmax_new = max(PGmax_new, blocks[t].PGmax_new);
+			PGmin_new = min(PGmin_new, blocks[t].PGmin_new);
+			active_size += blocks[t].active_size;
+		}
+
+		iter++;
+		if(iter % 10 == 0)
+			info(".");
+
+		if(PGmax_new - PGmin_new <= eps)
+		{
+			if(active_size == l)
+				break;
+			else
+			{
+				for (t=0; t<nr_thread; t++)
+					blocks[t].active_size = blocks[t].size;
+				info("*");
+				PGmax_old = INF;
+				PGmin_old = -INF;
+				continue;
+			}
+		}
+		PGmax_old = PGmax_new;
+		PGmin_old = PGmin_new;
+		if (PGmax_old <= 0)
+			PGmax_old = INF;
+		if (PGmin_old >= 0)
+			PGmin_old = -INF;
+	}
+
+	info("\noptimization finished, #iter = %d, #threads = %d\n",iter,nr_thread);
+	if (iter >= max_iter)
+		info("\nWARNING: reaching max number of iterations\nUsing -s 2 may be faster (also see FAQ)\n\n");
+
+	double v = 0;
+	int nSV = 0;
+	for(i=0; i<w_size; i++)
+		v += center ? (w[i]-center[i])*(w[i]-center[i]) : w[i]*w[i];
+	for(i=0; i<l; i++)
+	{
+		v += alpha[i]*(alpha[i]*diag[GETI(i)] - 2*(center ? 1 - y[i]*rows.dot(i, center) : 1));
+		if(alpha[i] > 0)
+			++nSV;
+	}
+	info("Objective value = %lf\n",v/2);
+	info("nSV = %d\n",nSV);
+
+	delete [] QD;
+	delete [] alpha;
+	delete [] y;
+	delete [] index;
+	delete [] blocks;
+}
+
+// rows are dense rows of the problem, or NULL to use feature_node lists
+static void solve_l2r_l1l2_svc(
+	const problem *prob, const dense_rows *rows, double *w, double eps,
+	double Cp, double Cn, int solver_type, int nr_thread, bool warm_start, const double *center,
+	train_budget *budget)
+{
+	if(nr_thread > 1 && prob->l > 1)
+	{
+		if(rows)
+			solve_l2r_l1l2_svc_parallel(prob, *rows, w, eps, Cp, Cn, solver_type, nr_thread, warm_start, center, budget);
+		else
+			solve_l2r_l1l2_svc_parallel(prob, sparse_rows(prob), w, eps, Cp, Cn, solver_type, nr_thread, warm_start, center, budget);
+	}
+	else if(rows)
+		solve_l2r_l1l2_svc(prob, *rows, w, eps, Cp, Cn, solver_type, warm_start, center, budget);
+	else
+		solve_l2r_l1l2_svc(prob, sparse_rows(prob), w, eps, Cp, Cn, solver_type, warm_start, center, budget);
+}
+
 
 // A coordinate descent algorithm for 
 // L1-loss and L2-loss epsilon-SVR dual problem
@@ -995,7 +1847,7 @@ static void solve_l2r_l1l2_svc(
 
 static void solve_l2r_l1l2_svr(
 	const problem *prob, double *w, const parameter *param,
-	int solver_type)
+	int solver_type, train_budget *budget)
 {
 	int l = prob->l;
 	double C = param->C;
@@ -1003,7 +1855,7 @@ static void solve_l2r_l1l2_svr(
 	int w_size = prob->n;
 	double eps = param->eps;
 	int i, s, iter = 0;
-	int max_iter = 1000;
+	int max_iter = budget->max_iter(1000);
 	int active_size = l;
 	int *index = new int[l];
 
@@ -1049,7 +1901,7 @@ static void solve_l2r_l1l2_svr(
 	}
 
 
-	while(iter < max_iter)
+	while(iter < max_iter && budget->proceed(w))
 	{
 		Gmax_new = 0;
 		Gnorm1_new = 0;
@@ -1220,13 +2072,15 @@ static void solve_l2r_l1l2_svr(
 #define GETI(i) (y[i]+1)
 // To support weights for instances, use GETI(i) (i)
 
-void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, double Cn)
+template <class Rows>
+static void solve_l2r_lr_dual(const problem *prob, const Rows &rows, double *w, double eps, double Cp, double Cn, bool warm_start,
+	train_budget *budget)
 {
 	int l = prob->l;
 	int w_size = prob->n;
 	int i, s, iter = 0;
 	double *xTx = new double[l];
-	int max_iter = 1000;
+	int max_iter = budget->max_iter(1000);
 	int *index = new int[l];	
 	double *alpha = new double[2*l]; // store alpha and C - alpha
 	schar *y = new schar[l];
@@ -1250,9 +2104,15 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 	// Initial alpha can be set here. Note that
 	// 0 < alpha[i] < upper_bound[GETI(i)]
 	// alpha[2*i] + alpha[2*i+1] = upper_bound[GETI(i)]
+	// When resuming from w, alpha[2*i] = C/(1 + exp(y_i w^T x_i)) as in the
+	// optimality conditions, kept away from the bounds
 	for(i=0; i<l; i++)
 	{
-		alpha[2*i] = min(0.001*upper_bound[GETI(i)], 1e-8);
+		double alpha_min = min(0.001*upper_bound[GETI(i)], 1e-8);
+		alpha[2*i] = alpha_min;
+		if(warm_start)
+			alpha[2*i] = min(max(upper_bound[GETI(i)]/(1 + exp(y[i]*rows.dot(i, w))), alpha_min),
+				upper_bound[GETI(i)] - alpha_min);
 		alpha[2*i+1] = upper_bound[GETI(i)] - alpha[2*i];
 	}
 
@@ -1260,25 +2120,14 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 		w[i] = 0;
 	for(i=0; i<l; i++)
 	{
-		xTx[i] = 0;
-		feature_node *xi = prob->x[i];
-		while (xi->index != -1)
-		{
-			double val = xi->value;
-			xTx[i] += val*val;
-			w[xi->index-1] += y[i]*alpha[2*i]*val;
-			xi++;
-		}
+		xTx[i] = rows.sqnorm(i, 0);
+		rows.axpy(i, y[i]*alpha[2*i], w);
 		index[i] = i;
 	}
 
-	while (iter < max_iter)
+	while (iter < max_iter && budget->proceed(w))
 	{
-		for (i=0; i<l; i++)
-		{
-			int j = i+rand()%(l-i);
-			swap(index[i], index[j]);
-		}
+		shuffle_index(index, l, rows.shuffle_block(), NULL);
 		int newton_iter = 0;
 		double Gmax = 0;
 		for (s=0; s<l; s++)
@@ -1286,13 +2135,7 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 			i = index[s];
 			schar yi = y[i];
 			double C = upper_bound[GETI(i)];
-			double ywTx = 0, xisq = xTx[i];
-			feature_node *xi = prob->x[i];
-			while (xi->index != -1)
-			{
-				ywTx += w[xi->index-1]*xi->value;
-				xi++;
-			}
+			double ywTx = rows.dot(i, w), xisq = xTx[i];
 			ywTx *= y[i];
 			double a = xisq, b = ywTx;
 
@@ -1335,12 +2178,7 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 			{
 				alpha[ind1] = z;
 				alpha[ind2] = C-z;
-				xi = prob->x[i];
-				while (xi->index != -1)
-				{
-					w[xi->index-1] += sign*(z-alpha_old)*yi*xi->value;
-					xi++;
-				}
+				rows.axpy(i, sign*(z-alpha_old)*yi, w);
 			}
 		}
 
@@ -1377,6 +2215,15 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 	delete [] index;
 }
 
+void solve_l2r_lr_dual(const problem *prob, const dense_rows *rows, double *w, double eps, double Cp, double Cn, bool warm_start,
+	train_budget *budget)
+{
+	if(rows)
+		solve_l2r_lr_dual(prob, *rows, w, eps, Cp, Cn, warm_start, budget);
+	else
+		solve_l2r_lr_dual(prob, sparse_rows(prob), w, eps, Cp, Cn, warm_start, budget);
+}
+
 // A coordinate descent algorithm for 
 // L1-regularized L2-loss support vector classification
 //
@@ -1396,12 +2243,12 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 
 static void solve_l1r_l2_svc(
 	problem *prob_col, double *w, double eps,
-	double Cp, double Cn)
+	double Cp, double Cn, train_budget *budget)
 {
 	int l = prob_col->l;
 	int w_size = prob_col->n;
 	int j, s, iter = 0;
-	int max_iter = 1000;
+	int max_iter = budget->max_iter(1000);
 	int active_size = w_size;
 	int max_num_linesearch = 20;
 
@@ -1450,7 +2297,7 @@ static void solve_l1r_l2_svc(
 		}
 	}
 
-	while(iter < max_iter)
+	while(iter < max_iter && budget->proceed(w))
 	{
 		Gmax_new = 0;
 		Gnorm1_new = 0;
@@ -1683,12 +2530,12 @@ static void solve_l1r_l2_svc(
 
 static void solve_l1r_lr(
 	const problem *prob_col, double *w, double eps,
-	double Cp, double Cn)
+	double Cp, double Cn, train_budget *budget)
 {
 	int l = prob_col->l;
 	int w_size = prob_col->n;
 	int j, s, newton_iter=0, iter=0;
-	int max_newton_iter = 100;
+	int max_newton_iter = budget->max_iter(100);
 	int max_iter = 1000;
 	int max_num_linesearch = 20;
 	int active_size;
@@ -1761,7 +2608,7 @@ static void solve_l1r_lr(
 		D[j] = C[GETI(j)]*exp_wTx[j]*tau_tmp*tau_tmp;
 	}
 
-	while(newton_iter < max_newton_iter)
+	while(newton_iter < max_newton_iter && budget->proceed(w))
 	{
 		Gmax_new = 0;
 		Gnorm1_new = 0;
@@ -2178,7 +3025,30 @@ static void group_classes(const problem *prob, int *nr_class_ret, int **label_re
 	free(data_label);
 }
 
-static void train_one(const problem *prob, const parameter *param, double *w, double Cp, double Cn)
+// Starting point of train_one: column k of param->init_sol, which has
+// nr_w interleaved columns like model->w, or zero
+static void init_w(const parameter *param, double *w, int w_size, int nr_w, int k)
+{
+	for(int j=0;j<w_size;j++)
+		w[j] = param->init_sol ? param->init_sol[j*nr_w+k] : 0;
+}
+
+// Column k of param->prox_center in center, or NULL without the center
+static double *init_center(const parameter *param, double *center, int w_size, int nr_w, int k)
+{
+	if(param->prox_center == NULL)
+		return NULL;
+	for(int j=0;j<w_size;j++)
+		center[j] = param->prox_center[j*nr_w+k];
+	return center;
+}
+
+// w is the initial solution on entry. Solvers that cannot start from it
+// (see check_parameter) reset it to zero. rows are dense rows of the
+// problem (see train_model), only dual solvers get them.
+// center is the proximal center of the regularizer for solvers -s 1 and 3, or NULL.
+static void train_one(const problem *prob, const dense_rows *rows, const parameter *param, double *w,
+	const double *center, double Cp, double Cn, train_budget *budget)
 {
 	double eps=param->eps;
 	int pos = 0;
@@ -2203,8 +3073,8 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 				else
 					C[i] = Cn;
 			}
-			fun_obj=new l2r_lr_fun(prob, C);
-			TRON tron_obj(fun_obj, primal_solver_tol);
+			fun_obj=new l2r_lr_fun(prob, C, param->nr_thread);
+			TRON tron_obj(fun_obj, primal_solver_tol, budget->max_iter(1000), budget);
 			tron_obj.set_print_string(liblinear_print_string);
 			tron_obj.tron(w);
 			delete fun_obj;
@@ -2221,8 +3091,8 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 				else
 					C[i] = Cn;
 			}
-			fun_obj=new l2r_l2_svc_fun(prob, C);
-			TRON tron_obj(fun_obj, primal_solver_tol);
+			fun_obj=new l2r_l2_svc_fun(prob, C, param->nr_thread);
+			TRON tron_obj(fun_obj, primal_solver_tol, budget->max_iter(1000), budget);
 			tron_obj.set_print_string(liblinear_print_string);
 			tron_obj.tron(w);
 			delete fun_obj;
@@ -2230,17 +3100,17 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 			break;
 		}
 		case L2R_L2LOSS_SVC_DUAL:
-			solve_l2r_l1l2_svc(prob, w, eps, Cp, Cn, L2R_L2LOSS_SVC_DUAL);
+			solve_l2r_l1l2_svc(prob, rows, w, eps, Cp, Cn, L2R_L2LOSS_SVC_DUAL, param->nr_thread, param->init_sol != NULL, center, budget);
 			break;
 		case L2R_L1LOSS_SVC_DUAL:
-			solve_l2r_l1l2_svc(prob, w, eps, Cp, Cn, L2R_L1LOSS_SVC_DUAL);
+			solve_l2r_l1l2_svc(prob, rows, w, eps, Cp, Cn, L2R_L1LOSS_SVC_DUAL, param->nr_thread, param->init_sol != NULL, center, budget);
 			break;
 		case L1R_L2LOSS_SVC:
 		{
 			problem prob_col;
 			feature_node *x_space = NULL;
 			transpose(prob, &x_space ,&prob_col);
-			solve_l1r_l2_svc(&prob_col, w, primal_solver_tol, Cp, Cn);
+			solve_l1r_l2_svc(&prob_col, w, primal_solver_tol, Cp, Cn, budget);
 			delete [] prob_col.y;
 			delete [] prob_col.x;
 			delete [] x_space;
@@ -2251,14 +3121,14 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 			problem prob_col;
 			feature_node *x_space = NULL;
 			transpose(prob, &x_space ,&prob_col);
-			solve_l1r_lr(&prob_col, w, primal_solver_tol, Cp, Cn);
+			solve_l1r_lr(&prob_col, w, primal_solver_tol, Cp, Cn, budget);
 			delete [] prob_col.y;
 			delete [] prob_col.x;
 			delete [] x_space;
 			break;
 		}
 		case L2R_LR_DUAL:
-			solve_l2r_lr_dual(prob, w, eps, Cp, Cn);
+			solve_l2r_lr_dual(prob, rows, w, eps, Cp, Cn, param->init_sol != NULL, budget);
 			break;
 		case L2R_L2LOSS_SVR:
 		{
@@ -2266,8 +3136,8 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 			for(int i = 0; i < prob->l; i++)
 				C[i] = param->C;
 
-			fun_obj=new l2r_l2_svr_fun(prob, C, param->p);
-			TRON tron_obj(fun_obj, param->eps);
+			fun_obj=new l2r_l2_svr_fun(prob, C, param->p, param->nr_thread);
+			TRON tron_obj(fun_obj, param->eps, budget->max_iter(1000), budget);
 			tron_obj.set_print_string(liblinear_print_string);
 			tron_obj.tron(w);
 			delete fun_obj;
@@ -2276,10 +3146,10 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 
 		}
 		case L2R_L1LOSS_SVR_DUAL:
-			solve_l2r_l1l2_svr(prob, w, param, L2R_L1LOSS_SVR_DUAL);
+			solve_l2r_l1l2_svr(prob, w, param, L2R_L1LOSS_SVR_DUAL, budget);
 			break;
 		case L2R_L2LOSS_SVR_DUAL:
-			solve_l2r_l1l2_svr(prob, w, param, L2R_L2LOSS_SVR_DUAL);
+			solve_l2r_l1l2_svr(prob, w, param, L2R_L2LOSS_SVR_DUAL, budget);
 			break;
 		default:
 			fprintf(stderr, "ERROR: unknown solver_type\n");
@@ -2287,10 +3157,19 @@ static void train_one(const problem *prob, const parameter *param, double *w, do
 	}
 }
 
+// Solvers which read instances through sparse_rows or dense_rows
+static bool uses_rows(int solver_type)
+{
+	return solver_type == L2R_L2LOSS_SVC_DUAL || solver_type == L2R_L1LOSS_SVC_DUAL ||
+		solver_type == L2R_LR_DUAL;
+}
+
 //
 // Interface functions
 //
-model* train(const problem *prob, const parameter *param)
+// prob->x is NULL when rows are given. Without rows a dense problem is
+// copied to float rows here, once for all classes.
+static model* train_model(const problem *prob, const dense_rows *rows, const parameter *param)
 {
 	int i,j;
 	int l = prob->l;
@@ -2303,7 +3182,12 @@ model* train(const problem *prob, const parameter *param)
 	else
 		model_->nr_feature=n;
 	model_->param = *param;
+	model_->param.init_sol = NULL;
+	model_->param.prox_center = NULL;
+	model_->param.checkpoint = NULL;
+	model_->param.checkpoint_arg = NULL;
 	model_->bias = prob->bias;
+	train_budget budget(param, model_, w_size);
 
 	if(param->solver_type == L2R_L2LOSS_SVR ||
 	   param->solver_type == L2R_L1LOSS_SVR_DUAL ||
@@ -2312,7 +3196,9 @@ model* train(const problem *prob, const parameter *param)
 		model_->w = Malloc(double, w_size);
 		model_->nr_class = 2;
 		model_->label = NULL;
-		train_one(prob, param, &model_->w[0], 0, 0);
+		init_w(param, model_->w, w_size, 1, 0);
+		budget.start(-1, 1);
+		train_one(prob, NULL, param, &model_->w[0], NULL, 0, 0, &budget);
 	}
 	else
 	{
@@ -2345,10 +3231,17 @@ model* train(const problem *prob, const parameter *param)
 				weighted_C[j] *= param->weight[i];
 		}
 
+		dense_rows dense;
+		if(rows == NULL && uses_rows(param->solver_type) && dense.load(prob))
+			rows = &dense;
+
 		// constructing the subproblem
 		feature_node **x = Malloc(feature_node *,l);
 		for(i=0;i<l;i++)
-			x[i] = prob->x[perm[i]];
+			x[i] = prob->x ? prob->x[perm[i]] : NULL;
+		dense_rows sub_rows;
+		if(rows)
+			sub_rows.select(*rows, perm, l);
 
 		int k;
 		problem sub_prob;
@@ -2367,7 +3260,8 @@ model* train(const problem *prob, const parameter *param)
 			for(i=0;i<nr_class;i++)
 				for(j=start[i];j<start[i]+count[i];j++)
 					sub_prob.y[j] = i;
-			Solver_MCSVM_CS Solver(&sub_prob, nr_class, weighted_C, param->eps);
+			budget.start(-1, 1);
+			Solver_MCSVM_CS Solver(&sub_prob, nr_class, weighted_C, &budget, param->eps);
 			Solver.Solve(model_->w);
 		}
 		else
@@ -2383,12 +3277,21 @@ model* train(const problem *prob, const parameter *param)
 				for(; k<sub_prob.l; k++)
 					sub_prob.y[k] = -1;
 
-				train_one(&sub_prob, param, &model_->w[0], weighted_C[0], weighted_C[1]);
+				double *center = param->prox_center ? Malloc(double, w_size) : NULL;
+				init_w(param, model_->w, w_size, 1, 0);
+				budget.start(0, 1);
+				train_one(&sub_prob, rows ? &sub_rows : NULL, param, &model_->w[0],
+					init_center(param, center, w_size, 1, 0), weighted_C[0], weighted_C[1], &budget);
+				free(center);
 			}
 			else
 			{
 				model_->w=Malloc(double, w_size*nr_class);
 				double *w=Malloc(double, w_size);
+				double *center = param->prox_center ? Malloc(double, w_size) : NULL;
+				// Classes not trained yet are in checkpoints with their initial weights
+				for(j=0;j<w_size*nr_class;j++)
+					model_->w[j] = param->init_sol ? param->init_sol[j] : 0;
 				for(i=0;i<nr_class;i++)
 				{
 					int si = start[i];
@@ -2402,12 +3305,16 @@ model* train(const problem *prob, const parameter *param)
 					for(; k<sub_prob.l; k++)
 						sub_prob.y[k] = -1;
 
-					train_one(&sub_prob, param, w, weighted_C[i], param->C);
+					init_w(param, w, w_size, nr_class, i);
+					budget.start(i, nr_class - i);
+					train_one(&sub_prob, rows ? &sub_rows : NULL, param, w,
+						init_center(param, center, w_size, nr_class, i), weighted_C[i], param->C, &budget);
 
 					for(int j=0;j<w_size;j++)
 						model_->w[j*nr_class+i] = w[j];
 				}
 				free(w);
+				free(center);
 			}
 
 		}
@@ -2424,6 +3331,24 @@ model* train(const problem *prob, const parameter *param)
 	return model_;
 }
 
+model* train(const problem *prob, const parameter *param)
+{
+	return train_model(prob, NULL, param);
+}
+
+model* train_dense(const dense_problem *prob, const parameter *param)
+{
+	problem sparse;
+	sparse.l = prob->l;
+	sparse.n = prob->n;
+	sparse.y = prob->y;
+	sparse.x = NULL;
+	sparse.bias = -1;
+	dense_rows rows;
+	rows.attach(prob->x, prob->stride, prob->l, prob->n, prob->shuffle_block);
+	return train_model(&sparse, &rows, param);
+}
+
 void cross_validation(const problem *prob, const parameter *param, int nr_fold, double *target)
 {
 	int i;
@@ -2814,6 +3739,46 @@ const char *check_parameter(const problem *prob, const parameter *param)
 		&& param->solver_type != L2R_L1LOSS_SVR_DUAL)
 		return "unknown solver type";
 
+	if(param->init_sol != NULL
+		&& param->solver_type != L2R_LR
+		&& param->solver_type != L2R_L2LOSS_SVC_DUAL
+		&& param->solver_type != L2R_L2LOSS_SVC
+		&& param->solver_type != L2R_L1LOSS_SVC_DUAL
+		&& param->solver_type != L2R_LR_DUAL
+		&& param->solver_type != L2R_L2LOSS_SVR)
+		return "initial solution is supported only for solvers -s 0, 1, 2, 3, 7 and 11";
+
+	if(param->prox_center != NULL
+		&& param->solver_type != L2R_L2LOSS_SVC_DUAL
+		&& param->solver_type != L2R_L1LOSS_SVC_DUAL)
+		return "proximal center is supported only for solvers -s 1 and 3";
+
+	if(param->checkpoint != NULL && param->checkpoint_seconds <= 0)
+		return "checkpoint_seconds <= 0";
+
+	return NULL;
+}
+
+const char *check_dense_parameter(const dense_problem *prob, const parameter *param)
+{
+	if(prob->l <= 0 || prob->n <= 0 || prob->stride < (size_t)prob->n)
+		return "dense problem has no rows or rows shorter than n";
+
+	problem sparse;
+	sparse.l = prob->l;
+	sparse.n = prob->n;
+	sparse.y = prob->y;
+	sparse.x = NULL;
+	sparse.bias = -1;
+	const char *error = check_parameter(&sparse, param);
+	if(error)
+		return error;
+
+	if(param->solver_type != L2R_L2LOSS_SVC_DUAL
+		&& param->solver_type != L2R_L1LOSS_SVC_DUAL
+		&& param->solver_type != L2R_LR_DUAL)
+		return "dense problems are supported only for solvers -s 1, 3 and 7";
+
 	return NULL;
 }
 
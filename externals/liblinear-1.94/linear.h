@@ -1,6 +1,8 @@
 #ifndef _LIBLINEAR_H
 #define _LIBLINEAR_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -19,6 +21,15 @@ struct problem
 	double bias;            /* < 0 if no bias term */  
 };
 
+struct dense_problem
+{
+	int l, n;
+	double *y;
+	const float *x;		/* row i is x + i*stride, n floats */
+	size_t stride;
+	int shuffle_block;	/* rows shuffled together by the solvers, <= 1 means each row alone */
+};
+
 enum { L2R_LR, L2R_L2LOSS_SVC_DUAL, L2R_L2LOSS_SVC, L2R_L1LOSS_SVC_DUAL, MCSVM_CS, L1R_L2LOSS_SVC, L1R_LR, L2R_LR_DUAL, L2R_L2LOSS_SVR = 11, L2R_L2LOSS_SVR_DUAL, L2R_L1LOSS_SVR_DUAL }; /* solver_type */
 
 struct parameter
@@ -32,6 +43,14 @@ struct parameter
 	int *weight_label;
 	double* weight;
 	double p;
+	int nr_thread;	/* threads of solvers -s 0, 1, 2, 3 and 11, <= 1 means one */
+	double *init_sol;	/* initial w in the layout of model->w, or NULL */
+	double *prox_center;	/* c of the regularizer 0.5||w - c||^2 in the layout of model->w (-s 1 and 3), or NULL */
+	int max_iter;	/* outer iterations of the solver (passes over data, Newton steps), <= 0 means its default */
+	double max_seconds;	/* wall-clock budget of train(), <= 0 means none; solvers stop with the solution so far */
+	void (*checkpoint)(const struct model *model_, void *arg);	/* called with the model so far, or NULL */
+	double checkpoint_seconds;	/* interval of checkpoint calls */
+	void *checkpoint_arg;
 };
 
 struct model
@@ -45,6 +64,7 @@ struct model
 };
 
 struct model* train(const struct problem *prob, const struct parameter *param);
+struct model* train_dense(const struct dense_problem *prob, const struct parameter *param);
 void cross_validation(const struct problem *prob, const struct parameter *param, int nr_fold, double *target);
 
 double predict_values(const struct model *model_, const struct feature_node *x, double* dec_values);
@@ -63,6 +83,7 @@ void free_and_destroy_model(struct model **model_ptr_ptr);
 void destroy_param(struct parameter *param);
 
 const char *check_parameter(const struct problem *prob, const struct parameter *param);
+const char *check_dense_parameter(const struct dense_problem *prob, const struct parameter *param);
 int check_probability_model(const struct model *model);
 void set_print_string_function(void (*print_func) (const char*));
 
@@ -49,6 +49,7 @@ void exit_with_help()
 	"-B bias : if bias >= 0, instance x becomes [x; bias]; if < 0, no bias term added (default -1)\n"
 	"-wi weight: weights adjust the parameter C of different classes (see README for details)\n"
 	"-v n: n-fold cross validation mode\n"
+	"-n nr_thread: number of threads of solvers -s 0, 1, 2, 3 and 11 (default 1)\n"
 	"-q : quiet mode (no outputs)\n"
 	);
 	exit(1);
@@ -186,6 +187,14 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 	param.nr_weight = 0;
 	param.weight_label = NULL;
 	param.weight = NULL;
+	param.nr_thread = 1;
+	param.init_sol = NULL;
+	param.prox_center = NULL;
+	param.max_iter = 0;
+	param.max_seconds = 0;
+	param.checkpoint = NULL;
+	param.checkpoint_seconds = 0;
+	param.checkpoint_arg = NULL;
 	flag_cross_validation = 0;
 	bias = -1;
 
@@ -225,6 +234,10 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 				param.weight[param.nr_weight-1] = atof(argv[i]);
 				break;
 
+			case 'n':
+				param.nr_thread = atoi(argv[i]);
+				break;
+
 			case 'v':
 				flag_cross_validation = 1;
 				nr_fold = atoi(argv[i]);
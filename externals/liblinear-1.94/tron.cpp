@@ -41,11 +41,12 @@ void TRON::info(const char *fmt,...)
 	(*tron_print_string)(buf);
 }
 
-TRON::TRON(const function *fun_obj, double eps, int max_iter)
+TRON::TRON(const function *fun_obj, double eps, int max_iter, solver_budget *budget)
 {
 	this->fun_obj=const_cast<function *>(fun_obj);
 	this->eps=eps;
 	this->max_iter=max_iter;
+	this->budget=budget;
 	tron_print_string = default_print;
 }
 
@@ -71,21 +72,34 @@ void TRON::tron(double *w)
 	double *w_new = new double[n];
 	double *g = new double[n];
 
+	// w is the starting point, zero unless training is resumed.
+	// The stopping condition is relative to the gradient at zero,
+	// so a resumed run stops at the same accuracy as a new one.
+	double gnorm1 = -1;
 	for (i=0; i<n; i++)
-		w[i] = 0;
+		if (w[i] != 0)
+			break;
+	if (i < n)
+	{
+		memset(w_new, 0, sizeof(double)*n);
+		fun_obj->fun(w_new);
+		fun_obj->grad(w_new, g);
+		gnorm1 = dnrm2_(&n, g, &inc);
+	}
 
 	f = fun_obj->fun(w);
 	fun_obj->grad(w, g);
 	delta = dnrm2_(&n, g, &inc);
-	double gnorm1 = delta;
-	double gnorm = gnorm1;
+	if (gnorm1 < 0)
+		gnorm1 = delta;
+	double gnorm = delta;
 
 	if (gnorm <= eps*gnorm1)
 		search = 0;
 
 	iter = 1;
 
-	while (iter <= max_iter && search)
+	while (iter <= max_iter && search && (budget == NULL || budget->proceed(w)))
 	{
 		cg_iter = trcg(delta, g, s, r);
 
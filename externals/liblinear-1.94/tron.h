@@ -12,10 +12,20 @@ public:
 	virtual ~function(void){}
 };
 
+// Limits of a solver run (see train_budget in linear.cpp)
+class solver_budget
+{
+public:
+	// Called with the current solution before every outer iteration,
+	// false stops the solver
+	virtual bool proceed(const double *w) = 0 ;
+	virtual ~solver_budget(void){}
+};
+
 class TRON
 {
 public:
-	TRON(const function *fun_obj, double eps = 0.1, int max_iter = 1000);
+	TRON(const function *fun_obj, double eps = 0.1, int max_iter = 1000, solver_budget *budget = NULL);
 	~TRON();
 
 	void tron(double *w);
@@ -27,6 +37,7 @@ private:
 
 	double eps;
 	int max_iter;
+	solver_budget *budget;
 	function *fun_obj;
 	void info(const char *fmt,...);
 	void (*tron_print_string)(const char *buf);
@@ -0,0 +1,65 @@
+#ifndef CASCADE_H_
+#define CASCADE_H_
+
+#include <vector>
+#include <cstddef>
+
+#include "extraction.h"
+#include "linear.h"
+
+/**
+@file cascade.h
+Two-stage classification: a model of the coarse descriptor decides confident images,
+the model of all features is used only for the rest
+*/
+
+///Default margin of (@ref TCascade): decision values outside [-1, 1] are outside the SVM margin
+const double CASCADE_MARGIN = 1.0;
+
+/**
+@class TCascadeStage
+Statistics of one stage of (@ref TCascade)
+*/
+struct TCascadeStage {
+    ///Number of images which reached the stage
+    size_t images;
+    ///Number of images whose label the stage gave
+    size_t decided;
+    ///Time spent in the stage, features and prediction
+    double seconds;
+
+    TCascadeStage() : images(0), decided(0), seconds(0) {}
+};
+
+/**
+@class TCascade
+Predicts a label with the coarse model (@ref ExtractCoarseDescriptor) first. If its confidence
+(the absolute decision value for two classes, the gap between the two best decision values otherwise)
+is less than the margin, the label comes from the fine model of (@ref ExtractDescriptor) features.
+Models are not owned and must outlive the cascade
+*/
+class TCascade {
+ public:
+    TCascade(const struct model* coarse, const struct model* fine, double margin, bool full);
+
+    ///Label of the image, stage is set to the index of the stage which gave it if not NULL
+    int Predict(BMP* image, bool useSse, MagnitudeMode mode, int* stage = NULL);
+    ///Statistics of stage 0 (coarse) or 1 (fine)
+    const TCascadeStage& Stage(int stage) const { return stages_[stage]; }
+
+    ///Confidence of the decision values of model, see (@ref TCascade)
+    static double Confidence(const struct model* model, const double* values);
+
+ private:
+    ///Decision values of model for the features and the label liblinear would predict
+    static int DecisionValues(const struct model* model, const std::vector<float>& features, double* values);
+
+    const struct model* coarse_;
+    const struct model* fine_;
+    double margin_;
+    bool full_;
+    TCascadeStage stages_[2];
+    std::vector<double> values_;
+};
+
+#endif
@@ -4,32 +4,39 @@
 #include <vector>
 #include <string>
 #include <cstdlib>
+#include <cassert>
 #include <iostream>
 #include <memory>
+#include <algorithm>
+#include <cstdio>
 
 #include "linear.h"
+#include "feature_matrix.h"
+#include "thread_pool.h"
 
 using std::vector;
 using std::pair;
 using std::string;
-using std::auto_ptr;
 
-typedef vector<pair<vector<float>, int> > TFeatures;
+typedef FeatureMatrix TFeatures;
 typedef vector<int> TLabels;
 
 // Model of classifier to be trained
-// Encapsulates 'struct model' from liblinear
+// Encapsulates 'struct model' from liblinear. The model is never changed once it is set:
+// copies of TModel share it, so any number of threads may predict with one copy in memory
 class TModel {
-        // Pointer to liblinear model;
-    auto_ptr<struct model> model_;
+        // Shared liblinear model, freed by liblinear with the last copy
+    std::shared_ptr<const struct model> model_;
  public:
         // Basic constructor
-    TModel(): model_(NULL) {}
-        // Construct class by liblinear model
-    TModel(struct model* model): model_(model) {}
-        // Operator = for liblinear model
+    TModel() {}
+        // Construct class by liblinear model, which TModel takes
+    TModel(struct model* model) {
+        *this = model;
+    }
+        // Operator = for liblinear model, other copies keep the previous model
     TModel& operator=(struct model* model) {
-        model_ = auto_ptr<struct model>(model);
+        model_ = std::shared_ptr<const struct model>(model, Free);
         return *this;
     }
         // Save model to file
@@ -39,14 +46,28 @@ class TModel {
     }
         // Load model from file
     void Load(const string& model_file) {
-        model_ = auto_ptr<struct model>(load_model(model_file.c_str()));
+        *this = load_model(model_file.c_str());
     }
         // Get pointer to liblinear model
-    struct model* get() const {
+    const struct model* get() const {
         return model_.get();
     }
+
+ private:
+        // Deleter of models allocated by liblinear
+    static void Free(const struct model* model) {
+        struct model* owned = const_cast<struct model*>(model);
+        free_and_destroy_model(&owned);
+    }
 };
 
+// Samples predicted by one thread at a time
+const size_t PREDICT_CHUNK = 64;
+
+// Samples shuffled together when features are mapped from a file:
+// 256 rows of the HOG descriptor are 4 MB of neighbouring pages
+const int MAPPED_SHUFFLE_BLOCK = 256;
+
 // Parameters for classifier training
 // Read more about it in liblinear documentation
 struct TClassifierParams {
@@ -54,18 +75,47 @@ struct TClassifierParams {
     int solver_type;
     double C;
     double eps;
+        // Epsilon of the loss of support vector regression
+    double p;
     int nr_weight;
     int* weight_label;
     double* weight;
+        // Threads of solvers (L2R_LR, L2R_L2LOSS_SVC, L2R_L2LOSS_SVC_DUAL, L2R_L1LOSS_SVC_DUAL)
+    int nr_thread;
+        // Model to resume training from (weights of its classes seed the solver), or NULL
+    const struct model* init_model;
+        // Model whose weights w0 replace zero in the regularizer |w - w0|^2 / 2, or NULL.
+        // Only dual SVM solvers (L2R_L2LOSS_SVC_DUAL, L2R_L1LOSS_SVC_DUAL)
+    const struct model* center_model;
+        // Dual solvers shuffle runs of this many neighbouring samples, 0 means
+        // MAPPED_SHUFFLE_BLOCK for mapped features and single samples otherwise
+    int shuffle_block;
+        // Outer iterations of the solver (passes over samples for dual solvers),
+        // 0 means the default of liblinear (1000 for dual solvers)
+    int max_iter;
+        // Wall-clock budget of training in seconds, 0 means none. Classes share the time left equally,
+        // when the share is over the solver stops with the weights it has reached
+    double max_seconds;
+        // File the model trained so far is saved to every checkpoint_seconds, or empty
+    string checkpoint_file;
+    double checkpoint_seconds;
 
     TClassifierParams() {
         bias = -1;
         solver_type = L2R_L2LOSS_SVC_DUAL;
         C = 0.1;
         eps = 1e-4;
+        p = 0.1;
         nr_weight = 0;
         weight_label = NULL;
         weight = NULL;
+        nr_thread = 1;
+        init_model = NULL;
+        center_model = NULL;
+        shuffle_block = 0;
+        max_iter = 0;
+        max_seconds = 0;
+        checkpoint_seconds = 60;
     }
 };
 
@@ -73,81 +123,206 @@ struct TClassifierParams {
 class TClassifier {
         // Parameters of classifier
     TClassifierParams params_;
+        // Threads of prediction if nr_thread > 1, shared by copies of the classifier
+    std::shared_ptr<TThreadPool> pool_;
 
  public:
         // Basic constructor
-    TClassifier(const TClassifierParams& params): params_(params) {}
+    TClassifier(const TClassifierParams& params)
+        : params_(params),
+          pool_(params.nr_thread > 1 ? new TThreadPool(params.nr_thread) : NULL) {}
 
         // Train classifier
     void Train(const TFeatures& features, TModel* model) {
             // Number of samples and features must be nonzero
-        size_t number_of_samples = features.size();
+        size_t number_of_samples = features.Rows();
         assert(number_of_samples > 0);
 
-        size_t number_of_features = features[0].first.size();
+        size_t number_of_features = features.Cols();
         assert(number_of_features > 0);
 
+            // Fill param structure by values from 'params_'
+        struct parameter param;
+        param.solver_type = params_.solver_type;
+        param.C = params_.C;      // try to vary it
+        param.eps = params_.eps;
+        param.p = params_.p;
+        param.nr_weight = params_.nr_weight;
+        param.weight_label = params_.weight_label;
+        param.weight = params_.weight;
+        param.nr_thread = params_.nr_thread;
+        param.max_iter = params_.max_iter;
+        param.max_seconds = params_.max_seconds;
+        param.checkpoint = params_.checkpoint_file.empty() ? NULL : SaveCheckpoint;
+        param.checkpoint_seconds = params_.checkpoint_seconds;
+        param.checkpoint_arg = &params_.checkpoint_file;
+            // Initial weights from the model to resume
+        vector<double> init_sol;
+        param.init_sol = NULL;
+        if (params_.init_model) {
+            InitialSolution(features, params_.init_model, &init_sol);
+            param.init_sol = &init_sol[0];
+        }
+            // Center of the regularizer in the same layout
+        vector<double> center;
+        param.prox_center = NULL;
+        if (params_.center_model) {
+            InitialSolution(features, params_.center_model, &center);
+            param.prox_center = &center[0];
+        }
+            // Labels of samples
+        vector<double> y(number_of_samples);
+        for (size_t sample_idx = 0; sample_idx < number_of_samples; ++sample_idx)
+            y[sample_idx] = features.Label(sample_idx);
+
+            // Dual solvers read rows of the feature matrix in place, also when it is mapped from a file
+        struct dense_problem dense;
+        dense.l = number_of_samples;
+        dense.n = number_of_features;
+        dense.y = &y[0];
+        dense.x = features.Row(0);
+        dense.stride = features.Stride();
+        dense.shuffle_block = params_.shuffle_block;
+        if (dense.shuffle_block == 0)
+            dense.shuffle_block = features.IsMapped() ? MAPPED_SHUFFLE_BLOCK : 1;
+        if (!check_dense_parameter(&dense, &param)) {
+            *model = train_dense(&dense, &param);
+            destroy_param(&param);
+            return;
+        }
+
             // Description of one problem
         struct problem prob;
         prob.l = number_of_samples;
         prob.bias = -1;
         prob.n = number_of_features;
-        prob.y = new double[number_of_samples];
+        prob.y = &y[0];
+        const char* error = check_parameter(&prob, &param);
+        if (error)
+            throw string(error);
         prob.x = new struct feature_node*[number_of_samples];
+            // All samples share one block of nodes
+        struct feature_node* x_space =
+            new struct feature_node[number_of_samples * (number_of_features + 1)];
 
-            // Fill struct problem
+            // Fill struct problem straight from the rows of feature matrix
         for (size_t sample_idx = 0; sample_idx < number_of_samples; ++sample_idx)
         {
-            prob.x[sample_idx] = new struct feature_node[number_of_features + 1];
-            for (unsigned int feature_idx = 0; feature_idx < number_of_features; feature_idx++)
-            {
-                prob.x[sample_idx][feature_idx].index = feature_idx + 1;
-                prob.x[sample_idx][feature_idx].value = features[sample_idx].first[feature_idx];
-            }
-            prob.x[sample_idx][number_of_features].index = -1;
-            prob.y[sample_idx] = features[sample_idx].second;
+            prob.x[sample_idx] = x_space + sample_idx * (number_of_features + 1);
+            FillNodes(features.Row(sample_idx), number_of_features, prob.x[sample_idx]);
         }
 
-            // Fill param structure by values from 'params_'
-        struct parameter param;
-        param.solver_type = params_.solver_type;
-        param.C = params_.C;      // try to vary it
-        param.eps = params_.eps;
-        param.nr_weight = params_.nr_weight;
-        param.weight_label = params_.weight_label;
-        param.weight = params_.weight;
-
             // Train model
         *model = train(&prob, &param);
 
             // Clear param structure
         destroy_param(&param);
             // clear problem structure
-        delete[] prob.y;
-        for (unsigned int sample_idx = 0; sample_idx < number_of_samples; ++sample_idx)
-            delete[] prob.x[sample_idx];
+        delete[] x_space;
         delete[] prob.x;
     }
 
-        // Predict data
-    void Predict(const TFeatures& features, const TModel& model, TLabels* labels) {
+        // Predict data. Chunks of PREDICT_CHUNK samples are spread over nr_thread threads,
+        // which only read the model. Predict may be called from many threads at once safely,
+        // but copies of the classifier share one thread pool, so such calls run one after another
+    void Predict(const TFeatures& features, const TModel& model, TLabels* labels) const {
             // Number of samples and features must be nonzero
-        size_t number_of_samples = features.size();
+        size_t number_of_samples = features.Rows();
         assert(number_of_samples > 0);
-        size_t number_of_features = features[0].first.size();
+        size_t number_of_features = features.Cols();
         assert(number_of_features > 0);
 
-            // Fill struct problem
-        struct feature_node* x = new struct feature_node[number_of_features + 1];
-        for (size_t sample_idx = 0; sample_idx < features.size(); ++sample_idx) {
-            for (unsigned int feature_idx = 0; feature_idx < number_of_features; ++feature_idx) {
-                x[feature_idx].index = feature_idx + 1;
-                x[feature_idx].value = features[sample_idx].first[feature_idx];
-            }
-            x[number_of_features].index = -1;
-                // Add predicted label to labels structure
-            labels->push_back(predict(model.get(), x));
+            // Predicted labels are appended to labels structure
+        size_t first_label = labels->size();
+        labels->resize(first_label + number_of_samples);
+        const struct model* shared = model.get();
+            // Every thread reuses its own node buffer and decision values for all its samples,
+            // predict() would allocate decision values for every sample
+        size_t threads = pool_ ? pool_->Threads() : 1;
+        vector<vector<struct feature_node> > nodes(threads);
+        vector<vector<double> > values(threads);
+        std::function<void(size_t, size_t, size_t)> body =
+            [&](size_t first, size_t last, size_t thread) {
+                if (nodes[thread].empty()) {
+                    nodes[thread].resize(number_of_features + 1);
+                    values[thread].resize(get_nr_class(shared));
+                }
+                for (size_t sample_idx = first; sample_idx < last; ++sample_idx) {
+                    FillNodes(features.Row(sample_idx), number_of_features, &nodes[thread][0]);
+                    (*labels)[first_label + sample_idx] = int(predict_values(shared, &nodes[thread][0], &values[thread][0]));
+                }
+            };
+        if (pool_)
+            pool_->Run(number_of_samples, PREDICT_CHUNK, body);
+        else
+            body(0, number_of_samples, 0);
+    }
+
+        // Labels of features in the order of classes of the model that train() returns:
+        // first appearance of labels (liblinear group_classes), +1 before -1
+    static vector<int> ClassLabels(const TFeatures& features) {
+        vector<int> labels;
+        for (size_t sample_idx = 0; sample_idx < features.Rows(); ++sample_idx)
+            if (std::find(labels.begin(), labels.end(), features.Label(sample_idx)) == labels.end())
+                labels.push_back(features.Label(sample_idx));
+        if (labels.size() == 2 && labels[0] == -1 && labels[1] == 1)
+            std::swap(labels[0], labels[1]);
+        return labels;
+    }
+
+        // Weights of model in the layout of a model with classes of labels: a weight vector per class,
+        // two classes share one weight vector, positive for the first class.
+        // Classes which model doesn't have get zero weights
+    static void ModelWeights(const struct model* model, const vector<int>& labels, vector<double>* weights) {
+        int number_of_features = get_nr_feature(model);
+
+            // Labels of model and the number of its weight vectors
+        int model_classes = get_nr_class(model);
+        vector<int> model_labels(model_classes);
+        get_labels(model, &model_labels[0]);
+        int model_stride = (model_classes == 2 && model->param.solver_type != MCSVM_CS) ? 1 : model_classes;
+
+        int stride = (labels.size() == 2) ? 1 : labels.size();
+        weights->assign(number_of_features * stride, 0);
+        for (int column = 0; column < stride; ++column) {
+                // Weight vector of the label in model, -w of the other label for two classes
+            int model_idx = std::find(model_labels.begin(), model_labels.end(), labels[column]) - model_labels.begin();
+            if (model_idx == model_classes)
+                continue;
+            int model_column = (model_stride == 1) ? 0 : model_idx;
+            double sign = (model_stride == 1 && model_idx == 1) ? -1 : 1;
+            for (int feature_idx = 0; feature_idx < number_of_features; ++feature_idx)
+                (*weights)[feature_idx * stride + column] =
+                    sign * model->w[feature_idx * model_stride + model_column];
+        }
+    }
+
+ private:
+        // Weights of init model in the layout of the model that train() returns for features
+    static void InitialSolution(const TFeatures& features, const struct model* init_model, vector<double>* init_sol) {
+        if (init_model->bias >= 0)
+            throw string("Initial model is trained with a bias feature, training has none");
+        if (get_nr_feature(init_model) != int(features.Cols()))
+            throw string("Initial model has a different number of features");
+        ModelWeights(init_model, ClassLabels(features), init_sol);
+    }
+
+        // Checkpoint of liblinear: the model is written to a temporary file and renamed,
+        // so the file always holds a whole model
+    static void SaveCheckpoint(const struct model* model, void* checkpoint_file) {
+        const string& file = *static_cast<const string*>(checkpoint_file);
+        string temporary = file + ".tmp";
+        if (save_model(temporary.c_str(), model) == 0)
+            rename(temporary.c_str(), file.c_str());
+    }
+
+        // Convert dense row of features to liblinear nodes terminated by index -1
+    static void FillNodes(const float* row, size_t number_of_features, struct feature_node* x) {
+        for (unsigned int feature_idx = 0; feature_idx < number_of_features; ++feature_idx) {
+            x[feature_idx].index = feature_idx + 1;
+            x[feature_idx].value = row[feature_idx];
         }
+        x[number_of_features].index = -1;
     }
 };
 
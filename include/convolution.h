@@ -0,0 +1,42 @@
+#pragma once
+
+#include "matrix.h"
+
+// Separable convolution.
+//
+// Kernel which is an outer product of a column and a row
+// (e.g. Sobel = [1 2 1]^T * [-1 0 1]) is applied in two 1d passes:
+// every source row is filtered by row kernel once and kept in a small
+// ring buffer of (col kernel size) rows, then rows of the ring buffer are
+// combined by column kernel into the output row. Both passes run over
+// contiguous rows with sse, ring buffer stays in L1 cache.
+//
+// Kernels are one-row matrices with odd number of coefficients,
+// radius is (size - 1) / 2. Coefficients are applied without flipping,
+// exactly like operators of unary_map:
+// result(i, j) = sum col(0, r) * row(0, c) * src(i + r - vr, j + c - hr)
+// Borders are mirrored as in Matrix::extra_borders.
+//
+// Supported types are short (wrap-around arithmetic, the same as
+// computing in int and truncating to short) and float.
+//
+// Example (5x5 Sobel):
+// Image smooth = {1, 4, 6, 4, 1}, deriv = {-1, -2, 0, 2, 1};
+// Image dx = convolve_separable(gray, deriv, smooth);
+
+template<typename ValueT>
+Matrix<ValueT> convolve_separable(const Matrix<ValueT> &src,
+	const Matrix<ValueT> &row_kernel, const Matrix<ValueT> &col_kernel);
+
+// Two convolutions of the same source in one sweep: every source row is
+// read and border-extended once and both row kernels are applied to it
+// while it is in cache. Results are written to first and second, which
+// are reallocated if their size differs from src.
+//
+// Sobel:
+// convolve_separable_pair(gray, {-1, 0, 1}, {1, 2, 1}, hor,
+//                               {1, 2, 1}, {-1, 0, 1}, vert);
+template<typename ValueT>
+void convolve_separable_pair(const Matrix<ValueT> &src,
+	const Matrix<ValueT> &row_first, const Matrix<ValueT> &col_first, Matrix<ValueT> &first,
+	const Matrix<ValueT> &row_second, const Matrix<ValueT> &col_second, Matrix<ValueT> &second);
@@ -0,0 +1,57 @@
+#ifndef DETECT_H_
+#define DETECT_H_
+
+#include <vector>
+
+#include "methods.h"
+#include "linear.h"
+
+/**
+@file detect.h
+Multi-scale sliding-window detection with the HOG descriptor of (@ref GetDescriptor) and a linear model
+*/
+
+///Size in pixels (both vertical and horizontal) of one cell of the detection grid. The window is (@ref CELL_COUNT) cells wide and high
+const uint DETECT_CELL_SIZE = 4;
+///Ratio between the sizes of two consecutive levels of the image pyramid
+const float DETECT_SCALE_STEP = 1.2;
+///Two detections which overlap more than this (intersection over union) are merged by (@ref SuppressNonMaximum)
+const float DETECT_NMS_OVERLAP = 0.5;
+///Label of the object class in the trained model
+const int DETECT_OBJECT_LABEL = 1;
+
+/**
+@struct Detection
+Window of the original image found by (@ref DetectObjects)
+*/
+struct Detection {
+	///Column of the upper-left corner
+	uint x;
+	///Row of the upper-left corner
+	uint y;
+	///Width of the window
+	uint width;
+	///Height of the window
+	uint height;
+	///Value of the linear model for the window
+	float score;
+};
+
+/**
+@struct DetectorWeights
+Linear model applied to the HOG descriptor of a window: score = weights * descriptor + bias
+*/
+struct DetectorWeights {
+	///(@ref CELL_COUNT) * (@ref CELL_COUNT) * (@ref SEGMENT_COUNT) weights in the order of (@ref GetDescriptor)
+	std::vector<float> weights;
+	///Constant term
+	float bias;
+};
+
+DetectorWeights GetDetectorWeights(const struct model *model, int label);
+floatImage ComputeCellGrid(ImageView hor, ImageView vert, floatImageView magn, uint cellSize);
+floatImage ScoreWindows(const floatImage &cells, const DetectorWeights &detector);
+std::vector<Detection> SuppressNonMaximum(std::vector<Detection> detections, float overlap);
+std::vector<Detection> DetectObjects(const Image &gray, const DetectorWeights &detector, float threshold, bool useSse);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef DISTRIBUTED_H_
+#define DISTRIBUTED_H_
+
+#include <string>
+
+#include "classifier.h"
+
+/**
+@file distributed.h
+Training of a linear SVM on features partitioned among processes, local or remote, by consensus ADMM.
+Every worker solves the dual problem of its partition with the liblinear solver, regularized towards
+the consensus weights instead of zero; the coordinator averages weights of workers into the next consensus.
+Workers and the coordinator exchange weight vectors over a Unix or TCP socket, hosts must share the byte order
+*/
+
+/**
+@class TConsensusParams
+Parameters of (@ref TConsensusCoordinator)
+*/
+struct TConsensusParams {
+    ///Penalty of the distance between weights of a worker and the consensus
+    double rho;
+    ///Maximal number of rounds
+    int rounds;
+    ///Training stops when the distance of workers from the consensus and the change of the consensus
+    ///in a round are below tolerance times its norm
+    double tolerance;
+
+    TConsensusParams() {
+        rho = 1;
+        rounds = 50;
+        tolerance = 1e-3;
+    }
+};
+
+/**
+@class TConsensusCoordinator
+Coordinator of consensus ADMM for min |z|^2 / 2 + C * (sum of losses of all samples). Every round worker k gets z
+and solves min C * (sum of losses of its samples) + rho / 2 |w_k - z + u_k|^2, then u_k += w_k - z,
+and the coordinator sets z = rho * sum(w_k + u_k) / (1 + rho * workers).
+The model is z, the solution of the problem on all samples together
+*/
+class TConsensusCoordinator {
+ public:
+    ///Listens on address, "unix:PATH" or "HOST:PORT" (port 0 picks a free one), so workers can connect
+    ///before (@ref Train) is called
+    TConsensusCoordinator(const std::string& address, const TConsensusParams& params);
+    ~TConsensusCoordinator();
+
+    ///Address workers connect to, with the port that was picked
+    const std::string& Address() const { return address_; }
+    ///Waits for workers, runs rounds and stores the consensus to model, its classes are in ascending order of labels
+    void Train(size_t workers, TModel* model);
+    ///Number of rounds of the last training
+    int Rounds() const { return rounds_; }
+
+ private:
+    TConsensusCoordinator(const TConsensusCoordinator&);
+    TConsensusCoordinator& operator=(const TConsensusCoordinator&);
+
+    std::string address_;
+    TConsensusParams params_;
+    int listener_;
+    int rounds_;
+};
+
+///Worker of (@ref TConsensusCoordinator): connects to address, retrying while the coordinator doesn't listen,
+///and solves rounds on features until the coordinator stops. C of params is C of the whole problem, solver_type
+///must be L2R_L2LOSS_SVC_DUAL or L2R_L1LOSS_SVC_DUAL, every worker must have samples of every class
+void RunConsensusWorker(const std::string& address, const TFeatures& features, const TClassifierParams& params);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef EXTRACTION_H_
+#define EXTRACTION_H_
+
+#include <vector>
+#include <cstddef>
+
+#include "methods.h"
+#include "linear.h"
+
+/**
+@file extraction.h
+Features of one image: HOG descriptor or full features (HOG of the image and its quadrants,
+mapped by (@ref ApplyHIKernel), and colors), extracted completely or only where a model needs them,
+and the coarse descriptor of the first stage of (@ref TCascade)
+*/
+
+///Cells of one HOG descriptor
+const size_t DESCRIPTOR_CELLS = CELL_COUNT * CELL_COUNT;
+///HOG descriptors of full features: the whole image and its four quadrants
+const size_t FULL_DESCRIPTORS = 5;
+///Number of features (@ref ApplyHIKernel) makes of one value
+const size_t HIK_SIZE = 2 * (2 * N + 1);
+///Number of features of one color cell (@ref GetCellColors)
+const size_t COLOR_SIZE = 3;
+///Cells of the coarse HOG descriptor in each direction
+const uint COARSE_CELL_COUNT = 4;
+///The coarse HOG descriptor is computed on the grayscale image reduced this many times in each direction
+const uint COARSE_SCALE = 4;
+
+/**
+@class FeatureMask
+Cells of HOG descriptors and color cells which have a significant weight in a liblinear model.
+A weight is significant if its absolute value exceeds threshold times the largest absolute weight,
+threshold 0 keeps every nonzero weight, so predictions don't change at all
+*/
+class FeatureMask {
+ public:
+    ///Mask of features with all cells needed
+    explicit FeatureMask(bool full);
+    ///Analyzes weights of model, which must have (@ref FeatureCount) features
+    FeatureMask(const struct model* model, bool full, double threshold);
+
+    bool Full() const { return full_; }
+    ///Whether cell of HOG descriptor (0 is the whole image, 1..4 are quadrants in full features) is needed
+    bool Cell(size_t descriptor, size_t cell) const { return cells_[descriptor * DESCRIPTOR_CELLS + cell]; }
+    ///Whether color cell is needed (only full features)
+    bool ColorCell(size_t cell) const { return colors_[cell]; }
+    ///Number of needed cells, HOG and color ones
+    size_t ActiveCells() const;
+    ///Number of all cells, HOG and color ones
+    size_t TotalCells() const { return cells_.size() + colors_.size(); }
+
+    ///Number of features of an image
+    static size_t FeatureCount(bool full);
+
+ private:
+    bool full_;
+    std::vector<bool> cells_;
+    std::vector<bool> colors_;
+};
+
+///Appends all features of image to result
+void ExtractDescriptor(BMP *image, bool full, bool useSse, MagnitudeMode mode, std::vector<float> &result);
+///Same as (@ref ExtractDescriptor) for the image already converted to grayscale
+void ExtractDescriptor(BMP *image, const Image &gray, bool full, bool useSse, MagnitudeMode mode,
+    std::vector<float> &result);
+///Appends features of image to result, computing gradients only in needed cells, other features are zeros.
+///If more than half of the cells are needed, all features are extracted as it is faster
+void ExtractDescriptor(BMP *image, const FeatureMask &mask, bool useSse, MagnitudeMode mode, std::vector<float> &result);
+
+///Appends the cheap HOG descriptor of (@ref COARSE_CELL_COUNT) x (@ref COARSE_CELL_COUNT) cells
+///of the grayscale image reduced (@ref COARSE_SCALE) times, (@ref COARSE_SCALE)^2 times less work than the full one
+void ExtractCoarseDescriptor(const Image &gray, bool useSse, std::vector<float> &result);
+
+#endif
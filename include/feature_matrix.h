@@ -0,0 +1,118 @@
+#ifndef FEATURE_MATRIX_H_
+#define FEATURE_MATRIX_H_
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+/**
+@file feature_matrix.h
+Contiguous row-major storage for feature vectors and their labels
+*/
+
+///Alignment in bytes of the feature block and of every row in it
+const size_t FEATURE_ALIGNMENT = 64;
+
+/**
+@class FeatureMatrixView
+Non-owning view of consecutive samples of a (@ref FeatureMatrix).
+It is cheap to copy and stays valid while the matrix it was taken from is alive and is not appended to.
+*/
+struct FeatureMatrixView {
+    ///Pointer to the first feature of the first row
+    const float *data;
+    ///Pointer to the label of the first row
+    const int *labels;
+    ///Number of samples
+    size_t n_rows;
+    ///Number of features in every sample
+    size_t n_cols;
+    ///Number of floats between two consecutive rows
+    size_t stride;
+
+    ///Features of the sample with index row
+    const float *Row(size_t row) const {
+        return data + row * stride;
+    }
+    ///Label of the sample with index row
+    int Label(size_t row) const {
+        return labels[row];
+    }
+    ///View of count samples starting with sample first
+    FeatureMatrixView Slice(size_t first, size_t count) const;
+};
+
+/**
+@class FeatureMatrix
+One aligned block of features (one row per sample, rows padded with zeros up to
+a multiple of (@ref FEATURE_ALIGNMENT) bytes) together with an array of labels.
+The matrix either owns its memory and grows by (@ref AppendRow) or is
+read-only and backed by a memory-mapped file created by (@ref Save).
+*/
+class FeatureMatrix {
+ public:
+    ///Empty matrix, the number of features is taken from the first appended row
+    FeatureMatrix();
+    ///Empty matrix for samples with cols features
+    explicit FeatureMatrix(size_t cols);
+    FeatureMatrix(FeatureMatrix&& other);
+    FeatureMatrix& operator=(FeatureMatrix&& other);
+    ~FeatureMatrix();
+
+    ///Appends one sample. Throws if the number of features differs from (@ref Cols)
+    ///or if the matrix is backed by a mapped file
+    void AppendRow(const float* row, size_t cols, int label);
+    void AppendRow(const std::vector<float>& row, int label) {
+        AppendRow(row.data(), row.size(), label);
+    }
+    ///Preallocates memory for rows samples. Before the number of features is known
+    ///the request is kept and memory is allocated by the first (@ref AppendRow)
+    void Reserve(size_t rows);
+
+    ///Number of samples
+    size_t Rows() const { return rows_; }
+    ///Number of features in every sample
+    size_t Cols() const { return cols_; }
+    ///Number of floats between two consecutive rows
+    size_t Stride() const { return stride_; }
+    bool Empty() const { return rows_ == 0; }
+
+    const float* Row(size_t row) const { return data_ + row * stride_; }
+    int Label(size_t row) const { return labels_[row]; }
+    const int* Labels() const { return labels_; }
+    FeatureMatrixView View() const;
+
+    ///Writes the matrix to a binary file which can be mapped back by (@ref Map)
+    void Save(const std::string& file) const;
+    ///Maps a file written by (@ref Save) into memory. The returned matrix is read-only
+    static FeatureMatrix Map(const std::string& file);
+    bool IsMapped() const { return mapping_ != NULL; }
+    ///Key of the images and options the features are extracted from, kept in the file
+    ///by (@ref Save) and (@ref Map). 0 means unknown
+    uint64_t Source() const { return source_; }
+    void SetSource(uint64_t source) { source_ = source; }
+
+ private:
+    FeatureMatrix(const FeatureMatrix&) = delete;
+    FeatureMatrix& operator=(const FeatureMatrix&) = delete;
+
+    void Release();
+    void Grow(size_t rows);
+
+    size_t rows_;
+    size_t cols_;
+    size_t stride_;
+    size_t capacity_;
+    ///Rows requested by (@ref Reserve) before the number of features is known
+    size_t reserved_;
+    uint64_t source_;
+    ///Row-major features, (@ref FEATURE_ALIGNMENT) aligned
+    float* data_;
+    int* labels_;
+    ///Start and length of the mapped file, NULL for owned memory
+    void* mapping_;
+    size_t mapping_size_;
+};
+
+#endif
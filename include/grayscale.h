@@ -0,0 +1,33 @@
+#pragma once
+
+#include "matrix.h"
+
+// Grayscale conversion of raw interleaved pixels.
+//
+// Weights are fixed point with denominator 128 (close to
+// 0.299 R + 0.587 G + 0.114 B), result is rounded half up:
+// gray = (GRAY_BLUE * B + GRAY_GREEN * G + GRAY_RED * R + 64) >> 7
+// All implementations (plain, sse4.1 and avx2) give exactly this value.
+//
+// useSse selects vector code, avx2 is used when processor supports it.
+//
+// Example:
+// BGRA row as in EasyBMP columns or Windows bitmaps
+// BgraToGrayscale(row, out, width, true);
+
+const uint GRAY_BLUE = 15;
+const uint GRAY_GREEN = 75;
+const uint GRAY_RED = 38;
+const uint GRAY_SHIFT = 7;
+
+// Reference conversion of one pixel
+inline short GrayFromBgr(uint blue, uint green, uint red)
+{
+	return short((GRAY_BLUE * blue + GRAY_GREEN * green + GRAY_RED * red +
+		(1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+}
+
+// count pixels of 4 bytes (blue, green, red, alpha) to count shorts
+void BgraToGrayscale(const unsigned char *src, short *dst, uint count, bool useSse);
+// count pixels of 3 bytes (blue, green, red) to count shorts
+void BgrToGrayscale(const unsigned char *src, short *dst, uint count, bool useSse);
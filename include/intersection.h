@@ -0,0 +1,103 @@
+#ifndef INTERSECTION_H_
+#define INTERSECTION_H_
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+#include "feature_matrix.h"
+#include "thread_pool.h"
+
+/**
+@file intersection.h
+Exact histogram intersection kernel SVM compiled to piecewise-linear lookup tables
+(Maji, Berg, Malik "Classification using intersection kernel support vector machines is efficient")
+*/
+
+/**
+@class TIntersectionParams
+Parameters of (@ref TIntersectionClassifier)
+*/
+struct TIntersectionParams {
+    ///Penalty of the squared hinge loss, as C of L2R_L2LOSS_SVC_DUAL
+    double C;
+    ///Stopping tolerance on the projected gradient of the dual
+    double eps;
+    ///Largest number of passes over samples
+    int max_iter;
+    ///Number of intervals of the lookup table of every feature
+    size_t bins;
+
+    TIntersectionParams() {
+        C = 1;
+        eps = 0.1;
+        max_iter = 1000;
+        bins = 64;
+    }
+};
+
+/**
+@class TIntersectionModel
+Decision function sum_j h_j(x_j) of an intersection kernel SVM for every class.
+Every h_j is tabulated on (@ref TIntersectionParams::bins) equal intervals of [0, largest training value]
+and interpolated linearly, so a decision value costs one lookup per feature instead of one kernel per support vector.
+Classes are in the order of liblinear: one function for two classes, positive for the first label
+*/
+class TIntersectionModel {
+ public:
+    TIntersectionModel();
+
+    int NrClass() const { return labels_.size(); }
+    size_t Cols() const { return cols_; }
+    const std::vector<int>& Labels() const { return labels_; }
+
+    ///Decision values of the sample, one per function as in liblinear
+    void DecisionValues(const float* row, double* values) const;
+    ///Label of the sample, chosen from decision values the same way as liblinear predict
+    int Predict(const float* row) const;
+    ///Appends labels of all samples to labels, computed in the threads of pool if it is not NULL
+    void Predict(const FeatureMatrix& features, std::vector<int>* labels, TThreadPool* pool = NULL) const;
+
+    ///Writes the tables to a text file
+    void Save(const std::string& model_file) const;
+    ///Reads a file written by (@ref Save). Throws if it is not a lookup table model
+    void Load(const std::string& model_file);
+    ///Checks whether the file was written by (@ref Save) and not by liblinear
+    static bool IsModelFile(const std::string& model_file);
+
+ private:
+    friend class TIntersectionClassifier;
+
+    size_t cols_;
+    size_t bins_;
+    ///Number of functions: 1 for two classes, number of classes otherwise
+    size_t nr_w_;
+    std::vector<int> labels_;
+    ///bins_ divided by the largest training value of every feature, 0 for features which are always 0
+    std::vector<float> scales_;
+    ///For every feature bins_ + 1 knots, every knot holds values of all nr_w_ functions
+    std::vector<float> tables_;
+};
+
+/**
+@class TIntersectionClassifier
+Trains the intersection kernel SVM K(x, z) = sum_j min(x_j, z_j) exactly by dual coordinate descent
+(the L2R_L2LOSS_SVC_DUAL method of liblinear without bias), one class against the rest.
+With coefficients a_i = alpha_i y_i the decision function is additive,
+h_j(s) = sum over x_ij <= s of a_i x_ij + s * sum over x_ij > s of a_i,
+and both sums are kept in Fenwick trees over the samples sorted by feature j,
+so a coordinate step costs O(nnz log l) instead of O(l nnz). Features must not be negative
+*/
+class TIntersectionClassifier {
+ public:
+    explicit TIntersectionClassifier(const TIntersectionParams& params) : params_(params) {}
+
+    ///Trains model; coefficients, if not NULL, receive a_i of every function, Rows() per function
+    void Train(const FeatureMatrix& features, TIntersectionModel* model,
+        std::vector<double>* coefficients = NULL) const;
+
+ private:
+    TIntersectionParams params_;
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef KNN_H_
+#define KNN_H_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "feature_matrix.h"
+
+/**
+@file knn.h
+Classification by the vote of k nearest neighbours among labelled samples, found approximately by
+an inverted file index: samples are grouped in lists by the nearest k-means centroid and a query
+scans only the lists of its nearest centroids. New samples are inserted without retraining
+*/
+
+///Default number of neighbours which vote
+const int KNN_NEIGHBOURS = 5;
+///Default number of lists a query scans
+const size_t KNN_PROBES = 4;
+
+/**
+@class TKnnParams
+Parameters of (@ref TKnnIndex)
+*/
+struct TKnnParams {
+    ///Number of neighbours which vote
+    int k;
+    ///Number of lists (k-means centroids), 0 is the square root of the number of samples
+    size_t lists;
+    ///Number of lists with the nearest centroids a query scans, all lists give the exact neighbours
+    size_t probes;
+    ///Iterations of k-means
+    int iterations;
+    ///Number of threads of building and of (@ref TKnnIndex::Predict)
+    int threads;
+    ///Seed of the choice of initial centroids
+    unsigned seed;
+    ///Whether distances are computed with sse
+    bool useSse;
+
+    TKnnParams() {
+        k = KNN_NEIGHBOURS;
+        lists = 0;
+        probes = KNN_PROBES;
+        iterations = 10;
+        threads = 1;
+        seed = 0;
+        useSse = true;
+    }
+};
+
+/**
+@class TKnnNeighbour
+Sample found by (@ref TKnnIndex::Search)
+*/
+struct TKnnNeighbour {
+    ///Squared euclidean distance to the query
+    float distance;
+    int label;
+
+    bool operator<(const TKnnNeighbour& other) const { return distance < other.distance; }
+};
+
+/**
+@class TKnnIndex
+Inverted file index of samples. It is built from features (@ref Build) or mapped read-only from
+a file written by (@ref Save), and takes inserts in memory in both cases; (@ref Save) writes them
+to the file. Search and prediction are const and may run in many threads at once
+*/
+class TKnnIndex {
+ public:
+    explicit TKnnIndex(const TKnnParams& params);
+    ~TKnnIndex();
+
+    ///Clusters samples of features by k-means and indexes all of them
+    void Build(const FeatureMatrix& features);
+    ///Adds a sample to the list of its nearest centroid
+    void Insert(const float* row, size_t cols, int label);
+    ///Adds all samples of features
+    void Insert(const FeatureMatrix& features);
+
+    ///Number of indexed samples
+    size_t Size() const;
+    ///Number of features of samples
+    size_t Cols() const { return cols_; }
+    ///Number of lists
+    size_t Lists() const { return lists_; }
+    bool IsMapped() const { return mapping_ != NULL; }
+
+    ///Nearest samples to query, which has (@ref Cols) features padded with zeros like a row
+    ///of (@ref FeatureMatrix), sorted by distance. Lists after (@ref TKnnParams::probes) are scanned
+    ///while less than k samples are found
+    void Search(const float* query, std::vector<TKnnNeighbour>* neighbours) const;
+    ///Label given by the vote of neighbours, ties go to the label of the nearest neighbour
+    int Predict(const float* query) const;
+    ///Labels of all samples of features, predicted in (@ref TKnnParams::threads) threads
+    void Predict(const FeatureMatrix& features, std::vector<int>* labels) const;
+
+    ///Writes the index with inserted samples to file, through a temporary file, so the index
+    ///may be saved to the file it is mapped from
+    void Save(const std::string& file) const;
+    ///Maps a file written by (@ref Save)
+    void Load(const std::string& file);
+    ///Checks if file is written by (@ref Save)
+    static bool IsIndexFile(const std::string& file);
+
+ private:
+    TKnnIndex(const TKnnIndex&);
+    TKnnIndex& operator=(const TKnnIndex&);
+
+    ///Unmaps the file and forgets all samples
+    void Release();
+    ///Indexes of all lists, the one with the nearest centroid to row first
+    void SortedLists(const float* row, std::vector<size_t>* lists) const;
+    ///Calls callback(row, label) for every sample of list: built or mapped samples, then inserted ones
+    template<class Callback>
+    void ForEachSample(size_t list, Callback callback) const;
+
+    TKnnParams params_;
+    size_t cols_;
+    size_t stride_;
+    size_t lists_;
+    ///lists_ rows of stride_ floats
+    const float* centroids_;
+    ///Samples of list l are rows offsets_[l] to offsets_[l + 1] of samples_
+    const uint64_t* offsets_;
+    const float* samples_;
+    const int* labels_;
+    ///Memory of the index if it is built, not mapped
+    std::vector<float> built_centroids_;
+    FeatureMatrix built_samples_;
+    std::vector<uint64_t> built_offsets_;
+    ///Inserted samples of every list
+    std::vector<FeatureMatrix> inserted_;
+    void* mapping_;
+    size_t mapping_size_;
+};
+
+#endif
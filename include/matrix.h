@@ -8,10 +8,17 @@
 #include <string>
 #include <type_traits>
 
-typedef unsigned int uint;
+#include "matrix_view.h"
+
+// Lazy arithmetic expression, see matrix_expr.h
+namespace matrix_expr
+{
+	template<typename Derived>
+	struct MatrixExpr;
+}
 
 template<typename ValueT>
-class Matrix
+class Matrix : public matrix_expr::operand_base
 {
 public:
 	// Number of rows
@@ -44,6 +51,16 @@ public:
 	// Assignment operator
 	const Matrix<ValueT> &operator = (const Matrix<ValueT> &);
 
+	// Evaluate lazy expression (see matrix_expr.h) in one pass.
+	// Assignment allocates new data like assignment of a matrix,
+	// shallow copies of this matrix keep old values.
+	//
+	// Matrix<int> sq = hor * hor + vert * vert;
+	template<typename Derived>
+	Matrix(const matrix_expr::MatrixExpr<Derived> &);
+	template<typename Derived>
+	const Matrix<ValueT> &operator = (const matrix_expr::MatrixExpr<Derived> &);
+
 	// Move copy constructor. Needed when copy temporary object.
 	// It is from c++ 11 standard.
 	Matrix(Matrix && );
@@ -63,11 +80,21 @@ public:
 	// cout << a; // 9 3 7
 	ValueT &operator() (uint row, uint col);
 
+	// Non-owning view of the whole matrix. Matrix keeps ownership,
+	// so view is valid while this matrix (or its copy) is alive.
+	MatrixView<const ValueT> view() const;
+	MatrixView<ValueT> view();
+	// Matrix can be passed wherever read-only view is expected.
+	operator MatrixView<const ValueT>() const
+	{
+		return view();
+	}
+
 	// Matrix convolution.
 	//
 	// You give this function a unary operator. Operator _must_
-	// have radius field and function
-	// operator()(const Matrix<ValueT> neighbourhood).
+	// have vert_radius and hor_radius fields and function
+	// operator()(const MatrixView<const ValueT> &neighbourhood).
 	// For every pixel of that matrix this function takes
 	// neighbourhood of that pixel of size
 	// (2 * radius + 1) x (2 * radius + 1), applies operator to that
@@ -79,7 +106,7 @@ public:
 		// type which is returned
 	typename std::result_of <
 		// by operator applied to neighbourhood of pixel
-	UnaryMatrixOperator(Matrix<ValueT>)
+	UnaryMatrixOperator(MatrixView<const ValueT>)
 	> ::type
 	>
 	unary_map(const UnaryMatrixOperator &op) const;
@@ -93,20 +120,10 @@ public:
 	// make statistic computations using unary map
 	// (statistics like sum of pixel values or histograms of pixel values)
 	template<typename UnaryMatrixOperator>
-	Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
+	Matrix<typename std::result_of<UnaryMatrixOperator(MatrixView<const ValueT>)>::type>
 	unary_map(UnaryMatrixOperator &op) const;
 
-	// binary_map has the same idea as unary_map,
-	// but now operator takes two neighbourhoods. For example,
-	// if radius = 0, you can make operator, which make elementwise
-	// product of two matrices.
-	//
-	// This function isn't implemented, if you understood unary_map, using its
-	// code you can easily implement binary_map.
-	template<typename BinaryMatrixOperator>
-	friend Matrix<ValueT> binary_map(const BinaryMatrixOperator&,
-		const Matrix<ValueT>&,
-		const Matrix<ValueT>&);
+	// See also binary_map and nary_map below the class.
 
 	// Get sumbmatrix of matrix
 	// Remember that indexing starts at 0!
@@ -150,6 +167,78 @@ private:
 	template<typename T> inline T& make_rw(const T& val) const;	
 };
 
+// Traits used by binary_map and nary_map.
+//
+// Operator with vert_radius and hor_radius fields is a neighbourhood
+// operator (as in unary_map), operator without them is an elementwise
+// (radius 0) operator and is called with element values.
+//
+// Elementwise operator may additionally provide SIMD interface:
+// static constant block_size and function
+// void apply_block(ReturnT *out, const ValueT1 *in1, const ValueT2 *in2, ...) const
+// which computes block_size consecutive results at once. Map functions
+// call apply_block for whole blocks of every row and operator() for the tail.
+template<typename Operator>
+struct has_radius
+{
+private:
+	template<typename T>
+	static std::true_type test(decltype(&T::vert_radius), decltype(&T::hor_radius));
+	template<typename T>
+	static std::false_type test(...);
+public:
+	static const bool value = decltype(test<Operator>(nullptr, nullptr))::value;
+};
+
+template<typename Operator>
+struct has_block
+{
+private:
+	template<typename T>
+	static std::true_type test(decltype(&T::block_size));
+	template<typename T>
+	static std::false_type test(...);
+public:
+	static const bool value = decltype(test<Operator>(nullptr))::value;
+};
+
+// binary_map has the same idea as unary_map,
+// but now operator takes two neighbourhoods of the same pixel
+// of two equally sized matrices.
+//
+// If operator has no radius fields it is elementwise: it is called
+// with two element values and rows are processed as contiguous arrays,
+// so simple operators (and lambdas) are vectorized by compiler.
+//
+// Matrix<int> a = {1, 2, 3}, b = {4, 5, 6};
+// auto product = binary_map([](int x, int y) { return x * y; }, a, b);
+// cout << product; // 4 10 18
+template<typename BinaryMatrixOperator, typename ValueA, typename ValueB>
+auto binary_map(const BinaryMatrixOperator &op,
+	const Matrix<ValueA> &first,
+	const Matrix<ValueB> &second) ->
+	Matrix<typename std::conditional<has_radius<BinaryMatrixOperator>::value,
+		std::result_of<const BinaryMatrixOperator(MatrixView<const ValueA>, MatrixView<const ValueB>)>,
+		std::result_of<const BinaryMatrixOperator(ValueA, ValueB)>
+	>::type::type>;
+
+// Elementwise map of any number of equally sized matrices:
+// result(i, j) = op(first(i, j), rest(i, j)...)
+//
+// auto magn = nary_map([](short x, short y) { return x * x + y * y; }, hor, vert);
+template<typename ElementwiseOperator, typename ValueT, typename... Rest>
+Matrix<typename std::result_of<const ElementwiseOperator(ValueT, Rest...)>::type>
+	nary_map(const ElementwiseOperator &op,
+		const Matrix<ValueT> &first,
+		const Matrix<Rest> &... rest);
+
+// Same for read-only views, e.g. submatrices.
+template<typename ElementwiseOperator, typename ValueT, typename... Rest>
+Matrix<typename std::result_of<const ElementwiseOperator(ValueT, Rest...)>::type>
+	nary_map(const ElementwiseOperator &op,
+		MatrixView<const ValueT> first,
+		MatrixView<const Rest>... rest);
+
 // Output for matrix. Useful for debugging
 template<typename ValueT>
 std::ostream &operator << (std::ostream &out, const Matrix<ValueT> &m)
@@ -108,6 +108,7 @@ Matrix<ValueT>::Matrix(std::initializer_list < std::initializer_list < ValueT >>
 
 template<typename ValueT>
 Matrix<ValueT>::Matrix(const Matrix &src) :
+	matrix_expr::operand_base(),
 	n_rows{ src.n_rows },
 	n_cols{ src.n_cols },
 	stride{ src.stride },
@@ -175,27 +176,46 @@ const Matrix<ValueT> Matrix<ValueT>::submatrix(uint prow, uint pcol,
 	return tmp;
 }
 
+template<typename ValueT>
+MatrixView<const ValueT> Matrix<ValueT>::view() const
+{
+	return MatrixView<const ValueT>(_data.get() + pin_row * stride + pin_col,
+		n_rows, n_cols, stride);
+}
+
+template<typename ValueT>
+MatrixView<ValueT> Matrix<ValueT>::view()
+{
+	return MatrixView<ValueT>(_data.get() + pin_row * stride + pin_col,
+		n_rows, n_cols, stride);
+}
+
 template<typename ValueT>
 template<typename UnaryMatrixOperator>
-Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
+Matrix<typename std::result_of<UnaryMatrixOperator(MatrixView<const ValueT>)>::type>
 	Matrix<ValueT>::unary_map(const UnaryMatrixOperator &op) const
 {
 	// Let's typedef return type of function for ease of usage
-	typedef typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type ReturnT;
+	typedef typename std::result_of<UnaryMatrixOperator(MatrixView<const ValueT>)>::type ReturnT;
 	if (n_cols * n_rows == 0)
 		return Matrix<ReturnT>(0, 0);
 
 	Matrix<ReturnT> tmp(n_rows, n_cols);
 
-	const auto kernel_vert_radius = op.vert_radius;
-	const auto kernel_hor_radius = op.hor_radius;
+	const uint kernel_vert_radius = op.vert_radius;
+	const uint kernel_hor_radius = op.hor_radius;
 
 	Matrix<ValueT> extra_image = extra_borders(kernel_vert_radius, kernel_hor_radius);
+	// Neighbourhoods are views, so no reference counting happens per pixel.
+	const MatrixView<const ValueT> src = extra_image.view();
+	const MatrixView<ReturnT> dst = tmp.view();
 
 	for (uint i = 0; i < n_rows; ++i) {
+		ReturnT *dst_row = dst.row(i);
 		for (uint j = 0; j < n_cols; ++j) {
-			auto neighbourhood = extra_image.submatrix(i, j, 2 * kernel_vert_radius + 1, 2 * kernel_hor_radius + 1);
-			tmp(i, j) = op(neighbourhood);
+			MatrixView<const ValueT> neighbourhood(src.row(i) + j,
+				2 * kernel_vert_radius + 1, 2 * kernel_hor_radius + 1, src.stride);
+			dst_row[j] = op(neighbourhood);
 		}
 	}
 	return tmp;
@@ -203,29 +223,159 @@ Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
 
 template<typename ValueT>
 template<typename UnaryMatrixOperator>
-Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
+Matrix<typename std::result_of<UnaryMatrixOperator(MatrixView<const ValueT>)>::type>
 	Matrix<ValueT>::unary_map(UnaryMatrixOperator &op) const
 {
-	typedef typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type ReturnT;
+	typedef typename std::result_of<UnaryMatrixOperator(MatrixView<const ValueT>)>::type ReturnT;
 	if (n_cols * n_rows == 0)
 		return Matrix<ReturnT>(0, 0);
 
 	Matrix<ReturnT> tmp(n_rows, n_cols);	
 
-	const auto kernel_vert_radius = op.vert_radius;
-	const auto kernel_hor_radius = op.hor_radius;
+	const uint kernel_vert_radius = op.vert_radius;
+	const uint kernel_hor_radius = op.hor_radius;
 
 	Matrix<ValueT> extra_image = extra_borders(kernel_vert_radius, kernel_hor_radius);
+	const MatrixView<const ValueT> src = extra_image.view();
+	const MatrixView<ReturnT> dst = tmp.view();
 
 	for (uint i = 0; i < n_rows; ++i) {
+		ReturnT *dst_row = dst.row(i);
 		for (uint j = 0; j < n_cols; ++j) {
-			auto neighbourhood = extra_image.submatrix(i, j, 2 * kernel_vert_radius + 1, 2 * kernel_hor_radius + 1);
-			tmp(i, j) = op(neighbourhood);
+			MatrixView<const ValueT> neighbourhood(src.row(i) + j,
+				2 * kernel_vert_radius + 1, 2 * kernel_hor_radius + 1, src.stride);
+			dst_row[j] = op(neighbourhood);
 		}
 	}
 	return tmp;
 }
 
+// Check that all matrices (or views) given to map function have the same size.
+template<typename MatrixT>
+inline void check_same_size(const MatrixT &)
+{}
+
+template<typename MatrixT, typename OtherT, typename... Rest>
+inline void check_same_size(const MatrixT &first, const OtherT &second,
+	const Rest &... rest)
+{
+	if (first.n_rows != second.n_rows || first.n_cols != second.n_cols)
+		throw std::string("Matrix sizes differ");
+	check_same_size(second, rest...);
+}
+
+// One row of elementwise map, plain operator.
+template<typename ElementwiseOperator, typename ReturnT, typename... ValueT>
+inline void elementwise_row(const ElementwiseOperator &op, std::false_type,
+	uint n_cols, ReturnT *out, const ValueT *... in)
+{
+	for (uint j = 0; j < n_cols; ++j)
+		out[j] = op(in[j]...);
+}
+
+// One row of elementwise map, operator with SIMD interface.
+template<typename ElementwiseOperator, typename ReturnT, typename... ValueT>
+inline void elementwise_row(const ElementwiseOperator &op, std::true_type,
+	uint n_cols, ReturnT *out, const ValueT *... in)
+{
+	const uint block = ElementwiseOperator::block_size;
+	uint j = 0;
+	for (; j + block <= n_cols; j += block)
+		op.apply_block(out + j, (in + j)...);
+	for (; j < n_cols; ++j)
+		out[j] = op(in[j]...);
+}
+
+template<typename ElementwiseOperator, typename ValueT, typename... Rest>
+Matrix<typename std::result_of<const ElementwiseOperator(ValueT, Rest...)>::type>
+	nary_map(const ElementwiseOperator &op,
+		MatrixView<const ValueT> first,
+		MatrixView<const Rest>... rest)
+{
+	typedef typename std::result_of<const ElementwiseOperator(ValueT, Rest...)>::type ReturnT;
+	check_same_size(first, rest...);
+	if (first.n_cols * first.n_rows == 0)
+		return Matrix<ReturnT>(0, 0);
+
+	Matrix<ReturnT> tmp(first.n_rows, first.n_cols);
+	const MatrixView<ReturnT> out = tmp.view();
+	for (uint i = 0; i < first.n_rows; ++i)
+		elementwise_row(op, std::integral_constant<bool, has_block<ElementwiseOperator>::value>(),
+			first.n_cols, out.row(i), first.row(i), rest.row(i)...);
+	return tmp;
+}
+
+template<typename ElementwiseOperator, typename ValueT, typename... Rest>
+Matrix<typename std::result_of<const ElementwiseOperator(ValueT, Rest...)>::type>
+	nary_map(const ElementwiseOperator &op,
+		const Matrix<ValueT> &first,
+		const Matrix<Rest> &... rest)
+{
+	return nary_map(op, first.view(), rest.view()...);
+}
+
+// binary_map for neighbourhood operators.
+template<typename BinaryMatrixOperator, typename ValueA, typename ValueB>
+Matrix<typename std::result_of<const BinaryMatrixOperator(MatrixView<const ValueA>, MatrixView<const ValueB>)>::type>
+	binary_map_impl(const BinaryMatrixOperator &op,
+		const Matrix<ValueA> &first,
+		const Matrix<ValueB> &second,
+		std::true_type)
+{
+	typedef typename std::result_of<const BinaryMatrixOperator(
+		MatrixView<const ValueA>, MatrixView<const ValueB>)>::type ReturnT;
+	check_same_size(first, second);
+	if (first.n_cols * first.n_rows == 0)
+		return Matrix<ReturnT>(0, 0);
+
+	Matrix<ReturnT> tmp(first.n_rows, first.n_cols);
+
+	const uint kernel_vert_radius = op.vert_radius;
+	const uint kernel_hor_radius = op.hor_radius;
+	const uint rows = 2 * kernel_vert_radius + 1;
+	const uint cols = 2 * kernel_hor_radius + 1;
+
+	Matrix<ValueA> extra_first = first.extra_borders(kernel_vert_radius, kernel_hor_radius);
+	Matrix<ValueB> extra_second = second.extra_borders(kernel_vert_radius, kernel_hor_radius);
+	const MatrixView<const ValueA> src_first = extra_first.view();
+	const MatrixView<const ValueB> src_second = extra_second.view();
+	const MatrixView<ReturnT> dst = tmp.view();
+
+	for (uint i = 0; i < first.n_rows; ++i) {
+		ReturnT *dst_row = dst.row(i);
+		for (uint j = 0; j < first.n_cols; ++j) {
+			MatrixView<const ValueA> a(src_first.row(i) + j, rows, cols, src_first.stride);
+			MatrixView<const ValueB> b(src_second.row(i) + j, rows, cols, src_second.stride);
+			dst_row[j] = op(a, b);
+		}
+	}
+	return tmp;
+}
+
+// binary_map for elementwise operators.
+template<typename BinaryMatrixOperator, typename ValueA, typename ValueB>
+Matrix<typename std::result_of<const BinaryMatrixOperator(ValueA, ValueB)>::type>
+	binary_map_impl(const BinaryMatrixOperator &op,
+		const Matrix<ValueA> &first,
+		const Matrix<ValueB> &second,
+		std::false_type)
+{
+	return nary_map(op, first, second);
+}
+
+template<typename BinaryMatrixOperator, typename ValueA, typename ValueB>
+auto binary_map(const BinaryMatrixOperator &op,
+	const Matrix<ValueA> &first,
+	const Matrix<ValueB> &second) ->
+	Matrix<typename std::conditional<has_radius<BinaryMatrixOperator>::value,
+		std::result_of<const BinaryMatrixOperator(MatrixView<const ValueA>, MatrixView<const ValueB>)>,
+		std::result_of<const BinaryMatrixOperator(ValueA, ValueB)>
+	>::type::type>
+{
+	return binary_map_impl(op, first, second,
+		std::integral_constant<bool, has_radius<BinaryMatrixOperator>::value>());
+}
+
 template<typename ValueT>
 Matrix<ValueT> Matrix<ValueT>::extra_borders(uint kernel_vert_radius, uint kernel_hor_radius) const
 {
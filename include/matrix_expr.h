@@ -0,0 +1,405 @@
+#pragma once
+
+#include <cmath>
+#include <type_traits>
+
+#include "matrix.h"
+
+// Lazy elementwise arithmetic on matrices (expression templates).
+//
+// Operators + - * / and functions sqrt, abs, min, max, cast<T> applied to
+// matrices, scalars and other expressions don't compute anything, they
+// build a small expression object. The whole expression is computed when
+// it is assigned to a matrix, in one pass over the destination, without
+// temporary frames:
+//
+// Image hor, vert; // Sobel results
+// floatImage weight = max(matrix_expr::cast<float>(hor * hor + vert * vert) - 100.0f, 0.0f) * 0.5f;
+//
+// Types follow the usual C++ rules: short * short is int, int + float is float.
+//
+// Expression keeps views of its matrices, so matrices must be alive when
+// expression is evaluated. Don't keep expressions with temporary matrices
+// in auto variables.
+//
+// Everything lives in namespace matrix_expr. Matrix and MatrixView derive
+// from matrix_expr::operand_base, so operators, min, max, abs, sqrt and evaluate
+// are found by argument-dependent lookup without a using directive. cast has
+// explicit template arguments, so it is called as matrix_expr::cast<T>.
+
+namespace matrix_expr
+{
+	template<typename Derived>
+	struct MatrixExpr
+	{
+		const Derived &self() const
+		{
+			return static_cast<const Derived &>(*this);
+		}
+	};
+
+	// Leaf: elements of matrix.
+	template<typename ValueT>
+	class MatrixTerminal : public MatrixExpr<MatrixTerminal<ValueT> >
+	{
+	public:
+		typedef ValueT value_type;
+
+		// Evaluator of one row: plain pointer, so that compiler sees
+		// contiguous loads in the evaluation loop.
+		struct row_type
+		{
+			const ValueT *ptr;
+			ValueT operator[] (uint col) const
+			{
+				return ptr[col];
+			}
+		};
+
+		explicit MatrixTerminal(MatrixView<const ValueT> view) :
+			_view(view)
+		{}
+
+		uint n_rows() const { return _view.n_rows; }
+		uint n_cols() const { return _view.n_cols; }
+		bool has_size() const { return true; }
+
+		row_type row(uint i) const
+		{
+			row_type r = { _view.row(i) };
+			return r;
+		}
+
+	private:
+		MatrixView<const ValueT> _view;
+	};
+
+	// Leaf: the same value for every element.
+	template<typename ValueT>
+	class ScalarTerminal : public MatrixExpr<ScalarTerminal<ValueT> >
+	{
+	public:
+		typedef ValueT value_type;
+
+		struct row_type
+		{
+			ValueT value;
+			ValueT operator[] (uint) const
+			{
+				return value;
+			}
+		};
+
+		explicit ScalarTerminal(ValueT value) :
+			_value(value)
+		{}
+
+		// Scalar has no size, it fits any matrix
+		uint n_rows() const { return 0; }
+		uint n_cols() const { return 0; }
+		bool has_size() const { return false; }
+
+		row_type row(uint) const
+		{
+			row_type r = { _value };
+			return r;
+		}
+
+	private:
+		ValueT _value;
+	};
+
+	// Node: op(expr(i, j))
+	template<typename Expr, typename Op>
+	class UnaryExpr : public MatrixExpr<UnaryExpr<Expr, Op> >
+	{
+	public:
+		typedef decltype(std::declval<Op>()(std::declval<typename Expr::value_type>())) value_type;
+
+		struct row_type
+		{
+			typename Expr::row_type arg;
+			value_type operator[] (uint col) const
+			{
+				return Op()(arg[col]);
+			}
+		};
+
+		explicit UnaryExpr(const Expr &arg) :
+			_arg(arg)
+		{}
+
+		uint n_rows() const { return _arg.n_rows(); }
+		uint n_cols() const { return _arg.n_cols(); }
+		bool has_size() const { return _arg.has_size(); }
+
+		row_type row(uint i) const
+		{
+			row_type r = { _arg.row(i) };
+			return r;
+		}
+
+	private:
+		Expr _arg;
+	};
+
+	// Node: op(left(i, j), right(i, j))
+	template<typename Left, typename Right, typename Op>
+	class BinaryExpr : public MatrixExpr<BinaryExpr<Left, Right, Op> >
+	{
+	public:
+		typedef decltype(std::declval<Op>()(std::declval<typename Left::value_type>(),
+			std::declval<typename Right::value_type>())) value_type;
+
+		struct row_type
+		{
+			typename Left::row_type left;
+			typename Right::row_type right;
+			value_type operator[] (uint col) const
+			{
+				return Op()(left[col], right[col]);
+			}
+		};
+
+		BinaryExpr(const Left &left, const Right &right) :
+			_left(left),
+			_right(right)
+		{
+			if (left.has_size() && right.has_size() &&
+				(left.n_rows() != right.n_rows() || left.n_cols() != right.n_cols()))
+				throw std::string("Matrix sizes differ");
+		}
+
+		uint n_rows() const { return _left.has_size() ? _left.n_rows() : _right.n_rows(); }
+		uint n_cols() const { return _left.has_size() ? _left.n_cols() : _right.n_cols(); }
+		bool has_size() const { return _left.has_size() || _right.has_size(); }
+
+		row_type row(uint i) const
+		{
+			row_type r = { _left.row(i), _right.row(i) };
+			return r;
+		}
+
+	private:
+		Left _left;
+		Right _right;
+	};
+
+	// Elementwise operations used in expression nodes.
+	namespace matrix_ops
+	{
+		struct plus
+		{
+			template<typename A, typename B>
+			auto operator() (A a, B b) const -> decltype(a + b) { return a + b; }
+		};
+		struct minus
+		{
+			template<typename A, typename B>
+			auto operator() (A a, B b) const -> decltype(a - b) { return a - b; }
+		};
+		struct multiplies
+		{
+			template<typename A, typename B>
+			auto operator() (A a, B b) const -> decltype(a * b) { return a * b; }
+		};
+		struct divides
+		{
+			template<typename A, typename B>
+			auto operator() (A a, B b) const -> decltype(a / b) { return a / b; }
+		};
+		struct minimum
+		{
+			template<typename A, typename B>
+			auto operator() (A a, B b) const -> decltype(a + b) { return (b < a) ? b : a; }
+		};
+		struct maximum
+		{
+			template<typename A, typename B>
+			auto operator() (A a, B b) const -> decltype(a + b) { return (a < b) ? b : a; }
+		};
+		struct negate
+		{
+			template<typename A>
+			auto operator() (A a) const -> decltype(-a) { return -a; }
+		};
+		struct absolute
+		{
+			template<typename A>
+			auto operator() (A a) const -> decltype(+a) { return (a < 0) ? -a : +a; }
+		};
+		// sqrt in precision of argument: float for float, double otherwise
+		struct square_root
+		{
+			float operator() (float a) const { return std::sqrt(a); }
+			double operator() (double a) const { return std::sqrt(a); }
+			template<typename A>
+			double operator() (A a) const { return std::sqrt(double(a)); }
+		};
+		template<typename T>
+		struct cast_to
+		{
+			template<typename A>
+			T operator() (A a) const { return static_cast<T>(a); }
+		};
+	}
+
+	// Conversion of operands (matrix, expression or scalar) to expression nodes.
+	template<typename T, typename Enable = void>
+	struct as_expr
+	{
+		static const bool value = false;
+	};
+
+	template<typename ValueT>
+	struct as_expr<Matrix<ValueT> >
+	{
+		static const bool value = true;
+		typedef MatrixTerminal<ValueT> type;
+		static type make(const Matrix<ValueT> &m) { return type(m.view()); }
+	};
+
+	template<typename ValueT>
+	struct as_expr<MatrixView<ValueT> >
+	{
+		static const bool value = true;
+		typedef MatrixTerminal<typename std::remove_const<ValueT>::type> type;
+		static type make(const MatrixView<ValueT> &m) { return type(m); }
+	};
+
+	template<typename T>
+	struct as_expr<T, typename std::enable_if<std::is_base_of<MatrixExpr<T>, T>::value>::type>
+	{
+		static const bool value = true;
+		typedef T type;
+		static const type &make(const T &e) { return e; }
+	};
+
+	template<typename T>
+	struct as_scalar
+	{
+		static const bool value = std::is_arithmetic<T>::value;
+		typedef ScalarTerminal<T> type;
+		static type make(T value) { return type(value); }
+	};
+
+	// Binary operation is enabled if one operand is a matrix or expression and
+	// the other one is a matrix, expression or number.
+	template<typename L, typename R>
+	struct binary_operands
+	{
+		static const bool value =
+			(as_expr<L>::value && (as_expr<R>::value || as_scalar<R>::value)) ||
+			(as_scalar<L>::value && as_expr<R>::value);
+	};
+
+	template<typename T>
+	struct operand
+	{
+		typedef typename std::conditional<as_expr<T>::value, as_expr<T>, as_scalar<T> >::type traits;
+		typedef typename traits::type type;
+		static type make(const T &value) { return traits::make(value); }
+	};
+
+	template<typename Op, typename L, typename R>
+	struct binary_result
+	{
+		typedef BinaryExpr<typename operand<L>::type, typename operand<R>::type, Op> type;
+		static type make(const L &l, const R &r)
+		{
+			return type(operand<L>::make(l), operand<R>::make(r));
+		}
+	};
+
+#define MATRIX_EXPR_BINARY(NAME, OP) \
+	template<typename L, typename R> \
+	typename std::enable_if<binary_operands<L, R>::value, \
+		typename binary_result<matrix_ops::OP, L, R>::type>::type \
+		NAME(const L &l, const R &r) \
+	{ \
+		return binary_result<matrix_ops::OP, L, R>::make(l, r); \
+	}
+
+	MATRIX_EXPR_BINARY(operator +, plus)
+	MATRIX_EXPR_BINARY(operator -, minus)
+	MATRIX_EXPR_BINARY(operator *, multiplies)
+	MATRIX_EXPR_BINARY(operator /, divides)
+	MATRIX_EXPR_BINARY(min, minimum)
+	MATRIX_EXPR_BINARY(max, maximum)
+
+#undef MATRIX_EXPR_BINARY
+
+#define MATRIX_EXPR_UNARY(NAME, OP) \
+	template<typename T> \
+	typename std::enable_if<as_expr<T>::value, \
+		UnaryExpr<typename as_expr<T>::type, matrix_ops::OP> >::type \
+		NAME(const T &arg) \
+	{ \
+		return UnaryExpr<typename as_expr<T>::type, matrix_ops::OP>(as_expr<T>::make(arg)); \
+	}
+
+	MATRIX_EXPR_UNARY(operator -, negate)
+	MATRIX_EXPR_UNARY(abs, absolute)
+	MATRIX_EXPR_UNARY(sqrt, square_root)
+
+#undef MATRIX_EXPR_UNARY
+
+	// cast<float>(hor * hor)
+	template<typename ResultT, typename T>
+	typename std::enable_if<as_expr<T>::value,
+		UnaryExpr<typename as_expr<T>::type, matrix_ops::cast_to<ResultT> > >::type
+		cast(const T &arg)
+	{
+		return UnaryExpr<typename as_expr<T>::type, matrix_ops::cast_to<ResultT> >(as_expr<T>::make(arg));
+	}
+
+	// Compute expression into dst in one pass. dst must have the size of expression.
+	template<typename ValueT, typename Derived>
+	void evaluate_into(MatrixView<ValueT> dst, const MatrixExpr<Derived> &expr)
+	{
+		const Derived &e = expr.self();
+		if (!e.has_size())
+			throw std::string("Expression has no matrix operands");
+		if (dst.n_rows != e.n_rows() || dst.n_cols != e.n_cols())
+			throw std::string("Matrix sizes differ");
+		const uint n_cols = dst.n_cols;
+		for (uint i = 0; i < dst.n_rows; ++i) {
+			const typename Derived::row_type row = e.row(i);
+			ValueT *out = dst.row(i);
+			for (uint j = 0; j < n_cols; ++j)
+				out[j] = static_cast<ValueT>(row[j]);
+		}
+	}
+
+	// Compute expression into a new matrix of its value type.
+	template<typename Derived>
+	Matrix<typename Derived::value_type> evaluate(const MatrixExpr<Derived> &expr)
+	{
+		const Derived &e = expr.self();
+		if (!e.has_size())
+			throw std::string("Expression has no matrix operands");
+		Matrix<typename Derived::value_type> tmp(e.n_rows(), e.n_cols());
+		evaluate_into(tmp.view(), expr);
+		return tmp;
+	}
+}
+
+template<typename ValueT>
+template<typename Derived>
+Matrix<ValueT>::Matrix(const matrix_expr::MatrixExpr<Derived> &expr) :
+	Matrix(expr.self().n_rows(), expr.self().n_cols())
+{
+	matrix_expr::evaluate_into(view(), expr);
+}
+
+template<typename ValueT>
+template<typename Derived>
+const Matrix<ValueT> &Matrix<ValueT>::operator = (const matrix_expr::MatrixExpr<Derived> &expr)
+{
+	// Fresh storage: shallow copies keep the old values, and the expression
+	// may read this matrix while it is computed
+	Matrix<ValueT> tmp(expr.self().n_rows(), expr.self().n_cols());
+	matrix_expr::evaluate_into(tmp.view(), expr);
+	*this = tmp;
+	return *this;
+}
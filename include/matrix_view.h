@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <type_traits>
+
+typedef unsigned int uint;
+
+// Non-owning window into matrix data.
+//
+// View is just a pointer and three numbers, so it is trivially copyable
+// and passing it around never touches reference counters of the Matrix
+// which owns the data. Matrix must outlive all views taken from it.
+//
+// Example:
+// Matrix<int> a = { {1, 2, 3},
+//                   {4, 5, 6} };
+// MatrixView<const int> v = a.view().submatrix(0, 1, 2, 2);
+// cout << v(1, 1); // 6
+// Lazy expressions of matrices, see matrix_expr.h. Empty base of Matrix
+// and MatrixView, which makes the namespace associated with them.
+namespace matrix_expr
+{
+	struct operand_base {};
+}
+
+template<typename ValueT>
+struct MatrixView : public matrix_expr::operand_base
+{
+	// Pointer to element (0, 0)
+	ValueT *data;
+	// Number of rows
+	uint n_rows;
+	// Number of cols
+	uint n_cols;
+	// Number of elements between two rows
+	uint stride;
+
+	MatrixView() :
+		data{ nullptr },
+		n_rows{ 0 },
+		n_cols{ 0 },
+		stride{ 0 }
+	{}
+
+	MatrixView(ValueT *ptr, uint row_count, uint col_count, uint row_stride) :
+		data{ ptr },
+		n_rows{ row_count },
+		n_cols{ col_count },
+		stride{ row_stride }
+	{}
+
+	// View of mutable data is also a view of const data.
+	operator MatrixView<const ValueT>() const
+	{
+		return MatrixView<const ValueT>(data, n_rows, n_cols, stride);
+	}
+
+	// Element access. Unlike Matrix::operator() it doesn't check bounds,
+	// views are meant for inner loops.
+	ValueT &operator() (uint row, uint col) const
+	{
+		return data[row * stride + col];
+	}
+
+	// Pointer to the first element of row
+	ValueT *row(uint row) const
+	{
+		return data + row * stride;
+	}
+
+	// Same as Matrix::submatrix, but result is a view again
+	MatrixView<ValueT> submatrix(uint prow, uint pcol, uint rows, uint cols) const
+	{
+		if (prow + rows > n_rows || pcol + cols > n_cols)
+			throw std::string("Out of bounds");
+		return MatrixView<ValueT>(data + prow * stride + pcol, rows, cols, stride);
+	}
+};
+
+static_assert(std::is_trivially_copyable<MatrixView<const short> >::value,
+	"MatrixView must stay trivially copyable");
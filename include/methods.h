@@ -2,7 +2,11 @@
 #define METHODS_H_
 
 
+#include <vector>
+#include <cmath>
+
 #include "matrix.h"
+#include "stencil.h"
 #include "EasyBMP.h"
 
 /**
@@ -20,7 +24,7 @@ const float L = 0.5;
 const int N = 1;
 ///Specifies in how many cells (both vertical and horizontal) the image will be divided when computing color features
 const int COLOR_CELL_COUNT = 8;
-///Specifies the radius of Sobel filters
+///Specifies the radius of Sobel filters used by (@ref HorSobel) and (@ref VertSobel). (@ref ApplyGradient) accepts kernels of any radius
 const uint FILTER_RADIUS = 1;
 ///Specifies how many shorts will be packed in __m128i
 const uint SSE_BLOCK_SIZE = 8;
@@ -31,21 +35,45 @@ const uint SSE_FLOAT_BLOCK_SIZE = 4;
 typedef Matrix<short> Image;
 ///Matrix of floats
 typedef Matrix<float> floatImage;
+///Read-only view of (@ref Image) data
+typedef MatrixView<const short> ImageView;
+///Read-only view of (@ref floatImage) data
+typedef MatrixView<const float> floatImageView;
+///Matrix of 16-bit unsigned integers, used for integer magnitudes
+typedef Matrix<unsigned short> ushortImage;
+///Read-only view of (@ref ushortImage) data
+typedef MatrixView<const unsigned short> ushortImageView;
+
+/**
+@enum MagnitudeMode
+Representation of gradient magnitudes used as histogram weights
+*/
+enum MagnitudeMode {
+    ///sqrt(x^2 + y^2) as float, see (@ref Magnitude)
+    MAGNITUDE_FLOAT,
+    ///|x| + |y| as uint16, see (@ref L1Magnitude)
+    MAGNITUDE_L1,
+    ///max + 3/8 min of |x|, |y| as uint16, see (@ref AlphaBetaMagnitude)
+    MAGNITUDE_ALPHA_BETA,
+    ///floor(sqrt(x^2 + y^2)) as uint16, see (@ref IntSqrtMagnitude)
+    MAGNITUDE_ISQRT
+};
 
 /**
 @class VertSobel
-Class used for Matrix::unary_map that computes the vertical Sobel matrix
+Stencil operator (see stencil.h) that computes the vertical Sobel matrix
 */
 class VertSobel 
 {
 public:
     ///Specifies the vertical radius of the filter
-    const int vert_radius;
+    static const uint vert_radius = FILTER_RADIUS;
     ///Specifies the horizontal radius of the filter
-    const int hor_radius;
-    VertSobel() : vert_radius(FILTER_RADIUS), hor_radius(FILTER_RADIUS) {}
-    ///Operator that computes the vertical Sobel matrix for a (2 * (@ref hor_radius) + 1) x (2 * (@ref vert_radius) + 1) submatrix
-    short operator () (const Image &mat) const
+    static const uint hor_radius = FILTER_RADIUS;
+    ///Operator that computes the vertical Sobel matrix for a (2 * (@ref hor_radius) + 1) x (2 * (@ref vert_radius) + 1) neighbourhood.
+    ///Window may be an (@ref ImageView) (Matrix::unary_map) or a (@ref StencilWindow) (@ref stencil_map)
+    template<typename Window>
+    short operator () (const Window &mat) const
     {
         return -mat(0, 0) - 2 * mat(0, 1) - mat(0, 2) + mat(2, 0) + 2 * mat(2, 1) + mat(2, 2);
     }
@@ -53,29 +81,116 @@ public:
 
 /**
 @class HorSobel
-Class used for Matrix::unary_map that computes the horizontal Sobel matrix
+Stencil operator (see stencil.h) that computes the horizontal Sobel matrix
 */
 class HorSobel
 {
 public:
     ///Specifies the vertical radius of the filter
-    const int vert_radius;
+    static const uint vert_radius = FILTER_RADIUS;
     ///Specifies the horizontal radius of the filter
-    const int hor_radius;
-    HorSobel() : vert_radius(FILTER_RADIUS), hor_radius(FILTER_RADIUS) {}
-    ///Operator that computes the horizontal Sobel matrix for a (2 * (@ref hor_radius) + 1) x (2 * (@ref vert_radius) + 1) submatrix
-    short operator () (const Image &mat) const
+    static const uint hor_radius = FILTER_RADIUS;
+    ///Operator that computes the horizontal Sobel matrix for a (2 * (@ref hor_radius) + 1) x (2 * (@ref vert_radius) + 1) neighbourhood.
+    ///Window may be an (@ref ImageView) (Matrix::unary_map) or a (@ref StencilWindow) (@ref stencil_map)
+    template<typename Window>
+    short operator () (const Window &mat) const
     {
         return -mat(0, 0) - 2 * mat(1, 0) - mat(2, 0) + mat(0, 2) + 2 * mat(1, 2) + mat(2, 2);
     }
 };
 
-Image ImgToGrayscale(BMP *img);
-floatImage GetMagnitude(const Image &hor, const Image &vert, bool useSse);
+/**
+@class Magnitude
+Elementwise operator for binary_map that computes the gradient magnitude from horizontal and vertical Sobel values
+*/
+class Magnitude
+{
+public:
+    ///Operator that computes the magnitude of one gradient
+    float operator () (short x, short y) const
+    {
+        return sqrt(pow(x, 2) + pow(y, 2));
+    }
+};
+
+/**
+@class SseMagnitude
+Same as (@ref Magnitude), but also provides the SIMD interface of binary_map
+and computes (@ref SSE_BLOCK_SIZE) magnitudes at once using sse intrinsics
+*/
+class SseMagnitude : public Magnitude
+{
+public:
+    ///Number of magnitudes computed by one call of (@ref apply_block)
+    static const uint block_size = SSE_BLOCK_SIZE;
+    void apply_block(float *out, const short *x, const short *y) const;
+};
+
+/**
+@class L1Magnitude
+Elementwise operator for nary_map that computes |x| + |y|.
+Like all integer magnitudes it saturates -32768 to -32767 first, so results always fit in uint16
+*/
+class L1Magnitude
+{
+public:
+    unsigned short operator () (short x, short y) const;
+    static void ApplySse(unsigned short *out, const short *x, const short *y);
+};
+
+/**
+@class AlphaBetaMagnitude
+Elementwise operator for nary_map that computes the alpha max plus beta min approximation
+max + (min >> 2) + (min >> 3) of |x| and |y| (alpha = 1, beta = 3/8, error is less than 7%)
+*/
+class AlphaBetaMagnitude
+{
+public:
+    unsigned short operator () (short x, short y) const;
+    static void ApplySse(unsigned short *out, const short *x, const short *y);
+};
+
+/**
+@class IntSqrtMagnitude
+Elementwise operator for nary_map that computes the exact integer square root floor(sqrt(x^2 + y^2))
+*/
+class IntSqrtMagnitude
+{
+public:
+    unsigned short operator () (short x, short y) const;
+    static void ApplySse(unsigned short *out, const short *x, const short *y);
+};
+
+/**
+@class SseBlockMagnitude
+Provides the SIMD interface of binary_map for an integer magnitude operator:
+(@ref SSE_BLOCK_SIZE) magnitudes are computed at once by ScalarMagnitude::ApplySse
+*/
+template<typename ScalarMagnitude>
+class SseBlockMagnitude : public ScalarMagnitude
+{
+public:
+    ///Number of magnitudes computed by one call of (@ref apply_block)
+    static const uint block_size = SSE_BLOCK_SIZE;
+    void apply_block(unsigned short *out, const short *x, const short *y) const
+    {
+        ScalarMagnitude::ApplySse(out, x, y);
+    }
+};
+
+Image ImgToGrayscale(BMP *img, bool useSse);
+floatImage GetMagnitude(ImageView hor, ImageView vert, bool useSse);
+ushortImage GetMagnitude(ImageView hor, ImageView vert, MagnitudeMode mode, bool useSse);
 void ApplySobel(const Image &img, Image &hor, Image &vert, bool useSse);
-void GetDescriptor(const Image &hor, const Image &vert, const floatImage &magn, std::vector<float> &result);
+void ApplyGradient(const Image &img, const Image &smooth, const Image &deriv, Image &hor, Image &vert);
+void GetDescriptor(ImageView hor, ImageView vert, floatImageView magn, std::vector<float> &result);
+void GetDescriptor(ImageView hor, ImageView vert, ushortImageView magn, std::vector<float> &result);
+void GetDescriptor(ImageView hor, ImageView vert, floatImageView magn, uint cellCount, std::vector<float> &result);
+Image Downsample(ImageView img, uint factor);
 void GetColors(BMP *img, std::vector<float> &result);
-std::vector<float> GetHist(const Image &hor, const Image &vert, const floatImage &magn);
+void GetCellColors(BMP *img, std::vector<float> &result, uint rows, uint cols, uint x, uint y);
+std::vector<float> GetHist(ImageView hor, ImageView vert, floatImageView magn);
+std::vector<float> GetHist(ImageView hor, ImageView vert, ushortImageView magn);
 std::vector<float> ApplyHIKernel(const std::vector<float> &preHI);
 
 #endif
\ No newline at end of file
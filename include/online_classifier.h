@@ -0,0 +1,68 @@
+#ifndef ONLINE_CLASSIFIER_H_
+#define ONLINE_CLASSIFIER_H_
+
+#include <vector>
+#include <cstddef>
+
+#include "classifier.h"
+
+/**
+@file online_classifier.h
+Streaming training of a linear classifier by averaged stochastic gradient descent
+*/
+
+/**
+@class TOnlineClassifierParams
+Parameters of (@ref TOnlineClassifier)
+*/
+struct TOnlineClassifierParams {
+    ///Regularization: the objective is lambda / 2 |w|^2 + mean of max(0, 1 - y w^T x)^2,
+    ///which is the L2R_L2LOSS_SVC objective of liblinear with C = 1 / (lambda * samples)
+    double lambda;
+    ///Initial step, 0 means 1 / (2 |x|^2) of the first sample
+    double eta0;
+    ///Number of samples after which averaging of weights starts
+    size_t averaging_start;
+
+    TOnlineClassifierParams() {
+        lambda = 1e-4;
+        eta0 = 0;
+        averaging_start = 0;
+    }
+};
+
+/**
+@class TOnlineClassifier
+One-vs-rest linear classifier trained one sample at a time, so the training set never has to be in memory.
+Every class has a dense weight vector updated by SGD with step eta0 / (1 + lambda * eta0 * t)^0.75
+and the running average of the weights (Bottou's ASGD), which is the result.
+Classes are added when their first sample arrives; the model is a liblinear L2R_L2LOSS_SVC model without bias.
+*/
+class TOnlineClassifier {
+ public:
+    TOnlineClassifier(size_t number_of_features, const TOnlineClassifierParams& params);
+
+    ///Makes one SGD step for every class with the sample
+    void Update(const float* row, int label);
+    void Update(const std::vector<float>& row, int label) {
+        Update(&row[0], label);
+    }
+    ///Number of samples seen
+    size_t Samples() const { return samples_; }
+    ///Stores averaged weights to model in liblinear format
+    void GetModel(TModel* model) const;
+
+ private:
+    size_t cols_;
+    TOnlineClassifierParams params_;
+    double eta0_;
+    size_t samples_;
+    ///Labels in the order of their first sample
+    std::vector<int> labels_;
+    ///Weights of every class, cols_ per class
+    std::vector<double> weights_;
+    ///Averages of weights of every class
+    std::vector<double> averages_;
+};
+
+#endif
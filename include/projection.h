@@ -0,0 +1,78 @@
+#ifndef PROJECTION_H_
+#define PROJECTION_H_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "feature_matrix.h"
+
+/**
+@file projection.h
+Reduction of features to fewer dimensions by a linear projection, learned by PCA from a sample
+of features or random, and the blocked matrix product which applies it to many samples at once
+*/
+
+///Default number of samples (@ref TProjection::Pca) learns from
+const size_t PROJECTION_SAMPLE = 1000;
+///Number of samples (@ref TProjection::Apply) projects by one matrix product
+const size_t PROJECTION_BATCH = 64;
+
+///C = A * B for A of rows x depth, B of depth x cols and C of rows x cols, all row-major with the given
+///row strides. If transpose_a, a holds A transposed (depth x rows) and lda is its row stride.
+///The product is computed by blocks which fit the cache, with sse if useSse
+void Gemm(const float* a, size_t lda, bool transpose_a, const float* b, size_t ldb, float* c, size_t ldc,
+    size_t rows, size_t cols, size_t depth, bool useSse);
+
+/**
+@class TProjection
+Projection of samples of Cols() features to Dims() features: y = (x - mean) * basis, where basis
+is a Cols() x Dims() matrix. Trained models keep it in a file next to the model, so samples are
+projected the same way for training and for prediction
+*/
+class TProjection {
+ public:
+    ///Empty projection, see (@ref Empty)
+    TProjection();
+
+    ///Principal components of features: mean is the mean of samples and columns of basis are orthonormal
+    ///directions of the largest variance, in decreasing order. They are found by subspace iteration on
+    ///at most sample_rows samples chosen with seed, which must be at least dims
+    static TProjection Pca(const FeatureMatrix& features, size_t dims, size_t sample_rows, unsigned seed, bool useSse);
+    ///Gaussian random projection with variance 1 / dims and zero mean, which keeps distances between samples
+    ///approximately, without learning
+    static TProjection Random(size_t cols, size_t dims, unsigned seed);
+
+    bool Empty() const { return dims_ == 0; }
+    ///Number of features of samples before projection
+    size_t Cols() const { return cols_; }
+    ///Number of features of projected samples
+    size_t Dims() const { return dims_; }
+    const std::vector<float>& Mean() const { return mean_; }
+    ///Row-major Cols() x Dims() matrix
+    const std::vector<float>& Basis() const { return basis_; }
+
+    ///Appends count projected samples, stride floats apart, with their labels to out
+    void Apply(const float* rows, size_t stride, const int* labels, size_t count, FeatureMatrix* out,
+        bool useSse) const;
+    ///Appends projected samples of features to out, (@ref PROJECTION_BATCH) samples at a time
+    void Apply(const FeatureMatrix& features, FeatureMatrix* out, bool useSse) const;
+
+    ///Writes the projection to a binary file
+    void Save(const std::string& file) const;
+    ///Reads a file written by (@ref Save), throws if it is not one
+    void Load(const std::string& file);
+
+ private:
+    size_t cols_;
+    size_t dims_;
+    std::vector<float> mean_;
+    std::vector<float> basis_;
+    ///mean_ * basis_, subtracted from products of samples and basis_
+    std::vector<float> offset_;
+
+    ///Computes offset_ from mean_ and basis_
+    void UpdateOffset();
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef QUANTIZED_H_
+#define QUANTIZED_H_
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "feature_matrix.h"
+#include "linear.h"
+
+/**
+@file quantized.h
+Compact storage of features (uint8 or float16) and linear prediction with int8 weights
+*/
+
+///Number of consecutive features which share one scale and offset (one cell histogram of GetDescriptor)
+const size_t QUANT_BLOCK_SIZE = 16;
+///Rows of codes and weights are padded with zeros to a multiple of this number of features
+const size_t QUANT_ROW_ALIGNMENT = 32;
+///Largest absolute value of a quantized weight: pmaddubsw adds two products of uint8 and int8 in 16 bits, 2 * 255 * 63 still fits
+const int QUANT_WEIGHT_MAX = 63;
+
+/**
+@enum QuantizedFormat
+Storage format of one feature
+*/
+enum QuantizedFormat {
+    ///Feature is offset + code * scale, where offset and scale are shared by (@ref QUANT_BLOCK_SIZE) features
+    QUANT_UINT8,
+    ///IEEE half precision float
+    QUANT_FP16
+};
+
+/**
+@class QuantizedFeatures
+Quantized copy of a (@ref FeatureMatrix). uint8 features take 1 byte plus 8 bytes per block
+of (@ref QUANT_BLOCK_SIZE), fp16 features take 2 bytes. Rows are quantized as they are appended,
+so float features of all samples never have to be kept
+*/
+class QuantizedFeatures {
+ public:
+    ///Empty features, the number of features is taken from the first (@ref Append)
+    explicit QuantizedFeatures(QuantizedFormat format);
+    QuantizedFeatures(const FeatureMatrix& features, QuantizedFormat format);
+
+    ///Quantizes and appends all samples of features
+    void Append(const FeatureMatrix& features);
+
+    QuantizedFormat Format() const { return format_; }
+    size_t Rows() const { return rows_; }
+    size_t Cols() const { return cols_; }
+    ///Number of features in a padded row, a multiple of (@ref QUANT_ROW_ALIGNMENT)
+    size_t Stride() const { return stride_; }
+    ///Number of blocks in a padded row
+    size_t Blocks() const { return stride_ / QUANT_BLOCK_SIZE; }
+    int Label(size_t row) const { return labels_[row]; }
+
+    ///uint8 codes of the sample (only for (@ref QUANT_UINT8))
+    const uint8_t* Codes(size_t row) const { return &codes_[row * stride_]; }
+    ///Scale of every block of the sample (only for (@ref QUANT_UINT8))
+    const float* Scales(size_t row) const { return &scales_[row * Blocks()]; }
+    ///Offset of every block of the sample (only for (@ref QUANT_UINT8))
+    const float* Offsets(size_t row) const { return &offsets_[row * Blocks()]; }
+    ///float16 features of the sample (only for (@ref QUANT_FP16))
+    const uint16_t* Halves(size_t row) const { return &halves_[row * stride_]; }
+
+    ///Restores (@ref Stride) approximate float features of the sample
+    void Dequantize(size_t row, float* out) const;
+    ///Memory taken by features and their scales
+    size_t Bytes() const;
+
+ private:
+    ///Quantizes and appends one sample of (@ref Cols) features
+    void AppendRow(const float* values, int label);
+
+    QuantizedFormat format_;
+    size_t rows_;
+    size_t cols_;
+    size_t stride_;
+    std::vector<uint8_t> codes_;
+    std::vector<float> scales_;
+    std::vector<float> offsets_;
+    std::vector<uint16_t> halves_;
+    std::vector<int> labels_;
+};
+
+/**
+@class QuantizedModel
+Linear liblinear model with every class weight vector quantized to int8 with its own scale.
+Decision values are computed like liblinear predict_values: uint8 samples use integer dot products
+(pmaddubsw, or vpdpbusd if the processor has avx-vnni), fp16 samples use float weights
+*/
+class QuantizedModel {
+ public:
+    explicit QuantizedModel(const struct model* model);
+
+    int NrClass() const { return nr_class_; }
+    ///Decision values of the sample, one per weight vector as in liblinear
+    void DecisionValues(const QuantizedFeatures& features, size_t row, double* values) const;
+    ///Label of the sample, chosen from decision values the same way as liblinear predict
+    int Predict(const QuantizedFeatures& features, size_t row) const;
+    ///Labels of all samples
+    void Predict(const QuantizedFeatures& features, std::vector<int>* labels) const;
+
+ private:
+    size_t cols_;
+    size_t stride_;
+    int nr_class_;
+    ///Number of weight vectors: 1 for two classes, nr_class_ otherwise
+    int nr_w_;
+    std::vector<int> labels_;
+    ///nr_w_ rows of stride_ int8 weights
+    std::vector<int8_t> weights_;
+    ///Scale of every row of weights_
+    std::vector<float> scales_;
+    ///nr_w_ rows of sums of dequantized weights over every block, multiplied by block offsets
+    std::vector<float> block_sums_;
+    ///nr_w_ rows of stride_ float weights for (@ref QUANT_FP16)
+    std::vector<float> float_weights_;
+    std::vector<float> bias_;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SHARDS_H_
+#define SHARDS_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <stdint.h>
+
+#include "methods.h"
+#include "feature_matrix.h"
+
+/**
+@file shards.h
+Extraction of features of a list of images in shards, by separate processes or machines, and the
+merge of shard files into the features of the whole list in its order
+*/
+
+///TFileList - vector containing pairs of image paths and corresponding labels
+typedef std::vector<std::pair<std::string, int> > TFileList;
+
+///Key of features extracted from the images of file_list with the given options (@ref FeatureMatrix::Source):
+///FNV-1a hash of image names, labels, mode and full, never 0
+uint64_t FeatureSource(const TFileList& file_list, MagnitudeMode mode, bool full);
+///Extracts features of one shard of the images and saves them to shard_file (@ref FeatureMatrix::Save):
+///shard i of N holds images with indices from i * size / N to (i + 1) * size / N of file_list,
+///so shards 0..N-1 together keep its order. The shard keeps (@ref FeatureSource) of the whole file_list
+void ExtractShard(const TFileList& file_list, const std::string& shard_file, size_t shard, size_t shards,
+    bool useSse, MagnitudeMode mode, bool full);
+///Extracts all shards by forked worker processes, one shard per worker, shard i is written to shard_prefix.i.
+///Returns names of shard files in the order of shards. If a worker can't be started or fails,
+///shard files are removed and an error is thrown
+std::vector<std::string> ExtractInWorkers(const TFileList& file_list, const std::string& shard_prefix,
+    size_t workers, bool useSse, MagnitudeMode mode, bool full);
+/**
+@class TTemporaryFiles
+Files which are removed when the object is destroyed, also when an exception leaves its scope
+*/
+class TTemporaryFiles {
+ public:
+    TTemporaryFiles() {}
+    ~TTemporaryFiles();
+
+    std::vector<std::string> files;
+
+ private:
+    TTemporaryFiles(const TTemporaryFiles&);
+    TTemporaryFiles& operator=(const TTemporaryFiles&);
+};
+
+///Replaces features by samples of shard files, in the order of files, and sets their source.
+///Throws if a shard is not extracted from the images and with the options of source (@ref FeatureSource)
+void MergeShards(const std::vector<std::string>& shard_files, uint64_t source, FeatureMatrix* features);
+
+#endif
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <type_traits>
+
+#include "matrix.h"
+
+// Stencil engine: Matrix convolution with compile-time kernel size.
+//
+// unary_map knows kernel radius only at run time and calls operator
+// through a generic neighbourhood view. stencil_map takes radius from
+// the operator type, so every offset inside the window is a compile-time
+// constant and the inner loop over columns is a plain sliding loop which
+// compiler unrolls and vectorizes.
+//
+// Stencil operator _must_ have static constants vert_radius and
+// hor_radius and a template function
+// template<typename Window> ReturnT operator()(const Window &w) const,
+// where w(row, col) is the element of neighbourhood as in unary_map.
+//
+// Example:
+// struct Box3 {
+//     static const uint vert_radius = 1;
+//     static const uint hor_radius = 1;
+//     template<typename Window> int operator()(const Window &w) const
+//     {
+//         int sum = 0;
+//         for (uint i = 0; i < 3; ++i)
+//             for (uint j = 0; j < 3; ++j)
+//                 sum += w(i, j);
+//         return sum;
+//     }
+// };
+// Matrix<int> box = stencil_map(image, Box3());
+
+// Neighbourhood of one pixel with size known at compile time.
+template<typename ValueT, uint VertRadius, uint HorRadius>
+struct StencilWindow
+{
+	static const uint n_rows = 2 * VertRadius + 1;
+	static const uint n_cols = 2 * HorRadius + 1;
+
+	// Pointer to element (0, 0) of neighbourhood
+	const ValueT *data;
+	// Number of elements between two rows of image
+	uint stride;
+
+	StencilWindow(const ValueT *ptr, uint row_stride) :
+		data{ ptr },
+		stride{ row_stride }
+	{}
+
+	const ValueT &operator() (uint row, uint col) const
+	{
+		return data[row * stride + col];
+	}
+
+	// Same neighbourhood as a run-time sized view
+	MatrixView<const ValueT> view() const
+	{
+		return MatrixView<const ValueT>(data, n_rows, n_cols, stride);
+	}
+};
+
+// Return type of stencil operator applied to a window of ValueT
+template<typename StencilOperator, typename ValueT>
+struct stencil_result
+{
+	typedef decltype(std::declval<const StencilOperator &>()(
+		std::declval<StencilWindow<ValueT, StencilOperator::vert_radius,
+			StencilOperator::hor_radius> >())) type;
+};
+
+// Apply stencil operator to every pixel of src. Borders are mirrored
+// exactly as in Matrix::unary_map, so for the same operator both
+// functions give equal results.
+template<typename ValueT, typename StencilOperator>
+Matrix<typename stencil_result<StencilOperator, ValueT>::type>
+	stencil_map(const Matrix<ValueT> &src, const StencilOperator &op)
+{
+	typedef typename stencil_result<StencilOperator, ValueT>::type ReturnT;
+	const uint vert_radius = StencilOperator::vert_radius;
+	const uint hor_radius = StencilOperator::hor_radius;
+	typedef StencilWindow<ValueT, StencilOperator::vert_radius,
+		StencilOperator::hor_radius> Window;
+
+	if (src.n_cols * src.n_rows == 0)
+		return Matrix<ReturnT>(0, 0);
+
+	Matrix<ReturnT> tmp(src.n_rows, src.n_cols);
+	Matrix<ValueT> extra_image = src.extra_borders(vert_radius, hor_radius);
+	const MatrixView<const ValueT> in = extra_image.view();
+	const MatrixView<ReturnT> out = tmp.view();
+	const uint stride = in.stride;
+	const uint n_cols = src.n_cols;
+
+	for (uint i = 0; i < src.n_rows; ++i) {
+		const ValueT *in_row = in.row(i);
+		ReturnT *out_row = out.row(i);
+		for (uint j = 0; j < n_cols; ++j)
+			out_row[j] = op(Window(in_row + j, stride));
+	}
+	return tmp;
+}
+
+// Adapter which runs an old style unary_map operator (radius fields known
+// only at run time, operator() taking MatrixView) through stencil_map.
+// Radius of operator must be equal to template parameters.
+template<typename UnaryMatrixOperator, uint VertRadius, uint HorRadius>
+class StencilAdapter
+{
+public:
+	static const uint vert_radius = VertRadius;
+	static const uint hor_radius = HorRadius;
+
+	explicit StencilAdapter(const UnaryMatrixOperator &op) :
+		_op(op)
+	{
+		if (uint(op.vert_radius) != VertRadius || uint(op.hor_radius) != HorRadius)
+			throw std::string("Stencil radius differs from operator radius");
+	}
+
+	template<typename Window>
+	auto operator() (const Window &w) const -> decltype(
+		std::declval<const UnaryMatrixOperator &>()(w.view()))
+	{
+		return _op(w.view());
+	}
+
+private:
+	UnaryMatrixOperator _op;
+};
+
+// Helper to deduce operator type:
+// stencil_map(image, make_stencil<1, 1>(OldSobel()));
+template<uint VertRadius, uint HorRadius, typename UnaryMatrixOperator>
+StencilAdapter<UnaryMatrixOperator, VertRadius, HorRadius>
+	make_stencil(const UnaryMatrixOperator &op)
+{
+	return StencilAdapter<UnaryMatrixOperator, VertRadius, HorRadius>(op);
+}
+
+// Sum of window elements multiplied by compile-time coefficients,
+// unrolled over flat index Index = row * width + col. Terms with zero
+// coefficient are not generated at all.
+template<typename Kernel, typename AccT, uint Index,
+	bool End = (Index >= (2 * Kernel::vert_radius + 1) * (2 * Kernel::hor_radius + 1))>
+struct stencil_sum
+{
+	static const uint width = 2 * Kernel::hor_radius + 1;
+	static const int weight = Kernel::weight(Index / width, Index % width);
+
+	template<typename Window>
+	static AccT apply(const Window &w)
+	{
+		return term(w, std::integral_constant<bool, weight == 0>()) +
+			stencil_sum<Kernel, AccT, Index + 1>::apply(w);
+	}
+
+private:
+	template<typename Window>
+	static AccT term(const Window &, std::true_type)
+	{
+		return AccT(0);
+	}
+
+	template<typename Window>
+	static AccT term(const Window &w, std::false_type)
+	{
+		return AccT(weight) * AccT(w(Index / width, Index % width));
+	}
+};
+
+template<typename Kernel, typename AccT, uint Index>
+struct stencil_sum<Kernel, AccT, Index, true>
+{
+	template<typename Window>
+	static AccT apply(const Window &)
+	{
+		return AccT(0);
+	}
+};
+
+// Linear stencil with constexpr coefficients. Kernel _must_ have static
+// constants vert_radius, hor_radius and
+// static constexpr int weight(uint row, uint col).
+//
+// Example (horizontal Sobel):
+// struct SobelX {
+//     static const uint vert_radius = 1;
+//     static const uint hor_radius = 1;
+//     static constexpr int weight(uint row, uint col)
+//     {
+//         return (int(col) - 1) * (row == 1 ? 2 : 1);
+//     }
+// };
+// Matrix<int> dx = stencil_map(image, LinearStencil<SobelX>());
+template<typename Kernel, typename AccT = int>
+struct LinearStencil
+{
+	static const uint vert_radius = Kernel::vert_radius;
+	static const uint hor_radius = Kernel::hor_radius;
+
+	template<typename Window>
+	AccT operator() (const Window &w) const
+	{
+		return stencil_sum<Kernel, AccT, 0>::apply(w);
+	}
+};
@@ -0,0 +1,65 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+@file thread_pool.h
+Threads started once and reused by every parallel loop, so short loops don't pay for thread creation
+*/
+
+/**
+@class TThreadPool
+Runs ranges of a loop in its threads and in the thread which calls (@ref Run). Ranges are taken
+from a shared counter, so faster threads take more of them
+*/
+class TThreadPool {
+ public:
+    ///Pool of threads threads in total: threads - 1 are started, the caller of (@ref Run) is the last one
+    explicit TThreadPool(size_t threads);
+    ~TThreadPool();
+
+    ///Number of threads including the caller of (@ref Run)
+    size_t Threads() const { return workers_.size() + 1; }
+    ///Calls body(first, last, thread) for consecutive ranges of at most chunk of [0, count) and returns when all are done.
+    ///thread is below (@ref Threads) and differs between threads which run at the same time, so it can index
+    ///per-thread buffers. Calls of Run from many threads are served one after another.
+    ///If body throws, the rest of ranges is skipped and the first exception is thrown by Run
+    void Run(size_t count, size_t chunk, const std::function<void(size_t, size_t, size_t)>& body);
+
+ private:
+    TThreadPool(const TThreadPool&);
+    TThreadPool& operator=(const TThreadPool&);
+
+    ///Loop of a started thread: waits for a new Run and takes ranges of it
+    void Work(size_t thread);
+    ///Takes ranges of the current Run until none is left
+    void RunRanges(size_t thread);
+
+    std::vector<std::thread> workers_;
+    ///Held by Run for the whole loop
+    std::mutex run_mutex_;
+    ///Guards the fields below, except next_
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    const std::function<void(size_t, size_t, size_t)>* body_;
+    size_t count_;
+    size_t chunk_;
+    std::atomic<size_t> next_;
+    ///Number of Run calls, a started thread joins the loop when it changes
+    size_t generation_;
+    ///Started threads which have not finished the current loop
+    size_t busy_;
+    bool stop_;
+    std::exception_ptr error_;
+};
+
+#endif
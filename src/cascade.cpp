@@ -0,0 +1,88 @@
+#include "cascade.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <string>
+
+/**
+@file cascade.cpp
+Implementation of (@ref TCascade)
+*/
+
+/**
+@function Seconds
+Seconds since start
+*/
+static double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+@function NrW
+Number of weight vectors of the model, as in liblinear predict_values
+*/
+static int NrW(const struct model* model) {
+    return (model->nr_class == 2 && model->param.solver_type != MCSVM_CS) ? 1 : model->nr_class;
+}
+
+TCascade::TCascade(const struct model* coarse, const struct model* fine, double margin, bool full)
+    : coarse_(coarse),
+      fine_(fine),
+      margin_(margin),
+      full_(full),
+      values_(std::max(NrW(coarse), NrW(fine))) {
+    if (get_nr_feature(coarse) != int(COARSE_CELL_COUNT * COARSE_CELL_COUNT * SEGMENT_COUNT))
+        throw std::string("Number of features of the coarse model differs from the coarse descriptor");
+    if (get_nr_feature(fine) != int(FeatureMask::FeatureCount(full)))
+        throw std::string("Number of features of the model differs from the features of images");
+}
+
+int TCascade::DecisionValues(const struct model* model, const std::vector<float>& features, double* values) {
+    const int nr_w = NrW(model);
+    const int cols = get_nr_feature(model);
+    for (int k = 0; k < nr_w; ++k)
+        values[k] = model->bias >= 0 ? model->w[cols * nr_w + k] * model->bias : 0;
+    for (int j = 0; j < cols; ++j)
+        for (int k = 0; k < nr_w; ++k)
+            values[k] += model->w[j * nr_w + k] * features[j];
+    if (nr_w == 1)
+        return values[0] > 0 ? model->label[0] : model->label[1];
+    return model->label[std::max_element(values, values + nr_w) - values];
+}
+
+double TCascade::Confidence(const struct model* model, const double* values) {
+    const int nr_w = NrW(model);
+    if (nr_w == 1)
+        return std::fabs(values[0]);
+    std::vector<double> sorted(values, values + nr_w);
+    std::partial_sort(sorted.begin(), sorted.begin() + 2, sorted.end(), std::greater<double>());
+    return sorted[0] - sorted[1];
+}
+
+int TCascade::Predict(BMP* image, bool useSse, MagnitudeMode mode, int* stage) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Image gray = ImgToGrayscale(image, useSse);
+    std::vector<float> features;
+    ExtractCoarseDescriptor(gray, useSse, features);
+    int label = DecisionValues(coarse_, features, &values_[0]);
+    ++stages_[0].images;
+    bool decided = Confidence(coarse_, &values_[0]) >= margin_;
+    stages_[0].decided += decided;
+    stages_[0].seconds += Seconds(start);
+    if (stage)
+        *stage = decided ? 0 : 1;
+    if (decided)
+        return label;
+
+        // The grayscale image is shared by both stages
+    start = std::chrono::steady_clock::now();
+    features.clear();
+    ExtractDescriptor(image, gray, full_, useSse, mode, features);
+    label = DecisionValues(fine_, features, &values_[0]);
+    ++stages_[1].images;
+    ++stages_[1].decided;
+    stages_[1].seconds += Seconds(start);
+    return label;
+}
@@ -0,0 +1,225 @@
+#include "convolution.h"
+
+#include <vector>
+#include <emmintrin.h>
+#include <xmmintrin.h>
+
+/**
+@file convolution.cpp
+Separable convolution with a ring buffer of row-filtered lines and sse inner loops
+*/
+
+/**
+@struct SeparablePass
+One separable convolution computed during a sweep over the source rows
+*/
+template<typename ValueT>
+struct SeparablePass {
+	///Row kernel coefficients
+	const ValueT *row;
+	///Radius of the row kernel
+	uint hor_radius;
+	///Column kernel coefficients
+	const ValueT *col;
+	///Radius of the column kernel
+	uint vert_radius;
+	///Output matrix
+	MatrixView<ValueT> out;
+	///(2 * vert_radius + 1) row-filtered lines
+	std::vector<ValueT> ring;
+};
+
+/**
+@function MultiplyAdd
+dst[j] (+)= coef * src[j] for n shorts. If init is true dst is overwritten.
+Arithmetic wraps around exactly as int computation truncated to short
+*/
+static inline void MultiplyAdd(short *dst, const short *src, short coef, uint n, bool init) {
+	const __m128i c = _mm_set1_epi16(coef);
+	uint j = 0;
+	if (init) {
+		for (; j + 8 <= n; j += 8) {
+			__m128i s = _mm_loadu_si128((const __m128i *) (src + j));
+			_mm_storeu_si128((__m128i *) (dst + j), _mm_mullo_epi16(s, c));
+		}
+		for (; j < n; ++j)
+			dst[j] = short(coef * src[j]);
+	}
+	else {
+		for (; j + 8 <= n; j += 8) {
+			__m128i s = _mm_loadu_si128((const __m128i *) (src + j));
+			__m128i d = _mm_loadu_si128((const __m128i *) (dst + j));
+			_mm_storeu_si128((__m128i *) (dst + j), _mm_add_epi16(d, _mm_mullo_epi16(s, c)));
+		}
+		for (; j < n; ++j)
+			dst[j] = short(dst[j] + coef * src[j]);
+	}
+}
+
+/**
+@function MultiplyAdd
+dst[j] (+)= coef * src[j] for n floats. If init is true dst is overwritten
+*/
+static inline void MultiplyAdd(float *dst, const float *src, float coef, uint n, bool init) {
+	const __m128 c = _mm_set1_ps(coef);
+	uint j = 0;
+	if (init) {
+		for (; j + 4 <= n; j += 4)
+			_mm_storeu_ps(dst + j, _mm_mul_ps(_mm_loadu_ps(src + j), c));
+		for (; j < n; ++j)
+			dst[j] = coef * src[j];
+	}
+	else {
+		for (; j + 4 <= n; j += 4)
+			_mm_storeu_ps(dst + j, _mm_add_ps(_mm_loadu_ps(dst + j), _mm_mul_ps(_mm_loadu_ps(src + j), c)));
+		for (; j < n; ++j)
+			dst[j] += coef * src[j];
+	}
+}
+
+/**
+@function Correlate
+dst = sum of coef[k] * lines[k], zero coefficients are skipped
+*/
+template<typename ValueT>
+static void Correlate(ValueT *dst, const ValueT *const *lines, const ValueT *coef, uint size, uint n) {
+	bool init = true;
+	for (uint k = 0; k < size; ++k) {
+		if (coef[k] == ValueT(0))
+			continue;
+		MultiplyAdd(dst, lines[k], coef[k], n, init);
+		init = false;
+	}
+	if (init)
+		std::fill(dst, dst + n, ValueT(0));
+}
+
+/**
+@function MirrorIndex
+Maps row index of border-extended image to the source row, the same way as Matrix::extra_borders does
+*/
+static inline uint MirrorIndex(int index, uint size) {
+	if (index < 0)
+		return -index - 1;
+	if (index >= int(size))
+		return 2 * size - 1 - index;
+	return index;
+}
+
+/**
+@function CheckKernel
+Throws if kernel is not a row with odd number of coefficients or if it is larger than the image
+*/
+template<typename ValueT>
+static uint CheckKernel(const Matrix<ValueT> &kernel, uint image_size) {
+	if (kernel.n_rows != 1 || kernel.n_cols % 2 == 0)
+		throw std::string("Kernel must be one row with odd number of coefficients");
+	uint radius = kernel.n_cols / 2;
+	if (radius > image_size)
+		throw std::string("Kernel is larger than image");
+	return radius;
+}
+
+/**
+@function ConvolveSeparable
+Runs all passes in one sweep over the rows of src
+*/
+template<typename ValueT>
+static void ConvolveSeparable(const Matrix<ValueT> &src, std::vector<SeparablePass<ValueT> > &passes) {
+	const uint n_rows = src.n_rows;
+	const uint n_cols = src.n_cols;
+	if (n_rows * n_cols == 0)
+		return;
+
+	uint max_hor = 0, max_vert = 0;
+	for (size_t p = 0; p < passes.size(); ++p) {
+		max_hor = std::max(max_hor, passes[p].hor_radius);
+		max_vert = std::max(max_vert, passes[p].vert_radius);
+		passes[p].ring.resize((2 * passes[p].vert_radius + 1) * n_cols);
+	}
+
+	const MatrixView<const ValueT> in = src.view();
+	std::vector<ValueT> extended(n_cols + 2 * max_hor);
+	std::vector<const ValueT *> lines(2 * std::max(max_hor, max_vert) + 1);
+
+	for (int s = -int(max_vert); s < int(n_rows + max_vert); ++s) {
+		// Border-extended copy of the source row, shared by all passes
+		const ValueT *src_row = in.row(MirrorIndex(s, n_rows));
+		std::copy(src_row, src_row + n_cols, extended.begin() + max_hor);
+		for (uint k = 0; k < max_hor; ++k) {
+			extended[max_hor - 1 - k] = src_row[k];
+			extended[max_hor + n_cols + k] = src_row[n_cols - 1 - k];
+		}
+
+		for (size_t p = 0; p < passes.size(); ++p) {
+			SeparablePass<ValueT> &pass = passes[p];
+			const int vr = pass.vert_radius;
+			const uint ring_size = 2 * vr + 1;
+			if (s < -vr || s >= int(n_rows) + vr)
+				continue;
+
+			// Row pass into the ring buffer
+			const ValueT *base = &extended[max_hor - pass.hor_radius];
+			for (uint c = 0; c < 2 * pass.hor_radius + 1; ++c)
+				lines[c] = base + c;
+			ValueT *line = &pass.ring[((s + vr) % ring_size) * n_cols];
+			Correlate(line, &lines[0], pass.row, 2 * pass.hor_radius + 1, n_cols);
+
+			// Column pass as soon as all lines of output row are ready
+			int i = s - vr;
+			if (i < 0)
+				continue;
+			for (uint r = 0; r < ring_size; ++r)
+				lines[r] = &pass.ring[((i + r) % ring_size) * n_cols];
+			Correlate(pass.out.row(i), &lines[0], pass.col, ring_size, n_cols);
+		}
+	}
+}
+
+/**
+@function MakePass
+Checks kernels, prepares output matrix and describes the pass
+*/
+template<typename ValueT>
+static SeparablePass<ValueT> MakePass(const Matrix<ValueT> &src,
+	const Matrix<ValueT> &row_kernel, const Matrix<ValueT> &col_kernel, Matrix<ValueT> &out) {
+	SeparablePass<ValueT> pass;
+	pass.hor_radius = CheckKernel(row_kernel, src.n_cols);
+	pass.vert_radius = CheckKernel(col_kernel, src.n_rows);
+	pass.row = row_kernel.view().row(0);
+	pass.col = col_kernel.view().row(0);
+	if (out.n_rows != src.n_rows || out.n_cols != src.n_cols)
+		out = Matrix<ValueT>(src.n_rows, src.n_cols);
+	pass.out = out.view();
+	return pass;
+}
+
+template<typename ValueT>
+Matrix<ValueT> convolve_separable(const Matrix<ValueT> &src,
+	const Matrix<ValueT> &row_kernel, const Matrix<ValueT> &col_kernel) {
+	Matrix<ValueT> out(src.n_rows, src.n_cols);
+	std::vector<SeparablePass<ValueT> > passes(1, MakePass(src, row_kernel, col_kernel, out));
+	ConvolveSeparable(src, passes);
+	return out;
+}
+
+template<typename ValueT>
+void convolve_separable_pair(const Matrix<ValueT> &src,
+	const Matrix<ValueT> &row_first, const Matrix<ValueT> &col_first, Matrix<ValueT> &first,
+	const Matrix<ValueT> &row_second, const Matrix<ValueT> &col_second, Matrix<ValueT> &second) {
+	std::vector<SeparablePass<ValueT> > passes;
+	passes.push_back(MakePass(src, row_first, col_first, first));
+	passes.push_back(MakePass(src, row_second, col_second, second));
+	ConvolveSeparable(src, passes);
+}
+
+template Matrix<short> convolve_separable(const Matrix<short> &,
+	const Matrix<short> &, const Matrix<short> &);
+template Matrix<float> convolve_separable(const Matrix<float> &,
+	const Matrix<float> &, const Matrix<float> &);
+template void convolve_separable_pair(const Matrix<short> &,
+	const Matrix<short> &, const Matrix<short> &, Matrix<short> &,
+	const Matrix<short> &, const Matrix<short> &, Matrix<short> &);
+template void convolve_separable_pair(const Matrix<float> &,
+	const Matrix<float> &, const Matrix<float> &, Matrix<float> &,
+	const Matrix<float> &, const Matrix<float> &, Matrix<float> &);
@@ -0,0 +1,234 @@
+#include "detect.h"
+
+#include <algorithm>
+#include <xmmintrin.h>
+
+/**
+@file detect.cpp
+Sliding-window detection: cell histograms are computed once per pyramid level
+and the linear model is correlated with the grid of cells
+*/
+
+///Number of floats in one row of the window in the cell grid
+static const uint WINDOW_ROW_SIZE = CELL_COUNT * SEGMENT_COUNT;
+
+/**
+@function GetDetectorWeights
+Extracts the weights of one class from a trained liblinear model.
+For a two-class model the sign is chosen so that positive score means label
+@param model is the trained model, its features must be the (@ref GetDescriptor) descriptor
+@param label is the label of the object class
+*/
+DetectorWeights GetDetectorWeights(const struct model *model, int label) {
+	const uint featureCount = CELL_COUNT * CELL_COUNT * SEGMENT_COUNT;
+	if (!model || uint(get_nr_feature(model)) != featureCount)
+		throw std::string("Model was not trained on the plain HOG descriptor, detection needs its features only");
+	int classCount = get_nr_class(model);
+	std::vector<int> labels(classCount);
+	get_labels(model, &labels[0]);
+	int classIdx = std::find(labels.begin(), labels.end(), label) - labels.begin();
+	if (classIdx == classCount)
+		throw std::string("Model has no object class");
+
+	// liblinear keeps one weight vector for two classes (positive for label[0])
+	// and one vector per class otherwise, interleaved by feature
+	int stride = (classCount == 2 && model->param.solver_type != MCSVM_CS) ? 1 : classCount;
+	int column = (stride == 1) ? 0 : classIdx;
+	float sign = (stride == 1 && classIdx == 1) ? -1 : 1;
+
+	DetectorWeights detector;
+	detector.weights.resize(featureCount);
+	for (uint i = 0 ; i < featureCount ; ++i) {
+		detector.weights[i] = sign * model->w[i * stride + column];
+	}
+	detector.bias = 0;
+	if (model->bias >= 0) {
+		detector.bias = sign * model->w[featureCount * stride + column] * model->bias;
+	}
+	return detector;
+}
+
+/**
+@function ComputeCellGrid
+Computes the histogram of every cellSize x cellSize cell of the image with (@ref GetHist).
+Cell (i, j) is stored in row i of the result, in columns [j * SEGMENT_COUNT, (j + 1) * SEGMENT_COUNT)
+@param hor is the horizontal Sobel matrix
+@param vert is the vertical Sobel matrix
+@param magn is the magnitudes` matrix
+@param cellSize is the size of a cell in pixels
+*/
+floatImage ComputeCellGrid(ImageView hor, ImageView vert, floatImageView magn, uint cellSize) {
+	uint gridRows = hor.n_rows / cellSize;
+	uint gridCols = hor.n_cols / cellSize;
+	floatImage cells(gridRows, gridCols * SEGMENT_COUNT);
+	for (uint i = 0 ; i < gridRows ; ++i) {
+		for (uint j = 0 ; j < gridCols ; ++j) {
+			uint x = i * cellSize;
+			uint y = j * cellSize;
+			std::vector<float> hist = GetHist(hor.submatrix(x, y, cellSize, cellSize),
+				vert.submatrix(x, y, cellSize, cellSize), magn.submatrix(x, y, cellSize, cellSize));
+			std::copy(hist.begin(), hist.end(), &cells(i, j * SEGMENT_COUNT));
+		}
+	}
+	return cells;
+}
+
+/**
+@function Dot
+Dot product of two float arrays using sse intrinsics
+@param a is the first array
+@param b is the second array
+@param n is the length of arrays, must be a multiple of (@ref SSE_FLOAT_BLOCK_SIZE)
+*/
+static inline float Dot(const float *a, const float *b, uint n) {
+	__m128 sum = _mm_setzero_ps();
+	for (uint i = 0 ; i < n ; i += SSE_FLOAT_BLOCK_SIZE) {
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	}
+	float parts[SSE_FLOAT_BLOCK_SIZE];
+	_mm_storeu_ps(parts, sum);
+	return (parts[0] + parts[1]) + (parts[2] + parts[3]);
+}
+
+/**
+@function ScoreWindows
+Correlates the detector with the grid of cells. Element (i, j) of the result is the score of the window
+whose upper-left cell is (i, j). A window row is (@ref CELL_COUNT) consecutive cells of one grid row, so it is
+one contiguous array and its score is a dot product with the corresponding row of weights
+@param cells is the grid computed by (@ref ComputeCellGrid)
+@param detector is the linear model
+*/
+floatImage ScoreWindows(const floatImage &cells, const DetectorWeights &detector) {
+	uint gridCols = cells.n_cols / SEGMENT_COUNT;
+	if (cells.n_rows < CELL_COUNT || gridCols < CELL_COUNT)
+		return floatImage(0, 0);
+	floatImage scores(cells.n_rows - CELL_COUNT + 1, gridCols - CELL_COUNT + 1);
+	floatImageView in = cells.view();
+	MatrixView<float> out = scores.view();
+	for (uint i = 0 ; i < scores.n_rows ; ++i) {
+		float *outRow = out.row(i);
+		std::fill(outRow, outRow + scores.n_cols, detector.bias);
+		for (uint r = 0 ; r < CELL_COUNT ; ++r) {
+			const float *cellRow = in.row(i + r);
+			const float *weightRow = &detector.weights[r * WINDOW_ROW_SIZE];
+			for (uint j = 0 ; j < scores.n_cols ; ++j) {
+				outRow[j] += Dot(cellRow + j * SEGMENT_COUNT, weightRow, WINDOW_ROW_SIZE);
+			}
+		}
+	}
+	return scores;
+}
+
+/**
+@function Overlap
+Intersection over union of two detections
+*/
+static float Overlap(const Detection &a, const Detection &b) {
+	float width = float(std::min(a.x + a.width, b.x + b.width)) - std::max(a.x, b.x);
+	float height = float(std::min(a.y + a.height, b.y + b.height)) - std::max(a.y, b.y);
+	if (width <= 0 || height <= 0)
+		return 0;
+	float intersection = width * height;
+	return intersection / (float(a.width) * a.height + float(b.width) * b.height - intersection);
+}
+
+/**
+@function SuppressNonMaximum
+Greedy non-maximum suppression: detections are taken in order of decreasing score and
+every detection which overlaps an already taken one more than overlap is dropped
+@param detections is the list of detections
+@param overlap is the maximum allowed intersection over union of two results
+*/
+std::vector<Detection> SuppressNonMaximum(std::vector<Detection> detections, float overlap) {
+	std::stable_sort(detections.begin(), detections.end(),
+		[](const Detection &a, const Detection &b) { return a.score > b.score; });
+	std::vector<Detection> result;
+	for (const Detection &candidate : detections) {
+		bool keep = true;
+		for (const Detection &taken : result) {
+			if (Overlap(candidate, taken) > overlap) {
+				keep = false;
+				break;
+			}
+		}
+		if (keep)
+			result.push_back(candidate);
+	}
+	return result;
+}
+
+/**
+@function Resize
+Bilinear resize of a grayscale image
+@param img is the source image
+@param rows is the number of rows of the result
+@param cols is the number of cols of the result
+*/
+static Image Resize(const Image &img, uint rows, uint cols) {
+	Image result(rows, cols);
+	ImageView in = img.view();
+	float rowScale = float(img.n_rows) / rows;
+	float colScale = float(img.n_cols) / cols;
+	for (uint i = 0 ; i < rows ; ++i) {
+		float y = std::max((i + 0.5f) * rowScale - 0.5f, 0.0f);
+		uint y0 = std::min(uint(y), img.n_rows - 1);
+		uint y1 = std::min(y0 + 1, img.n_rows - 1);
+		float dy = y - y0;
+		for (uint j = 0 ; j < cols ; ++j) {
+			float x = std::max((j + 0.5f) * colScale - 0.5f, 0.0f);
+			uint x0 = std::min(uint(x), img.n_cols - 1);
+			uint x1 = std::min(x0 + 1, img.n_cols - 1);
+			float dx = x - x0;
+			float top = in(y0, x0) + dx * (in(y0, x1) - in(y0, x0));
+			float bottom = in(y1, x0) + dx * (in(y1, x1) - in(y1, x0));
+			result(i, j) = short(top + dy * (bottom - top) + 0.5f);
+		}
+	}
+	return result;
+}
+
+/**
+@function DetectObjects
+Finds windows of (@ref CELL_COUNT) x (@ref CELL_COUNT) cells of (@ref DETECT_CELL_SIZE) pixels
+whose score is greater than threshold on every level of the image pyramid.
+Gradients and cell histograms are computed once per level and all windows are scored by (@ref ScoreWindows).
+The HOG descriptor of a window differs from the descriptor of the cropped window only near the border:
+here the Sobel filter sees the real neighbouring pixels instead of mirrored ones
+@param gray is the grayscale image
+@param detector is the linear model
+@param threshold is the minimal score of a detection
+@param useSse is a bool that specifies whether sse intrinsics will be used for gradients
+*/
+std::vector<Detection> DetectObjects(const Image &gray, const DetectorWeights &detector, float threshold, bool useSse) {
+	const uint windowSize = CELL_COUNT * DETECT_CELL_SIZE;
+	std::vector<Detection> detections;
+	for (float scale = 1 ; ; scale *= DETECT_SCALE_STEP) {
+		uint rows = uint(gray.n_rows / scale + 0.5f);
+		uint cols = uint(gray.n_cols / scale + 0.5f);
+		if (rows < windowSize || cols < windowSize)
+			break;
+		Image level = (scale == 1) ? gray : Resize(gray, rows, cols);
+		Image hor(rows, cols);
+		Image vert(rows, cols);
+		ApplySobel(level, hor, vert, useSse);
+		floatImage magn = GetMagnitude(hor, vert, useSse);
+		floatImage scores = ScoreWindows(ComputeCellGrid(hor, vert, magn, DETECT_CELL_SIZE), detector);
+
+		float rowScale = float(gray.n_rows) / rows;
+		float colScale = float(gray.n_cols) / cols;
+		for (uint i = 0 ; i < scores.n_rows ; ++i) {
+			for (uint j = 0 ; j < scores.n_cols ; ++j) {
+				if (scores(i, j) <= threshold)
+					continue;
+				Detection found;
+				found.x = uint(j * DETECT_CELL_SIZE * colScale + 0.5f);
+				found.y = uint(i * DETECT_CELL_SIZE * rowScale + 0.5f);
+				found.width = std::min(uint(windowSize * colScale + 0.5f), gray.n_cols - found.x);
+				found.height = std::min(uint(windowSize * rowScale + 0.5f), gray.n_rows - found.y);
+				found.score = scores(i, j);
+				detections.push_back(found);
+			}
+		}
+	}
+	return SuppressNonMaximum(detections, DETECT_NMS_OVERLAP);
+}
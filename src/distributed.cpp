@@ -0,0 +1,398 @@
+#include "distributed.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+@file distributed.cpp
+Implementation of (@ref TConsensusCoordinator) and (@ref RunConsensusWorker).
+A worker sends int32 {rows, features, solver_type, classes}, its labels and double C; the coordinator answers
+with int32 classes, labels in the order of the consensus (ascending) and double rho. Then every round the coordinator
+sends int32 kind and the consensus z, the worker answers with |w - z|^2 of the previous round and w + u
+*/
+
+///Round of the coordinator: the worker solves its problem and answers
+static const int32_t CONSENSUS_ROUND = 0;
+///Last message of the coordinator, the worker stops
+static const int32_t CONSENSUS_DONE = 1;
+///A worker tries to connect this many times, 100 ms apart
+static const int CONNECT_ATTEMPTS = 300;
+///Largest number of classes a worker may announce, a larger one is a foreign or broken connection
+static const int32_t MAX_CONSENSUS_CLASSES = 1 << 16;
+///Largest number of features a worker may announce
+static const int32_t MAX_CONSENSUS_FEATURES = 1 << 24;
+
+/**
+@function SendAll
+Sends size bytes of data or throws if the connection is broken
+*/
+static void SendAll(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            throw std::string("Connection of consensus training is broken");
+        bytes += sent;
+        size -= sent;
+    }
+}
+
+/**
+@function ReceiveAll
+Receives size bytes to data or throws if the connection is closed
+*/
+static void ReceiveAll(int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t received = recv(fd, bytes, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            throw std::string("Connection of consensus training is broken");
+        bytes += received;
+        size -= received;
+    }
+}
+
+template<typename T>
+static void Send(int fd, const std::vector<T>& values) {
+    SendAll(fd, &values[0], values.size() * sizeof(T));
+}
+
+///Receives as many values as the vector holds
+template<typename T>
+static void Receive(int fd, std::vector<T>* values) {
+    ReceiveAll(fd, &(*values)[0], values->size() * sizeof(T));
+}
+
+/**
+@class Connections
+Sockets closed on destruction, also when training throws
+*/
+struct Connections {
+    std::vector<int> fds;
+
+    ~Connections() {
+        for (size_t k = 0; k < fds.size(); ++k)
+            close(fds[k]);
+    }
+};
+
+/**
+@function NoDelay
+Turns off Nagle's algorithm of a TCP socket: every round is a request and an answer,
+a delayed acknowledgement would stall it. Unix sockets ignore it
+*/
+static int NoDelay(int fd) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+/**
+@function UnixAddress
+Fills addr if address is "unix:PATH"
+@return false for a TCP address
+*/
+static bool UnixAddress(const std::string& address, sockaddr_un* addr) {
+    if (address.compare(0, 5, "unix:") != 0)
+        return false;
+    std::string path = address.substr(5);
+    if (path.empty() || path.size() >= sizeof(addr->sun_path))
+        throw std::string("Bad path of Unix socket " + address);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path.c_str(), path.size());
+    return true;
+}
+
+/**
+@function TcpAddress
+Resolves "HOST:PORT", an empty host means any interface for the coordinator
+*/
+static addrinfo* TcpAddress(const std::string& address, bool passive) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+        throw std::string("Address must be unix:PATH or HOST:PORT, not " + address);
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo* result = NULL;
+    int error = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &result);
+    if (error != 0)
+        throw std::string("Can't resolve " + address + ": " + gai_strerror(error));
+    return result;
+}
+
+/**
+@function TryConnect
+Socket connected to address or -1 if nobody listens there
+*/
+static int TryConnect(const std::string& address) {
+    sockaddr_un unix_addr;
+    if (UnixAddress(address, &unix_addr)) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&unix_addr), sizeof(unix_addr)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+    addrinfo* info = TcpAddress(address, false);
+    int fd = -1;
+    for (addrinfo* ai = info; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(info);
+    return fd >= 0 ? NoDelay(fd) : fd;
+}
+
+/**
+@function WeightsModel
+liblinear model without bias which shares weights w, in the layout of classes of labels
+*/
+static struct model WeightsModel(std::vector<int>& labels, int cols, int solver_type, std::vector<double>& w) {
+    struct model result;
+    memset(&result, 0, sizeof(result));
+    result.param.solver_type = solver_type;
+    result.nr_class = labels.size();
+    result.nr_feature = cols;
+    result.w = &w[0];
+    result.label = &labels[0];
+    result.bias = -1;
+    return result;
+}
+
+TConsensusCoordinator::TConsensusCoordinator(const std::string& address, const TConsensusParams& params)
+    : address_(address),
+      params_(params),
+      listener_(-1),
+      rounds_(0) {
+    sockaddr_un unix_addr;
+    if (UnixAddress(address, &unix_addr)) {
+            // Socket file of a previous run
+        unlink(unix_addr.sun_path);
+        listener_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener_ >= 0 && (bind(listener_, reinterpret_cast<sockaddr*>(&unix_addr), sizeof(unix_addr)) != 0 ||
+                listen(listener_, SOMAXCONN) != 0)) {
+            close(listener_);
+            listener_ = -1;
+        }
+        if (listener_ < 0)
+            throw std::string("Can't listen on " + address);
+        return;
+    }
+    addrinfo* info = TcpAddress(address, true);
+    for (addrinfo* ai = info; ai && listener_ < 0; ai = ai->ai_next) {
+        listener_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (listener_ < 0)
+            continue;
+        int reuse = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(listener_, ai->ai_addr, ai->ai_addrlen) != 0 || listen(listener_, SOMAXCONN) != 0) {
+            close(listener_);
+            listener_ = -1;
+        }
+    }
+    freeaddrinfo(info);
+    if (listener_ < 0)
+        throw std::string("Can't listen on " + address);
+        // Port 0 is replaced by the port the system picked
+    sockaddr_storage bound;
+    socklen_t length = sizeof(bound);
+    char port[NI_MAXSERV];
+    if (getsockname(listener_, reinterpret_cast<sockaddr*>(&bound), &length) == 0 &&
+            getnameinfo(reinterpret_cast<sockaddr*>(&bound), length, NULL, 0, port, sizeof(port), NI_NUMERICSERV) == 0)
+        address_ = address.substr(0, address.rfind(':') + 1) + port;
+}
+
+TConsensusCoordinator::~TConsensusCoordinator() {
+    close(listener_);
+    sockaddr_un unix_addr;
+    if (UnixAddress(address_, &unix_addr))
+        unlink(unix_addr.sun_path);
+}
+
+void TConsensusCoordinator::Train(size_t workers, TModel* model) {
+    Connections connections;
+    while (connections.fds.size() < workers) {
+        int fd = accept(listener_, NULL, NULL);
+        if (fd < 0 && errno != EINTR)
+            throw std::string("Can't accept workers on " + address_);
+        if (fd >= 0)
+            connections.fds.push_back(NoDelay(fd));
+    }
+
+        // Workers must describe the same problem
+    int cols = 0, solver_type = 0;
+    double C = 0;
+    std::vector<int32_t> labels;
+    for (size_t k = 0; k < workers; ++k) {
+        std::vector<int32_t> hello(4);
+        Receive(connections.fds[k], &hello);
+        if (hello[1] <= 0 || hello[1] > MAX_CONSENSUS_FEATURES || hello[3] <= 0 || hello[3] > MAX_CONSENSUS_CLASSES)
+            throw std::string("Worker of consensus training sent a bad description of its problem");
+        std::vector<int32_t> worker_labels(hello[3]);
+        Receive(connections.fds[k], &worker_labels);
+        std::vector<double> worker_C(1);
+        Receive(connections.fds[k], &worker_C);
+        if (k == 0) {
+            cols = hello[1];
+            solver_type = hello[2];
+            labels = worker_labels;
+            C = worker_C[0];
+        }
+        else if (hello[1] != cols || hello[2] != solver_type || worker_labels.size() != labels.size() ||
+                !std::is_permutation(labels.begin(), labels.end(), worker_labels.begin()) || worker_C[0] != C)
+            throw std::string("Workers of consensus training have different features, solvers, classes or C");
+    }
+        // Workers connect in any order, sorted classes keep the model independent of it
+    std::sort(labels.begin(), labels.end());
+    std::vector<int32_t> start(1, labels.size());
+    start.insert(start.end(), labels.begin(), labels.end());
+    for (size_t k = 0; k < workers; ++k) {
+        Send(connections.fds[k], start);
+        Send(connections.fds[k], std::vector<double>(1, params_.rho));
+    }
+
+    const size_t nr_w = labels.size() == 2 ? 1 : labels.size();
+    const size_t size = cols * nr_w;
+    std::vector<double> z(size, 0), sum(size), answer(size + 1);
+    bool converged = false;
+    for (rounds_ = 0; ; ++rounds_) {
+        std::vector<int32_t> kind(1, (converged || rounds_ == params_.rounds) ? CONSENSUS_DONE : CONSENSUS_ROUND);
+        for (size_t k = 0; k < workers; ++k) {
+            Send(connections.fds[k], kind);
+            Send(connections.fds[k], z);
+        }
+        if (kind[0] == CONSENSUS_DONE)
+            break;
+
+        std::fill(sum.begin(), sum.end(), 0);
+        double residual = 0;
+        for (size_t k = 0; k < workers; ++k) {
+            Receive(connections.fds[k], &answer);
+            residual += answer[0];
+            for (size_t j = 0; j < size; ++j)
+                sum[j] += answer[j + 1];
+        }
+        double norm = 0, change = 0;
+        for (size_t j = 0; j < size; ++j) {
+            double next = params_.rho * sum[j] / (1 + params_.rho * workers);
+            norm += next * next;
+            change += (next - z[j]) * (next - z[j]);
+            z[j] = next;
+        }
+            // Residual of the first round is not known, workers had no weights
+        const double limit = params_.tolerance * std::sqrt(norm);
+        converged = rounds_ > 0 && std::sqrt(residual / workers) <= limit && std::sqrt(change) <= limit;
+    }
+
+    struct model* result = (struct model*) malloc(sizeof(struct model));
+    memset(&result->param, 0, sizeof(result->param));
+    result->param.solver_type = solver_type;
+    result->param.C = C;
+    result->param.nr_thread = 1;
+    result->nr_class = labels.size();
+    result->nr_feature = cols;
+    result->bias = -1;
+    result->label = (int*) malloc(labels.size() * sizeof(int));
+    std::copy(labels.begin(), labels.end(), result->label);
+    result->w = (double*) malloc(size * sizeof(double));
+    std::copy(z.begin(), z.end(), result->w);
+    *model = result;
+}
+
+void RunConsensusWorker(const std::string& address, const TFeatures& features, const TClassifierParams& params) {
+    if (params.solver_type != L2R_L2LOSS_SVC_DUAL && params.solver_type != L2R_L1LOSS_SVC_DUAL)
+        throw std::string("Consensus training needs solver L2R_L2LOSS_SVC_DUAL or L2R_L1LOSS_SVC_DUAL");
+    if (features.Rows() == 0)
+        throw std::string("Worker of consensus training has no samples");
+    Connections connection;
+    for (int attempt = 0; connection.fds.empty(); ++attempt) {
+        int fd = TryConnect(address);
+        if (fd >= 0)
+            connection.fds.push_back(fd);
+        else if (attempt == CONNECT_ATTEMPTS)
+            throw std::string("Can't connect to coordinator " + address);
+        else
+            usleep(100000);
+    }
+    const int fd = connection.fds[0];
+
+    std::vector<int> local_labels = TClassifier::ClassLabels(features);
+    std::vector<int32_t> hello(4);
+    hello[0] = features.Rows();
+    hello[1] = features.Cols();
+    hello[2] = params.solver_type;
+    hello[3] = local_labels.size();
+    Send(fd, hello);
+    Send(fd, std::vector<int32_t>(local_labels.begin(), local_labels.end()));
+    Send(fd, std::vector<double>(1, params.C));
+
+        // Weights are kept in the layout of classes of the coordinator
+    std::vector<int32_t> classes(1);
+    Receive(fd, &classes);
+    std::vector<int32_t> labels32(classes[0]);
+    Receive(fd, &labels32);
+    std::vector<double> rho(1);
+    Receive(fd, &rho);
+    std::vector<int> labels(labels32.begin(), labels32.end());
+    const size_t nr_w = labels.size() == 2 ? 1 : labels.size();
+    const int cols = features.Cols();
+    const size_t size = cols * nr_w;
+
+        // Scaled dual variable u, weights w of the worker and the center z - u of its regularizer
+    std::vector<double> z(size), u(size, 0), w(size, 0), center(size), answer(size + 1);
+    struct model center_model = WeightsModel(labels, cols, params.solver_type, center);
+    struct model init_model = WeightsModel(labels, cols, params.solver_type, w);
+    TClassifierParams local_params = params;
+        // C sum(loss) + rho/2 |w - center|^2 is liblinear's problem with C / rho
+    local_params.C = params.C / rho[0];
+    local_params.center_model = &center_model;
+    bool solved = false;
+    while (true) {
+        std::vector<int32_t> kind(1);
+        Receive(fd, &kind);
+        Receive(fd, &z);
+        double residual = 0;
+        for (size_t j = 0; solved && j < size; ++j) {
+            u[j] += w[j] - z[j];
+            residual += (w[j] - z[j]) * (w[j] - z[j]);
+        }
+        if (kind[0] == CONSENSUS_DONE)
+            break;
+        for (size_t j = 0; j < size; ++j)
+            center[j] = z[j] - u[j];
+            // Weights of the previous round are the warm start
+        local_params.init_model = solved ? &init_model : NULL;
+        TModel local;
+        TClassifier(local_params).Train(features, &local);
+        TClassifier::ModelWeights(local.get(), labels, &w);
+        solved = true;
+
+        answer[0] = residual;
+        for (size_t j = 0; j < size; ++j)
+            answer[j + 1] = w[j] + u[j];
+        Send(fd, answer);
+    }
+}
@@ -0,0 +1,200 @@
+#include "extraction.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+/**
+@file extraction.cpp
+Implementation of (@ref FeatureMask) and (@ref ExtractDescriptor)
+*/
+
+///Cells of color features
+static const size_t COLOR_CELLS = COLOR_CELL_COUNT * COLOR_CELL_COUNT;
+///Features of one HOG descriptor
+static const size_t DESCRIPTOR_SIZE = DESCRIPTOR_CELLS * SEGMENT_COUNT;
+
+FeatureMask::FeatureMask(bool full)
+    : full_(full),
+      cells_((full ? FULL_DESCRIPTORS : 1) * DESCRIPTOR_CELLS, true),
+      colors_(full ? COLOR_CELLS : 0, true) {
+}
+
+FeatureMask::FeatureMask(const struct model* model, bool full, double threshold)
+    : full_(full),
+      cells_((full ? FULL_DESCRIPTORS : 1) * DESCRIPTOR_CELLS, false),
+      colors_(full ? COLOR_CELLS : 0, false) {
+    const size_t cols = get_nr_feature(model);
+    if (cols != FeatureCount(full))
+        throw std::string("Number of features of the model differs from the features of images");
+    const int nr_class = get_nr_class(model);
+    const size_t nr_w = (nr_class == 2 && model->param.solver_type != MCSVM_CS) ? 1 : nr_class;
+
+    double largest = 0;
+    for (size_t f = 0; f < cols * nr_w; ++f)
+        largest = std::max(largest, std::fabs(model->w[f]));
+    const double limit = threshold * largest;
+    const size_t hog_features = cells_.size() * SEGMENT_COUNT;
+    for (size_t f = 0; f < cols; ++f) {
+        bool significant = false;
+        for (size_t k = 0; k < nr_w; ++k)
+            significant = significant || std::fabs(model->w[f * nr_w + k]) > limit;
+        if (!significant)
+            continue;
+            // Full features are HOG values mapped by the kernel, then colors
+        size_t value = full ? f / HIK_SIZE : f;
+        if (value < hog_features)
+            cells_[value / SEGMENT_COUNT] = true;
+        else
+            colors_[(f - hog_features * HIK_SIZE) / COLOR_SIZE] = true;
+    }
+}
+
+size_t FeatureMask::ActiveCells() const {
+    return std::count(cells_.begin(), cells_.end(), true) + std::count(colors_.begin(), colors_.end(), true);
+}
+
+size_t FeatureMask::FeatureCount(bool full) {
+    if (!full)
+        return DESCRIPTOR_SIZE;
+    return FULL_DESCRIPTORS * DESCRIPTOR_SIZE * HIK_SIZE + COLOR_CELLS * COLOR_SIZE;
+}
+
+/**
+@function AppendDescriptors
+Appends HOG descriptor of the image and, for full features, of its four quadrants
+*/
+template<typename MagnT>
+static void AppendDescriptors(ImageView hor, ImageView vert, MatrixView<const MagnT> magn, bool full,
+    std::vector<float> &result) {
+    GetDescriptor(hor, vert, magn, result);
+    if (!full)
+        return;
+    const uint halfRows = hor.n_rows >> 1;
+    const uint halfCols = hor.n_cols >> 1;
+    const uint corners[4][2] = {{0, 0}, {0, halfCols}, {halfRows, 0}, {halfRows, halfCols}};
+    for (uint q = 0; q < 4; ++q) {
+        GetDescriptor(hor.submatrix(corners[q][0], corners[q][1], halfRows, halfCols),
+            vert.submatrix(corners[q][0], corners[q][1], halfRows, halfCols),
+            magn.submatrix(corners[q][0], corners[q][1], halfRows, halfCols), result);
+    }
+}
+
+void ExtractDescriptor(BMP *image, bool full, bool useSse, MagnitudeMode mode, std::vector<float> &result) {
+    ExtractDescriptor(image, ImgToGrayscale(image, useSse), full, useSse, mode, result);
+}
+
+void ExtractDescriptor(BMP *image, const Image &gray, bool full, bool useSse, MagnitudeMode mode,
+    std::vector<float> &result) {
+    Image hor(gray.n_rows, gray.n_cols);
+    Image vert(gray.n_rows, gray.n_cols);
+    ApplySobel(gray, hor, vert, useSse);
+    std::vector<float> hog;
+    if (mode == MAGNITUDE_FLOAT) {
+        floatImage magn = GetMagnitude(hor, vert, useSse);
+        AppendDescriptors<float>(hor, vert, magn, full, hog);
+    }
+    else {
+            // Integer magnitudes take half of the memory
+        ushortImage magn = GetMagnitude(hor, vert, mode, useSse);
+        AppendDescriptors<unsigned short>(hor, vert, magn, full, hog);
+    }
+    if (!full) {
+        result.insert(result.end(), hog.begin(), hog.end());
+        return;
+    }
+    hog = ApplyHIKernel(hog);
+    result.insert(result.end(), hog.begin(), hog.end());
+    GetColors(image, result);
+}
+
+/**
+@function AppendCellHist
+Appends the histogram of the cell rows x cols at (x, y) of the image bordered by (@ref FILTER_RADIUS).
+Gradients are computed in the cell and its border only, they equal gradients of the whole image there
+*/
+static void AppendCellHist(const Image &padded, uint x, uint y, uint rows, uint cols, bool useSse,
+    MagnitudeMode mode, std::vector<float> &hog) {
+    Image window = padded.submatrix(x, y, rows + 2 * FILTER_RADIUS, cols + 2 * FILTER_RADIUS);
+    Image hor(window.n_rows, window.n_cols);
+    Image vert(window.n_rows, window.n_cols);
+    ApplySobel(window, hor, vert, useSse);
+    ImageView cellHor = hor.view().submatrix(FILTER_RADIUS, FILTER_RADIUS, rows, cols);
+    ImageView cellVert = vert.view().submatrix(FILTER_RADIUS, FILTER_RADIUS, rows, cols);
+    std::vector<float> hist;
+    if (mode == MAGNITUDE_FLOAT)
+        hist = GetHist(cellHor, cellVert, GetMagnitude(cellHor, cellVert, useSse));
+    else
+        hist = GetHist(cellHor, cellVert, GetMagnitude(cellHor, cellVert, mode, useSse));
+    hog.insert(hog.end(), hist.begin(), hist.end());
+}
+
+/**
+@function AppendMaskedDescriptor
+Same as (@ref GetDescriptor) for the region rows x cols at (x0, y0) of the image,
+cells which are not needed get zero histograms
+*/
+static void AppendMaskedDescriptor(const Image &padded, uint x0, uint y0, uint n_rows, uint n_cols,
+    const FeatureMask &mask, size_t descriptor, bool useSse, MagnitudeMode mode, std::vector<float> &hog) {
+    for (uint i = 0; i < CELL_COUNT; ++i) {
+        for (uint j = 0; j < CELL_COUNT; ++j) {
+            if (!mask.Cell(descriptor, i * CELL_COUNT + j)) {
+                hog.insert(hog.end(), SEGMENT_COUNT, 0.0f);
+                continue;
+            }
+            uint rows = (i == CELL_COUNT - 1) ? n_rows - i * n_rows / CELL_COUNT : n_rows / CELL_COUNT;
+            uint cols = (j == CELL_COUNT - 1) ? n_cols - j * n_cols / CELL_COUNT : n_cols / CELL_COUNT;
+            AppendCellHist(padded, x0 + i * n_rows / CELL_COUNT, y0 + j * n_cols / CELL_COUNT, rows, cols,
+                useSse, mode, hog);
+        }
+    }
+}
+
+void ExtractDescriptor(BMP *image, const FeatureMask &mask, bool useSse, MagnitudeMode mode, std::vector<float> &result) {
+        // A separate cell costs about twice as much per pixel as the whole image (border, small matrices)
+    if (2 * mask.ActiveCells() > mask.TotalCells()) {
+        ExtractDescriptor(image, mask.Full(), useSse, mode, result);
+        return;
+    }
+    Image gray = ImgToGrayscale(image, useSse);
+        // Mirrored border, as the filters of the whole image see it
+    Image padded = gray.extra_borders(FILTER_RADIUS, FILTER_RADIUS);
+    std::vector<float> hog;
+    hog.reserve(FeatureMask::FeatureCount(false) * (mask.Full() ? FULL_DESCRIPTORS : 1));
+    AppendMaskedDescriptor(padded, 0, 0, gray.n_rows, gray.n_cols, mask, 0, useSse, mode, hog);
+    if (!mask.Full()) {
+        result.insert(result.end(), hog.begin(), hog.end());
+        return;
+    }
+    const uint halfRows = gray.n_rows >> 1;
+    const uint halfCols = gray.n_cols >> 1;
+    const uint corners[4][2] = {{0, 0}, {0, halfCols}, {halfRows, 0}, {halfRows, halfCols}};
+    for (uint q = 0; q < 4; ++q)
+        AppendMaskedDescriptor(padded, corners[q][0], corners[q][1], halfRows, halfCols, mask, q + 1, useSse, mode, hog);
+        // Zero values are mapped to zeros without transcendental functions
+    hog = ApplyHIKernel(hog);
+    result.insert(result.end(), hog.begin(), hog.end());
+
+        // Same cells as GetColors
+    const uint height = image->TellHeight(), width = image->TellWidth();
+    for (uint i = 0; i < uint(COLOR_CELL_COUNT); ++i) {
+        for (uint j = 0; j < uint(COLOR_CELL_COUNT); ++j) {
+            if (!mask.ColorCell(i * COLOR_CELL_COUNT + j)) {
+                result.insert(result.end(), COLOR_SIZE, 0.0f);
+                continue;
+            }
+            uint rows = (i == COLOR_CELL_COUNT - 1) ? height - i * height / COLOR_CELL_COUNT : height / COLOR_CELL_COUNT;
+            uint cols = (j == COLOR_CELL_COUNT - 1) ? width - j * width / COLOR_CELL_COUNT : width / COLOR_CELL_COUNT;
+            GetCellColors(image, result, rows, cols, i * height / COLOR_CELL_COUNT, j * width / COLOR_CELL_COUNT);
+        }
+    }
+}
+
+void ExtractCoarseDescriptor(const Image &gray, bool useSse, std::vector<float> &result) {
+    Image small = Downsample(gray, COARSE_SCALE);
+    Image hor(small.n_rows, small.n_cols);
+    Image vert(small.n_rows, small.n_cols);
+    ApplySobel(small, hor, vert, useSse);
+    floatImage magn = GetMagnitude(hor, vert, useSse);
+    GetDescriptor(hor, vert, magn, COARSE_CELL_COUNT, result);
+}
@@ -0,0 +1,249 @@
+#include "feature_matrix.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+@file feature_matrix.cpp
+Implementation of (@ref FeatureMatrix)
+*/
+
+///Magic number in the beginning of a feature file
+static const char FEATURE_FILE_MAGIC[4] = {'F', 'M', 'A', 'T'};
+///Version of feature file layout
+static const uint32_t FEATURE_FILE_VERSION = 1;
+
+/**
+@struct FeatureFileHeader
+Header of a binary feature file. Labels follow the header, features follow
+the labels, both start at offsets aligned by (@ref FEATURE_ALIGNMENT)
+*/
+struct FeatureFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t stride;
+    ///(@ref FeatureMatrix::Source), zero in files written before it was kept
+    uint64_t source;
+    char reserved[FEATURE_ALIGNMENT - 40];
+};
+
+/**
+@function AlignUp
+Rounds size up to a multiple of alignment
+*/
+static size_t AlignUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+/**
+@function LabelsOffset
+Offset in bytes of the label array in a feature file
+*/
+static size_t LabelsOffset() {
+    return sizeof(FeatureFileHeader);
+}
+
+/**
+@function DataOffset
+Offset in bytes of the feature block in a feature file with rows samples
+*/
+static size_t DataOffset(size_t rows) {
+    return AlignUp(LabelsOffset() + rows * sizeof(int32_t), FEATURE_ALIGNMENT);
+}
+
+FeatureMatrixView FeatureMatrixView::Slice(size_t first, size_t count) const {
+    if (first + count > n_rows)
+        throw std::string("Out of bounds");
+    FeatureMatrixView view = *this;
+    view.data = Row(first);
+    view.labels = labels + first;
+    view.n_rows = count;
+    return view;
+}
+
+FeatureMatrix::FeatureMatrix()
+    : rows_(0), cols_(0), stride_(0), capacity_(0), reserved_(0), source_(0),
+      data_(NULL), labels_(NULL), mapping_(NULL), mapping_size_(0) {}
+
+FeatureMatrix::FeatureMatrix(size_t cols)
+    : rows_(0), cols_(cols),
+      stride_(AlignUp(cols, FEATURE_ALIGNMENT / sizeof(float))), capacity_(0), reserved_(0), source_(0),
+      data_(NULL), labels_(NULL), mapping_(NULL), mapping_size_(0) {}
+
+FeatureMatrix::FeatureMatrix(FeatureMatrix&& other)
+    : rows_(other.rows_), cols_(other.cols_), stride_(other.stride_),
+      capacity_(other.capacity_), reserved_(other.reserved_), source_(other.source_),
+      data_(other.data_), labels_(other.labels_),
+      mapping_(other.mapping_), mapping_size_(other.mapping_size_) {
+    other.data_ = NULL;
+    other.labels_ = NULL;
+    other.mapping_ = NULL;
+    other.rows_ = other.capacity_ = other.reserved_ = other.mapping_size_ = 0;
+    other.source_ = 0;
+}
+
+FeatureMatrix& FeatureMatrix::operator=(FeatureMatrix&& other) {
+    if (this != &other) {
+        Release();
+        std::swap(rows_, other.rows_);
+        std::swap(cols_, other.cols_);
+        std::swap(stride_, other.stride_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(reserved_, other.reserved_);
+        std::swap(source_, other.source_);
+        std::swap(data_, other.data_);
+        std::swap(labels_, other.labels_);
+        std::swap(mapping_, other.mapping_);
+        std::swap(mapping_size_, other.mapping_size_);
+    }
+    return *this;
+}
+
+FeatureMatrix::~FeatureMatrix() {
+    Release();
+}
+
+void FeatureMatrix::Release() {
+    if (mapping_) {
+        munmap(mapping_, mapping_size_);
+    } else {
+        free(data_);
+        free(labels_);
+    }
+    data_ = NULL;
+    labels_ = NULL;
+    mapping_ = NULL;
+    rows_ = capacity_ = mapping_size_ = 0;
+    source_ = 0;
+}
+
+void FeatureMatrix::Grow(size_t rows) {
+    if (mapping_)
+        throw std::string("Feature matrix is read-only");
+    if (rows <= capacity_)
+        return;
+    void* data = NULL;
+    if (posix_memalign(&data, FEATURE_ALIGNMENT, rows * stride_ * sizeof(float)))
+        throw std::string("Not enough memory for features");
+    int* labels = static_cast<int*>(realloc(labels_, rows * sizeof(int)));
+    if (!labels) {
+        free(data);
+        throw std::string("Not enough memory for features");
+    }
+    if (rows_)
+        memcpy(data, data_, rows_ * stride_ * sizeof(float));
+    free(data_);
+    data_ = static_cast<float*>(data);
+    labels_ = labels;
+    capacity_ = rows;
+}
+
+void FeatureMatrix::Reserve(size_t rows) {
+        // Rows can't be allocated before their size is known
+    if (!stride_ && !mapping_) {
+        reserved_ = std::max(reserved_, rows);
+        return;
+    }
+    Grow(rows);
+}
+
+void FeatureMatrix::AppendRow(const float* row, size_t cols, int label) {
+    if (!stride_ && !rows_) {
+        cols_ = cols;
+        stride_ = AlignUp(cols, FEATURE_ALIGNMENT / sizeof(float));
+    }
+    if (cols != cols_)
+        throw std::string("Feature vectors must have equal length");
+    if (rows_ == capacity_)
+        Grow(capacity_ ? 2 * capacity_ : std::max<size_t>(reserved_, 64));
+
+    float* dst = data_ + rows_ * stride_;
+    memcpy(dst, row, cols * sizeof(float));
+    memset(dst + cols, 0, (stride_ - cols) * sizeof(float));
+    labels_[rows_] = label;
+    ++rows_;
+}
+
+FeatureMatrixView FeatureMatrix::View() const {
+    FeatureMatrixView view;
+    view.data = data_;
+    view.labels = labels_;
+    view.n_rows = rows_;
+    view.n_cols = cols_;
+    view.stride = stride_;
+    return view;
+}
+
+void FeatureMatrix::Save(const std::string& file) const {
+    FILE* fp = fopen(file.c_str(), "wb");
+    if (!fp)
+        throw std::string("Can't open feature file ") + file;
+
+    FeatureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FEATURE_FILE_MAGIC, sizeof(header.magic));
+    header.version = FEATURE_FILE_VERSION;
+    header.rows = rows_;
+    header.cols = cols_;
+    header.stride = stride_;
+    header.source = source_;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (size_t row = 0; ok && row < rows_; ++row) {
+        int32_t label = labels_[row];
+        ok = fwrite(&label, sizeof(label), 1, fp) == 1;
+    }
+    char zeros[FEATURE_ALIGNMENT] = {0};
+    size_t padding = DataOffset(rows_) - LabelsOffset() - rows_ * sizeof(int32_t);
+    if (ok && padding)
+        ok = fwrite(zeros, padding, 1, fp) == 1;
+    if (ok && rows_)
+        ok = fwrite(data_, rows_ * stride_ * sizeof(float), 1, fp) == 1;
+    if (fclose(fp) || !ok)
+        throw std::string("Can't write feature file ") + file;
+}
+
+FeatureMatrix FeatureMatrix::Map(const std::string& file) {
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::string("Can't open feature file ") + file;
+    struct stat st;
+    if (fstat(fd, &st) || size_t(st.st_size) < sizeof(FeatureFileHeader)) {
+        close(fd);
+        throw std::string("Bad feature file ") + file;
+    }
+    size_t size = st.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::string("Can't map feature file ") + file;
+
+    const FeatureFileHeader* header = static_cast<const FeatureFileHeader*>(mapping);
+    if (memcmp(header->magic, FEATURE_FILE_MAGIC, sizeof(header->magic)) ||
+        header->version != FEATURE_FILE_VERSION || sizeof(int32_t) != sizeof(int) || header->cols > header->stride ||
+        DataOffset(header->rows) + header->rows * header->stride * sizeof(float) > size) {
+        munmap(mapping, size);
+        throw std::string("Bad feature file ") + file;
+    }
+
+    FeatureMatrix matrix;
+    char* base = static_cast<char*>(mapping);
+    matrix.rows_ = matrix.capacity_ = header->rows;
+    matrix.cols_ = header->cols;
+    matrix.stride_ = header->stride;
+    matrix.source_ = header->source;
+    matrix.labels_ = reinterpret_cast<int*>(base + LabelsOffset());
+    matrix.data_ = reinterpret_cast<float*>(base + DataOffset(header->rows));
+    matrix.mapping_ = mapping;
+    matrix.mapping_size_ = size;
+    return matrix;
+}
@@ -0,0 +1,170 @@
+#include "grayscale.h"
+
+#include <immintrin.h>
+
+/**
+@file grayscale.cpp
+Grayscale conversion of interleaved BGR and BGRA pixels with pmaddubsw and pshufb
+*/
+
+///Bytes of one BGRA pixel
+static const uint BGRA_SIZE = 4;
+///Bytes of one BGR pixel
+static const uint BGR_SIZE = 3;
+
+/**
+@function BgraToGrayscalePlain
+Reference implementation for BGRA pixels, also used for the tails of vector loops
+*/
+static void BgraToGrayscalePlain(const unsigned char *src, short *dst, uint count) {
+	for (uint j = 0 ; j < count ; ++j, src += BGRA_SIZE) {
+		dst[j] = GrayFromBgr(src[0], src[1], src[2]);
+	}
+}
+
+/**
+@function BgrToGrayscalePlain
+Reference implementation for BGR pixels, also used for the tails of vector loops
+*/
+static void BgrToGrayscalePlain(const unsigned char *src, short *dst, uint count) {
+	for (uint j = 0 ; j < count ; ++j, src += BGR_SIZE) {
+		dst[j] = GrayFromBgr(src[0], src[1], src[2]);
+	}
+}
+
+/**
+@function WeightedSum
+Gray values of 8 pixels given as two registers of 4 BGRA pixels.
+pmaddubsw gives (wB * B + wG * G, wR * R + 0 * A) for every pixel, phaddw adds the pairs.
+Sums are at most 255 * 128, so 16-bit arithmetic never saturates
+*/
+static inline __m128i WeightedSum(__m128i first, __m128i second) {
+	const __m128i weights = _mm_setr_epi8(GRAY_BLUE, GRAY_GREEN, GRAY_RED, 0, GRAY_BLUE, GRAY_GREEN, GRAY_RED, 0,
+		GRAY_BLUE, GRAY_GREEN, GRAY_RED, 0, GRAY_BLUE, GRAY_GREEN, GRAY_RED, 0);
+	const __m128i round = _mm_set1_epi16(1 << (GRAY_SHIFT - 1));
+	__m128i sum = _mm_hadd_epi16(_mm_maddubs_epi16(first, weights), _mm_maddubs_epi16(second, weights));
+	return _mm_srli_epi16(_mm_add_epi16(sum, round), GRAY_SHIFT);
+}
+
+/**
+@function BgrShuffle
+pshufb mask that spreads 4 BGR pixels (12 bytes) to 4 BGRA pixels with zero alpha
+*/
+static inline __m128i BgrShuffle() {
+	return _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+}
+
+/**
+@function BgraToGrayscaleSse
+Converts 8 BGRA pixels per iteration using sse4.1
+*/
+static void BgraToGrayscaleSse(const unsigned char *src, short *dst, uint count) {
+	uint j = 0;
+	for (; j + 8 <= count ; j += 8) {
+		__m128i first = _mm_loadu_si128((const __m128i *) (src + j * BGRA_SIZE));
+		__m128i second = _mm_loadu_si128((const __m128i *) (src + (j + 4) * BGRA_SIZE));
+		_mm_storeu_si128((__m128i *) (dst + j), WeightedSum(first, second));
+	}
+	BgraToGrayscalePlain(src + j * BGRA_SIZE, dst + j, count - j);
+}
+
+/**
+@function BgrToGrayscaleSse
+Converts 8 BGR pixels per iteration using sse4.1
+*/
+static void BgrToGrayscaleSse(const unsigned char *src, short *dst, uint count) {
+	const __m128i shuffle = BgrShuffle();
+	uint j = 0;
+	// Every load reads 16 bytes of which 12 are used, last load must not cross the end of row
+	for (; (j + 8) * BGR_SIZE + 4 <= count * BGR_SIZE ; j += 8) {
+		__m128i first = _mm_loadu_si128((const __m128i *) (src + j * BGR_SIZE));
+		__m128i second = _mm_loadu_si128((const __m128i *) (src + (j + 4) * BGR_SIZE));
+		_mm_storeu_si128((__m128i *) (dst + j),
+			WeightedSum(_mm_shuffle_epi8(first, shuffle), _mm_shuffle_epi8(second, shuffle)));
+	}
+	BgrToGrayscalePlain(src + j * BGR_SIZE, dst + j, count - j);
+}
+
+/**
+@function WeightedSumAvx
+Same as (@ref WeightedSum) for 16 pixels. phaddw works inside 128-bit lanes,
+so the 64-bit quarters are reordered afterwards
+*/
+__attribute__((target("avx2")))
+static inline __m256i WeightedSumAvx(__m256i first, __m256i second) {
+	const __m256i weights = _mm256_broadcastsi128_si256(_mm_setr_epi8(GRAY_BLUE, GRAY_GREEN, GRAY_RED, 0,
+		GRAY_BLUE, GRAY_GREEN, GRAY_RED, 0, GRAY_BLUE, GRAY_GREEN, GRAY_RED, 0, GRAY_BLUE, GRAY_GREEN, GRAY_RED, 0));
+	const __m256i round = _mm256_set1_epi16(1 << (GRAY_SHIFT - 1));
+	__m256i sum = _mm256_hadd_epi16(_mm256_maddubs_epi16(first, weights), _mm256_maddubs_epi16(second, weights));
+	sum = _mm256_permute4x64_epi64(sum, _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm256_srli_epi16(_mm256_add_epi16(sum, round), GRAY_SHIFT);
+}
+
+/**
+@function BgraToGrayscaleAvx
+Converts 16 BGRA pixels per iteration using avx2, the tail is converted by (@ref BgraToGrayscaleSse)
+*/
+__attribute__((target("avx2")))
+static void BgraToGrayscaleAvx(const unsigned char *src, short *dst, uint count) {
+	uint j = 0;
+	for (; j + 16 <= count ; j += 16) {
+		__m256i first = _mm256_loadu_si256((const __m256i *) (src + j * BGRA_SIZE));
+		__m256i second = _mm256_loadu_si256((const __m256i *) (src + (j + 8) * BGRA_SIZE));
+		_mm256_storeu_si256((__m256i *) (dst + j), WeightedSumAvx(first, second));
+	}
+	BgraToGrayscaleSse(src + j * BGRA_SIZE, dst + j, count - j);
+}
+
+/**
+@function LoadBgrAvx
+Loads 8 BGR pixels as two lanes of 4 and spreads them to BGRA
+*/
+__attribute__((target("avx2")))
+static inline __m256i LoadBgrAvx(const unsigned char *src) {
+	const __m256i shuffle = _mm256_broadcastsi128_si256(BgrShuffle());
+	__m256i pixels = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) src));
+	pixels = _mm256_inserti128_si256(pixels, _mm_loadu_si128((const __m128i *) (src + 4 * BGR_SIZE)), 1);
+	return _mm256_shuffle_epi8(pixels, shuffle);
+}
+
+/**
+@function BgrToGrayscaleAvx
+Converts 16 BGR pixels per iteration using avx2, the tail is converted by (@ref BgrToGrayscaleSse)
+*/
+__attribute__((target("avx2")))
+static void BgrToGrayscaleAvx(const unsigned char *src, short *dst, uint count) {
+	uint j = 0;
+	for (; (j + 16) * BGR_SIZE + 4 <= count * BGR_SIZE ; j += 16) {
+		__m256i first = LoadBgrAvx(src + j * BGR_SIZE);
+		__m256i second = LoadBgrAvx(src + (j + 8) * BGR_SIZE);
+		_mm256_storeu_si256((__m256i *) (dst + j), WeightedSumAvx(first, second));
+	}
+	BgrToGrayscaleSse(src + j * BGR_SIZE, dst + j, count - j);
+}
+
+/**
+@function HasAvx2
+Checks once whether the processor supports avx2
+*/
+static bool HasAvx2() {
+	static const bool supported = __builtin_cpu_supports("avx2");
+	return supported;
+}
+
+void BgraToGrayscale(const unsigned char *src, short *dst, uint count, bool useSse) {
+	if (!useSse)
+		BgraToGrayscalePlain(src, dst, count);
+	else if (HasAvx2())
+		BgraToGrayscaleAvx(src, dst, count);
+	else
+		BgraToGrayscaleSse(src, dst, count);
+}
+
+void BgrToGrayscale(const unsigned char *src, short *dst, uint count, bool useSse) {
+	if (!useSse)
+		BgrToGrayscalePlain(src, dst, count);
+	else if (HasAvx2())
+		BgrToGrayscaleAvx(src, dst, count);
+	else
+		BgrToGrayscaleSse(src, dst, count);
+}
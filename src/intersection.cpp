@@ -0,0 +1,358 @@
+#include "intersection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <random>
+#include <string>
+
+/**
+@file intersection.cpp
+Implementation of (@ref TIntersectionClassifier) and (@ref TIntersectionModel)
+*/
+
+///First word of a lookup table model file, liblinear writes a solver name there
+static const char* const INTERSECTION_SOLVER_NAME = "INTERSECTION_LUT";
+///Samples predicted by one task of the thread pool
+static const size_t INTERSECTION_PREDICT_CHUNK = 64;
+
+/**
+@class IntersectionSums
+Nonzero features of all samples, sorted by value for every feature, and two Fenwick trees per feature
+over that order: sums of a_i x_ij and sums of a_i. Zero features add nothing to the kernel, so they are skipped
+*/
+class IntersectionSums {
+ public:
+    explicit IntersectionSums(const FeatureMatrix& features);
+
+    ///Sets all coefficients to 0
+    void Reset();
+    ///Sum over samples of a_i K(x_i, x_sample)
+    double Decision(size_t sample) const;
+    ///Adds delta to the coefficient of the sample
+    void Add(size_t sample, double delta);
+    ///K(x_sample, x_sample)
+    double SelfKernel(size_t sample) const;
+    ///Writes h_j(b / scales[j]) for b = 0..bins of function k of nr_w with coefficients a to tables
+    void Tabulate(const std::vector<double>& a, const std::vector<float>& scales, size_t bins,
+        size_t nr_w, size_t k, std::vector<float>* tables) const;
+
+ private:
+    struct Entry {
+        size_t feature;
+        ///Position of the sample among nonzero values of the feature, from 1
+        size_t position;
+        float value;
+    };
+    struct Sorted {
+        float value;
+        size_t sample;
+        bool operator<(const Sorted& other) const { return value < other.value; }
+    };
+
+    double Prefix(const std::vector<double>& tree, size_t feature, size_t position) const {
+        double sum = 0;
+        for (; position > 0; position -= position & (~position + 1))
+            sum += tree[tree_start_[feature] + position];
+        return sum;
+    }
+
+    size_t cols_;
+    ///Nonzero features of sample i are entries_[row_start_[i]..row_start_[i + 1])
+    std::vector<size_t> row_start_;
+    std::vector<Entry> entries_;
+    ///Nonzero values of feature j in increasing order are sorted_[col_start_[j]..col_start_[j + 1])
+    std::vector<size_t> col_start_;
+    std::vector<Sorted> sorted_;
+    ///Tree of feature j takes elements tree_start_[j] + 1..tree_start_[j] + nnz
+    std::vector<size_t> tree_start_;
+    std::vector<double> weighted_;
+    std::vector<double> counts_;
+    ///Sum of a_i of every feature
+    std::vector<double> totals_;
+};
+
+IntersectionSums::IntersectionSums(const FeatureMatrix& features)
+    : cols_(features.Cols()),
+      row_start_(features.Rows() + 1, 0),
+      col_start_(cols_ + 1, 0),
+      tree_start_(cols_),
+      totals_(cols_, 0) {
+    for (size_t i = 0; i < features.Rows(); ++i) {
+        const float* row = features.Row(i);
+        for (size_t j = 0; j < cols_; ++j) {
+            if (row[j] < 0)
+                throw std::string("Intersection kernel needs features which are not negative");
+            if (row[j] > 0)
+                ++col_start_[j + 1];
+        }
+    }
+    for (size_t j = 0; j < cols_; ++j) {
+        tree_start_[j] = col_start_[j] + j;
+        col_start_[j + 1] += col_start_[j];
+    }
+    sorted_.resize(col_start_[cols_]);
+    std::vector<size_t> filled(col_start_.begin(), col_start_.end() - 1);
+    for (size_t i = 0; i < features.Rows(); ++i) {
+        const float* row = features.Row(i);
+        for (size_t j = 0; j < cols_; ++j) {
+            if (row[j] > 0) {
+                Sorted& next = sorted_[filled[j]++];
+                next.value = row[j];
+                next.sample = i;
+            }
+        }
+    }
+
+        // Positions of samples in the sorted order, ties may go either way: min(x, s) = x = s for them
+    std::vector<size_t> counts(features.Rows(), 0);
+    for (size_t j = 0; j < cols_; ++j) {
+        std::sort(sorted_.begin() + col_start_[j], sorted_.begin() + col_start_[j + 1]);
+        for (size_t p = col_start_[j]; p < col_start_[j + 1]; ++p)
+            ++counts[sorted_[p].sample];
+    }
+    for (size_t i = 0; i < features.Rows(); ++i)
+        row_start_[i + 1] = row_start_[i] + counts[i];
+    entries_.resize(row_start_.back());
+    std::copy(row_start_.begin(), row_start_.end() - 1, counts.begin());
+    for (size_t j = 0; j < cols_; ++j) {
+        for (size_t p = col_start_[j]; p < col_start_[j + 1]; ++p) {
+            Entry& entry = entries_[counts[sorted_[p].sample]++];
+            entry.feature = j;
+            entry.position = p - col_start_[j] + 1;
+            entry.value = sorted_[p].value;
+        }
+    }
+    weighted_.resize(sorted_.size() + cols_ + 1, 0);
+    counts_.resize(weighted_.size(), 0);
+}
+
+void IntersectionSums::Reset() {
+    std::fill(weighted_.begin(), weighted_.end(), 0);
+    std::fill(counts_.begin(), counts_.end(), 0);
+    std::fill(totals_.begin(), totals_.end(), 0);
+}
+
+double IntersectionSums::Decision(size_t sample) const {
+    double decision = 0;
+    for (size_t e = row_start_[sample]; e < row_start_[sample + 1]; ++e) {
+        const Entry& entry = entries_[e];
+            // Samples up to this one have min = their value, the rest have min = this value
+        decision += Prefix(weighted_, entry.feature, entry.position) +
+            entry.value * (totals_[entry.feature] - Prefix(counts_, entry.feature, entry.position));
+    }
+    return decision;
+}
+
+void IntersectionSums::Add(size_t sample, double delta) {
+    for (size_t e = row_start_[sample]; e < row_start_[sample + 1]; ++e) {
+        const Entry& entry = entries_[e];
+        const size_t start = tree_start_[entry.feature];
+        const size_t size = col_start_[entry.feature + 1] - col_start_[entry.feature];
+        for (size_t position = entry.position; position <= size; position += position & (~position + 1)) {
+            weighted_[start + position] += delta * entry.value;
+            counts_[start + position] += delta;
+        }
+        totals_[entry.feature] += delta;
+    }
+}
+
+double IntersectionSums::SelfKernel(size_t sample) const {
+    double sum = 0;
+    for (size_t e = row_start_[sample]; e < row_start_[sample + 1]; ++e)
+        sum += entries_[e].value;
+    return sum;
+}
+
+void IntersectionSums::Tabulate(const std::vector<double>& a, const std::vector<float>& scales, size_t bins,
+    size_t nr_w, size_t k, std::vector<float>* tables) const {
+    for (size_t j = 0; j < cols_; ++j) {
+        double total = 0;
+        for (size_t p = col_start_[j]; p < col_start_[j + 1]; ++p)
+            total += a[sorted_[p].sample];
+        double weighted = 0, below = 0;
+        size_t p = col_start_[j];
+        for (size_t b = 0; b <= bins; ++b) {
+            const double s = scales[j] > 0 ? b / double(scales[j]) : 0;
+            for (; p < col_start_[j + 1] && sorted_[p].value <= s; ++p) {
+                weighted += a[sorted_[p].sample] * sorted_[p].value;
+                below += a[sorted_[p].sample];
+            }
+            (*tables)[(j * (bins + 1) + b) * nr_w + k] = weighted + s * (total - below);
+        }
+    }
+}
+
+void TIntersectionClassifier::Train(const FeatureMatrix& features, TIntersectionModel* model,
+    std::vector<double>* coefficients) const {
+    const size_t l = features.Rows(), cols = features.Cols();
+    if (l == 0 || params_.C <= 0 || params_.bins == 0)
+        throw std::string("Intersection kernel SVM needs samples, positive C and bins");
+    IntersectionSums sums(features);
+
+        // Classes in the order of liblinear train(): first appearance, +1 before -1
+    std::vector<int> labels;
+    for (size_t i = 0; i < l; ++i)
+        if (std::find(labels.begin(), labels.end(), features.Label(i)) == labels.end())
+            labels.push_back(features.Label(i));
+    if (labels.size() == 2 && labels[0] == -1 && labels[1] == 1)
+        std::swap(labels[0], labels[1]);
+    const size_t nr_w = labels.size() == 2 ? 1 : labels.size();
+
+    model->cols_ = cols;
+    model->bins_ = params_.bins;
+    model->nr_w_ = nr_w;
+    model->labels_ = labels;
+    model->scales_.assign(cols, 0);
+    for (size_t i = 0; i < l; ++i)
+        for (size_t j = 0; j < cols; ++j)
+            model->scales_[j] = std::max(model->scales_[j], features.Row(i)[j]);
+    for (size_t j = 0; j < cols; ++j)
+        model->scales_[j] = model->scales_[j] > 0 ? params_.bins / model->scales_[j] : 0;
+    model->tables_.assign(cols * (params_.bins + 1) * nr_w, 0);
+    if (coefficients)
+        coefficients->assign(l * nr_w, 0);
+
+        // Squared hinge loss: the dual has diagonal 1 / (2C) and no upper bound
+    const double diag = 0.5 / params_.C;
+    std::vector<double> QD(l);
+    for (size_t i = 0; i < l; ++i)
+        QD[i] = sums.SelfKernel(i) + diag;
+
+    for (size_t k = 0; k < nr_w; ++k) {
+        std::vector<double> alpha(l, 0), a(l, 0);
+        std::vector<size_t> index(l);
+        for (size_t i = 0; i < l; ++i)
+            index[i] = i;
+        std::mt19937 generator(0);
+        sums.Reset();
+        for (int iter = 0; iter < params_.max_iter; ++iter) {
+            std::shuffle(index.begin(), index.end(), generator);
+            double PGmax = -std::numeric_limits<double>::infinity();
+            double PGmin = std::numeric_limits<double>::infinity();
+            for (size_t s = 0; s < l; ++s) {
+                const size_t i = index[s];
+                const double y = features.Label(i) == labels[k] ? 1 : -1;
+                const double G = y * sums.Decision(i) - 1 + diag * alpha[i];
+                const double PG = alpha[i] == 0 ? std::min(G, 0.0) : G;
+                PGmax = std::max(PGmax, PG);
+                PGmin = std::min(PGmin, PG);
+                if (std::fabs(PG) > 1e-12) {
+                    const double old = alpha[i];
+                    alpha[i] = std::max(alpha[i] - G / QD[i], 0.0);
+                    if (alpha[i] != old) {
+                        sums.Add(i, (alpha[i] - old) * y);
+                        a[i] = alpha[i] * y;
+                    }
+                }
+            }
+            if (PGmax - PGmin <= params_.eps)
+                break;
+        }
+        sums.Tabulate(a, model->scales_, params_.bins, nr_w, k, &model->tables_);
+        if (coefficients)
+            std::copy(a.begin(), a.end(), coefficients->begin() + k * l);
+    }
+}
+
+TIntersectionModel::TIntersectionModel()
+    : cols_(0),
+      bins_(0),
+      nr_w_(0) {
+}
+
+void TIntersectionModel::DecisionValues(const float* row, double* values) const {
+    std::fill(values, values + nr_w_, 0.0);
+    for (size_t j = 0; j < cols_; ++j) {
+            // h_j(0) = 0 and h_j is constant after the largest training value
+        const float t = row[j] * scales_[j];
+        if (!(t > 0))
+            continue;
+        size_t knot = bins_;
+        float fraction = 0;
+        if (t < bins_) {
+            knot = size_t(t);
+            fraction = t - knot;
+        }
+        const float* low = &tables_[(j * (bins_ + 1) + knot) * nr_w_];
+        const float* high = knot < bins_ ? low + nr_w_ : low;
+        for (size_t k = 0; k < nr_w_; ++k)
+            values[k] += low[k] + fraction * (high[k] - low[k]);
+    }
+}
+
+int TIntersectionModel::Predict(const float* row) const {
+    std::vector<double> values(nr_w_);
+    DecisionValues(row, &values[0]);
+    if (nr_w_ == 1)
+        return values[0] > 0 ? labels_[0] : labels_[1];
+    return labels_[std::max_element(values.begin(), values.end()) - values.begin()];
+}
+
+void TIntersectionModel::Predict(const FeatureMatrix& features, std::vector<int>* labels, TThreadPool* pool) const {
+    if (features.Cols() != cols_)
+        throw std::string("Number of features differs from the model");
+    const size_t first_label = labels->size();
+    labels->resize(first_label + features.Rows());
+    std::function<void(size_t, size_t, size_t)> body = [this, &features, labels, first_label](size_t first,
+            size_t last, size_t) {
+        for (size_t row = first; row < last; ++row)
+            (*labels)[first_label + row] = Predict(features.Row(row));
+    };
+    if (pool)
+        pool->Run(features.Rows(), INTERSECTION_PREDICT_CHUNK, body);
+    else
+        body(0, features.Rows(), 0);
+}
+
+void TIntersectionModel::Save(const std::string& model_file) const {
+    std::ofstream stream(model_file.c_str());
+    stream.precision(9);
+    stream << "solver_type " << INTERSECTION_SOLVER_NAME << "\n";
+    stream << "nr_class " << labels_.size() << "\nlabel";
+    for (size_t k = 0; k < labels_.size(); ++k)
+        stream << " " << labels_[k];
+    stream << "\nnr_feature " << cols_ << "\nbins " << bins_ << "\ntables\n";
+        // One line per feature: scale and knots
+    for (size_t j = 0; j < cols_; ++j) {
+        stream << scales_[j];
+        for (size_t v = 0; v < (bins_ + 1) * nr_w_; ++v)
+            stream << " " << tables_[j * (bins_ + 1) * nr_w_ + v];
+        stream << "\n";
+    }
+    if (!stream)
+        throw std::string("Can't save model " + model_file);
+}
+
+void TIntersectionModel::Load(const std::string& model_file) {
+    std::ifstream stream(model_file.c_str());
+    std::string key, name;
+    size_t nr_class = 0;
+    stream >> key >> name;
+    if (key != "solver_type" || name != INTERSECTION_SOLVER_NAME)
+        throw std::string("Not a lookup table model " + model_file);
+    stream >> key >> nr_class >> key;
+    labels_.resize(nr_class);
+    for (size_t k = 0; k < nr_class; ++k)
+        stream >> labels_[k];
+    stream >> key >> cols_ >> key >> bins_ >> key;
+    nr_w_ = nr_class == 2 ? 1 : nr_class;
+    scales_.resize(cols_);
+    tables_.resize(cols_ * (bins_ + 1) * nr_w_);
+    for (size_t j = 0; j < cols_; ++j) {
+        stream >> scales_[j];
+        for (size_t v = 0; v < (bins_ + 1) * nr_w_; ++v)
+            stream >> tables_[j * (bins_ + 1) * nr_w_ + v];
+    }
+    if (!stream || nr_class < 2)
+        throw std::string("Can't load model " + model_file);
+}
+
+bool TIntersectionModel::IsModelFile(const std::string& model_file) {
+    std::ifstream stream(model_file.c_str());
+    std::string key, name;
+    stream >> key >> name;
+    return key == "solver_type" && name == INTERSECTION_SOLVER_NAME;
+}
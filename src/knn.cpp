@@ -0,0 +1,380 @@
+#include "knn.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <smmintrin.h>
+
+/**
+@file knn.cpp
+Implementation of (@ref TKnnIndex)
+*/
+
+///Magic number in the beginning of an index file
+static const char INDEX_FILE_MAGIC[4] = {'K', 'N', 'N', 'I'};
+///Version of index file layout
+static const uint32_t INDEX_FILE_VERSION = 1;
+
+/**
+@struct IndexFileHeader
+Header of an index file. List offsets and labels follow the header, then centroids and samples,
+which start at an offset aligned by (@ref FEATURE_ALIGNMENT)
+*/
+struct IndexFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t cols;
+    uint64_t stride;
+    uint64_t lists;
+    uint64_t rows;
+    char reserved[FEATURE_ALIGNMENT - 40];
+};
+
+/**
+@function AlignUp
+Rounds size up to a multiple of alignment
+*/
+static size_t AlignUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+/**
+@function CentroidsOffset
+Offset in bytes of centroids in an index file
+*/
+static size_t CentroidsOffset(size_t lists, size_t rows) {
+    return AlignUp(sizeof(IndexFileHeader) + (lists + 1) * sizeof(uint64_t) + rows * sizeof(int32_t),
+        FEATURE_ALIGNMENT);
+}
+
+/**
+@function SquaredDistance
+Squared euclidean distance between two rows of stride floats
+*/
+static float SquaredDistance(const float* a, const float* b, size_t stride, bool useSse) {
+    if (!useSse) {
+        float sum = 0;
+        for (size_t j = 0; j < stride; ++j)
+            sum += (a[j] - b[j]) * (a[j] - b[j]);
+        return sum;
+    }
+        // Strides of (@ref FeatureMatrix) are multiples of 16 floats
+    __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+    for (size_t j = 0; j < stride; j += 8) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + j), _mm_loadu_ps(b + j));
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + j + 4), _mm_loadu_ps(b + j + 4));
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(d0, d0));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(d1, d1));
+    }
+    __m128 sum = _mm_add_ps(sum0, sum1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+/**
+@function ParallelFor
+Calls body(first, last) for consecutive ranges of [0, count) in at most threads threads
+*/
+template<class Body>
+static void ParallelFor(size_t count, int threads, Body body) {
+    const size_t parts = std::max<size_t>(1, std::min<size_t>(std::max(threads, 1), count));
+    std::vector<std::thread> workers;
+    for (size_t part = 1; part < parts; ++part)
+        workers.push_back(std::thread(body, count * part / parts, count * (part + 1) / parts));
+    body(0, count / parts);
+    for (size_t part = 0; part < workers.size(); ++part)
+        workers[part].join();
+}
+
+TKnnIndex::TKnnIndex(const TKnnParams& params)
+    : params_(params),
+      cols_(0),
+      stride_(0),
+      lists_(0),
+      centroids_(NULL),
+      offsets_(NULL),
+      samples_(NULL),
+      labels_(NULL),
+      mapping_(NULL),
+      mapping_size_(0) {
+}
+
+TKnnIndex::~TKnnIndex() {
+    Release();
+}
+
+void TKnnIndex::Release() {
+    if (mapping_)
+        munmap(mapping_, mapping_size_);
+    mapping_ = NULL;
+    mapping_size_ = 0;
+    built_centroids_.clear();
+    built_samples_ = FeatureMatrix();
+    built_offsets_.clear();
+    inserted_.clear();
+    centroids_ = samples_ = NULL;
+    offsets_ = NULL;
+    labels_ = NULL;
+    cols_ = stride_ = lists_ = 0;
+}
+
+void TKnnIndex::Build(const FeatureMatrix& features) {
+    if (features.Empty())
+        throw std::string("Index needs samples");
+    Release();
+    const size_t rows = features.Rows();
+    cols_ = features.Cols();
+    stride_ = features.Stride();
+    lists_ = params_.lists ? params_.lists : size_t(std::sqrt(double(rows)) + 0.5);
+    lists_ = std::max<size_t>(1, std::min(lists_, rows));
+
+        // k-means from distinct random samples
+    std::vector<size_t> order(rows);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937 random(params_.seed);
+    std::shuffle(order.begin(), order.end(), random);
+    built_centroids_.assign(lists_ * stride_, 0.0f);
+    for (size_t list = 0; list < lists_; ++list)
+        std::copy(features.Row(order[list]), features.Row(order[list]) + stride_, &built_centroids_[list * stride_]);
+    centroids_ = &built_centroids_[0];
+    std::vector<size_t> assignment(rows);
+    for (int iteration = 0; ; ++iteration) {
+        ParallelFor(rows, params_.threads, [this, &features, &assignment](size_t first, size_t last) {
+            std::vector<size_t> lists;
+            for (size_t row = first; row < last; ++row) {
+                SortedLists(features.Row(row), &lists);
+                assignment[row] = lists[0];
+            }
+        });
+        if (iteration == params_.iterations)
+            break;
+        std::vector<double> sums(lists_ * cols_, 0);
+        std::vector<size_t> sizes(lists_, 0);
+        for (size_t row = 0; row < rows; ++row) {
+            double* sum = &sums[assignment[row] * cols_];
+            for (size_t j = 0; j < cols_; ++j)
+                sum[j] += features.Row(row)[j];
+            ++sizes[assignment[row]];
+        }
+            // Lists without samples keep their centroids
+        for (size_t list = 0; list < lists_; ++list)
+            for (size_t j = 0; sizes[list] && j < cols_; ++j)
+                built_centroids_[list * stride_ + j] = float(sums[list * cols_ + j] / sizes[list]);
+    }
+
+        // Samples grouped by lists
+    built_offsets_.assign(lists_ + 1, 0);
+    for (size_t row = 0; row < rows; ++row)
+        ++built_offsets_[assignment[row] + 1];
+    std::partial_sum(built_offsets_.begin(), built_offsets_.end(), built_offsets_.begin());
+    std::vector<size_t> grouped(rows);
+    std::vector<uint64_t> next(built_offsets_.begin(), built_offsets_.end() - 1);
+    for (size_t row = 0; row < rows; ++row)
+        grouped[next[assignment[row]]++] = row;
+    built_samples_ = FeatureMatrix(cols_);
+    built_samples_.Reserve(rows);
+    for (size_t k = 0; k < rows; ++k)
+        built_samples_.AppendRow(features.Row(grouped[k]), cols_, features.Label(grouped[k]));
+    offsets_ = &built_offsets_[0];
+    samples_ = built_samples_.Row(0);
+    labels_ = built_samples_.Labels();
+    inserted_.resize(lists_);
+}
+
+void TKnnIndex::Insert(const float* row, size_t cols, int label) {
+    if (!lists_)
+        throw std::string("Can't insert to an index which is not built");
+    if (cols != cols_)
+        throw std::string("Number of features differs from the index");
+        // Padded copy of the row
+    FeatureMatrix padded(cols_);
+    padded.AppendRow(row, cols, label);
+    std::vector<size_t> lists;
+    SortedLists(padded.Row(0), &lists);
+    inserted_[lists[0]].AppendRow(row, cols, label);
+}
+
+void TKnnIndex::Insert(const FeatureMatrix& features) {
+    for (size_t row = 0; row < features.Rows(); ++row)
+        Insert(features.Row(row), features.Cols(), features.Label(row));
+}
+
+size_t TKnnIndex::Size() const {
+    size_t size = lists_ ? offsets_[lists_] : 0;
+    for (size_t list = 0; list < inserted_.size(); ++list)
+        size += inserted_[list].Rows();
+    return size;
+}
+
+void TKnnIndex::SortedLists(const float* row, std::vector<size_t>* lists) const {
+    std::vector<std::pair<float, size_t> > distances(lists_);
+    for (size_t list = 0; list < lists_; ++list)
+        distances[list] = std::make_pair(SquaredDistance(row, centroids_ + list * stride_, stride_, params_.useSse), list);
+    std::sort(distances.begin(), distances.end());
+    lists->resize(lists_);
+    for (size_t list = 0; list < lists_; ++list)
+        (*lists)[list] = distances[list].second;
+}
+
+template<class Callback>
+void TKnnIndex::ForEachSample(size_t list, Callback callback) const {
+    for (uint64_t row = offsets_[list]; row < offsets_[list + 1]; ++row)
+        callback(samples_ + row * stride_, labels_[row]);
+    const FeatureMatrix& inserted = inserted_[list];
+    for (size_t row = 0; row < inserted.Rows(); ++row)
+        callback(inserted.Row(row), inserted.Label(row));
+}
+
+void TKnnIndex::Search(const float* query, std::vector<TKnnNeighbour>* neighbours) const {
+    if (!lists_)
+        throw std::string("Can't search an index which is not built");
+    const size_t k = std::max(params_.k, 1);
+    std::vector<size_t> lists;
+    SortedLists(query, &lists);
+    neighbours->clear();
+        // Max-heap of the nearest samples found so far
+    for (size_t probe = 0; probe < lists_ && (probe < params_.probes || neighbours->size() < k); ++probe)
+        ForEachSample(lists[probe], [this, query, k, neighbours](const float* row, int label) {
+            TKnnNeighbour neighbour;
+            neighbour.distance = SquaredDistance(query, row, stride_, params_.useSse);
+            neighbour.label = label;
+            if (neighbours->size() < k) {
+                neighbours->push_back(neighbour);
+                std::push_heap(neighbours->begin(), neighbours->end());
+            }
+            else if (neighbour < neighbours->front()) {
+                std::pop_heap(neighbours->begin(), neighbours->end());
+                neighbours->back() = neighbour;
+                std::push_heap(neighbours->begin(), neighbours->end());
+            }
+        });
+    std::sort_heap(neighbours->begin(), neighbours->end());
+}
+
+int TKnnIndex::Predict(const float* query) const {
+    std::vector<TKnnNeighbour> neighbours;
+    Search(query, &neighbours);
+    std::map<int, size_t> votes;
+    for (size_t k = 0; k < neighbours.size(); ++k)
+        ++votes[neighbours[k].label];
+        // Labels are visited from the nearest neighbour, so ties go to the nearest one
+    int best = neighbours.empty() ? 0 : neighbours[0].label;
+    for (size_t k = 1; k < neighbours.size(); ++k)
+        if (votes[neighbours[k].label] > votes[best])
+            best = neighbours[k].label;
+    return best;
+}
+
+void TKnnIndex::Predict(const FeatureMatrix& features, std::vector<int>* labels) const {
+    if (features.Cols() != cols_)
+        throw std::string("Number of features differs from the index");
+    labels->resize(features.Rows());
+    ParallelFor(features.Rows(), params_.threads, [this, &features, labels](size_t first, size_t last) {
+        for (size_t row = first; row < last; ++row)
+            (*labels)[row] = Predict(features.Row(row));
+    });
+}
+
+void TKnnIndex::Save(const std::string& file) const {
+    const std::string temporary = file + ".tmp";
+    FILE* fp = fopen(temporary.c_str(), "wb");
+    if (!fp)
+        throw std::string("Can't open index file ") + temporary;
+
+    IndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+    header.version = INDEX_FILE_VERSION;
+    header.cols = cols_;
+    header.stride = stride_;
+    header.lists = lists_;
+    header.rows = Size();
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    std::vector<uint64_t> offsets(lists_ + 1, 0);
+    for (size_t list = 0; list < lists_; ++list)
+        offsets[list + 1] = offsets[list] + offsets_[list + 1] - offsets_[list] + inserted_[list].Rows();
+    ok = ok && fwrite(&offsets[0], offsets.size() * sizeof(uint64_t), 1, fp) == 1;
+    for (size_t list = 0; ok && list < lists_; ++list)
+        ForEachSample(list, [&ok, fp](const float*, int label) {
+            int32_t value = label;
+            ok = ok && fwrite(&value, sizeof(value), 1, fp) == 1;
+        });
+    char zeros[FEATURE_ALIGNMENT] = {0};
+    size_t padding = CentroidsOffset(lists_, header.rows) - sizeof(header) - offsets.size() * sizeof(uint64_t) -
+        header.rows * sizeof(int32_t);
+    if (ok && padding)
+        ok = fwrite(zeros, padding, 1, fp) == 1;
+    if (ok && lists_)
+        ok = fwrite(centroids_, lists_ * stride_ * sizeof(float), 1, fp) == 1;
+    for (size_t list = 0; ok && list < lists_; ++list)
+        ForEachSample(list, [this, &ok, fp](const float* row, int) {
+            ok = ok && fwrite(row, stride_ * sizeof(float), 1, fp) == 1;
+        });
+    if (fclose(fp) || !ok || rename(temporary.c_str(), file.c_str())) {
+        remove(temporary.c_str());
+        throw std::string("Can't write index file ") + file;
+    }
+}
+
+void TKnnIndex::Load(const std::string& file) {
+    Release();
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::string("Can't open index file ") + file;
+    struct stat st;
+    if (fstat(fd, &st) || size_t(st.st_size) < sizeof(IndexFileHeader)) {
+        close(fd);
+        throw std::string("Bad index file ") + file;
+    }
+    size_t size = st.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::string("Can't map index file ") + file;
+
+    const IndexFileHeader* header = static_cast<const IndexFileHeader*>(mapping);
+    if (memcmp(header->magic, INDEX_FILE_MAGIC, sizeof(header->magic)) ||
+        header->version != INDEX_FILE_VERSION || sizeof(int32_t) != sizeof(int) || !header->lists ||
+        header->stride != AlignUp(header->cols, FEATURE_ALIGNMENT / sizeof(float)) ||
+        CentroidsOffset(header->lists, header->rows) +
+            (header->lists + header->rows) * header->stride * sizeof(float) > size) {
+        munmap(mapping, size);
+        throw std::string("Bad index file ") + file;
+    }
+    const char* base = static_cast<const char*>(mapping);
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(base + sizeof(IndexFileHeader));
+    if (offsets[header->lists] != header->rows) {
+        munmap(mapping, size);
+        throw std::string("Bad index file ") + file;
+    }
+    mapping_ = mapping;
+    mapping_size_ = size;
+    cols_ = header->cols;
+    stride_ = header->stride;
+    lists_ = header->lists;
+    offsets_ = offsets;
+    labels_ = reinterpret_cast<const int*>(offsets_ + lists_ + 1);
+    centroids_ = reinterpret_cast<const float*>(base + CentroidsOffset(lists_, header->rows));
+    samples_ = centroids_ + lists_ * stride_;
+    inserted_.resize(lists_);
+}
+
+bool TKnnIndex::IsIndexFile(const std::string& file) {
+    char magic[sizeof(INDEX_FILE_MAGIC)];
+    FILE* fp = fopen(file.c_str(), "rb");
+    if (!fp)
+        return false;
+    bool index = fread(magic, sizeof(magic), 1, fp) == 1 && !memcmp(magic, INDEX_FILE_MAGIC, sizeof(magic));
+    fclose(fp);
+    return index;
+}
@@ -4,12 +4,33 @@
 #include <cassert>
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <sstream>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
 
 #include "classifier.h"
 #include "EasyBMP.h"
 #include "linear.h"
 #include "argvparser.h"
 #include "methods.h"
+#include "convolution.h"
+#include "matrix_expr.h"
+#include "detect.h"
+#include "grayscale.h"
+#include "quantized.h"
+#include "online_classifier.h"
+#include "intersection.h"
+#include "extraction.h"
+#include "cascade.h"
+#include "distributed.h"
+#include "projection.h"
+#include "knn.h"
+#include "shards.h"
 #include <smmintrin.h>
 #include <emmintrin.h>
 #include <xmmintrin.h>
@@ -68,7 +89,7 @@ public:
 	@param useSse is a bool that specifies whether sse  intrinsics will be used
 	*/
 	SVMTest(BMP *image, bool useSse): hor(image->TellHeight(), image->TellWidth()), vert(image->TellHeight(), image->TellWidth()) {
-		gray = ImgToGrayscale(image);
+		gray = ImgToGrayscale(image, useSse);
 		ApplySobel(gray, hor, vert, useSse);
 		magn = GetMagnitude(hor, vert, useSse);
 	}
@@ -150,6 +171,1497 @@ TEST(SSETest, TestGetDescriptor) {
 }
 
 
+/**
+@function TEST(MatrixViewTest, Submatrix)
+Test that checks that a view of a submatrix addresses the same elements as Matrix::submatrix
+and that writes through a view are visible in the matrix
+*/
+
+TEST(MatrixViewTest, Submatrix) {
+	Matrix<int> mat(7, 9);
+	for (uint i = 0 ; i < mat.n_rows ; ++i) {
+		for (uint j = 0 ; j < mat.n_cols ; ++j) {
+			mat(i, j) = i * 100 + j;
+		}
+	}
+	Matrix<int> sub = mat.submatrix(1, 2, 5, 6).submatrix(1, 1, 3, 4);
+	MatrixView<const int> view = mat.view().submatrix(1, 2, 5, 6).submatrix(1, 1, 3, 4);
+	ASSERT_EQ(view.n_rows, sub.n_rows);
+	ASSERT_EQ(view.n_cols, sub.n_cols);
+	for (uint i = 0 ; i < view.n_rows ; ++i) {
+		for (uint j = 0 ; j < view.n_cols ; ++j) {
+			EXPECT_EQ(view(i, j), sub(i, j));
+		}
+	}
+	mat.view()(3, 4) = -1;
+	EXPECT_EQ(view(1, 1), -1);
+	EXPECT_ANY_THROW(view.submatrix(1, 1, 3, 3));
+}
+
+/**
+@class SobelXKernel
+Coefficients of horizontal Sobel filter for (@ref LinearStencil)
+*/
+struct SobelXKernel {
+	static const uint vert_radius = 1;
+	static const uint hor_radius = 1;
+	static constexpr int weight(uint row, uint col) {
+		return (int(col) - 1) * (row == 1 ? 2 : 1);
+	}
+};
+
+/**
+@class RuntimeBox
+Old style unary_map operator with radius known at run time, used to test (@ref StencilAdapter)
+*/
+struct RuntimeBox {
+	const int vert_radius;
+	const int hor_radius;
+	RuntimeBox() : vert_radius(1), hor_radius(2) {}
+	int operator () (const ImageView &mat) const {
+		int sum = 0;
+		for (uint i = 0 ; i < mat.n_rows ; ++i) {
+			for (uint j = 0 ; j < mat.n_cols ; ++j) {
+				sum += mat(i, j);
+			}
+		}
+		return sum;
+	}
+};
+
+/**
+@function TEST(StencilTest, SameAsUnaryMap)
+Test that checks that (@ref stencil_map) gives the same results as Matrix::unary_map
+for Sobel operators, for a (@ref LinearStencil) and for an adapted run-time operator
+*/
+
+TEST(StencilTest, SameAsUnaryMap) {
+	BMP* image = new BMP();
+	image->ReadFromFile(PATH_TO_LENNA);
+	Image gray = ImgToGrayscale(image, true);
+	EXPECT_TRUE(ImagesEqual(stencil_map(gray, HorSobel()), gray.unary_map(HorSobel())));
+	EXPECT_TRUE(ImagesEqual(stencil_map(gray, VertSobel()), gray.unary_map(VertSobel())));
+
+	Matrix<int> linear = stencil_map(gray, LinearStencil<SobelXKernel>());
+	Image sobel = gray.unary_map(HorSobel());
+	bool equal = true;
+	for (uint i = 0 ; i < gray.n_rows ; ++i) {
+		for (uint j = 0 ; j < gray.n_cols ; ++j) {
+			equal = equal && linear(i, j) == sobel(i, j);
+		}
+	}
+	EXPECT_TRUE(equal);
+
+	EXPECT_TRUE(ImagesEqual(stencil_map(gray, make_stencil<1, 2>(RuntimeBox())), gray.unary_map(RuntimeBox())));
+	EXPECT_ANY_THROW((make_stencil<1, 1>(RuntimeBox())));
+	delete image;
+}
+
+/**
+@class NeighbourhoodDiff
+Neighbourhood operator for binary_map: sum of first neighbourhood minus center of the second one
+*/
+struct NeighbourhoodDiff {
+	const int vert_radius;
+	const int hor_radius;
+	NeighbourhoodDiff() : vert_radius(1), hor_radius(1) {}
+	int operator () (const ImageView &first, const ImageView &second) const {
+		int sum = 0;
+		for (uint i = 0 ; i < first.n_rows ; ++i) {
+			for (uint j = 0 ; j < first.n_cols ; ++j) {
+				sum += first(i, j);
+			}
+		}
+		return sum - second(1, 1);
+	}
+};
+
+/**
+@function TEST(MapTest, BinaryAndNaryMap)
+Test that checks elementwise and neighbourhood binary_map, nary_map and
+the SIMD interface of (@ref SseMagnitude) on a matrix whose width is not a multiple of the block size
+*/
+
+TEST(MapTest, BinaryAndNaryMap) {
+	Image a(5, 13), b(5, 13), c(5, 13);
+	for (uint i = 0 ; i < a.n_rows ; ++i) {
+		for (uint j = 0 ; j < a.n_cols ; ++j) {
+			a(i, j) = i * 31 - j * 7;
+			b(i, j) = j * j - 3 * i;
+			c(i, j) = i + j;
+		}
+	}
+	Matrix<int> product = binary_map([](short x, short y) { return int(x) * y; }, a, b);
+	Matrix<int> sum = nary_map([](short x, short y, short z) { return x + y + z; }, a, b, c);
+	Matrix<int> diff = binary_map(NeighbourhoodDiff(), a, b);
+	floatImage plain = nary_map(Magnitude(), ImageView(a), ImageView(b));
+	floatImage simd = nary_map(SseMagnitude(), ImageView(a), ImageView(b));
+	for (uint i = 0 ; i < a.n_rows ; ++i) {
+		for (uint j = 0 ; j < a.n_cols ; ++j) {
+			EXPECT_EQ(product(i, j), a(i, j) * b(i, j));
+			EXPECT_EQ(sum(i, j), a(i, j) + b(i, j) + c(i, j));
+		}
+	}
+	EXPECT_EQ(diff(2, 2), a(1, 1) + a(1, 2) + a(1, 3) + a(2, 1) + a(2, 2) + a(2, 3) +
+		a(3, 1) + a(3, 2) + a(3, 3) - b(2, 2));
+	EXPECT_TRUE(ImagesEqual(plain, simd));
+	EXPECT_ANY_THROW(binary_map([](short x, short y) { return x + y; }, a, Image(5, 12)));
+}
+
+/**
+@class Sobel5
+Direct 5x5 Sobel operator used as reference for separable convolution
+*/
+struct Sobel5 {
+	static const uint vert_radius = 2;
+	static const uint hor_radius = 2;
+	template<typename Window>
+	short operator () (const Window &mat) const {
+		static const int smooth[5] = {1, 4, 6, 4, 1};
+		static const int deriv[5] = {-1, -2, 0, 2, 1};
+		int sum = 0;
+		for (uint i = 0 ; i < 5 ; ++i) {
+			for (uint j = 0 ; j < 5 ; ++j) {
+				sum += smooth[i] * deriv[j] * mat(i, j);
+			}
+		}
+		return sum;
+	}
+};
+
+/**
+@function TEST(ConvolutionTest, SeparableEqualsDirect)
+Test that checks that separable convolution gives the same result as direct 2d convolution
+for Sobel 5x5 (short) and for a float kernel
+*/
+
+TEST(ConvolutionTest, SeparableEqualsDirect) {
+	BMP* image = new BMP();
+	image->ReadFromFile(PATH_TO_LENNA);
+	Image gray = ImgToGrayscale(image, true);
+	Image smooth = {1, 4, 6, 4, 1};
+	Image deriv = {-1, -2, 0, 2, 1};
+	Image hor, vert;
+	ApplyGradient(gray, smooth, deriv, hor, vert);
+	EXPECT_TRUE(ImagesEqual(hor, stencil_map(gray, Sobel5())));
+	EXPECT_TRUE(ImagesEqual(vert, convolve_separable(gray, smooth, deriv)));
+
+	floatImage small(7, 11);
+	for (uint i = 0 ; i < small.n_rows ; ++i) {
+		for (uint j = 0 ; j < small.n_cols ; ++j) {
+			small(i, j) = 0.25f * i - 0.5f * j * j;
+		}
+	}
+	floatImage rowKernel = {0.25f, 0.5f, 0.25f};
+	floatImage colKernel = {-1.0f, 0.0f, 1.0f};
+	floatImage separable = convolve_separable(small, rowKernel, colKernel);
+	floatImage extra = small.extra_borders(1, 1);
+	for (uint i = 0 ; i < small.n_rows ; ++i) {
+		for (uint j = 0 ; j < small.n_cols ; ++j) {
+			float direct = 0;
+			for (uint r = 0 ; r < 3 ; ++r) {
+				for (uint c = 0 ; c < 3 ; ++c) {
+					direct += colKernel(0, r) * rowKernel(0, c) * extra(i + r, j + c);
+				}
+			}
+			EXPECT_NEAR(separable(i, j), direct, 1e-4);
+		}
+	}
+	EXPECT_ANY_THROW(convolve_separable(small, floatImage({1.0f, 1.0f}), colKernel));
+	delete image;
+}
+
+/**
+@function TEST(FeatureMatrixTest, SaveAndMap)
+Test that checks that rows of (@ref FeatureMatrix) are aligned and
+that a matrix mapped from file equals the saved one, including its source key
+*/
+
+TEST(FeatureMatrixTest, SaveAndMap) {
+	const char *path = "feature_matrix_test.bin";
+	FeatureMatrix features;
+	for (int row = 0 ; row < 100 ; ++row) {
+		std::vector<float> sample(37);
+		for (uint i = 0 ; i < sample.size() ; ++i) {
+			sample[i] = row * 0.5f + i;
+		}
+		features.AppendRow(sample, row % 3);
+	}
+	EXPECT_EQ(features.Rows(), 100u);
+	EXPECT_EQ(features.Cols(), 37u);
+	EXPECT_EQ(reinterpret_cast<size_t>(features.Row(1)) % FEATURE_ALIGNMENT, 0u);
+	EXPECT_EQ(features.Row(0)[37], 0.0f);
+	features.SetSource(0x123456789abcdefULL);
+	features.Save(path);
+	{
+		FeatureMatrix mapped = FeatureMatrix::Map(path);
+		EXPECT_TRUE(mapped.IsMapped());
+		EXPECT_EQ(mapped.Source(), features.Source());
+		ASSERT_EQ(mapped.Rows(), features.Rows());
+		ASSERT_EQ(mapped.Cols(), features.Cols());
+		EXPECT_EQ(reinterpret_cast<size_t>(mapped.Row(0)) % FEATURE_ALIGNMENT, 0u);
+		FeatureMatrixView tail = mapped.View().Slice(90, 10);
+		for (uint row = 0 ; row < tail.n_rows ; ++row) {
+			EXPECT_EQ(tail.Label(row), features.Label(90 + row));
+			EXPECT_TRUE(std::equal(tail.Row(row), tail.Row(row) + tail.n_cols, features.Row(90 + row)));
+		}
+		EXPECT_ANY_THROW(mapped.AppendRow(std::vector<float>(37), 0));
+	}
+	remove(path);
+}
+
+
+/**
+@function TEST(FeatureMatrixTest, ReserveBeforeFirstRow)
+Test that checks that (@ref FeatureMatrix::Reserve) of a matrix which doesn't know its number
+of features yet is applied by the first appended row, and that files whose rows are shorter
+than the number of features are not mapped
+*/
+
+TEST(FeatureMatrixTest, ReserveBeforeFirstRow) {
+	FeatureMatrix features;
+	features.Reserve(10);
+	for (int row = 0 ; row < 200 ; ++row) {
+		features.AppendRow(std::vector<float>(1000, float(row)), row);
+	}
+	ASSERT_EQ(features.Rows(), 200u);
+	for (int row = 0 ; row < 200 ; ++row) {
+		EXPECT_EQ(features.Row(row)[999], float(row));
+		EXPECT_EQ(features.Label(row), row);
+	}
+
+	const char *path = "feature_matrix_reserve_test.bin";
+	features.Save(path);
+	{
+			// cols follows magic, version and rows in the header
+		FILE *fp = fopen(path, "r+b");
+		ASSERT_TRUE(fp != NULL);
+		uint64_t cols = features.Stride() + 1;
+		fseek(fp, 16, SEEK_SET);
+		fwrite(&cols, sizeof(cols), 1, fp);
+		fclose(fp);
+	}
+	EXPECT_ANY_THROW(FeatureMatrix::Map(path));
+	remove(path);
+}
+
+/**
+@function TEST(ExpressionTest, FusedArithmetic)
+Test that checks lazy matrix expressions against elementwise computation, including
+scalars, casts, unary functions, assignment to a matrix with shallow copies and submatrix operands
+*/
+
+TEST(ExpressionTest, FusedArithmetic) {
+	Image hor(7, 19), vert(7, 19);
+	for (uint i = 0 ; i < hor.n_rows ; ++i) {
+		for (uint j = 0 ; j < hor.n_cols ; ++j) {
+			hor(i, j) = i * 37 - j * 11;
+			vert(i, j) = j * j - 5 * i;
+		}
+	}
+	Matrix<int> square = hor * hor + vert * vert;
+	floatImage weight = max(matrix_expr::cast<float>(hor * hor + vert * vert) - 100.0f, 0.0f) * 0.5f;
+	floatImage magnitude = sqrt(matrix_expr::cast<float>(square));
+	floatImage same_size(7, 19);
+	same_size(0, 0) = -1.0f;
+	floatImage alias = same_size;
+	same_size = min(abs(hor - vert), 50) / 2.0f;
+	auto lazy = -hor + 1;
+	Image negated = evaluate(matrix_expr::cast<short>(lazy));
+	for (uint i = 0 ; i < hor.n_rows ; ++i) {
+		for (uint j = 0 ; j < hor.n_cols ; ++j) {
+			int sq = hor(i, j) * hor(i, j) + vert(i, j) * vert(i, j);
+			EXPECT_EQ(square(i, j), sq);
+			EXPECT_FLOAT_EQ(weight(i, j), std::max(float(sq) - 100.0f, 0.0f) * 0.5f);
+			EXPECT_FLOAT_EQ(magnitude(i, j), std::sqrt(float(sq)));
+			EXPECT_FLOAT_EQ(same_size(i, j), std::min(std::abs(hor(i, j) - vert(i, j)), 50) / 2.0f);
+			EXPECT_EQ(negated(i, j), 1 - hor(i, j));
+		}
+	}
+	EXPECT_NE(same_size.getData(), alias.getData());
+	EXPECT_FLOAT_EQ(alias(0, 0), -1.0f);
+	Matrix<int> part = hor.submatrix(2, 3, 4, 5) * vert.submatrix(1, 0, 4, 5);
+	EXPECT_EQ(part(3, 4), hor(5, 7) * vert(4, 4));
+	EXPECT_ANY_THROW(Matrix<int>(hor + Image(7, 18)));
+}
+
+/**
+@function TEST(DetectTest, WindowScoresAndSuppression)
+Test that checks that the score of a window computed from the cell grid equals the linear model
+applied to (@ref GetDescriptor) of the window, and checks (@ref SuppressNonMaximum)
+*/
+
+TEST(DetectTest, WindowScoresAndSuppression) {
+	BMP* image = new BMP();
+	image->ReadFromFile(PATH_TO_LENNA);
+	Image gray = ImgToGrayscale(image, true);
+	Image hor, vert;
+	ApplySobel(gray, hor, vert, true);
+	floatImage magn = GetMagnitude(hor, vert, true);
+	floatImage cells = ComputeCellGrid(hor, vert, magn, DETECT_CELL_SIZE);
+	DetectorWeights detector;
+	for (uint i = 0 ; i < CELL_COUNT * CELL_COUNT * SEGMENT_COUNT ; ++i) {
+		detector.weights.push_back(sin(0.01f * i));
+	}
+	detector.bias = 0.5;
+	floatImage scores = ScoreWindows(cells, detector);
+	ASSERT_EQ(scores.n_rows, gray.n_rows / DETECT_CELL_SIZE - CELL_COUNT + 1);
+	ASSERT_EQ(scores.n_cols, gray.n_cols / DETECT_CELL_SIZE - CELL_COUNT + 1);
+	const uint windowSize = CELL_COUNT * DETECT_CELL_SIZE;
+	const uint positions[3][2] = { {0, 0}, {7, 3}, {scores.n_rows - 1, scores.n_cols - 1} };
+	for (auto position : positions) {
+		uint x = position[0] * DETECT_CELL_SIZE, y = position[1] * DETECT_CELL_SIZE;
+		std::vector<float> descriptor;
+		GetDescriptor(ImageView(hor).submatrix(x, y, windowSize, windowSize),
+			ImageView(vert).submatrix(x, y, windowSize, windowSize),
+			floatImageView(magn).submatrix(x, y, windowSize, windowSize), descriptor);
+		double expected = detector.bias;
+		for (uint i = 0 ; i < descriptor.size() ; ++i) {
+			expected += descriptor[i] * detector.weights[i];
+		}
+		EXPECT_NEAR(scores(position[0], position[1]), expected, 1e-3);
+	}
+
+	std::vector<Detection> detections = { {0, 0, 64, 64, 1.0f}, {8, 8, 64, 64, 2.0f}, {100, 100, 64, 64, 0.5f} };
+	std::vector<Detection> kept = SuppressNonMaximum(detections, DETECT_NMS_OVERLAP);
+	ASSERT_EQ(kept.size(), 2u);
+	EXPECT_EQ(kept[0].score, 2.0f);
+	EXPECT_EQ(kept[1].score, 0.5f);
+	delete image;
+}
+
+/**
+@function TEST(GrayscaleTest, VectorEqualsReference)
+Test that checks that vector grayscale conversion of BGRA and BGR rows of every length
+up to 70 pixels is bit-exact with (@ref GrayFromBgr), and that (@ref ImgToGrayscale) gives
+the same image with and without sse
+*/
+
+TEST(GrayscaleTest, VectorEqualsReference) {
+	const uint maxCount = 70;
+	std::vector<unsigned char> pixels(maxCount * 4);
+	for (uint i = 0 ; i < pixels.size() ; ++i) {
+		pixels[i] = (i * 97 + i / 7) % 256;
+	}
+	pixels[0] = pixels[1] = pixels[2] = 255;
+	for (uint count = 0 ; count <= maxCount ; ++count) {
+		std::vector<short> bgra(count + 1, -1), bgr(count + 1, -1);
+		BgraToGrayscale(&pixels[0], &bgra[0], count, true);
+		BgrToGrayscale(&pixels[0], &bgr[0], count, true);
+		for (uint j = 0 ; j < count ; ++j) {
+			EXPECT_EQ(bgra[j], GrayFromBgr(pixels[4 * j], pixels[4 * j + 1], pixels[4 * j + 2]));
+			EXPECT_EQ(bgr[j], GrayFromBgr(pixels[3 * j], pixels[3 * j + 1], pixels[3 * j + 2]));
+		}
+		EXPECT_EQ(bgra[count], -1);
+		EXPECT_EQ(bgr[count], -1);
+	}
+	EXPECT_EQ(GrayFromBgr(255, 255, 255), 255);
+
+	BMP* image = new BMP();
+	image->ReadFromFile(PATH_TO_LENNA);
+	EXPECT_TRUE(ImagesEqual(ImgToGrayscale(image, true), ImgToGrayscale(image, false)));
+	delete image;
+}
+
+/**
+@function TEST(MagnitudeTest, IntegerModes)
+Test that checks sse and plain integer magnitudes (@ref L1Magnitude), (@ref AlphaBetaMagnitude) and
+(@ref IntSqrtMagnitude) on extreme gradients, and the integer (@ref GetHist) against the float one
+*/
+
+TEST(MagnitudeTest, IntegerModes) {
+	Image hor(9, 21), vert(9, 21);
+	for (uint i = 0 ; i < hor.n_rows ; ++i) {
+		for (uint j = 0 ; j < hor.n_cols ; ++j) {
+			hor(i, j) = short(i * 7919 + j * 104729);
+			vert(i, j) = short(j * 15485863 - i * 3);
+		}
+	}
+	hor(0, 0) = vert(0, 0) = -32768;
+	hor(0, 1) = vert(0, 1) = 32767;
+	hor(0, 2) = vert(0, 2) = 0;
+	const MagnitudeMode modes[] = { MAGNITUDE_L1, MAGNITUDE_ALPHA_BETA, MAGNITUDE_ISQRT };
+	for (MagnitudeMode mode : modes) {
+		EXPECT_TRUE(ImagesEqual(GetMagnitude(hor, vert, mode, true), GetMagnitude(hor, vert, mode, false)));
+	}
+	ushortImage l1 = GetMagnitude(hor, vert, MAGNITUDE_L1, true);
+	ushortImage alphaBeta = GetMagnitude(hor, vert, MAGNITUDE_ALPHA_BETA, true);
+	ushortImage root = GetMagnitude(hor, vert, MAGNITUDE_ISQRT, true);
+	for (uint i = 0 ; i < hor.n_rows ; ++i) {
+		for (uint j = 0 ; j < hor.n_cols ; ++j) {
+			int64_t x = std::max(int(hor(i, j)), -32767), y = std::max(int(vert(i, j)), -32767);
+			int64_t square = x * x + y * y;
+			int64_t r = root(i, j);
+			EXPECT_EQ(l1(i, j), std::abs(x) + std::abs(y));
+			EXPECT_TRUE(r * r <= square && (r + 1) * (r + 1) > square);
+			EXPECT_NEAR(alphaBeta(i, j), std::sqrt(double(square)), 0.07 * std::sqrt(double(square)) + 1);
+		}
+	}
+	EXPECT_EQ(l1(0, 0), 65534);
+
+	BMP* image = new BMP();
+	image->ReadFromFile(PATH_TO_LENNA);
+	Image gray = ImgToGrayscale(image, true);
+	Image sobelHor, sobelVert;
+	ApplySobel(gray, sobelHor, sobelVert, true);
+	std::vector<float> exact, integer;
+	GetDescriptor(sobelHor, sobelVert, GetMagnitude(sobelHor, sobelVert, true), exact);
+	GetDescriptor(sobelHor, sobelVert, GetMagnitude(sobelHor, sobelVert, MAGNITUDE_ISQRT, true), integer);
+	ASSERT_EQ(exact.size(), integer.size());
+	for (uint i = 0 ; i < exact.size() ; ++i) {
+		EXPECT_NEAR(exact[i], integer[i], 1e-2);
+	}
+	delete image;
+}
+
+/**
+@function TEST(QuantizedTest, DecisionValuesCloseToFloat)
+Test that checks that decision values of (@ref QuantizedModel) on uint8 and fp16 features
+are close to liblinear predict_values on float features, for a two-class model with bias
+and for a three-class model, and that features appended in parts are quantized the same
+*/
+
+TEST(QuantizedTest, DecisionValuesCloseToFloat) {
+	const uint cols = 100, rows = 20;
+	FeatureMatrix features(cols), first(cols), second(cols);
+	for (uint i = 0 ; i < rows ; ++i) {
+		std::vector<float> row(cols);
+		for (uint j = 0 ; j < cols ; ++j) {
+			row[j] = 0.5f + 0.5f * sin(0.37f * i * j + j);
+		}
+		row[3] = -0.25f;
+		features.AppendRow(row, i % 3);
+		(i < rows / 2 ? first : second).AppendRow(row, i % 3);
+	}
+	QuantizedFeatures bytes(features, QUANT_UINT8);
+	QuantizedFeatures halves(features, QUANT_FP16);
+	EXPECT_LT(bytes.Bytes(), rows * cols * sizeof(float) / 2);
+	QuantizedFeatures appended(QUANT_UINT8);
+	appended.Append(first);
+	appended.Append(second);
+	ASSERT_EQ(appended.Rows(), bytes.Rows());
+	EXPECT_EQ(appended.Bytes(), bytes.Bytes());
+	for (uint i = 0 ; i < rows ; ++i) {
+		EXPECT_EQ(appended.Label(i), bytes.Label(i));
+		EXPECT_EQ(memcmp(appended.Codes(i), bytes.Codes(i), bytes.Stride()), 0);
+	}
+
+	for (int nr_class = 2 ; nr_class <= 3 ; ++nr_class) {
+		int nr_w = (nr_class == 2) ? 1 : nr_class;
+		std::vector<double> w((cols + 1) * nr_w);
+		for (uint j = 0 ; j < w.size() ; ++j) {
+			w[j] = cos(0.11 * j * j) / cols;
+		}
+		std::vector<int> labels = {0, 1, 2};
+		struct model linear;
+		linear.param.solver_type = L2R_L2LOSS_SVC_DUAL;
+		linear.nr_class = nr_class;
+		linear.nr_feature = cols;
+		linear.w = &w[0];
+		linear.label = &labels[0];
+		linear.bias = 1;
+		QuantizedModel quantized(&linear);
+
+		std::vector<feature_node> x(cols + 2);
+		std::vector<double> expected(nr_w), fromBytes(nr_w), fromHalves(nr_w);
+		for (uint i = 0 ; i < rows ; ++i) {
+			for (uint j = 0 ; j < cols ; ++j) {
+				x[j].index = j + 1;
+				x[j].value = features.Row(i)[j];
+			}
+			x[cols].index = cols + 1;
+			x[cols].value = 1;
+			x[cols + 1].index = -1;
+			predict_values(&linear, &x[0], &expected[0]);
+			quantized.DecisionValues(bytes, i, &fromBytes[0]);
+			quantized.DecisionValues(halves, i, &fromHalves[0]);
+			for (int k = 0 ; k < nr_w ; ++k) {
+				EXPECT_NEAR(fromBytes[k], expected[k], 0.02);
+				EXPECT_NEAR(fromHalves[k], expected[k], 1e-3);
+			}
+		}
+	}
+}
+
+///Output of liblinear collected by (@ref CollectOutput)
+static std::string liblinearOutput;
+
+/**
+@function CollectOutput
+Print function for liblinear that keeps the output in (@ref liblinearOutput)
+*/
+static void CollectOutput(const char *s) {
+	liblinearOutput += s;
+}
+
+/**
+@function OuterIterations
+Sum of outer iteration counts reported by dual solvers in (@ref liblinearOutput)
+*/
+static int OuterIterations() {
+	int total = 0;
+	const std::string key = "#iter = ";
+	for (size_t pos = liblinearOutput.find(key) ; pos != std::string::npos ; pos = liblinearOutput.find(key, pos + 1)) {
+		total += atoi(liblinearOutput.c_str() + pos + key.size());
+	}
+	return total;
+}
+
+/**
+@function SyntheticSample
+Features of sample i of a synthetic problem: 0.5 * sin(frequency * i * j + j), plus shift
+for features j with j % classes == i % classes, so i % classes is the class of the sample
+*/
+static std::vector<float> SyntheticSample(size_t i, size_t cols, int classes, float frequency, float shift) {
+	std::vector<float> sample(cols);
+	for (size_t j = 0 ; j < cols ; ++j) {
+		sample[j] = 0.5f * sin(frequency * i * j + j) + (j % classes == i % classes ? shift : 0.0f);
+	}
+	return sample;
+}
+
+/**
+@function SyntheticFeatures
+rows samples of (@ref SyntheticSample) labelled by i % classes
+*/
+static FeatureMatrix SyntheticFeatures(size_t rows, size_t cols, int classes, float frequency, float shift) {
+	FeatureMatrix features(cols);
+	for (size_t i = 0 ; i < rows ; ++i) {
+		features.AppendRow(SyntheticSample(i, cols, classes, frequency, shift), int(i % classes));
+	}
+	return features;
+}
+
+/**
+@function LiblinearParameter
+Parameters of liblinear for solver_type with C = 1, eps = 1e-4, one thread and no weights,
+initial solution, proximal center, budget or checkpoints
+*/
+static struct parameter LiblinearParameter(int solver_type) {
+	struct parameter param;
+	param.solver_type = solver_type;
+	param.C = 1;
+	param.eps = 1e-4;
+	param.nr_weight = 0;
+	param.weight_label = NULL;
+	param.weight = NULL;
+	param.p = 0.1;
+	param.nr_thread = 1;
+	param.init_sol = NULL;
+	param.prox_center = NULL;
+	param.max_iter = 0;
+	param.max_seconds = 0;
+	param.checkpoint = NULL;
+	param.checkpoint_seconds = 0;
+	param.checkpoint_arg = NULL;
+	return param;
+}
+
+/**
+@function TrainCollectingOutput
+Trains the classifier with the output of liblinear appended to (@ref liblinearOutput)
+*/
+static void TrainCollectingOutput(const TClassifierParams& params, const FeatureMatrix& features, TModel* model) {
+	set_print_string_function(CollectOutput);
+	TClassifier(params).Train(features, model);
+	set_print_string_function(NULL);
+}
+
+/**
+@function TEST(LiblinearTest, DenseSolverMatchesSparse)
+Test that checks that dual coordinate descent solvers give the same model for a dense problem
+(float rows with sse, see linear.cpp) and for the same problem in sparse form
+*/
+
+TEST(LiblinearTest, DenseSolverMatchesSparse) {
+	const int rows = 60, cols = 37;
+	std::vector<feature_node> dense_space(rows * (cols + 1)), sparse_space(rows * (cols + 1));
+	std::vector<feature_node *> dense_x(rows), sparse_x(rows);
+	std::vector<double> y(rows);
+	for (int i = 0 ; i < rows ; ++i) {
+		y[i] = (i % 2) ? 1 : -1;
+		dense_x[i] = &dense_space[i * (cols + 1)];
+		sparse_x[i] = &sparse_space[i * (cols + 1)];
+		std::vector<float> sample = SyntheticSample(i, cols, 2, 0.7f, 0.3f);
+		int k = 0;
+		for (int j = 0 ; j < cols ; ++j) {
+			float value = sample[j];
+			dense_x[i][j].index = j + 1;
+			dense_x[i][j].value = value;
+			// Sparse form skips zero, the solution doesn't change
+			if (i == 0 && j == 1)
+				dense_x[i][j].value = value = 0;
+			if (value != 0) {
+				sparse_x[i][k].index = j + 1;
+				sparse_x[i][k++].value = value;
+			}
+		}
+		dense_x[i][cols].index = sparse_x[i][k].index = -1;
+	}
+	const int solvers[] = { L2R_L2LOSS_SVC_DUAL, L2R_L1LOSS_SVC_DUAL, L2R_LR_DUAL };
+	for (int solver : solvers) {
+		struct problem prob;
+		prob.l = rows;
+		prob.n = cols;
+		prob.y = &y[0];
+		prob.bias = -1;
+		struct parameter param = LiblinearParameter(solver);
+		param.eps = 1e-6;
+		prob.x = &dense_x[0];
+		srand(1);
+		struct model *dense = train(&prob, &param);
+		prob.x = &sparse_x[0];
+		srand(1);
+		struct model *sparse = train(&prob, &param);
+		for (int j = 0 ; j < cols ; ++j) {
+			EXPECT_NEAR(dense->w[j], sparse->w[j], 1e-6);
+		}
+		free_and_destroy_model(&dense);
+		free_and_destroy_model(&sparse);
+	}
+}
+
+/**
+@function TEST(LiblinearTest, ParallelPrimalMatchesSerial)
+Test that checks that primal solvers give the same model with several threads
+as with one thread, and the same model in two runs with several threads
+*/
+
+TEST(LiblinearTest, ParallelPrimalMatchesSerial) {
+	const int rows = 203, cols = 29;
+	std::vector<feature_node> space(rows * (cols + 1));
+	std::vector<feature_node *> x(rows);
+	std::vector<double> y(rows);
+	for (int i = 0 ; i < rows ; ++i) {
+		y[i] = (i % 3) ? 1 : -1;
+		x[i] = &space[i * (cols + 1)];
+		std::vector<float> sample = SyntheticSample(i, cols, 3, 0.3f, 0.2f);
+		for (int j = 0 ; j < cols ; ++j) {
+			x[i][j].index = j + 1;
+			x[i][j].value = sample[j];
+		}
+		x[i][cols].index = -1;
+	}
+	struct problem prob;
+	prob.l = rows;
+	prob.n = cols;
+	prob.y = &y[0];
+	prob.x = &x[0];
+	prob.bias = -1;
+	const int solvers[] = { L2R_LR, L2R_L2LOSS_SVC };
+	for (int solver : solvers) {
+		struct parameter param = LiblinearParameter(solver);
+		struct model *serial = train(&prob, &param);
+		param.nr_thread = 4;
+		struct model *first = train(&prob, &param);
+		struct model *second = train(&prob, &param);
+		for (int j = 0 ; j < cols ; ++j) {
+			EXPECT_NEAR(first->w[j], serial->w[j], 1e-6);
+			EXPECT_EQ(first->w[j], second->w[j]);
+		}
+		free_and_destroy_model(&serial);
+		free_and_destroy_model(&first);
+		free_and_destroy_model(&second);
+	}
+}
+
+/**
+@function TEST(LiblinearTest, ParallelDualMatchesSerial)
+Test that checks that dual coordinate descent with several threads converges
+to the same model as the serial solver
+*/
+
+TEST(LiblinearTest, ParallelDualMatchesSerial) {
+	const int rows = 301, cols = 23;
+	std::vector<feature_node> space(rows * (cols + 1));
+	std::vector<feature_node *> x(rows);
+	std::vector<double> y(rows);
+	for (int i = 0 ; i < rows ; ++i) {
+		y[i] = (i % 2) ? 1 : -1;
+		x[i] = &space[i * (cols + 1)];
+		std::vector<float> sample = SyntheticSample(i, cols, 2, 0.37f, 0.25f);
+		int k = 0;
+		for (int j = 0 ; j < cols ; ++j) {
+			double value = sample[j];
+			// Some zeros make the problem sparse
+			if ((i + j) % 7 != 0) {
+				x[i][k].index = j + 1;
+				x[i][k++].value = value;
+			}
+		}
+		x[i][k].index = -1;
+	}
+	struct problem prob;
+	prob.l = rows;
+	prob.n = cols;
+	prob.y = &y[0];
+	prob.x = &x[0];
+	prob.bias = -1;
+	const int solvers[] = { L2R_L2LOSS_SVC_DUAL, L2R_L1LOSS_SVC_DUAL };
+	for (int solver : solvers) {
+		struct parameter param = LiblinearParameter(solver);
+		param.eps = 1e-6;
+		struct model *serial = train(&prob, &param);
+		param.nr_thread = 4;
+		struct model *parallel = train(&prob, &param);
+		for (int j = 0 ; j < cols ; ++j) {
+			EXPECT_NEAR(parallel->w[j], serial->w[j], 1e-4);
+		}
+		free_and_destroy_model(&serial);
+		free_and_destroy_model(&parallel);
+	}
+}
+
+/**
+@function TEST(ClassifierTest, WarmStartFromModel)
+Test that checks that training resumed from a model converges to the same weights in fewer
+iterations, also when classes appear in the data in a different order than in the model
+*/
+
+TEST(ClassifierTest, WarmStartFromModel) {
+	const size_t rows = 240, cols = 19;
+	for (int classes = 2 ; classes <= 3 ; ++classes) {
+		FeatureMatrix features(cols), reversed(cols);
+		std::vector<std::vector<float> > samples(rows);
+		for (size_t i = 0 ; i < rows ; ++i) {
+			samples[i] = SyntheticSample(i, cols, classes, 0.41f, 0.3f);
+			features.AppendRow(samples[i], int(i % classes) + 1);
+		}
+		for (size_t i = rows ; i-- > 0 ; ) {
+			reversed.AppendRow(samples[i], int(i % classes) + 1);
+		}
+
+		TClassifierParams params;
+		params.C = 1;
+		params.eps = 1e-6;
+		liblinearOutput.clear();
+		TModel cold;
+		TrainCollectingOutput(params, features, &cold);
+		int coldIterations = OuterIterations();
+
+		params.init_model = cold.get();
+		liblinearOutput.clear();
+		TModel warm;
+		TrainCollectingOutput(params, reversed, &warm);
+		int warmIterations = OuterIterations();
+		EXPECT_LT(warmIterations, coldIterations);
+
+		std::vector<int> coldLabels(classes), warmLabels(classes);
+		get_labels(cold.get(), &coldLabels[0]);
+		get_labels(warm.get(), &warmLabels[0]);
+		if (classes == 2) {
+			// One weight vector, positive for the first label
+			ASSERT_EQ(coldLabels[0], warmLabels[1]);
+			for (size_t j = 0 ; j < cols ; ++j) {
+				EXPECT_NEAR(warm.get()->w[j], -cold.get()->w[j], 1e-3);
+			}
+			continue;
+		}
+		for (int k = 0 ; k < classes ; ++k) {
+			int c = std::find(coldLabels.begin(), coldLabels.end(), warmLabels[k]) - coldLabels.begin();
+			for (size_t j = 0 ; j < cols ; ++j) {
+				EXPECT_NEAR(warm.get()->w[j * classes + k], cold.get()->w[j * classes + c], 1e-3);
+			}
+		}
+	}
+}
+
+/**
+@function TEST(ClassifierTest, BudgetStopsTraining)
+Test that checks that the solver makes only max_iter passes, which already classify well, that the time
+budget stops a training which would not converge for minutes and that the model so far is saved to the
+checkpoint file
+*/
+
+TEST(ClassifierTest, BudgetStopsTraining) {
+	const char *path = "classifier_checkpoint_test.txt";
+	const size_t rows = 2000, cols = 40;
+	FeatureMatrix features = SyntheticFeatures(rows, cols, 3, 0.29f, 0.2f);
+	TClassifierParams params;
+	params.solver_type = L2R_L1LOSS_SVC_DUAL;
+	params.C = 1000;
+	params.eps = 1e-12;
+	params.max_iter = 5;
+	liblinearOutput.clear();
+	// Dual solvers shuffle samples by rand()
+	srand(1);
+	TModel fewPasses;
+	TrainCollectingOutput(params, features, &fewPasses);
+	EXPECT_EQ(OuterIterations(), 3 * params.max_iter);
+
+	params.max_iter = 1000000;
+	params.max_seconds = 0.3;
+	params.checkpoint_file = path;
+	params.checkpoint_seconds = 0.05;
+	remove(path);
+	liblinearOutput.clear();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	TModel budgeted;
+	TrainCollectingOutput(params, features, &budgeted);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	// Only catches a budget which is ignored, loaded machines may be many times slower
+	EXPECT_LT(seconds, 100 * params.max_seconds);
+	EXPECT_NE(liblinearOutput.find("time budget"), std::string::npos);
+
+	TModel checkpoint;
+	checkpoint.Load(path);
+	ASSERT_TRUE(checkpoint.get() != NULL);
+	EXPECT_EQ(get_nr_class(checkpoint.get()), 3);
+	EXPECT_EQ(get_nr_feature(checkpoint.get()), int(cols));
+	// How far the budgeted solver gets depends on the machine, few passes are deterministic
+	TLabels labels;
+	TClassifier(params).Predict(features, fewPasses, &labels);
+	size_t correct = 0;
+	for (size_t i = 0 ; i < rows ; ++i) {
+		correct += labels[i] == features.Label(i);
+	}
+	EXPECT_GE(correct, rows * 9 / 10);
+	labels.clear();
+	TClassifier(params).Predict(features, budgeted, &labels);
+	ASSERT_EQ(labels.size(), rows);
+	for (size_t i = 0 ; i < rows ; ++i) {
+		EXPECT_TRUE(labels[i] >= 0 && labels[i] < 3);
+	}
+	remove(path);
+}
+
+/**
+@function TEST(OnlineTest, AveragedSgdAgreesWithLiblinear)
+Test that checks that the model trained by (@ref TOnlineClassifier) sample by sample
+predicts the training samples like the liblinear model with the same objective
+*/
+
+TEST(OnlineTest, AveragedSgdAgreesWithLiblinear) {
+	const size_t rows = 600, cols = 24;
+	const int passes = 5;
+	for (int classes = 2 ; classes <= 3 ; ++classes) {
+		FeatureMatrix features(cols);
+		for (size_t i = 0 ; i < rows ; ++i) {
+			features.AppendRow(SyntheticSample(i, cols, classes, 0.23f, 0.4f), int(i % classes) * 2 - 1);
+		}
+
+		TClassifierParams params;
+		params.C = 1;
+		params.eps = 1e-4;
+		params.solver_type = L2R_L2LOSS_SVC;
+		TModel batch;
+		TrainCollectingOutput(params, features, &batch);
+
+		TOnlineClassifierParams onlineParams;
+		onlineParams.lambda = 1.0 / (params.C * rows);
+		onlineParams.averaging_start = rows * (passes - 1);
+		TOnlineClassifier online(cols, onlineParams);
+		for (int pass = 0 ; pass < passes ; ++pass) {
+			for (size_t i = 0 ; i < rows ; ++i) {
+				size_t row = (i * 7 + pass) % rows;
+				online.Update(features.Row(row), features.Label(row));
+			}
+		}
+		TModel onlineModel;
+		online.GetModel(&onlineModel);
+		EXPECT_EQ(online.Samples(), rows * passes);
+		EXPECT_EQ(get_nr_class(onlineModel.get()), classes);
+
+		TLabels batchLabels, onlineLabels;
+		TClassifier(params).Predict(features, batch, &batchLabels);
+		TClassifier(params).Predict(features, onlineModel, &onlineLabels);
+		size_t agree = 0;
+		for (size_t i = 0 ; i < rows ; ++i) {
+			agree += batchLabels[i] == onlineLabels[i];
+		}
+		EXPECT_GE(agree, rows * 95 / 100);
+	}
+}
+
+/**
+@function TEST(ClassifierTest, TrainFromMappedFeatures)
+Test that checks that training on a (@ref FeatureMatrix) mapped from file with block shuffle
+gives the weights of training on the matrix in memory
+*/
+
+TEST(ClassifierTest, TrainFromMappedFeatures) {
+	const char *path = "classifier_mapped_test.bin";
+	const size_t rows = 300, cols = 21;
+	FeatureMatrix features = SyntheticFeatures(rows, cols, 3, 0.37f, 0.3f);
+	features.Save(path);
+	const int solvers[] = {L2R_L2LOSS_SVC_DUAL, L2R_LR_DUAL};
+	for (uint s = 0 ; s < sizeof(solvers) / sizeof(solvers[0]) ; ++s) {
+		TClassifierParams params;
+		params.solver_type = solvers[s];
+		params.C = 1;
+		params.eps = 1e-6;
+		TModel inMemory;
+		TrainCollectingOutput(params, features, &inMemory);
+		TModel fromFile;
+		{
+			FeatureMatrix mapped = FeatureMatrix::Map(path);
+			params.shuffle_block = 16;
+			TrainCollectingOutput(params, mapped, &fromFile);
+		}
+		ASSERT_EQ(get_nr_class(fromFile.get()), 3);
+		for (size_t j = 0 ; j < cols * 3 ; ++j) {
+			EXPECT_NEAR(fromFile.get()->w[j], inMemory.get()->w[j], 1e-3);
+		}
+	}
+	remove(path);
+}
+
+/**
+@function TEST(IntersectionTest, LookupTableMatchesKernel)
+Test that checks that the intersection kernel SVM learns a class which is a band of one feature,
+that its lookup tables give the decision values of the exact kernel expansion and that they survive saving
+*/
+
+TEST(IntersectionTest, LookupTableMatchesKernel) {
+	const char *path = "intersection_test.txt";
+	const size_t rows = 400, cols = 6;
+	FeatureMatrix features(cols);
+	for (size_t i = 0 ; i < rows ; ++i) {
+		std::vector<float> sample(cols);
+		for (size_t j = 0 ; j < cols ; ++j) {
+			sample[j] = 0.5f + 0.5f * sin(0.73f * i * (j + 1) + j);
+		}
+		features.AppendRow(sample, sample[0] > 0.3f && sample[0] < 0.7f ? 1 : -1);
+	}
+	TIntersectionParams params;
+	params.C = 10;
+	params.eps = 1e-3;
+	params.bins = 256;
+	TIntersectionModel model;
+	std::vector<double> coefficients;
+	TIntersectionClassifier(params).Train(features, &model, &coefficients);
+	ASSERT_EQ(model.NrClass(), 2);
+	EXPECT_EQ(model.Labels()[0], 1);
+	ASSERT_EQ(coefficients.size(), rows);
+
+	size_t correct = 0;
+	for (size_t i = 0 ; i < rows ; ++i) {
+		const float *x = features.Row(i);
+		double exact = 0;
+		for (size_t k = 0 ; k < rows ; ++k) {
+			for (size_t j = 0 ; j < cols ; ++j) {
+				exact += coefficients[k] * std::min(x[j], features.Row(k)[j]);
+			}
+		}
+		double value;
+		model.DecisionValues(x, &value);
+		EXPECT_NEAR(value, exact, 0.05);
+		correct += model.Predict(x) == features.Label(i);
+	}
+	EXPECT_GE(correct, rows * 95 / 100);
+
+	model.Save(path);
+	EXPECT_TRUE(TIntersectionModel::IsModelFile(path));
+	TIntersectionModel loaded;
+	loaded.Load(path);
+	TLabels labels, loadedLabels;
+	model.Predict(features, &labels);
+	loaded.Predict(features, &loadedLabels);
+	EXPECT_EQ(labels, loadedLabels);
+	remove(path);
+}
+
+/**
+@function TEST(ExtractionTest, MaskedCellsEqualAllFeatures)
+Test that checks that (@ref FeatureMask) keeps the cells with significant weights of a model
+and that features extracted only in these cells equal the features of the whole image there and are zeros elsewhere
+*/
+
+TEST(ExtractionTest, MaskedCellsEqualAllFeatures) {
+	BMP* image = new BMP();
+	image->ReadFromFile(PATH_TO_LENNA);
+	for (int full = 0 ; full <= 1 ; ++full) {
+		const size_t cols = FeatureMask::FeatureCount(full);
+		const size_t valueSize = full ? HIK_SIZE : 1;
+		const size_t hogSize = (full ? FULL_DESCRIPTORS : 1) * DESCRIPTOR_CELLS * SEGMENT_COUNT * valueSize;
+		std::vector<double> w(cols, 0);
+		// Significant weights in cells 3 and 200 of the last descriptor, a negligible one in cell 7
+		const size_t last = (full ? FULL_DESCRIPTORS - 1 : 0) * DESCRIPTOR_CELLS;
+		w[((last + 3) * SEGMENT_COUNT + 5) * valueSize] = 1;
+		w[((last + 200) * SEGMENT_COUNT) * valueSize + valueSize - 1] = -0.5;
+		w[(last + 7) * SEGMENT_COUNT * valueSize] = 1e-4;
+		if (full) {
+			w[hogSize + 10 * COLOR_SIZE + 2] = 0.7;
+		}
+		int labels[] = {1, -1};
+		struct model sparse;
+		memset(&sparse, 0, sizeof(sparse));
+		sparse.param.solver_type = L1R_L2LOSS_SVC;
+		sparse.nr_class = 2;
+		sparse.nr_feature = cols;
+		sparse.w = &w[0];
+		sparse.label = labels;
+		sparse.bias = -1;
+		FeatureMask mask(&sparse, full, 1e-3);
+		EXPECT_EQ(mask.ActiveCells(), full ? 3u : 2u);
+		EXPECT_TRUE(mask.Cell(last / DESCRIPTOR_CELLS, 200));
+		EXPECT_FALSE(mask.Cell(last / DESCRIPTOR_CELLS, 7));
+		EXPECT_EQ(FeatureMask(&sparse, full, 0).ActiveCells(), full ? 4u : 3u);
+
+		for (int useSse = 0 ; useSse <= 1 ; ++useSse) {
+			const MagnitudeMode modes[] = {MAGNITUDE_FLOAT, MAGNITUDE_ISQRT};
+			for (MagnitudeMode mode : modes) {
+				std::vector<float> all, lazy;
+				ExtractDescriptor(image, full, useSse, mode, all);
+				ExtractDescriptor(image, mask, useSse, mode, lazy);
+				ASSERT_EQ(all.size(), cols);
+				ASSERT_EQ(lazy.size(), cols);
+				size_t differ = 0;
+				for (size_t f = 0 ; f < cols ; ++f) {
+					size_t cell = f < hogSize ? f / valueSize / SEGMENT_COUNT : (f - hogSize) / COLOR_SIZE;
+					bool needed = f < hogSize ? mask.Cell(cell / DESCRIPTOR_CELLS, cell % DESCRIPTOR_CELLS) : mask.ColorCell(cell);
+					differ += lazy[f] != (needed ? all[f] : 0.0f);
+				}
+				EXPECT_EQ(differ, 0u);
+			}
+		}
+	}
+	delete image;
+}
+
+/**
+@function TEST(CascadeTest, MarginChoosesStage)
+Test that checks (@ref Downsample), the size of the coarse descriptor and that (@ref TCascade)
+takes the label of the coarse model only when its confidence reaches the margin
+*/
+
+TEST(CascadeTest, MarginChoosesStage) {
+	Image image = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+	Image square(4, 4);
+	for (uint i = 0 ; i < 16 ; ++i) {
+		square(i / 4, i % 4) = image(0, i);
+	}
+	Image small = Downsample(square, 2);
+	ASSERT_EQ(small.n_rows, 2u);
+	ASSERT_EQ(small.n_cols, 2u);
+	EXPECT_EQ(small(0, 0), (1 + 2 + 5 + 6) / 4);
+	EXPECT_EQ(small(1, 1), (11 + 12 + 15 + 16) / 4);
+
+	BMP* bmp = new BMP();
+	bmp->ReadFromFile(PATH_TO_LENNA);
+	std::vector<float> coarseFeatures;
+	ExtractCoarseDescriptor(ImgToGrayscale(bmp, true), true, coarseFeatures);
+	ASSERT_EQ(coarseFeatures.size(), COARSE_CELL_COUNT * COARSE_CELL_COUNT * SEGMENT_COUNT);
+
+	// Coarse model gives decision value 0.5 by bias, fine model gives a negative one
+	int labels[] = {1, -1};
+	std::vector<double> coarseW(coarseFeatures.size() + 1, 0), fineW(FeatureMask::FeatureCount(false), -1);
+	coarseW.back() = 0.5;
+	struct model coarse, fine;
+	memset(&coarse, 0, sizeof(coarse));
+	coarse.param.solver_type = L2R_L2LOSS_SVC_DUAL;
+	coarse.nr_class = 2;
+	coarse.nr_feature = coarseFeatures.size();
+	coarse.w = &coarseW[0];
+	coarse.label = labels;
+	coarse.bias = 1;
+	fine = coarse;
+	fine.nr_feature = fineW.size();
+	fine.w = &fineW[0];
+	fine.bias = -1;
+
+	TCascade confident(&coarse, &fine, 0.4, false);
+	int stage;
+	EXPECT_EQ(confident.Predict(bmp, true, MAGNITUDE_FLOAT, &stage), 1);
+	EXPECT_EQ(stage, 0);
+	TCascade doubtful(&coarse, &fine, 1, false);
+	EXPECT_EQ(doubtful.Predict(bmp, true, MAGNITUDE_FLOAT, &stage), -1);
+	EXPECT_EQ(stage, 1);
+	EXPECT_EQ(doubtful.Stage(0).images, 1u);
+	EXPECT_EQ(doubtful.Stage(0).decided, 0u);
+	EXPECT_EQ(doubtful.Stage(1).decided, 1u);
+	EXPECT_ANY_THROW(TCascade(&fine, &fine, 1, false));
+
+	const double values[] = {1, 3, 2.5};
+	struct model multi = coarse;
+	multi.nr_class = 3;
+	EXPECT_DOUBLE_EQ(TCascade::Confidence(&multi, values), 0.5);
+	delete bmp;
+}
+
+/**
+@function TEST(DistributedTest, ConsensusMatchesSingleProcess)
+Test that checks that consensus ADMM of forked workers, each with a third of the samples,
+over a Unix socket and over TCP on localhost gives the weights of training on all samples,
+whichever worker connects first
+*/
+
+TEST(DistributedTest, ConsensusMatchesSingleProcess) {
+	const size_t rows = 300, cols = 21, workers = 3;
+	const char *addresses[] = {"unix:consensus_test.sock", "127.0.0.1:0"};
+	for (int binary = 0 ; binary < 2 ; ++binary) {
+		FeatureMatrix features(cols);
+		std::vector<FeatureMatrix> parts;
+		for (size_t k = 0 ; k < workers ; ++k) {
+			parts.push_back(FeatureMatrix(cols));
+		}
+		for (size_t i = 0 ; i < rows ; ++i) {
+			std::vector<float> sample = SyntheticSample(i, cols, 3, 0.37f, 0.3f);
+			int label = binary ? (i % 3 == 0 ? 1 : -1) : int(i % 3);
+			features.AppendRow(sample, label);
+			parts[i * workers / rows].AppendRow(sample, label);
+		}
+		TClassifierParams params;
+		params.C = 1;
+		params.eps = 1e-6;
+		set_print_string_function(CollectOutput);
+		TModel single;
+		TClassifier(params).Train(features, &single);
+
+		TConsensusParams consensus;
+		consensus.rounds = 1000;
+		consensus.tolerance = 1e-6;
+		TConsensusCoordinator coordinator(addresses[binary], consensus);
+		std::vector<pid_t> pids;
+		for (size_t k = 0 ; k < workers ; ++k) {
+			pid_t pid = fork();
+			ASSERT_GE(pid, 0);
+			if (pid == 0) {
+				int status = 0;
+				try {
+					RunConsensusWorker(coordinator.Address(), parts[k], params);
+				}
+				catch (const std::string &) {
+					status = 1;
+				}
+				_exit(status);
+			}
+			pids.push_back(pid);
+		}
+		TModel distributed;
+		coordinator.Train(workers, &distributed);
+		set_print_string_function(NULL);
+		for (size_t k = 0 ; k < workers ; ++k) {
+			int status;
+			ASSERT_EQ(waitpid(pids[k], &status, 0), pids[k]);
+			EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		}
+		EXPECT_LT(coordinator.Rounds(), consensus.rounds);
+		size_t nr_w = binary ? 1 : 3;
+		ASSERT_EQ(get_nr_class(distributed.get()), get_nr_class(single.get()));
+		// Classes of the consensus are sorted, the single model has them in the order of samples
+		EXPECT_TRUE(std::is_sorted(distributed.get()->label, distributed.get()->label + get_nr_class(single.get())));
+		for (size_t k = 0 ; k < nr_w ; ++k) {
+			size_t m = std::find(single.get()->label, single.get()->label + get_nr_class(single.get()),
+				distributed.get()->label[k]) - single.get()->label;
+			ASSERT_LT(m, size_t(get_nr_class(single.get())));
+			// A binary model has one column, with the other first class its weights are negated
+			double sign = (binary && m != k) ? -1 : 1;
+			size_t column = binary ? 0 : m;
+			for (size_t j = 0 ; j < cols ; ++j) {
+				EXPECT_NEAR(distributed.get()->w[j * nr_w + k], sign * single.get()->w[j * nr_w + column], 1e-3);
+			}
+		}
+	}
+}
+
+/**
+@function TEST(ProjectionTest, GemmAndPrincipalComponents)
+Test that checks that the blocked sse (@ref Gemm) equals the plain product, that principal components
+of (@ref TProjection::Pca) are orthonormal, ordered by variance and find the directions of the data,
+and that a saved projection projects the same way
+*/
+
+TEST(ProjectionTest, GemmAndPrincipalComponents) {
+	const size_t rows = 37, cols = 19, depth = 300;
+	std::vector<float> a(rows * depth), b(depth * cols), c(rows * cols), transposed(depth * rows);
+	for (size_t k = 0 ; k < a.size() ; ++k) {
+		a[k] = sin(0.1f * k);
+		transposed[(k % depth) * rows + k / depth] = a[k];
+	}
+	for (size_t k = 0 ; k < b.size() ; ++k) {
+		b[k] = cos(0.07f * k);
+	}
+	for (int useSse = 0 ; useSse < 2 ; ++useSse) {
+		for (int transpose = 0 ; transpose < 2 ; ++transpose) {
+			if (transpose) {
+				Gemm(&transposed[0], rows, true, &b[0], cols, &c[0], cols, rows, cols, depth, useSse);
+			} else {
+				Gemm(&a[0], depth, false, &b[0], cols, &c[0], cols, rows, cols, depth, useSse);
+			}
+			for (size_t i = 0 ; i < rows ; ++i) {
+				for (size_t j = 0 ; j < cols ; ++j) {
+					double expected = 0;
+					for (size_t p = 0 ; p < depth ; ++p) {
+						expected += double(a[i * depth + p]) * b[p * cols + j];
+					}
+					EXPECT_NEAR(c[i * cols + j], expected, 1e-3);
+				}
+			}
+		}
+	}
+
+		// Samples spread along u1 and, less, along u2
+	const size_t features_count = 40, samples = 300;
+	std::vector<float> u1(features_count, 0), u2(features_count, 0);
+	u1[0] = u1[1] = u2[2] = float(sqrt(0.5));
+	u2[3] = -u2[2];
+	std::mt19937 random(1);
+	std::normal_distribution<float> normal;
+	FeatureMatrix features;
+	for (size_t i = 0 ; i < samples ; ++i) {
+		float along1 = 4 * normal(random), along2 = 2 * normal(random);
+		std::vector<float> row(features_count);
+		for (size_t j = 0 ; j < features_count ; ++j) {
+			row[j] = 1 + along1 * u1[j] + along2 * u2[j] + 0.05f * normal(random);
+		}
+		features.AppendRow(row, i % 2);
+	}
+	const size_t dims = 3;
+	TProjection pca = TProjection::Pca(features, dims, PROJECTION_SAMPLE, 0, true);
+	ASSERT_EQ(pca.Dims(), dims);
+	ASSERT_EQ(pca.Cols(), features_count);
+	const std::vector<float>& basis = pca.Basis();
+	for (size_t d = 0 ; d < dims ; ++d) {
+		for (size_t e = 0 ; e < dims ; ++e) {
+			double dot = 0;
+			for (size_t j = 0 ; j < features_count ; ++j) {
+				dot += basis[j * dims + d] * basis[j * dims + e];
+			}
+			EXPECT_NEAR(dot, d == e ? 1 : 0, 1e-3);
+		}
+	}
+	double along1 = 0, along2 = 0;
+	for (size_t j = 0 ; j < features_count ; ++j) {
+		along1 += basis[j * dims] * u1[j];
+		along2 += basis[j * dims + 1] * u2[j];
+	}
+	EXPECT_GT(fabs(along1), 0.99);
+	EXPECT_GT(fabs(along2), 0.99);
+	FeatureMatrix reduced;
+	pca.Apply(features, &reduced, true);
+	ASSERT_EQ(reduced.Rows(), samples);
+	ASSERT_EQ(reduced.Cols(), dims);
+	std::vector<double> variance(dims, 0);
+	for (size_t i = 0 ; i < samples ; ++i) {
+		EXPECT_EQ(reduced.Label(i), features.Label(i));
+		for (size_t d = 0 ; d < dims ; ++d) {
+			variance[d] += reduced.Row(i)[d] * reduced.Row(i)[d] / samples;
+		}
+	}
+	EXPECT_NEAR(variance[0], 16, 3);
+	EXPECT_NEAR(variance[1], 4, 1);
+	EXPECT_LT(variance[2], 0.01);
+
+	const char *path = "projection_test.bin";
+	TProjection projection = TProjection::Random(features_count, 8, 5);
+	projection.Save(path);
+	TProjection loaded;
+	loaded.Load(path);
+	remove(path);
+	FeatureMatrix expected, actual;
+	projection.Apply(features, &expected, false);
+	loaded.Apply(features, &actual, true);
+	ASSERT_EQ(actual.Cols(), 8u);
+	for (size_t i = 0 ; i < samples ; ++i) {
+		for (size_t d = 0 ; d < 8 ; ++d) {
+			EXPECT_NEAR(actual.Row(i)[d], expected.Row(i)[d], 1e-4);
+		}
+	}
+	EXPECT_ANY_THROW(TProjection::Pca(features, 301, PROJECTION_SAMPLE, 0, true));
+}
+
+/**
+@function TEST(KnnTest, IndexFindsNeighbours)
+Test that checks that (@ref TKnnIndex) scanning all lists finds the exact nearest neighbours,
+that few probes still classify well in many threads, that inserted samples are found and that
+an index saved with inserts and mapped back is the same
+*/
+
+TEST(KnnTest, IndexFindsNeighbours) {
+	const size_t cols = 20, samples = 300;
+	std::mt19937 random(3);
+	std::normal_distribution<float> normal;
+	FeatureMatrix features, queries;
+	for (size_t i = 0 ; i < samples + 60 ; ++i) {
+		int label = i % 3;
+		std::vector<float> row(cols);
+		for (size_t j = 0 ; j < cols ; ++j) {
+			row[j] = (j % 3 == size_t(label) ? 3 : 0) + normal(random);
+		}
+		if (i < samples) {
+			features.AppendRow(row, label);
+		} else {
+			queries.AppendRow(row, label);
+		}
+	}
+	TKnnParams params;
+	params.lists = 8;
+	params.probes = params.lists;
+	TKnnIndex exact(params);
+	exact.Build(features);
+	ASSERT_EQ(exact.Size(), samples);
+	std::vector<TKnnNeighbour> neighbours;
+	for (size_t q = 0 ; q < queries.Rows() ; ++q) {
+		exact.Search(queries.Row(q), &neighbours);
+		std::vector<float> distances(samples);
+		for (size_t i = 0 ; i < samples ; ++i) {
+			distances[i] = 0;
+			for (size_t j = 0 ; j < cols ; ++j) {
+				distances[i] += (queries.Row(q)[j] - features.Row(i)[j]) * (queries.Row(q)[j] - features.Row(i)[j]);
+			}
+		}
+		std::sort(distances.begin(), distances.end());
+		ASSERT_EQ(neighbours.size(), size_t(params.k));
+		for (int k = 0 ; k < params.k ; ++k) {
+			EXPECT_NEAR(neighbours[k].distance, distances[k], 1e-3);
+		}
+	}
+
+	params.probes = 2;
+	params.threads = 4;
+	TKnnIndex index(params);
+	index.Build(features);
+	std::vector<int> labels, serial;
+	index.Predict(queries, &labels);
+	size_t correct = 0;
+	for (size_t q = 0 ; q < queries.Rows() ; ++q) {
+		correct += labels[q] == queries.Label(q);
+		serial.push_back(index.Predict(queries.Row(q)));
+	}
+	EXPECT_EQ(labels, serial);
+	EXPECT_GE(correct, queries.Rows() * 95 / 100);
+
+	std::vector<float> far(cols, 50.0f);
+	for (int copy = 0 ; copy < params.k ; ++copy) {
+		index.Insert(far.data(), cols, 7);
+	}
+	EXPECT_EQ(index.Size(), samples + params.k);
+	FeatureMatrix far_query;
+	far_query.AppendRow(far, 7);
+	EXPECT_EQ(index.Predict(far_query.Row(0)), 7);
+
+	const char *path = "knn_test.bin";
+	index.Save(path);
+	EXPECT_TRUE(TKnnIndex::IsIndexFile(path));
+	TKnnIndex mapped(params);
+	mapped.Load(path);
+	EXPECT_TRUE(mapped.IsMapped());
+	EXPECT_EQ(mapped.Size(), index.Size());
+	EXPECT_EQ(mapped.Predict(far_query.Row(0)), 7);
+	std::vector<int> mapped_labels;
+	mapped.Predict(queries, &mapped_labels);
+	EXPECT_EQ(mapped_labels, labels);
+	mapped.Insert(features.Row(0), cols, features.Label(0));
+	mapped.Save(path);
+	mapped.Load(path);
+	EXPECT_EQ(mapped.Size(), index.Size() + 1);
+	remove(path);
+}
+
+/**
+@function TEST(ClassifierTest, ConcurrentPredictOnSharedModel)
+Test that checks that copies of (@ref TModel) share one model, that prediction in a thread pool
+gives the labels of liblinear predict, and that threads predicting with one model at once agree
+*/
+
+TEST(ClassifierTest, ConcurrentPredictOnSharedModel) {
+	const size_t rows = 1000, cols = 24;
+	FeatureMatrix features = SyntheticFeatures(rows, cols, 3, 0.37f, 0.3f);
+	TClassifierParams params;
+	params.C = 1;
+	TModel model;
+	TrainCollectingOutput(params, features, &model);
+	TModel shared = model;
+	EXPECT_EQ(shared.get(), model.get());
+
+	TLabels expected;
+	std::vector<struct feature_node> x(cols + 1);
+	for (size_t i = 0 ; i < rows ; ++i) {
+		for (size_t j = 0 ; j < cols ; ++j) {
+			x[j].index = j + 1;
+			x[j].value = features.Row(i)[j];
+		}
+		x[cols].index = -1;
+		expected.push_back(int(predict(model.get(), &x[0])));
+	}
+	params.nr_thread = 4;
+	const TClassifier pooled(params);
+	TLabels labels(1, -7);
+	pooled.Predict(features, shared, &labels);
+	ASSERT_EQ(labels.size(), rows + 1);
+	EXPECT_EQ(labels[0], -7);
+	EXPECT_TRUE(std::equal(expected.begin(), expected.end(), labels.begin() + 1));
+
+	std::vector<TLabels> concurrent(4);
+	std::vector<std::thread> threads;
+	for (size_t t = 0 ; t < concurrent.size() ; ++t) {
+		threads.push_back(std::thread([&, t] {
+			TModel copy = shared;
+			if (t % 2) {
+				pooled.Predict(features, copy, &concurrent[t]);
+			} else {
+				TClassifier(TClassifierParams()).Predict(features, copy, &concurrent[t]);
+			}
+		}));
+	}
+	for (size_t t = 0 ; t < threads.size() ; ++t) {
+		threads[t].join();
+		EXPECT_EQ(concurrent[t], expected);
+	}
+}
+
+/**
+@function TEST(ShardsTest, MergedShardsEqualFullExtraction)
+Test that checks that shards extracted by forked workers and merged give the rows and labels
+of extracting all images at once, in the order of the file list, that shards extracted with other
+options are not merged and that no shard files are left when a worker fails
+*/
+
+TEST(ShardsTest, MergedShardsEqualFullExtraction) {
+	const size_t images = 7, workers = 3;
+	TFileList file_list;
+	for (size_t i = 0 ; i < images ; ++i) {
+		BMP image;
+		image.SetSize(40 + 4 * i, 48);
+		for (int y = 0 ; y < image.TellHeight() ; ++y) {
+			for (int x = 0 ; x < image.TellWidth() ; ++x) {
+				image(x, y)->Red = (x * (i + 1) + y) % 256;
+				image(x, y)->Green = (x + y * (i + 2)) % 256;
+				image(x, y)->Blue = (x * y + i) % 256;
+			}
+		}
+		std::ostringstream name;
+		name << "shards_test_" << i << ".bmp";
+		image.WriteToFile(name.str().c_str());
+		file_list.push_back(std::make_pair(name.str(), int(i % 3) - 1));
+	}
+	FeatureMatrix full;
+	for (size_t i = 0 ; i < images ; ++i) {
+		BMP image;
+		image.ReadFromFile(file_list[i].first.c_str());
+		std::vector<float> result;
+		ExtractDescriptor(&image, false, true, MAGNITUDE_FLOAT, result);
+		full.AppendRow(result, file_list[i].second);
+	}
+
+	std::vector<std::string> shard_files = ExtractInWorkers(file_list, "shards_test", workers, true,
+		MAGNITUDE_FLOAT, false);
+	ASSERT_EQ(shard_files.size(), workers);
+	FeatureMatrix merged;
+	EXPECT_ANY_THROW(MergeShards(shard_files, FeatureSource(file_list, MAGNITUDE_L1, false), &merged));
+	MergeShards(shard_files, FeatureSource(file_list, MAGNITUDE_FLOAT, false), &merged);
+	EXPECT_EQ(merged.Source(), FeatureSource(file_list, MAGNITUDE_FLOAT, false));
+	ASSERT_EQ(merged.Rows(), full.Rows());
+	ASSERT_EQ(merged.Cols(), full.Cols());
+	for (size_t row = 0 ; row < full.Rows() ; ++row) {
+		EXPECT_EQ(merged.Label(row), full.Label(row));
+		EXPECT_TRUE(std::equal(merged.Row(row), merged.Row(row) + full.Cols(), full.Row(row)));
+	}
+	for (size_t shard = 0 ; shard < shard_files.size() ; ++shard) {
+		remove(shard_files[shard].c_str());
+	}
+
+	// The last worker can't write its shard into a directory, shards of the others are removed
+	mkdir("shards_test.2", 0755);
+	EXPECT_ANY_THROW(ExtractInWorkers(file_list, "shards_test", workers, true, MAGNITUDE_FLOAT, false));
+	EXPECT_FALSE(std::ifstream("shards_test.0").good());
+	EXPECT_FALSE(std::ifstream("shards_test.1").good());
+	rmdir("shards_test.2");
+	for (size_t i = 0 ; i < images ; ++i) {
+		remove(file_list[i].first.c_str());
+	}
+}
 
 /**
 @function main
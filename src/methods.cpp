@@ -1,100 +1,116 @@
 #include "methods.h"
+#include "convolution.h"
+#include "grayscale.h"
 #include "EasyBMP.h"
 #include <smmintrin.h>
 #include <emmintrin.h>
 #include <xmmintrin.h>
 #include <math.h>
+#include <climits>
+#include <algorithm>
+#include <cstdint>
 
 /**
 @file methods.cpp
 This file contains the main functions for computing the HOG descriptor
 */
 
-///RED constant used for grayscale tranform
-#define RED 0.299
-///GREEN constant used for grayscale tranform
-#define GREEN 0.587
-///BLUE constant used for grayscale tranform
-#define BLUE 0.114
+static_assert(sizeof(RGBApixel) == 4, "EasyBMP pixels must be packed BGRA");
+
+///Number of image columns converted by (@ref BgraToGrayscale) before they are written to rows of the result
+const uint GRAY_COLUMN_BLOCK = 8;
+///Smoothing kernel of the 3x3 Sobel filter for (@ref ApplyGradient)
+const Image SOBEL_SMOOTH = {1, 2, 1};
+///Derivative kernel of the 3x3 Sobel filter for (@ref ApplyGradient)
+const Image SOBEL_DERIV = {-1, 0, 1};
 
 /**
 @function ImgToGrayscale
-Converts BMP color image to Grayscale
+Converts BMP color image to Grayscale with the fixed-point weights of grayscale.h.
+EasyBMP keeps every column of pixels as a contiguous BGRA array, so columns are converted
+by (@ref BgraToGrayscale) in blocks of (@ref GRAY_COLUMN_BLOCK) and then written to the rows of the result
 @param img is a pointer to color image
+@param useSse is a bool that specifies whether sse (or avx2) intrinsics will be used
 */
-Image ImgToGrayscale(BMP *img) {
-	Image newImg(img->TellHeight(), img->TellWidth());
-	for (uint i = 0 ; i < newImg.n_rows ; ++i) {
-		for (uint j = 0 ; j < newImg.n_cols ; ++j) {
-			auto pixel = img->GetPixel(j, i);
-			short value = pixel.Red * RED + pixel.Green * GREEN + pixel.Blue * BLUE;
-			newImg(i, j) = value;
+Image ImgToGrayscale(BMP *img, bool useSse) {
+	uint height = img->TellHeight();
+	uint width = img->TellWidth();
+	Image newImg(height, width);
+	MatrixView<short> out = newImg.view();
+	std::vector<short> columns(GRAY_COLUMN_BLOCK * height);
+	for (uint x = 0 ; x < width ; x += GRAY_COLUMN_BLOCK) {
+		uint block = std::min(GRAY_COLUMN_BLOCK, width - x);
+		for (uint k = 0 ; k < block ; ++k) {
+			const unsigned char *column = (const unsigned char *) (*img)(x + k, 0);
+			BgraToGrayscale(column, &columns[k * height], height, useSse);
+		}
+		for (uint i = 0 ; i < height ; ++i) {
+			short *row = out.row(i) + x;
+			for (uint k = 0 ; k < block ; ++k) {
+				row[k] = columns[k * height + i];
+			}
 		}
 	}
 	return newImg;
 }
 
+/**
+@function ApplyGradient
+Computes horizontal and vertical gradients with separable kernels:
+hor = smooth^T * deriv, vert = deriv^T * smooth. Both convolutions share one sweep over img
+(see (@ref convolve_separable_pair)). Sobel 3x3 is smooth = {1, 2, 1}, deriv = {-1, 0, 1},
+Sobel 5x5 is smooth = {1, 4, 6, 4, 1}, deriv = {-1, -2, 0, 2, 1}
+@param img is (@ref Image) to which the filters will be applied
+@param smooth is the smoothing kernel (one row with odd number of coefficients)
+@param deriv is the derivative kernel (one row with odd number of coefficients)
+@param hor is the img convolved with horizontal gradient filter
+@param vert is the img convolved with vertical gradient filter
+*/
+void ApplyGradient(const Image &img, const Image &smooth, const Image &deriv, Image &hor, Image &vert) {
+	convolve_separable_pair(img, deriv, smooth, hor, smooth, deriv, vert);
+}
+
 /**
 @function ApplySobel
 Applies horizontal and vertical Sobel filter to img 
 @param img is (@ref Image) to which Sobel filters will be applied
 @param hor is the img convolved with horizontal Sobel filter
 @param vert is the img convolved with vertical Sobel filter
+@param useSse is a bool that specifies whether sse intrinsics (separable convolution) will be used
 */
 
 void ApplySobel(const Image &img, Image &hor, Image &vert, bool useSse) {
 	if (!useSse) {
-		hor = img.unary_map(HorSobel());
-		vert = img.unary_map(VertSobel());
+		hor = stencil_map(img, HorSobel());
+		vert = stencil_map(img, VertSobel());
 	}
 	else {
-		Image extraImg = img.extra_borders(FILTER_RADIUS, FILTER_RADIUS);
-		uint j, leftElems = img.n_cols % SSE_BLOCK_SIZE;
-		uint blockElems =  img.n_cols - leftElems;
-		uint stride = extraImg.getStride();
-		short *ptr = extraImg.getData().get();
-		short *horPtr = hor.getData().get();
-		short *vertPtr = vert.getData().get();
-		for (uint i = 0 ; i < img.n_rows ; ++i) {
-			for (j = 0; j <  blockElems ; j += SSE_BLOCK_SIZE) {
-				__m128i A = _mm_loadu_si128((__m128i *) (ptr + i       * stride + j    ));
-				__m128i B = _mm_loadu_si128((__m128i *) (ptr + i       * stride + j + 1));
-				__m128i C = _mm_loadu_si128((__m128i *) (ptr + i       * stride + j + 2));
-				__m128i D = _mm_loadu_si128((__m128i *) (ptr + (i + 1) * stride + j    ));
-				__m128i F = _mm_loadu_si128((__m128i *) (ptr + (i + 1) * stride + j + 2));
-				__m128i G = _mm_loadu_si128((__m128i *) (ptr + (i + 2) * stride + j    ));
-				__m128i H = _mm_loadu_si128((__m128i *) (ptr + (i + 2) * stride + j + 1));
-				__m128i I = _mm_loadu_si128((__m128i *) (ptr + (i + 2) * stride + j + 2));
-					//X = (D - F) + (D - F) + A - I - C + G
-					//Y = (B - H) + (B - H) + A - I + C - G
-
-
-				__m128i  tmpX = _mm_sub_epi16(F, D);
-				__m128i  tmpY = _mm_sub_epi16(H, B);
-				__m128i  tmpAI = _mm_sub_epi16(I, A);
-				__m128i  tmpCG = _mm_sub_epi16(C, G);
-
-				__m128i X = _mm_add_epi16(tmpX, tmpX);
-				X = _mm_add_epi16(X, tmpAI);
-				X = _mm_add_epi16(X, tmpCG);
-
-				__m128i Y = _mm_add_epi16(tmpY, tmpY);
-				Y = _mm_add_epi16(Y, tmpAI);
-				Y = _mm_sub_epi16(Y, tmpCG);
-
-				_mm_storeu_si128((__m128i *) (horPtr +  i * img.getStride() + j), X);
-				_mm_storeu_si128((__m128i *) (vertPtr + i * img.getStride() + j), Y);
-
-			}
-			for (; j < img.n_cols ; ++j) {
-				auto mat = extraImg.submatrix(i, j, 2 * FILTER_RADIUS + 1, 2 * FILTER_RADIUS + 1);
-				hor(i, j) = -mat(0, 0) - 2 * mat(1, 0) - mat(2, 0) + mat(0, 2) + 2 * mat(1, 2) + mat(2, 2);
-				vert(i, j) = -mat(0, 0) - 2 * mat(0, 1) - mat(0, 2) + mat(2, 0) + 2 * mat(2, 1) + mat(2, 2);
-			}
-		}
+		ApplyGradient(img, SOBEL_SMOOTH, SOBEL_DERIV, hor, vert);
 	}
 }
 
+/**
+@function SseMagnitude::apply_block
+Computes (@ref SSE_BLOCK_SIZE) magnitudes using sse intrinsics
+@param out is the pointer to the first of the computed magnitudes
+@param x is the pointer to horizontal Sobel values
+@param y is the pointer to vertical Sobel values
+*/
+void SseMagnitude::apply_block(float *out, const short *x, const short *y) const {
+	__m128i xShort = _mm_loadu_si128((const __m128i *) x);
+	__m128i yShort = _mm_loadu_si128((const __m128i *) y);
+
+	__m128 XLo = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(xShort));
+	__m128 XHi = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(xShort, 8)));
+	__m128 YLo = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(yShort));
+	__m128 YHi = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(yShort, 8)));
+
+	__m128 sumLo = _mm_add_ps(_mm_mul_ps(XLo, XLo), _mm_mul_ps(YLo, YLo));
+	__m128 sumHi = _mm_add_ps(_mm_mul_ps(XHi, XHi), _mm_mul_ps(YHi, YHi));
+	_mm_storeu_ps(out, _mm_sqrt_ps(sumLo));
+	_mm_storeu_ps(out + SSE_FLOAT_BLOCK_SIZE, _mm_sqrt_ps(sumHi));
+}
+
 /**
 @function GetMagnitude
 Compute the matrix of gradients` magnitudes
@@ -102,69 +118,154 @@ Compute the matrix of gradients` magnitudes
 @param vert is the vertical Sobel matrix
 @param useSse is a bool that specifies whether sse  intrinsics will be used
 */
-floatImage GetMagnitude(const Image &hor, const Image &vert, bool useSse) {
-	floatImage magn(hor.n_rows, hor.n_cols);
+floatImage GetMagnitude(ImageView hor, ImageView vert, bool useSse) {
 	if (!useSse) {
-		for (uint i = 0 ; i < hor.n_rows ; ++i) {
-			for (uint j = 0 ; j < hor.n_cols ; ++j) {
-				magn(i, j) = sqrt(pow(hor(i, j), 2) + pow(vert(i, j), 2));
-			}
-		}
-	}
-	else {
-		uint j, leftElems = hor.n_cols % SSE_FLOAT_BLOCK_SIZE;
-		uint blockElems =  hor.n_cols - leftElems;
-		uint stride = hor.getStride();
-		short *horPtr = hor.getData().get();
-		short *vertPtr = vert.getData().get();
-		float *tmp = new float[SSE_FLOAT_BLOCK_SIZE];
-		for (uint i = 0 ; i < hor.n_rows ; ++i) {
-			for (j = 0; j <  blockElems ; j += SSE_FLOAT_BLOCK_SIZE) {
-				uint cur = i * stride + j;
-
-				__m128i xInt = _mm_setr_epi32( horPtr[cur],  horPtr[cur+1],  horPtr[cur+2],  horPtr[cur+3]);
-				__m128i yInt = _mm_setr_epi32(vertPtr[cur], vertPtr[cur+1], vertPtr[cur+2], vertPtr[cur+3]);
-				
-				__m128 X = _mm_cvtepi32_ps(xInt);
-				__m128 Y = _mm_cvtepi32_ps(yInt);
-				
-				X = _mm_mul_ps(X, X);
-				Y = _mm_mul_ps(Y, Y);
-
-				__m128 sum = _mm_add_ps(X, Y);
-				__m128 res = _mm_sqrt_ps(sum);
-				_mm_storeu_ps(tmp, res);
-
-				for (uint k = 0 ; k < SSE_FLOAT_BLOCK_SIZE ; ++k) {
-					magn(i, j + k) = tmp[k];
-				}
-			}
-			for (; j < hor.n_cols ; ++j) {
-				magn(i, j) = sqrt(pow(hor(i, j), 2) + pow(vert(i, j), 2));
-			}
-		}
-		delete tmp;
+		return nary_map(Magnitude(), hor, vert);
 	}
-	return magn;
+	return nary_map(SseMagnitude(), hor, vert);
 }
 
 /**
-@function GetHist
-Compute the histogram of gradients using the horizontal Sobel, vertical Sobel and magnitudes` matrixes
+@function SaturateGradient
+Maps -32768 to -32767 so that the absolute value fits in short
+*/
+static inline int SaturateGradient(short x) {
+	return std::max(int(x), -SHRT_MAX);
+}
+
+/**
+@function LoadGradient
+Loads (@ref SSE_BLOCK_SIZE) gradients and saturates them as (@ref SaturateGradient)
+*/
+static inline __m128i LoadGradient(const short *x) {
+	return _mm_max_epi16(_mm_loadu_si128((const __m128i *) x), _mm_set1_epi16(-SHRT_MAX));
+}
+
+unsigned short L1Magnitude::operator () (short x, short y) const {
+	return std::abs(SaturateGradient(x)) + std::abs(SaturateGradient(y));
+}
+
+/**
+@function L1Magnitude::ApplySse
+Computes (@ref SSE_BLOCK_SIZE) L1 magnitudes using sse intrinsics
+@param out is the pointer to the first of the computed magnitudes
+@param x is the pointer to horizontal Sobel values
+@param y is the pointer to vertical Sobel values
+*/
+void L1Magnitude::ApplySse(unsigned short *out, const short *x, const short *y) {
+	__m128i absX = _mm_abs_epi16(LoadGradient(x));
+	__m128i absY = _mm_abs_epi16(LoadGradient(y));
+	_mm_storeu_si128((__m128i *) out, _mm_add_epi16(absX, absY));
+}
+
+unsigned short AlphaBetaMagnitude::operator () (short x, short y) const {
+	int absX = std::abs(SaturateGradient(x));
+	int absY = std::abs(SaturateGradient(y));
+	int maxXY = std::max(absX, absY);
+	int minXY = std::min(absX, absY);
+	return maxXY + (minXY >> 2) + (minXY >> 3);
+}
+
+/**
+@function AlphaBetaMagnitude::ApplySse
+Computes (@ref SSE_BLOCK_SIZE) alpha max plus beta min magnitudes using sse intrinsics
+@param out is the pointer to the first of the computed magnitudes
+@param x is the pointer to horizontal Sobel values
+@param y is the pointer to vertical Sobel values
+*/
+void AlphaBetaMagnitude::ApplySse(unsigned short *out, const short *x, const short *y) {
+	__m128i absX = _mm_abs_epi16(LoadGradient(x));
+	__m128i absY = _mm_abs_epi16(LoadGradient(y));
+	__m128i maxXY = _mm_max_epu16(absX, absY);
+	__m128i minXY = _mm_min_epu16(absX, absY);
+	__m128i beta = _mm_add_epi16(_mm_srli_epi16(minXY, 2), _mm_srli_epi16(minXY, 3));
+	_mm_storeu_si128((__m128i *) out, _mm_add_epi16(maxXY, beta));
+}
+
+unsigned short IntSqrtMagnitude::operator () (short x, short y) const {
+	int satX = SaturateGradient(x);
+	int satY = SaturateGradient(y);
+	return unsigned(std::sqrt(double(satX * satX + satY * satY)));
+}
+
+/**
+@function IntSqrt
+Integer square root of 4 ints below 2^31: float estimate is corrected by one
+in either direction, comparing s - r^2 with 0 and 2r to stay in 32 bits
+*/
+static inline __m128i IntSqrt(__m128i s) {
+	__m128i r = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(s)));
+	__m128i rest = _mm_sub_epi32(s, _mm_mullo_epi32(r, r));
+	r = _mm_add_epi32(r, _mm_cmplt_epi32(rest, _mm_setzero_si128()));
+	r = _mm_sub_epi32(r, _mm_cmpgt_epi32(rest, _mm_add_epi32(r, r)));
+	return r;
+}
+
+/**
+@function IntSqrtMagnitude::ApplySse
+Computes (@ref SSE_BLOCK_SIZE) integer magnitudes using sse intrinsics.
+pmaddwd of interleaved (x, y) pairs gives x^2 + y^2 in 32 bits
+@param out is the pointer to the first of the computed magnitudes
+@param x is the pointer to horizontal Sobel values
+@param y is the pointer to vertical Sobel values
+*/
+void IntSqrtMagnitude::ApplySse(unsigned short *out, const short *x, const short *y) {
+	__m128i gradX = LoadGradient(x);
+	__m128i gradY = LoadGradient(y);
+	__m128i lo = _mm_unpacklo_epi16(gradX, gradY);
+	__m128i hi = _mm_unpackhi_epi16(gradX, gradY);
+	__m128i rootLo = IntSqrt(_mm_madd_epi16(lo, lo));
+	__m128i rootHi = IntSqrt(_mm_madd_epi16(hi, hi));
+	_mm_storeu_si128((__m128i *) out, _mm_packus_epi32(rootLo, rootHi));
+}
+
+/**
+@function GetMagnitude
+Compute the matrix of integer gradients` magnitudes
 @param hor is the horizontal Sobel matrix
 @param vert is the vertical Sobel matrix
-@param magn is the magnitudes` matrix
+@param mode is the integer approximation, (@ref MAGNITUDE_FLOAT) is not accepted
+@param useSse is a bool that specifies whether sse  intrinsics will be used
 */
-std::vector<float> GetHist(const Image &hor, const Image &vert, const floatImage &magn) {
-	std::vector<float> result(SEGMENT_COUNT);
+ushortImage GetMagnitude(ImageView hor, ImageView vert, MagnitudeMode mode, bool useSse) {
+	switch (mode) {
+	case MAGNITUDE_L1:
+		return useSse ? nary_map(SseBlockMagnitude<L1Magnitude>(), hor, vert) : nary_map(L1Magnitude(), hor, vert);
+	case MAGNITUDE_ALPHA_BETA:
+		return useSse ? nary_map(SseBlockMagnitude<AlphaBetaMagnitude>(), hor, vert) : nary_map(AlphaBetaMagnitude(), hor, vert);
+	case MAGNITUDE_ISQRT:
+		return useSse ? nary_map(SseBlockMagnitude<IntSqrtMagnitude>(), hor, vert) : nary_map(IntSqrtMagnitude(), hor, vert);
+	default:
+		throw std::string("Magnitude mode is not integer");
+	}
+}
+
+/**
+@function GetSection
+Index of the histogram segment of the gradient (x, y)
+*/
+static inline uint GetSection(short x, short y) {
+	float angle = atan2(y, x);
+	uint section = uint(SEGMENT_COUNT * (angle + M_PI) / (2 * M_PI));
+	return (section == SEGMENT_COUNT) ? SEGMENT_COUNT - 1 : section;
+}
+
+/**
+@function ComputeHist
+Histogram of gradients with bins of type AccT, normalized to unit length
+*/
+template<typename AccT, typename MagnT>
+static std::vector<float> ComputeHist(ImageView hor, ImageView vert, MatrixView<const MagnT> magn) {
+	AccT bins[SEGMENT_COUNT] = {};
 	for (uint i = 0 ; i < hor.n_rows ; ++i) {
+		const short *horPtr = hor.row(i);
+		const short *vertPtr = vert.row(i);
+		const MagnT *magnPtr = magn.row(i);
 		for (uint j = 0 ; j < hor.n_cols ; ++j) {
-			float angle = atan2(vert(i,j), hor(i,j));
-			uint section = uint(SEGMENT_COUNT * (angle + M_PI) / (2 * M_PI));
-			section = (section == SEGMENT_COUNT) ? SEGMENT_COUNT - 1 : section;
-			result[section] += magn(i, j);
+			bins[GetSection(horPtr[j], vertPtr[j])] += magnPtr[j];
 		}
 	}
+	std::vector<float> result(bins, bins + SEGMENT_COUNT);
 	float sum = 0;
 	for (uint i = 0 ; i < SEGMENT_COUNT ; ++i) {
 		sum += result[i] * result[i];
@@ -177,6 +278,28 @@ std::vector<float> GetHist(const Image &hor, const Image &vert, const floatImage
 	}
 	return result;
 }
+
+/**
+@function GetHist
+Compute the histogram of gradients using the horizontal Sobel, vertical Sobel and magnitudes` matrixes
+@param hor is the horizontal Sobel matrix
+@param vert is the vertical Sobel matrix
+@param magn is the magnitudes` matrix
+*/
+std::vector<float> GetHist(ImageView hor, ImageView vert, floatImageView magn) {
+	return ComputeHist<float>(hor, vert, magn);
+}
+
+/**
+@function GetHist
+Same as (@ref GetHist) for integer magnitudes, bins are accumulated in 64-bit integers
+@param hor is the horizontal Sobel matrix
+@param vert is the vertical Sobel matrix
+@param magn is the integer magnitudes` matrix
+*/
+std::vector<float> GetHist(ImageView hor, ImageView vert, ushortImageView magn) {
+	return ComputeHist<uint64_t>(hor, vert, magn);
+}
 /**
 @function sech
 Compute sech(x) == 1/sec(x)
@@ -209,6 +332,28 @@ std::vector<float> ApplyHIKernel(const std::vector<float> &preHI) {
 	}
 	return postHI;
 }
+/**
+@function ComputeDescriptor
+Divides the image into cellCount x cellCount cells and appends their histograms to result
+*/
+template<typename MagnT>
+static void ComputeDescriptor(ImageView hor, ImageView vert, MatrixView<const MagnT> magn, uint cellCount, std::vector<float> &result) {
+	for (uint i = 0 ; i < cellCount ; ++i) {
+		for (uint j = 0 ; j < cellCount ; ++j) {
+			uint rows = (i == cellCount - 1) ? hor.n_rows - i * hor.n_rows / cellCount : hor.n_rows / cellCount;
+			uint cols = (j == cellCount - 1) ? hor.n_cols - j * hor.n_cols / cellCount : hor.n_cols / cellCount;
+			uint x = i * hor.n_rows / cellCount;
+			uint y = j * hor.n_cols / cellCount;
+			ImageView subHor = hor.submatrix(x, y, rows, cols);
+			ImageView subVert = vert.submatrix(x, y, rows, cols);
+			MatrixView<const MagnT> subMagn = magn.submatrix(x, y, rows, cols);
+			std::vector<float> tmp;
+			tmp = GetHist(subHor, subVert, subMagn);
+			result.insert(result.end(), tmp.begin(), tmp.end());
+		} 
+	}
+}
+
 /**
 @function GetDescriptor
 Divides the image, computes the HOG descriptor using the horizontal Sobel, 
@@ -220,21 +365,58 @@ and appends it to the result vector
 @param result is the vector to which the HOG descriptor will be appended
 */
 
-void GetDescriptor(const Image &hor, const Image &vert, const floatImage &magn, std::vector<float> &result) {
-	for (uint i = 0 ; i < CELL_COUNT ; ++i) {
-		for (uint j = 0 ; j < CELL_COUNT ; ++j) {
-			uint rows = (i == CELL_COUNT - 1) ? hor.n_rows - i * hor.n_rows / CELL_COUNT : hor.n_rows / CELL_COUNT;
-			uint cols = (j == CELL_COUNT - 1) ? hor.n_cols - j * hor.n_cols / CELL_COUNT : hor.n_cols / CELL_COUNT;
-			uint x = i * hor.n_rows / CELL_COUNT;
-			uint y = j * hor.n_cols / CELL_COUNT;
-			Image subHor = hor.submatrix(x, y, rows, cols);
-			Image subVert = vert.submatrix(x, y, rows, cols);
-			floatImage subMagn = magn.submatrix(x, y, rows, cols);
-			std::vector<float> tmp;
-			tmp = GetHist(subHor, subVert, subMagn);
-			result.insert(result.end(), tmp.begin(), tmp.end());
-		} 
+void GetDescriptor(ImageView hor, ImageView vert, floatImageView magn, std::vector<float> &result) {
+	ComputeDescriptor(hor, vert, magn, CELL_COUNT, result);
+}
+
+/**
+@function GetDescriptor
+Same as (@ref GetDescriptor) for integer magnitudes
+@param hor is the horizontal Sobel matrix
+@param vert is the vertical Sobel matrix
+@param magn is the integer magnitudes` matrix
+@param result is the vector to which the HOG descriptor will be appended
+*/
+void GetDescriptor(ImageView hor, ImageView vert, ushortImageView magn, std::vector<float> &result) {
+	ComputeDescriptor(hor, vert, magn, CELL_COUNT, result);
+}
+
+/**
+@function GetDescriptor
+Same as (@ref GetDescriptor) with cellCount x cellCount cells instead of (@ref CELL_COUNT) x (@ref CELL_COUNT)
+@param hor is the horizontal Sobel matrix
+@param vert is the vertical Sobel matrix
+@param magn is the magnitudes` matrix
+@param cellCount is the number of cells in each direction
+@param result is the vector to which the HOG descriptor will be appended
+*/
+void GetDescriptor(ImageView hor, ImageView vert, floatImageView magn, uint cellCount, std::vector<float> &result) {
+	ComputeDescriptor(hor, vert, magn, cellCount, result);
+}
+
+/**
+@function Downsample
+Reduces the image factor times in each direction, every pixel is the mean of a factor x factor block.
+The last rows and columns which don't make a whole block are dropped
+@param img is the image to reduce
+@param factor is the size of a block
+*/
+Image Downsample(ImageView img, uint factor) {
+	Image small(img.n_rows / factor, img.n_cols / factor);
+	std::vector<int> sums(small.n_cols);
+	for (uint i = 0 ; i < small.n_rows ; ++i) {
+		std::fill(sums.begin(), sums.end(), 0);
+		for (uint k = 0 ; k < factor ; ++k) {
+			const short *row = img.row(i * factor + k);
+			for (uint j = 0 ; j < small.n_cols * factor ; ++j) {
+				sums[j / factor] += row[j];
+			}
+		}
+		for (uint j = 0 ; j < small.n_cols ; ++j) {
+			small(i, j) = short(sums[j] / int(factor * factor));
+		}
 	}
+	return small;
 }
 
 /**
@@ -0,0 +1,94 @@
+#include "online_classifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+/**
+@file online_classifier.cpp
+Implementation of (@ref TOnlineClassifier)
+*/
+
+TOnlineClassifier::TOnlineClassifier(size_t number_of_features, const TOnlineClassifierParams& params)
+    : cols_(number_of_features),
+      params_(params),
+      eta0_(params.eta0),
+      samples_(0) {
+    if (cols_ == 0 || params_.lambda <= 0)
+        throw std::string("Online classifier needs features and positive lambda");
+}
+
+void TOnlineClassifier::Update(const float* row, int label) {
+    if (std::find(labels_.begin(), labels_.end(), label) == labels_.end()) {
+        labels_.push_back(label);
+        weights_.resize(labels_.size() * cols_, 0);
+        averages_.resize(labels_.size() * cols_, 0);
+    }
+    if (eta0_ == 0) {
+        double norm = 0;
+        for (size_t j = 0; j < cols_; ++j)
+            norm += double(row[j]) * row[j];
+        eta0_ = norm > 0 ? 0.5 / norm : 1;
+    }
+
+    const double lambda = params_.lambda;
+    const double eta = eta0_ / std::pow(1 + lambda * eta0_ * samples_, 0.75);
+        // Average is the current weights until averaging starts
+    const double mu = samples_ < params_.averaging_start ? 1 : 1.0 / (samples_ - params_.averaging_start + 1);
+    for (size_t k = 0; k < labels_.size(); ++k) {
+        double* w = &weights_[k * cols_];
+        double* average = &averages_[k * cols_];
+        double y = labels_[k] == label ? 1 : -1;
+        double margin = 0;
+        for (size_t j = 0; j < cols_; ++j)
+            margin += w[j] * row[j];
+        margin *= y;
+            // Gradient of max(0, 1 - margin)^2 is -2 (1 - margin) y x
+        double decay = 1 - eta * lambda;
+        double step = margin < 1 ? 2 * eta * (1 - margin) * y : 0;
+        for (size_t j = 0; j < cols_; ++j) {
+            w[j] = decay * w[j] + step * row[j];
+            average[j] += mu * (w[j] - average[j]);
+        }
+    }
+    ++samples_;
+}
+
+void TOnlineClassifier::GetModel(TModel* model) const {
+    if (samples_ == 0)
+        throw std::string("Online classifier has seen no samples");
+
+        // Classes in the order of liblinear train(): first appearance, +1 before -1
+    std::vector<size_t> order(labels_.size());
+    for (size_t k = 0; k < order.size(); ++k)
+        order[k] = k;
+    if (labels_.size() == 2 && labels_[0] == -1 && labels_[1] == 1)
+        std::swap(order[0], order[1]);
+
+    int nr_class = labels_.size();
+    int nr_w = nr_class == 2 ? 1 : nr_class;
+    struct model* result = (struct model*) malloc(sizeof(struct model));
+    memset(&result->param, 0, sizeof(result->param));
+    result->param.solver_type = L2R_L2LOSS_SVC;
+    result->param.C = 1 / (params_.lambda * samples_);
+    result->param.nr_thread = 1;
+    result->nr_class = nr_class;
+    result->nr_feature = cols_;
+    result->bias = -1;
+    result->label = (int*) malloc(nr_class * sizeof(int));
+    result->w = (double*) malloc(cols_ * nr_w * sizeof(double));
+    for (int k = 0; k < nr_class; ++k)
+        result->label[k] = labels_[order[k]];
+    for (size_t j = 0; j < cols_; ++j) {
+        if (nr_w == 1) {
+                // One vector positive for the first class, both one-vs-rest vectors estimate it
+            result->w[j] = (averages_[order[0] * cols_ + j] - averages_[order[1] * cols_ + j]) / 2;
+            continue;
+        }
+        for (int k = 0; k < nr_w; ++k)
+            result->w[j * nr_w + k] = averages_[order[k] * cols_ + j];
+    }
+    *model = result;
+}
@@ -0,0 +1,379 @@
+#include "projection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <stdint.h>
+#include <smmintrin.h>
+
+/**
+@file projection.cpp
+Implementation of (@ref Gemm) and (@ref TProjection)
+*/
+
+///Rows of A and C in one block of (@ref Gemm)
+static const size_t GEMM_ROW_BLOCK = 64;
+///Columns of B and C in one block of (@ref Gemm)
+static const size_t GEMM_COL_BLOCK = 256;
+///Rows of B in one block of (@ref Gemm), a block of B takes 256 KB and stays in L2 cache for all row blocks
+static const size_t GEMM_DEPTH_BLOCK = 256;
+
+///Directions (@ref TProjection::Pca) iterates in addition to the requested ones, for accuracy of the last of them
+static const size_t PCA_OVERSAMPLE = 10;
+///Number of power iterations of (@ref TProjection::Pca)
+static const int PCA_POWER_ITERATIONS = 2;
+
+///Magic number in the beginning of a projection file
+static const char PROJECTION_FILE_MAGIC[4] = {'P', 'R', 'O', 'J'};
+///Version of projection file layout
+static const uint32_t PROJECTION_FILE_VERSION = 1;
+
+/**
+@struct ProjectionFileHeader
+Header of a projection file, the mean and the basis follow it
+*/
+struct ProjectionFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t cols;
+    uint64_t dims;
+};
+
+/**
+@function GemmBlock
+C += A * B on one block, element (i, p) of A is a[i * a_row + p * a_col]
+*/
+static void GemmBlock(const float* a, size_t a_row, size_t a_col, const float* b, size_t ldb, float* c, size_t ldc,
+    size_t rows, size_t cols, size_t depth) {
+    for (size_t i = 0; i < rows; ++i)
+        for (size_t p = 0; p < depth; ++p) {
+            const float value = a[i * a_row + p * a_col];
+            for (size_t j = 0; j < cols; ++j)
+                c[i * ldc + j] += value * b[p * ldb + j];
+        }
+}
+
+/**
+@function GemmBlockSse
+Same as (@ref GemmBlock) with sse: 4 rows x 8 columns of C stay in registers for the whole depth of the block,
+every row of B is loaded once for 4 rows of A
+*/
+static void GemmBlockSse(const float* a, size_t a_row, size_t a_col, const float* b, size_t ldb, float* c, size_t ldc,
+    size_t rows, size_t cols, size_t depth) {
+    const size_t wide_cols = cols / 8 * 8;
+    size_t i = 0;
+    for (; i + 4 <= rows; i += 4) {
+        const float* a0 = a + i * a_row;
+        for (size_t j = 0; j < wide_cols; j += 8) {
+            float* c0 = c + i * ldc + j;
+            __m128 c00 = _mm_loadu_ps(c0), c01 = _mm_loadu_ps(c0 + 4);
+            __m128 c10 = _mm_loadu_ps(c0 + ldc), c11 = _mm_loadu_ps(c0 + ldc + 4);
+            __m128 c20 = _mm_loadu_ps(c0 + 2 * ldc), c21 = _mm_loadu_ps(c0 + 2 * ldc + 4);
+            __m128 c30 = _mm_loadu_ps(c0 + 3 * ldc), c31 = _mm_loadu_ps(c0 + 3 * ldc + 4);
+            for (size_t p = 0; p < depth; ++p) {
+                const __m128 b0 = _mm_loadu_ps(b + p * ldb + j);
+                const __m128 b1 = _mm_loadu_ps(b + p * ldb + j + 4);
+                const float* ap = a0 + p * a_col;
+                __m128 value = _mm_set1_ps(ap[0]);
+                c00 = _mm_add_ps(c00, _mm_mul_ps(value, b0));
+                c01 = _mm_add_ps(c01, _mm_mul_ps(value, b1));
+                value = _mm_set1_ps(ap[a_row]);
+                c10 = _mm_add_ps(c10, _mm_mul_ps(value, b0));
+                c11 = _mm_add_ps(c11, _mm_mul_ps(value, b1));
+                value = _mm_set1_ps(ap[2 * a_row]);
+                c20 = _mm_add_ps(c20, _mm_mul_ps(value, b0));
+                c21 = _mm_add_ps(c21, _mm_mul_ps(value, b1));
+                value = _mm_set1_ps(ap[3 * a_row]);
+                c30 = _mm_add_ps(c30, _mm_mul_ps(value, b0));
+                c31 = _mm_add_ps(c31, _mm_mul_ps(value, b1));
+            }
+            _mm_storeu_ps(c0, c00);
+            _mm_storeu_ps(c0 + 4, c01);
+            _mm_storeu_ps(c0 + ldc, c10);
+            _mm_storeu_ps(c0 + ldc + 4, c11);
+            _mm_storeu_ps(c0 + 2 * ldc, c20);
+            _mm_storeu_ps(c0 + 2 * ldc + 4, c21);
+            _mm_storeu_ps(c0 + 3 * ldc, c30);
+            _mm_storeu_ps(c0 + 3 * ldc + 4, c31);
+        }
+            // Columns which don't fill 8 lanes
+        if (wide_cols < cols)
+            GemmBlock(a0, a_row, a_col, b + wide_cols, ldb, c + i * ldc + wide_cols, ldc, 4, cols - wide_cols, depth);
+    }
+        // Rows which don't fill 4 registers
+    if (i < rows)
+        GemmBlock(a + i * a_row, a_row, a_col, b, ldb, c + i * ldc, ldc, rows - i, cols, depth);
+}
+
+void Gemm(const float* a, size_t lda, bool transpose_a, const float* b, size_t ldb, float* c, size_t ldc,
+    size_t rows, size_t cols, size_t depth, bool useSse) {
+    const size_t a_row = transpose_a ? 1 : lda;
+    const size_t a_col = transpose_a ? lda : 1;
+    for (size_t i = 0; i < rows; ++i)
+        std::fill(c + i * ldc, c + i * ldc + cols, 0.0f);
+    for (size_t p = 0; p < depth; p += GEMM_DEPTH_BLOCK) {
+        const size_t block_depth = std::min(GEMM_DEPTH_BLOCK, depth - p);
+        for (size_t j = 0; j < cols; j += GEMM_COL_BLOCK) {
+            const size_t block_cols = std::min(GEMM_COL_BLOCK, cols - j);
+            for (size_t i = 0; i < rows; i += GEMM_ROW_BLOCK) {
+                const size_t block_rows = std::min(GEMM_ROW_BLOCK, rows - i);
+                if (useSse)
+                    GemmBlockSse(a + i * a_row + p * a_col, a_row, a_col, b + p * ldb + j, ldb, c + i * ldc + j, ldc,
+                        block_rows, block_cols, block_depth);
+                else
+                    GemmBlock(a + i * a_row + p * a_col, a_row, a_col, b + p * ldb + j, ldb, c + i * ldc + j, ldc,
+                        block_rows, block_cols, block_depth);
+            }
+        }
+    }
+}
+
+/**
+@function Orthonormalize
+Makes columns of the row-major rows x cols matrix orthonormal by modified Gram-Schmidt in double,
+applied twice for float input. Columns dependent on previous ones become zero
+*/
+static void Orthonormalize(std::vector<float>* matrix, size_t rows, size_t cols) {
+        // Column-major copy
+    std::vector<double> q(rows * cols);
+    for (size_t i = 0; i < rows; ++i)
+        for (size_t j = 0; j < cols; ++j)
+            q[j * rows + i] = (*matrix)[i * cols + j];
+    for (size_t j = 0; j < cols; ++j) {
+        double* column = &q[j * rows];
+        const double norm = std::sqrt(std::inner_product(column, column + rows, column, 0.0));
+        for (int pass = 0; pass < 2; ++pass)
+            for (size_t k = 0; k < j; ++k) {
+                const double* previous = &q[k * rows];
+                const double dot = std::inner_product(column, column + rows, previous, 0.0);
+                for (size_t i = 0; i < rows; ++i)
+                    column[i] -= dot * previous[i];
+            }
+        const double rest = std::sqrt(std::inner_product(column, column + rows, column, 0.0));
+        const double scale = rest > 1e-6 * norm && rest > 0 ? 1 / rest : 0;
+        for (size_t i = 0; i < rows; ++i)
+            column[i] *= scale;
+    }
+    for (size_t i = 0; i < rows; ++i)
+        for (size_t j = 0; j < cols; ++j)
+            (*matrix)[i * cols + j] = float(q[j * rows + i]);
+}
+
+/**
+@function JacobiEigen
+Eigenvalues and eigenvectors of the symmetric n x n matrix by cyclic Jacobi rotations.
+The diagonal of matrix becomes eigenvalues, columns of vectors are the eigenvectors
+*/
+static void JacobiEigen(std::vector<double>* matrix, size_t n, std::vector<double>* vectors) {
+    std::vector<double>& a = *matrix;
+    std::vector<double>& v = *vectors;
+    v.assign(n * n, 0);
+    for (size_t i = 0; i < n; ++i)
+        v[i * n + i] = 1;
+    for (int sweep = 0; sweep < 100; ++sweep) {
+        double off = 0, diagonal = 0;
+        for (size_t i = 0; i < n; ++i) {
+            diagonal += a[i * n + i] * a[i * n + i];
+            for (size_t j = i + 1; j < n; ++j)
+                off += a[i * n + j] * a[i * n + j];
+        }
+        if (off <= 1e-24 * diagonal)
+            break;
+        for (size_t p = 0; p < n; ++p)
+            for (size_t q = p + 1; q < n; ++q) {
+                const double apq = a[p * n + q];
+                if (apq == 0)
+                    continue;
+                    // Rotation in the plane (p, q) which zeroes a[p][q]
+                const double theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+                const double t = (theta >= 0 ? 1 : -1) / (std::fabs(theta) + std::sqrt(theta * theta + 1));
+                const double cosine = 1 / std::sqrt(t * t + 1);
+                const double sine = t * cosine;
+                for (size_t k = 0; k < n; ++k) {
+                    const double akp = a[k * n + p], akq = a[k * n + q];
+                    a[k * n + p] = cosine * akp - sine * akq;
+                    a[k * n + q] = sine * akp + cosine * akq;
+                }
+                for (size_t k = 0; k < n; ++k) {
+                    const double apk = a[p * n + k], aqk = a[q * n + k];
+                    a[p * n + k] = cosine * apk - sine * aqk;
+                    a[q * n + k] = sine * apk + cosine * aqk;
+                }
+                for (size_t k = 0; k < n; ++k) {
+                    const double vkp = v[k * n + p], vkq = v[k * n + q];
+                    v[k * n + p] = cosine * vkp - sine * vkq;
+                    v[k * n + q] = sine * vkp + cosine * vkq;
+                }
+            }
+    }
+}
+
+TProjection::TProjection()
+    : cols_(0),
+      dims_(0) {
+}
+
+TProjection TProjection::Pca(const FeatureMatrix& features, size_t dims, size_t sample_rows, unsigned seed,
+    bool useSse) {
+    const size_t cols = features.Cols();
+    const size_t rows = std::min(sample_rows, features.Rows());
+    if (dims == 0 || dims > cols || dims > rows)
+        throw std::string("Number of principal components must be positive and at most the number of features and samples");
+
+        // Sample of rows in the order of features, for locality
+    std::vector<size_t> order(features.Rows());
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937 random(seed);
+    std::shuffle(order.begin(), order.end(), random);
+    order.resize(rows);
+    std::sort(order.begin(), order.end());
+
+    TProjection projection;
+    projection.cols_ = cols;
+    projection.dims_ = dims;
+    std::vector<double> mean(cols, 0);
+    for (size_t i = 0; i < rows; ++i)
+        for (size_t j = 0; j < cols; ++j)
+            mean[j] += features.Row(order[i])[j];
+    projection.mean_.resize(cols);
+    for (size_t j = 0; j < cols; ++j)
+        projection.mean_[j] = float(mean[j] / rows);
+    std::vector<float> sample(rows * cols);
+    for (size_t i = 0; i < rows; ++i)
+        for (size_t j = 0; j < cols; ++j)
+            sample[i * cols + j] = features.Row(order[i])[j] - projection.mean_[j];
+
+        // Subspace iteration: the range of X * (X^T * X)^q * Omega for Gaussian Omega approximates the span
+        // of the leading left singular vectors of the centered sample X
+    const size_t rank = std::min(dims + PCA_OVERSAMPLE, rows);
+    std::normal_distribution<float> normal;
+    std::vector<float> omega(cols * rank);
+    for (size_t k = 0; k < omega.size(); ++k)
+        omega[k] = normal(random);
+    std::vector<float> range(rows * rank);
+    std::vector<float> coranged(cols * rank);
+    Gemm(&sample[0], cols, false, &omega[0], rank, &range[0], rank, rows, rank, cols, useSse);
+    for (int iteration = 0; iteration < PCA_POWER_ITERATIONS; ++iteration) {
+        Orthonormalize(&range, rows, rank);
+        Gemm(&sample[0], cols, true, &range[0], rank, &coranged[0], rank, cols, rank, rows, useSse);
+        Gemm(&sample[0], cols, false, &coranged[0], rank, &range[0], rank, rows, rank, cols, useSse);
+    }
+    Orthonormalize(&range, rows, rank);
+        // Z = X^T * Q, the right singular vectors of Z^T are Z * U / sigma for eigenvectors U of Z^T * Z
+    Gemm(&sample[0], cols, true, &range[0], rank, &coranged[0], rank, cols, rank, rows, useSse);
+    std::vector<float> gram(rank * rank);
+    Gemm(&coranged[0], rank, true, &coranged[0], rank, &gram[0], rank, rank, rank, cols, useSse);
+    std::vector<double> eigen(gram.begin(), gram.end());
+    std::vector<double> vectors;
+    JacobiEigen(&eigen, rank, &vectors);
+
+    std::vector<size_t> components(rank);
+    std::iota(components.begin(), components.end(), 0);
+    std::sort(components.begin(), components.end(), [&eigen, rank](size_t left, size_t right) {
+        return eigen[left * rank + left] > eigen[right * rank + right];
+    });
+    const double largest = std::max(eigen[components[0] * rank + components[0]], 0.0);
+    std::vector<float> rotation(rank * dims);
+    for (size_t d = 0; d < dims; ++d) {
+        const double value = eigen[components[d] * rank + components[d]];
+            // Directions of no variance are left zero
+        const double scale = value > 1e-12 * largest && value > 0 ? 1 / std::sqrt(value) : 0;
+        for (size_t k = 0; k < rank; ++k)
+            rotation[k * dims + d] = float(vectors[k * rank + components[d]] * scale);
+    }
+    projection.basis_.resize(cols * dims);
+    Gemm(&coranged[0], rank, false, &rotation[0], dims, &projection.basis_[0], dims, cols, dims, rank, useSse);
+    projection.UpdateOffset();
+    return projection;
+}
+
+TProjection TProjection::Random(size_t cols, size_t dims, unsigned seed) {
+    if (dims == 0 || cols == 0)
+        throw std::string("Random projection needs features and dimensions");
+    TProjection projection;
+    projection.cols_ = cols;
+    projection.dims_ = dims;
+    projection.mean_.assign(cols, 0.0f);
+    projection.basis_.resize(cols * dims);
+    std::mt19937 random(seed);
+    std::normal_distribution<float> normal(0.0f, float(1 / std::sqrt(double(dims))));
+    for (size_t k = 0; k < projection.basis_.size(); ++k)
+        projection.basis_[k] = normal(random);
+    projection.UpdateOffset();
+    return projection;
+}
+
+void TProjection::UpdateOffset() {
+    offset_.assign(dims_, 0.0f);
+    for (size_t j = 0; j < cols_; ++j)
+        for (size_t d = 0; d < dims_; ++d)
+            offset_[d] += mean_[j] * basis_[j * dims_ + d];
+}
+
+void TProjection::Apply(const float* rows, size_t stride, const int* labels, size_t count, FeatureMatrix* out,
+    bool useSse) const {
+    std::vector<float> projected(std::min(count, PROJECTION_BATCH) * dims_);
+    for (size_t first = 0; first < count; first += PROJECTION_BATCH) {
+        const size_t batch = std::min(PROJECTION_BATCH, count - first);
+        Gemm(rows + first * stride, stride, false, &basis_[0], dims_, &projected[0], dims_, batch, dims_, cols_, useSse);
+        for (size_t i = 0; i < batch; ++i) {
+            float* row = &projected[i * dims_];
+            for (size_t d = 0; d < dims_; ++d)
+                row[d] -= offset_[d];
+            out->AppendRow(row, dims_, labels[first + i]);
+        }
+    }
+}
+
+void TProjection::Apply(const FeatureMatrix& features, FeatureMatrix* out, bool useSse) const {
+    if (features.Cols() != cols_)
+        throw std::string("Number of features differs from the projection");
+    if (!features.Empty())
+        Apply(features.Row(0), features.Stride(), features.Labels(), features.Rows(), out, useSse);
+}
+
+void TProjection::Save(const std::string& file) const {
+    FILE* fp = fopen(file.c_str(), "wb");
+    if (!fp)
+        throw std::string("Can't open projection file ") + file;
+    ProjectionFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PROJECTION_FILE_MAGIC, sizeof(header.magic));
+    header.version = PROJECTION_FILE_VERSION;
+    header.cols = cols_;
+    header.dims = dims_;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    if (ok && !mean_.empty())
+        ok = fwrite(&mean_[0], cols_ * sizeof(float), 1, fp) == 1;
+    if (ok && !basis_.empty())
+        ok = fwrite(&basis_[0], cols_ * dims_ * sizeof(float), 1, fp) == 1;
+    if (fclose(fp) || !ok)
+        throw std::string("Can't write projection file ") + file;
+}
+
+void TProjection::Load(const std::string& file) {
+    FILE* fp = fopen(file.c_str(), "rb");
+    if (!fp)
+        throw std::string("Can't open projection file ") + file;
+    ProjectionFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+        !memcmp(header.magic, PROJECTION_FILE_MAGIC, sizeof(header.magic)) &&
+        header.version == PROJECTION_FILE_VERSION && header.cols && header.dims;
+    if (ok) {
+        mean_.resize(header.cols);
+        basis_.resize(header.cols * header.dims);
+        ok = fread(&mean_[0], mean_.size() * sizeof(float), 1, fp) == 1 &&
+            fread(&basis_[0], basis_.size() * sizeof(float), 1, fp) == 1;
+    }
+    fclose(fp);
+    if (!ok) {
+        *this = TProjection();
+        throw std::string("Bad projection file ") + file;
+    }
+    cols_ = header.cols;
+    dims_ = header.dims;
+    UpdateOffset();
+}
@@ -0,0 +1,285 @@
+#include "quantized.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <cpuid.h>
+#include <immintrin.h>
+
+/**
+@file quantized.cpp
+Implementation of (@ref QuantizedFeatures) and (@ref QuantizedModel)
+*/
+
+/**
+@function AlignUp
+Rounds size up to a multiple of alignment
+*/
+static size_t AlignUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+/**
+@function FloatToHalf
+Converts float to IEEE half precision, rounding to nearest even
+*/
+static uint16_t FloatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (((bits >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    if (exponent <= 0) {
+            // Subnormal half or zero
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t middle = 1u << (shift - 1);
+        if (rest > middle || (rest == middle && (half & 1)))
+            ++half;
+        return sign | half;
+    }
+    uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+        // Carry from mantissa correctly increments exponent
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        ++half;
+    return half;
+}
+
+/**
+@function HalfToFloat
+Converts IEEE half precision to float exactly
+*/
+static float HalfToFloat(uint16_t half) {
+    uint32_t sign = uint32_t(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        float value = std::ldexp(float(mantissa), -24);
+        return sign ? -value : value;
+    }
+    if (exponent == 31)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+QuantizedFeatures::QuantizedFeatures(QuantizedFormat format)
+    : format_(format),
+      rows_(0),
+      cols_(0),
+      stride_(0) {
+}
+
+QuantizedFeatures::QuantizedFeatures(const FeatureMatrix& features, QuantizedFormat format)
+    : format_(format),
+      rows_(0),
+      cols_(0),
+      stride_(0) {
+    Append(features);
+}
+
+void QuantizedFeatures::Append(const FeatureMatrix& features) {
+    if (!features.Rows())
+        return;
+    if (!rows_) {
+        cols_ = features.Cols();
+        stride_ = AlignUp(std::max<size_t>(cols_, 1), QUANT_ROW_ALIGNMENT);
+    }
+    else if (features.Cols() != cols_) {
+        throw std::string("Appended samples have a different number of features");
+    }
+    for (size_t i = 0; i < features.Rows(); ++i)
+        AppendRow(features.Row(i), features.Labels()[i]);
+}
+
+void QuantizedFeatures::AppendRow(const float* values, int label) {
+    labels_.push_back(label);
+    if (format_ == QUANT_FP16) {
+        halves_.resize((rows_ + 1) * stride_);
+        for (size_t j = 0; j < cols_; ++j)
+            halves_[rows_ * stride_ + j] = FloatToHalf(values[j]);
+        ++rows_;
+        return;
+    }
+
+    std::vector<float> row(stride_, 0);
+    std::copy(values, values + cols_, row.begin());
+    codes_.resize((rows_ + 1) * stride_);
+    scales_.resize((rows_ + 1) * Blocks());
+    offsets_.resize((rows_ + 1) * Blocks());
+    for (size_t block = 0; block < Blocks(); ++block) {
+        const float* block_values = &row[block * QUANT_BLOCK_SIZE];
+        float low = *std::min_element(block_values, block_values + QUANT_BLOCK_SIZE);
+        float high = *std::max_element(block_values, block_values + QUANT_BLOCK_SIZE);
+        float scale = (high - low) / 255;
+        uint8_t* codes = &codes_[rows_ * stride_ + block * QUANT_BLOCK_SIZE];
+        for (size_t j = 0; j < QUANT_BLOCK_SIZE; ++j) {
+            float code = scale > 0 ? (block_values[j] - low) / scale : 0;
+            codes[j] = uint8_t(std::min(255.0f, std::max(0.0f, code + 0.5f)));
+        }
+        scales_[rows_ * Blocks() + block] = scale;
+        offsets_[rows_ * Blocks() + block] = low;
+    }
+    ++rows_;
+}
+
+void QuantizedFeatures::Dequantize(size_t row, float* out) const {
+    if (format_ == QUANT_FP16) {
+        for (size_t j = 0; j < stride_; ++j)
+            out[j] = HalfToFloat(Halves(row)[j]);
+        return;
+    }
+    for (size_t j = 0; j < stride_; ++j) {
+        size_t block = j / QUANT_BLOCK_SIZE;
+        out[j] = Offsets(row)[block] + Codes(row)[j] * Scales(row)[block];
+    }
+}
+
+size_t QuantizedFeatures::Bytes() const {
+    return codes_.size() * sizeof(uint8_t) + halves_.size() * sizeof(uint16_t) +
+        (scales_.size() + offsets_.size()) * sizeof(float);
+}
+
+/**
+@function BlockDotSse
+Sum over blocks of scales[block] * (integer dot product of codes and weights in the block).
+pmaddubsw multiplies uint8 codes by int8 weights and adds pairs in 16 bits, pmaddwd adds them to 32 bits
+*/
+static float BlockDotSse(const uint8_t* codes, const int8_t* weights, const float* scales, size_t blocks) {
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128 sum = _mm_setzero_ps();
+    for (size_t block = 0; block < blocks; ++block) {
+        __m128i q = _mm_loadu_si128((const __m128i*) (codes + block * QUANT_BLOCK_SIZE));
+        __m128i w = _mm_loadu_si128((const __m128i*) (weights + block * QUANT_BLOCK_SIZE));
+        __m128i dot = _mm_madd_epi16(_mm_maddubs_epi16(q, w), ones);
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(dot), _mm_set1_ps(scales[block])));
+    }
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+/**
+@function BlockDotVnni
+Same as (@ref BlockDotSse) for two blocks at once with vpdpbusd, which adds four
+uint8 * int8 products straight to 32 bits. The number of blocks must be even
+*/
+__attribute__((target("avx2,avxvnni")))
+static float BlockDotVnni(const uint8_t* codes, const int8_t* weights, const float* scales, size_t blocks) {
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t block = 0; block < blocks; block += 2) {
+        __m256i q = _mm256_loadu_si256((const __m256i*) (codes + block * QUANT_BLOCK_SIZE));
+        __m256i w = _mm256_loadu_si256((const __m256i*) (weights + block * QUANT_BLOCK_SIZE));
+        __m256i dot = _mm256_dpbusd_avx_epi32(_mm256_setzero_si256(), q, w);
+        __m256 scale = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(scales[block])),
+            _mm_set1_ps(scales[block + 1]), 1);
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_cvtepi32_ps(dot), scale));
+    }
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+    return _mm_cvtss_f32(half);
+}
+
+/**
+@function HasAvxVnni
+Checks once whether the processor supports avx2 and avx-vnni (cpuid leaf 7, subleaf 1, eax bit 4)
+*/
+static bool HasAvxVnni() {
+    static const bool supported = [] {
+        unsigned eax, ebx, ecx, edx;
+        if (!__builtin_cpu_supports("avx2") || !__get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx))
+            return false;
+        return ((eax >> 4) & 1) != 0;
+    }();
+    return supported;
+}
+
+QuantizedModel::QuantizedModel(const struct model* model)
+    : cols_(get_nr_feature(model)),
+      stride_(AlignUp(std::max<size_t>(cols_, 1), QUANT_ROW_ALIGNMENT)),
+      nr_class_(get_nr_class(model)),
+      nr_w_((nr_class_ == 2 && model->param.solver_type != MCSVM_CS) ? 1 : nr_class_),
+      labels_(nr_class_),
+      weights_(nr_w_ * stride_, 0),
+      scales_(nr_w_),
+      block_sums_(nr_w_ * (stride_ / QUANT_BLOCK_SIZE), 0),
+      float_weights_(nr_w_ * stride_, 0),
+      bias_(nr_w_, 0) {
+    get_labels(model, &labels_[0]);
+    const size_t blocks = stride_ / QUANT_BLOCK_SIZE;
+    for (int k = 0; k < nr_w_; ++k) {
+        float* w = &float_weights_[k * stride_];
+        double largest = 0;
+        for (size_t j = 0; j < cols_; ++j) {
+            w[j] = model->w[j * nr_w_ + k];
+            largest = std::max(largest, std::fabs(model->w[j * nr_w_ + k]));
+        }
+        if (model->bias >= 0)
+            bias_[k] = model->w[cols_ * nr_w_ + k] * model->bias;
+        scales_[k] = largest / QUANT_WEIGHT_MAX;
+        for (size_t j = 0; j < cols_; ++j) {
+            int8_t q = scales_[k] > 0 ? int8_t(std::lround(model->w[j * nr_w_ + k] / scales_[k])) : 0;
+            weights_[k * stride_ + j] = q;
+            block_sums_[k * blocks + j / QUANT_BLOCK_SIZE] += q * scales_[k];
+        }
+    }
+}
+
+void QuantizedModel::DecisionValues(const QuantizedFeatures& features, size_t row, double* values) const {
+    if (features.Cols() != cols_)
+        throw std::string("Number of features differs from the model");
+    if (features.Format() == QUANT_FP16) {
+        std::vector<float> x(stride_);
+        features.Dequantize(row, &x[0]);
+        for (int k = 0; k < nr_w_; ++k) {
+            const float* w = &float_weights_[k * stride_];
+            double sum = bias_[k];
+            for (size_t j = 0; j < cols_; ++j)
+                sum += double(w[j]) * x[j];
+            values[k] = sum;
+        }
+        return;
+    }
+
+    const size_t blocks = features.Blocks();
+    const float* offsets = features.Offsets(row);
+    for (int k = 0; k < nr_w_; ++k) {
+        const int8_t* w = &weights_[k * stride_];
+        float dot = HasAvxVnni() ? BlockDotVnni(features.Codes(row), w, features.Scales(row), blocks)
+                                 : BlockDotSse(features.Codes(row), w, features.Scales(row), blocks);
+            // Offsets of blocks multiply sums of weights
+        const float* sums = &block_sums_[k * blocks];
+        double shift = 0;
+        for (size_t block = 0; block < blocks; ++block)
+            shift += offsets[block] * sums[block];
+        values[k] = double(scales_[k]) * dot + shift + bias_[k];
+    }
+}
+
+int QuantizedModel::Predict(const QuantizedFeatures& features, size_t row) const {
+    std::vector<double> values(nr_w_);
+    DecisionValues(features, row, &values[0]);
+    if (nr_w_ == 1)
+        return values[0] > 0 ? labels_[0] : labels_[1];
+    return labels_[std::max_element(values.begin(), values.end()) - values.begin()];
+}
+
+void QuantizedModel::Predict(const QuantizedFeatures& features, std::vector<int>* labels) const {
+    for (size_t row = 0; row < features.Rows(); ++row)
+        labels->push_back(Predict(features, row));
+}
@@ -0,0 +1,108 @@
+#include "shards.h"
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "EasyBMP.h"
+#include "extraction.h"
+
+/**
+@file shards.cpp
+Implementation of extraction and merge of feature shards and of (@ref TTemporaryFiles)
+*/
+
+uint64_t FeatureSource(const TFileList& file_list, MagnitudeMode mode, bool full) {
+    std::ostringstream description;
+    description << int(mode) << " " << full << "\n";
+    for (size_t image_idx = 0; image_idx < file_list.size(); ++image_idx)
+        description << file_list[image_idx].first << " " << file_list[image_idx].second << "\n";
+    const std::string& text = description.str();
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t idx = 0; idx < text.size(); ++idx)
+        hash = (hash ^ (unsigned char)text[idx]) * 1099511628211ULL;
+    return hash ? hash : 1;
+}
+
+void ExtractShard(const TFileList& file_list, const std::string& shard_file, size_t shard, size_t shards,
+    bool useSse, MagnitudeMode mode, bool full) {
+    FeatureMatrix features;
+    size_t first = file_list.size() * shard / shards;
+    size_t last = file_list.size() * (shard + 1) / shards;
+    for (size_t image_idx = first; image_idx < last; ++image_idx) {
+            // Images are loaded one by one
+        BMP image;
+        image.ReadFromFile(file_list[image_idx].first.c_str());
+        std::vector<float> result;
+        ExtractDescriptor(&image, full, useSse, mode, result);
+        features.AppendRow(result, file_list[image_idx].second);
+    }
+    features.SetSource(FeatureSource(file_list, mode, full));
+    features.Save(shard_file);
+}
+
+std::vector<std::string> ExtractInWorkers(const TFileList& file_list, const std::string& shard_prefix,
+    size_t workers, bool useSse, MagnitudeMode mode, bool full) {
+    std::vector<std::string> shard_files;
+    std::vector<pid_t> pids;
+    for (size_t shard = 0; shard < workers; ++shard) {
+        std::ostringstream name;
+        name << shard_prefix << "." << shard;
+        shard_files.push_back(name.str());
+        pid_t pid = fork();
+        if (pid < 0)
+            break;
+        if (pid == 0) {
+                // Worker never returns to the caller
+            int status = 0;
+            try {
+                ExtractShard(file_list, shard_files.back(), shard, workers, useSse, mode, full);
+            }
+            catch (const std::string& error) {
+                std::cerr << "Error! " << error << std::endl;
+                status = 1;
+            }
+            _exit(status);
+        }
+        pids.push_back(pid);
+    }
+    bool ok = pids.size() == workers;
+    for (size_t worker = 0; worker < pids.size(); ++worker) {
+        int status;
+        ok = waitpid(pids[worker], &status, 0) == pids[worker] && WIFEXITED(status) && WEXITSTATUS(status) == 0 && ok;
+    }
+    if (!ok) {
+            // Shards of workers which succeeded are useless without the others
+        for (size_t shard = 0; shard < shard_files.size(); ++shard)
+            remove(shard_files[shard].c_str());
+        throw std::string("Worker extracting features failed");
+    }
+    return shard_files;
+}
+
+TTemporaryFiles::~TTemporaryFiles() {
+    for (size_t file = 0; file < files.size(); ++file)
+        remove(files[file].c_str());
+}
+
+void MergeShards(const std::vector<std::string>& shard_files, uint64_t source, FeatureMatrix* features) {
+    std::vector<FeatureMatrix> shards;
+    size_t rows = 0, cols = 0;
+    for (size_t shard = 0; shard < shard_files.size(); ++shard) {
+        shards.push_back(FeatureMatrix::Map(shard_files[shard]));
+        if (shards.back().Source() != source)
+            throw std::string("Feature shard " + shard_files[shard] + " is not of these images and options");
+        rows += shards.back().Rows();
+        if (shards.back().Rows())
+            cols = shards.back().Cols();
+    }
+        // Rows are reserved for the known number of features
+    *features = FeatureMatrix(cols);
+    features->Reserve(rows);
+    for (size_t shard = 0; shard < shards.size(); ++shard)
+        for (size_t row = 0; row < shards[shard].Rows(); ++row)
+            features->AppendRow(shards[shard].Row(row), shards[shard].Cols(), shards[shard].Label(row));
+    features->SetSource(source);
+}
@@ -4,12 +4,28 @@
 #include <cassert>
 #include <iostream>
 #include <cmath>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+#include <exception>
 
 #include "classifier.h"
 #include "EasyBMP.h"
 #include "linear.h"
 #include "argvparser.h"
 #include "methods.h"
+#include "detect.h"
+#include "quantized.h"
+#include "online_classifier.h"
+#include "intersection.h"
+#include "extraction.h"
+#include "cascade.h"
+#include "distributed.h"
+#include "projection.h"
+#include "knn.h"
+#include "shards.h"
 
 using std::string;
 using std::vector;
@@ -36,10 +52,7 @@ The program may also work with sse intrinsics for faster results.
 
 ///TDataSet - vector containing pairs of pointers to BMP images and corresponding labels
 typedef vector<pair<BMP*, int> > TDataSet;
-///TFileList - vector containing pairs of image paths and corresponding labels
-typedef vector<pair<string, int> > TFileList;
-///TFeatures - vector containing pairs of image features and corresponding labels
-typedef vector<pair<vector<float>, int> > TFeatures;
+///TFeatures - (@ref FeatureMatrix) containing image features and corresponding labels (see classifier.h)
 
 
 
@@ -113,48 +126,76 @@ Extract features form given dataset
 @param data_set is a (@ref TDataSet) that contains loaded images and corresponding labels
 @param features is a (@ref TFeatures) that will store the extracted features
 @param useSse is a bool that specifies whether sse  intrinsics will be used
+@param mode is the (@ref MagnitudeMode) of gradient magnitudes
+@param full is a bool that specifies whether full features (see extraction.h) are extracted
+@param mask is a (@ref FeatureMask) of cells to compute, or NULL to compute all features
+@param projection is a (@ref TProjection) applied to features of every (@ref PROJECTION_BATCH) images
+as they are extracted, or NULL to store features as they are
 */
-void ExtractFeatures(const TDataSet& data_set, TFeatures* features, bool useSse) {
+void ExtractFeatures(const TDataSet& data_set, TFeatures* features, bool useSse, MagnitudeMode mode,
+   bool full, const FeatureMask* mask = NULL, const TProjection* projection = NULL) {
+        // Features of images which are not projected yet
+    TFeatures batch;
     for (size_t image_idx = 0; image_idx < data_set.size(); ++image_idx) {
         std::vector<float> result;
-        Image gray = ImgToGrayscale(data_set[image_idx].first);
-        Image hor(gray.n_rows, gray.n_cols);
-        Image vert(gray.n_rows, gray.n_cols);
-        ApplySobel(gray, hor, vert, useSse);
-        floatImage magn = GetMagnitude(hor, vert, useSse);
-
-        GetDescriptor(hor, vert, magn, result);
-
-        //uncomment to run full tests
-        /*uint halfRows = hor.n_rows >> 1;
-        uint halfCols = hor.n_cols >> 1;
-
-        GetDescriptor(   hor.submatrix(0, 0, halfRows, halfCols), 
-                        vert.submatrix(0, 0, halfRows, halfCols),  
-                        magn.submatrix(0, 0, halfRows, halfCols), 
-                        result);
-
-        GetDescriptor(   hor.submatrix(0, halfCols, halfRows, halfCols), 
-                        vert.submatrix(0, halfCols, halfRows, halfCols), 
-                        magn.submatrix(0, halfCols, halfRows, halfCols),
-                        result);
-
-        GetDescriptor(   hor.submatrix(halfRows, 0, halfRows, halfCols), 
-                        vert.submatrix(halfRows, 0, halfRows, halfCols),
-                        magn.submatrix(halfRows, 0, halfRows, halfCols),
-                        result);
-
-        GetDescriptor(   hor.submatrix(halfRows, halfCols, halfRows, halfCols), 
-                        vert.submatrix(halfRows, halfCols, halfRows, halfCols), 
-                        magn.submatrix(halfRows, halfCols, halfRows, halfCols), 
-                        result);
+        if (mask)
+            ExtractDescriptor(data_set[image_idx].first, *mask, useSse, mode, result);
+        else
+            ExtractDescriptor(data_set[image_idx].first, full, useSse, mode, result);
+        if (!projection) {
+            features->AppendRow(result, data_set[image_idx].second);
+            continue;
+        }
+        batch.AppendRow(result, data_set[image_idx].second);
+        if (batch.Rows() == PROJECTION_BATCH || image_idx + 1 == data_set.size()) {
+            projection->Apply(batch, features, useSse);
+            batch = TFeatures();
+        }
+    }
+}
 
-        result = ApplyHIKernel(result);
+/**
+@function ProjectionFile
+Path to the file of (@ref TProjection) of features of the model in model_file
+*/
+string ProjectionFile(const string& model_file) {
+    return model_file + ".projection";
+}
 
-        GetColors(data_set[image_idx].first, result);*/
+/**
+@function LoadProjection
+Loads the projection of features of the model in model_file, leaves projection empty if the model has none
+*/
+void LoadProjection(const string& model_file, TProjection* projection) {
+    if (ifstream(ProjectionFile(model_file).c_str()))
+        projection->Load(ProjectionFile(model_file));
+}
 
-        features->push_back(std::make_pair(result, data_set[image_idx].second));
+/**
+@function ReduceFeatures
+Reduces features for the model in model_file and saves the projection next to it (@ref ProjectionFile)
+@param reduce is a string that specifies the projection: "pca" learned from a sample of features,
+"random", or empty to keep features and remove the projection of a previous model
+@param reduce_dims is the number of features after reduction
+@param model_file is a string that specifies the path to the file of the model
+@param useSse is a bool that specifies whether sse intrinsics will be used
+@param features is a (@ref TFeatures) that is replaced by projected features
+*/
+void ReduceFeatures(const string& reduce, size_t reduce_dims, const string& model_file, bool useSse,
+   TFeatures* features) {
+    if (reduce.empty()) {
+            // Projection of a previous model must not apply to this one
+        remove(ProjectionFile(model_file).c_str());
+        return;
     }
+    TProjection projection = reduce == "pca" ?
+        TProjection::Pca(*features, reduce_dims, PROJECTION_SAMPLE, 0, useSse) :
+        TProjection::Random(features->Cols(), reduce_dims, 0);
+    TFeatures reduced;
+    projection.Apply(*features, &reduced, useSse);
+    cout << "Features reduced from " << features->Cols() << " to " << reduced.Cols() << endl;
+    *features = std::move(reduced);
+    projection.Save(ProjectionFile(model_file));
 }
 
 /**
@@ -170,44 +211,379 @@ void ClearDataset(TDataSet* data_set) {
     data_set->clear();
 }   
 
+/**
+@function LoadTrainingFeatures
+Loads features for training from feature shards, from the file of features or from images
+@param data_file is a string that specifies the path to the file that contains images` names and corresponding labels
+@param useSse is a bool that specifies whether sse  intrinsics will be used
+@param mode is the (@ref MagnitudeMode) of gradient magnitudes
+@param full is a bool that specifies whether full features are extracted
+@param features_file is a string that specifies the path to the file of features, or is empty.
+If the file exists and holds features of the images of data_file extracted with mode and full
+(@ref FeatureSource), features are mapped from it and images are not loaded at all; otherwise features
+are extracted, saved to it and mapped back, so the solver reads samples from the page cache
+@param shard_files is a vector of paths to feature shards (@ref ExtractShard) to train on instead of images,
+or is empty. Shards must be extracted from the images of data_file with mode and full, merged shards
+are saved to features_file if it is given
+@param features is a (@ref TFeatures) that will store the samples
+*/
+void LoadTrainingFeatures(const string& data_file, bool useSse, MagnitudeMode mode, bool full,
+   const string& features_file, const vector<string>& shard_files, TFeatures* features) {
+        // List of image file names and its labels
+    TFileList file_list;
+        // Structure of images and its labels
+    TDataSet data_set;
+
+        // Load list of image file names and its labels
+    LoadFileList(data_file, &file_list);
+        // Key of features of these images with these options
+    uint64_t source = FeatureSource(file_list, mode, full);
+    if (shard_files.empty() && !features_file.empty() && ifstream(features_file.c_str())) {
+        *features = TFeatures::Map(features_file);
+        if (features->Source() == source)
+            return;
+        cout << "Features in " << features_file << " are not of these images and options, extracting again" << endl;
+        *features = TFeatures();
+    }
+
+    if (!shard_files.empty()) {
+            // Shards keep the order of the file list
+        MergeShards(shard_files, source, features);
+        bool same = features->Rows() == file_list.size();
+        for (size_t image_idx = 0; same && image_idx < file_list.size(); ++image_idx)
+            same = features->Label(image_idx) == file_list[image_idx].second;
+        if (!same)
+            throw string("Feature shards don't hold the images of " + data_file);
+    }
+    else {
+            // Load images
+        LoadImages(file_list, &data_set);
+            // Extract features from images
+        ExtractFeatures(data_set, features, useSse, mode, full);
+            // Clear dataset structure
+        ClearDataset(&data_set);
+    }
+    features->SetSource(source);
+    if (!features_file.empty()) {
+        features->Save(features_file);
+        *features = TFeatures::Map(features_file);
+    }
+}
+
 /**
 @function TrainClassifier
 Trains the SVM classifier 
 @param data_file is a string that specifies the path to the file that contains images` names and corresponding labels
 @param model_file is a string that specifies the path to the file that will store the model
 @param useSse is a bool that specifies whether sse  intrinsics will be used
+@param mode is the (@ref MagnitudeMode) of gradient magnitudes
+@param full is a bool that specifies whether full features are extracted
+@param settings is a (@ref TClassifierParams) with threads, budget and checkpoints of the solver
+@param init_model_file is a string that specifies the path to the model to resume training from, or is empty
+@param features_file is a string that specifies the path to the file of features, or is empty,
+see (@ref LoadTrainingFeatures)
+@param shard_files is a vector of paths to feature shards to train on instead of images, or is empty
+@param reduce is a string that specifies how features are reduced before training, see (@ref ReduceFeatures)
+@param reduce_dims is the number of features after reduction
 */
-void TrainClassifier(const string& data_file, const string& model_file, bool useSse) {
+void TrainClassifier(const string& data_file, const string& model_file, bool useSse, MagnitudeMode mode,
+   bool full, const TClassifierParams& settings, const string& init_model_file, const string& features_file,
+   const vector<string>& shard_files, const string& reduce, size_t reduce_dims) {
     //data_file == file with images` names and labels
     //model_file == output_file
 
-        // List of image file names and its labels
-    TFileList file_list;
-        // Structure of images and its labels
-    TDataSet data_set;
         // Structure of features of images and its labels
     TFeatures features;
         // Model which would be trained
     TModel model;
         // Parameters of classifier
-    TClassifierParams params;
+    TClassifierParams params(settings);
+        // Model to resume training from
+    TModel init_model;
 
-        // Load list of image file names and its labels
-    LoadFileList(data_file, &file_list);
-        // Load images
-    LoadImages(file_list, &data_set);
-        // Extract features from images
-    ExtractFeatures(data_set, &features, useSse);
+    LoadTrainingFeatures(data_file, useSse, mode, full, features_file, shard_files, &features);
+    ReduceFeatures(reduce, reduce_dims, model_file, useSse, &features);
         // PLACE YOUR CODE HERE
         // You can change parameters of classifier here
     params.C = 0.01;
+    if (!init_model_file.empty()) {
+        init_model.Load(init_model_file);
+        if (!init_model.get())
+            throw string("Can't load initial model " + init_model_file);
+        params.init_model = init_model.get();
+    }
     TClassifier classifier(params);
         // Train classifier
     classifier.Train(features, &model);
         // Save model to file
     model.Save(model_file);
-        // Clear dataset structure
+}
+
+/**
+@function TrainIndex
+Indexes features of labelled images for k nearest neighbours classification (@ref TKnnIndex)
+instead of training the SVM classifier
+@param data_file is a string that specifies the path to the file that contains images` names and corresponding labels
+@param model_file is a string that specifies the path to the file that will store the index
+@param useSse is a bool that specifies whether sse  intrinsics will be used
+@param mode is the (@ref MagnitudeMode) of gradient magnitudes
+@param full is a bool that specifies whether full features are extracted
+@param params is a (@ref TKnnParams) with lists and threads of the index
+@param features_file is a string that specifies the path to the file of features, or is empty,
+see (@ref LoadTrainingFeatures)
+@param shard_files is a vector of paths to feature shards to index instead of images, or is empty
+@param reduce is a string that specifies how features are reduced before indexing, see (@ref ReduceFeatures)
+@param reduce_dims is the number of features after reduction
+*/
+void TrainIndex(const string& data_file, const string& model_file, bool useSse, MagnitudeMode mode, bool full,
+   const TKnnParams& params, const string& features_file, const vector<string>& shard_files,
+   const string& reduce, size_t reduce_dims) {
+        // Structure of features of images and its labels
+    TFeatures features;
+        // Index of features
+    TKnnIndex index(params);
+
+    LoadTrainingFeatures(data_file, useSse, mode, full, features_file, shard_files, &features);
+    ReduceFeatures(reduce, reduce_dims, model_file, useSse, &features);
+    index.Build(features);
+    cout << "Indexed " << index.Size() << " images in " << index.Lists() << " lists" << endl;
+    index.Save(model_file);
+}
+
+/**
+@function InsertToIndex
+Adds labelled images to the index of (@ref TrainIndex) without rebuilding it: every image goes
+to the list of its nearest centroid
+@param data_file is a string that specifies the path to the file that contains images` names and corresponding labels
+@param model_file is a string that specifies the path to the file of the index, which is updated
+@param useSse is a bool that specifies whether sse  intrinsics will be used
+@param mode is the (@ref MagnitudeMode) of gradient magnitudes, must be the same as in indexing
+@param full is a bool that specifies whether full features are extracted, must be the same as in indexing
+@param params is a (@ref TKnnParams) of the index
+*/
+void InsertToIndex(const string& data_file, const string& model_file, bool useSse, MagnitudeMode mode, bool full,
+   const TKnnParams& params) {
+        // List of image file names and its labels
+    TFileList file_list;
+        // Structure of images and its labels
+    TDataSet data_set;
+        // Structure of features of images and its labels
+    TFeatures features;
+        // Index of features
+    TKnnIndex index(params);
+        // Projection of features of the index
+    TProjection projection;
+
+    index.Load(model_file);
+    LoadProjection(model_file, &projection);
+    LoadFileList(data_file, &file_list);
+    LoadImages(file_list, &data_set);
+    ExtractFeatures(data_set, &features, useSse, mode, full, NULL, projection.Empty() ? NULL : &projection);
     ClearDataset(&data_set);
+    index.Insert(features);
+    cout << "Inserted " << features.Rows() << " images, the index has " << index.Size() << endl;
+    index.Save(model_file);
+}
+
+/**
+@function TrainWorker
+Trains the SVM classifier together with other processes, local or remote, as a worker of (@ref CoordinateTraining):
+this process holds only its own part of the samples
+@param address is a string, address of the coordinator: unix:PATH or HOST:PORT
+@param data_file is a string that specifies the path to the file that contains images` names and corresponding labels
+of the part of the worker
+@param useSse is a bool that specifies whether sse  intrinsics will be used
+@param mode is the (@ref MagnitudeMode) of gradient magnitudes
+@param full is a bool that specifies whether full features are extracted
+@param settings is a (@ref TClassifierParams) with threads and budget of the solver of every round
+@param features_file is a string that specifies the path to the file of features, or is empty,
+see (@ref LoadTrainingFeatures)
+@param shard_files is a vector of paths to feature shards to train on instead of images, or is empty
+*/
+void TrainWorker(const string& address, const string& data_file, bool useSse, MagnitudeMode mode, bool full,
+   const TClassifierParams& settings, const string& features_file, const vector<string>& shard_files) {
+        // Features of the part of the worker
+    TFeatures features;
+        // Parameters of classifier, the same as in TrainClassifier
+    TClassifierParams params(settings);
+
+    LoadTrainingFeatures(data_file, useSse, mode, full, features_file, shard_files, &features);
+    params.C = 0.01;
+        // Local weights of a round are not a model of the whole problem
+    params.checkpoint_file.clear();
+    RunConsensusWorker(address, features, params);
+}
+
+/**
+@function CoordinateTraining
+Coordinates training of workers (@ref TrainWorker) by consensus ADMM (@ref TConsensusCoordinator),
+the model is the one TrainClassifier would train on the samples of all workers
+@param address is a string, address to listen on: unix:PATH or HOST:PORT
+@param model_file is a string that specifies the path to the file that will store the model
+@param workers is the number of workers
+@param rounds is the maximal number of rounds, 0 means the default
+*/
+void CoordinateTraining(const string& address, const string& model_file, size_t workers, int rounds) {
+        // Parameters of ADMM
+    TConsensusParams params;
+    if (rounds > 0)
+        params.rounds = rounds;
+    TConsensusCoordinator coordinator(address, params);
+    cout << "Waiting for " << workers << " workers on " << coordinator.Address() << endl;
+        // Model which would be trained
+    TModel model;
+    coordinator.Train(workers, &model);
+    cout << "Consensus after " << coordinator.Rounds() << " rounds" << endl;
+        // Save model to file
+    model.Save(model_file);
+}
+
+/**
+@function TrainOnline
+Trains the classifier with (@ref TOnlineClassifier) while images are read: every image is loaded,
+described and dropped, so memory doesn't depend on the number of images.
+The order of images is shuffled in every pass, files sorted by class would spoil SGD
+@param data_file is a string that specifies the path to the file that contains images` names and corresponding labels
+@param model_file is a string that specifies the path to the file that will store the model
+@param useSse is a bool that specifies whether sse  intrinsics will be used
+@param mode is the (@ref MagnitudeMode) of gradient magnitudes
+@param full is a bool that specifies whether full features are extracted
+@param passes is the number of passes over images
+*/
+void TrainOnline(const string& data_file, const string& model_file, bool useSse, MagnitudeMode mode, bool full,
+   int passes) {
+        // List of image file names and its labels
+    TFileList file_list;
+    LoadFileList(data_file, &file_list);
+    if (file_list.empty())
+        throw string("No images in " + data_file);
+
+        // Same regularization as C = 0.01 in TrainClassifier
+    TOnlineClassifierParams params;
+    params.lambda = 1 / (0.01 * file_list.size());
+        // Average over the last pass
+    params.averaging_start = file_list.size() * (passes - 1);
+        // Classifier, created when the number of features is known
+    std::unique_ptr<TOnlineClassifier> classifier;
+        // Shuffles images before every pass
+    std::mt19937 generator(0);
+    for (int pass = 0; pass < passes; ++pass) {
+        std::shuffle(file_list.begin(), file_list.end(), generator);
+        for (size_t image_idx = 0; image_idx < file_list.size(); ++image_idx) {
+            BMP image;
+            image.ReadFromFile(file_list[image_idx].first.c_str());
+            vector<float> features;
+            ExtractDescriptor(&image, full, useSse, mode, features);
+                // Number of features is known after the first image
+            if (!classifier)
+                classifier.reset(new TOnlineClassifier(features.size(), params));
+            classifier->Update(features, file_list[image_idx].second);
+        }
+    }
+    TModel model;
+    classifier->GetModel(&model);
+    model.Save(model_file);
+}
+
+/**
+@function TrainIntersection
+Trains the intersection kernel SVM (@ref TIntersectionClassifier) and saves its lookup tables,
+a replacement of the explicit feature map of (@ref ApplyHIKernel)
+@param data_file is a string that specifies the path to the file that contains images` names and corresponding labels
+@param model_file is a string that specifies the path to the file that will store the model
+@param useSse is a bool that specifies whether sse  intrinsics will be used
+@param mode is the (@ref MagnitudeMode) of gradient magnitudes
+@param full is a bool that specifies whether full features are extracted
+@param features_file is a string that specifies the path to the file of features, or is empty,
+see (@ref LoadTrainingFeatures)
+@param shard_files is a vector of paths to feature shards to train on instead of images, or is empty
+*/
+void TrainIntersection(const string& data_file, const string& model_file, bool useSse, MagnitudeMode mode,
+   bool full, const string& features_file, const vector<string>& shard_files) {
+        // Structure of features of images and its labels
+    TFeatures features;
+        // Lookup tables of the trained model
+    TIntersectionModel model;
+
+    LoadTrainingFeatures(data_file, useSse, mode, full, features_file, shard_files, &features);
+    TIntersectionClassifier(TIntersectionParams()).Train(features, &model);
+    model.Save(model_file);
+}
+
+/**
+@function TrainCoarse
+Trains the first stage of (@ref TCascade) on coarse descriptors (@ref ExtractCoarseDescriptor)
+@param data_file is a string that specifies the path to the file that contains images` names and corresponding labels
+@param cascade_file is a string that specifies the path to the file that will store the coarse model
+@param useSse is a bool that specifies whether sse  intrinsics will be used
+*/
+void TrainCoarse(const string& data_file, const string& cascade_file, bool useSse) {
+        // List of image file names and its labels
+    TFileList file_list;
+        // Coarse features of images and its labels
+    TFeatures features;
+        // Model which would be trained
+    TModel model;
+        // Parameters of classifier
+    TClassifierParams params;
+
+    LoadFileList(data_file, &file_list);
+    for (size_t image_idx = 0; image_idx < file_list.size(); ++image_idx) {
+        BMP image;
+        image.ReadFromFile(file_list[image_idx].first.c_str());
+        vector<float> result;
+        ExtractCoarseDescriptor(ImgToGrayscale(&image, useSse), useSse, result);
+        features.AppendRow(result, file_list[image_idx].second);
+    }
+    params.C = 0.1;
+    TClassifier(params).Train(features, &model);
+    model.Save(cascade_file);
+}
+
+/**
+@function PredictCascade
+Classifies images with (@ref TCascade) and reports images, time and accuracy of every stage
+@param data_file is a string that specifies the path to the file that contains images` names and labels
+@param model_file is a string that specifies the path to the file that contains the model
+@param cascade_file is a string that specifies the path to the file that contains the coarse model
+@param prediction_file is a string that specifies the path to the file to save predictions
+@param useSse is a bool that specifies whether sse intrinsics will be used
+@param mode is the (@ref MagnitudeMode) of gradient magnitudes, must be the same as in training
+@param full is a bool that specifies whether full features are extracted, must be the same as in training
+@param margin is the confidence of the coarse model below which the model is used
+*/
+void PredictCascade(const string& data_file, const string& model_file, const string& cascade_file,
+   const string& prediction_file, bool useSse, MagnitudeMode mode, bool full, double margin) {
+        // List of image file names and its labels
+    TFileList file_list;
+        // Models of both stages
+    TModel model, coarse;
+        // List of image labels
+    TLabels labels;
+
+    LoadFileList(data_file, &file_list);
+    model.Load(model_file);
+    coarse.Load(cascade_file);
+    if (!model.get() || !coarse.get())
+        throw string("Can't load models " + model_file + " and " + cascade_file);
+    TCascade cascade(coarse.get(), model.get(), margin, full);
+        // Correct labels given by every stage
+    size_t correct[2] = {0, 0};
+    for (size_t image_idx = 0; image_idx < file_list.size(); ++image_idx) {
+            // Images are loaded one by one, most of them never need all features
+        BMP image;
+        image.ReadFromFile(file_list[image_idx].first.c_str());
+        int stage;
+        labels.push_back(cascade.Predict(&image, useSse, mode, &stage));
+        correct[stage] += labels.back() == file_list[image_idx].second;
+    }
+    for (int stage = 0; stage < 2; ++stage) {
+        const TCascadeStage& stats = cascade.Stage(stage);
+        cout << "Stage " << stage + 1 << ": " << stats.images << " images, "
+            << (stats.images ? 1000 * stats.seconds / stats.images : 0) << " ms per image, decided "
+            << stats.decided << " with " << correct[stage] << " correct" << endl;
+    }
+    SavePredictions(file_list, labels, prediction_file);
 }
 
 /**
@@ -216,10 +592,21 @@ Classifies images using the model_file
 @param data_file is a string that specifies the path to the file that contains images` names
 @param model_file is a string that specifies the path to the file that contains the model
 @param useSse is a bool that specifies whether sse intrinsics will be used
+@param mode is the (@ref MagnitudeMode) of gradient magnitudes, must be the same as in training
+@param full is a bool that specifies whether full features are extracted, must be the same as in training
+@param quantize is "uint8" or "fp16" to predict with (@ref QuantizedModel) on features quantized as they
+are extracted, empty string for float prediction
+@param lazy is the threshold of (@ref FeatureMask): only cells with larger weights are extracted.
+Negative lazy extracts all features
+@param knn is a (@ref TKnnParams) with neighbours, probes and threads of prediction if model_file
+is an index of (@ref TrainIndex)
+@param settings is a (@ref TClassifierParams) with threads of prediction by the SVM classifier
+and by the intersection kernel SVM
 */
 void PredictData(const string& data_file,
    const string& model_file,
-   const string& prediction_file, bool useSse) {
+   const string& prediction_file, bool useSse, MagnitudeMode mode, bool full,
+   const string& quantize, double lazy, const TKnnParams& knn, const TClassifierParams& settings) {
         // List of image file names and its labels
     TFileList file_list;
         // Structure of images and its labels
@@ -233,18 +620,79 @@ void PredictData(const string& data_file,
     LoadFileList(data_file, &file_list);
         // Load images
     LoadImages(file_list, &data_set);
-        // Extract features from images
-    ExtractFeatures(data_set, &features, useSse);
 
-        // Classifier 
-    TClassifier classifier = TClassifier(TClassifierParams());
+    if (TIntersectionModel::IsModelFile(model_file)) {
+        if (!quantize.empty() || lazy >= 0)
+            throw string("Intersection kernel models don't support --quantize or --lazy");
+        ExtractFeatures(data_set, &features, useSse, mode, full);
+            // Lookup tables of the intersection kernel SVM
+        TIntersectionModel intersection;
+        intersection.Load(model_file);
+            // Threads of prediction
+        TThreadPool pool(std::max(settings.nr_thread, 1));
+        intersection.Predict(features, &labels, &pool);
+        SavePredictions(file_list, labels, prediction_file);
+        ClearDataset(&data_set);
+        return;
+    }
+
+    if (TKnnIndex::IsIndexFile(model_file)) {
+        if (!quantize.empty() || lazy >= 0)
+            throw string("Nearest neighbours indexes don't support --quantize or --lazy");
+            // Index of labelled features and its projection
+        TKnnIndex index(knn);
+        TProjection projection;
+        index.Load(model_file);
+        LoadProjection(model_file, &projection);
+        ExtractFeatures(data_set, &features, useSse, mode, full, NULL, projection.Empty() ? NULL : &projection);
+        index.Predict(features, &labels);
+        SavePredictions(file_list, labels, prediction_file);
+        ClearDataset(&data_set);
+        return;
+    }
+
+        // Classifier, predicts in threads of settings
+    TClassifier classifier = TClassifier(settings);
         // Trained model
     TModel model;
         // Load model from file
     model.Load(model_file);
-        // Predict images by its features using 'model' and store predictions
-        // to 'labels'
-    classifier.Predict(features, model, &labels);
+    if (!model.get())
+        throw string("Can't load model " + model_file);
+        // Projection the model was trained with
+    TProjection projection;
+    LoadProjection(model_file, &projection);
+    if (!projection.Empty() && lazy >= 0)
+        throw string("Lazy extraction needs a model of features which are not reduced");
+        // Only cells the model needs are extracted if lazy
+    std::unique_ptr<FeatureMask> mask;
+    if (lazy >= 0) {
+        mask.reset(new FeatureMask(model.get(), full, lazy));
+        cout << "Lazy extraction computes " << mask->ActiveCells() << " of " << mask->TotalCells() << " cells" << endl;
+    }
+
+    if (!quantize.empty()) {
+            // Features are quantized batch by batch, float features of all images are never kept
+        QuantizedFeatures quantized(quantize == "fp16" ? QUANT_FP16 : QUANT_UINT8);
+        for (size_t first = 0; first < data_set.size(); first += PROJECTION_BATCH) {
+            TDataSet batch(data_set.begin() + first,
+                data_set.begin() + std::min(first + PROJECTION_BATCH, data_set.size()));
+            TFeatures batch_features;
+            ExtractFeatures(batch, &batch_features, useSse, mode, full, mask.get(),
+                projection.Empty() ? NULL : &projection);
+            quantized.Append(batch_features);
+        }
+        QuantizedModel(model.get()).Predict(quantized, &labels);
+        cout << "Quantized " << quantize << " features take " << quantized.Bytes() << " bytes instead of "
+            << quantized.Rows() * quantized.Cols() * sizeof(float) << endl;
+    }
+    else {
+        ExtractFeatures(data_set, &features, useSse, mode, full, mask.get(),
+            projection.Empty() ? NULL : &projection);
+            // Predict images by its features using 'model' and store predictions
+            // to 'labels'
+        classifier.Predict(features, model, &labels);
+    }
 
         // Save predictions
     SavePredictions(file_list, labels, prediction_file);
@@ -252,6 +700,90 @@ void PredictData(const string& data_file,
     ClearDataset(&data_set);
 }
 
+/**
+@function DetectData
+Finds objects (@ref DETECT_OBJECT_LABEL) in images using the model_file and writes
+one line "image x y width height score" per detection to detection_file
+@param data_file is a string that specifies the path to the file that contains images` names
+@param model_file is a string that specifies the path to the file that contains the model
+@param detection_file is a string that specifies the path to the file that will store the detections
+@param threshold is the minimal score of a detection
+@param useSse is a bool that specifies whether sse intrinsics will be used
+*/
+void DetectData(const string& data_file,
+   const string& model_file,
+   const string& detection_file, float threshold, bool useSse) {
+        // List of image file names
+    TFileList file_list;
+        // Trained model
+    TModel model;
+        // Detector correlates the weights with the grid of plain HOG cells
+    if (TIntersectionModel::IsModelFile(model_file) || TKnnIndex::IsIndexFile(model_file))
+        throw string("Detection needs a linear model, " + model_file + " is not one");
+    if (ifstream(ProjectionFile(model_file).c_str()))
+        throw string("Detection needs a model of features which are not reduced");
+        // Load list of image file names
+    LoadFileList(data_file, &file_list);
+        // Load model from file
+    model.Load(model_file);
+        // Weights of the object class
+    DetectorWeights detector = GetDetectorWeights(model.get(), DETECT_OBJECT_LABEL);
+
+    ofstream stream(detection_file.c_str());
+    for (size_t image_idx = 0; image_idx < file_list.size(); ++image_idx) {
+            // Images are loaded one by one, frames may be large
+        BMP image;
+        image.ReadFromFile(file_list[image_idx].first.c_str());
+        Image gray = ImgToGrayscale(&image, useSse);
+        vector<Detection> detections = DetectObjects(gray, detector, threshold, useSse);
+        for (const Detection& found : detections)
+            stream << file_list[image_idx].first << " " << found.x << " " << found.y << " "
+                << found.width << " " << found.height << " " << found.score << endl;
+    }
+    stream.close();
+}
+
+/**
+@function ParseMagnitudeMode
+Converts the value of --magnitude option to (@ref MagnitudeMode)
+@param name is one of "float", "l1", "alphabeta", "isqrt"
+@param mode is the result
+@return false if the name is unknown
+*/
+bool ParseMagnitudeMode(const string& name, MagnitudeMode* mode) {
+    const pair<string, MagnitudeMode> modes[] = {
+        make_pair("float", MAGNITUDE_FLOAT),
+        make_pair("l1", MAGNITUDE_L1),
+        make_pair("alphabeta", MAGNITUDE_ALPHA_BETA),
+        make_pair("isqrt", MAGNITUDE_ISQRT)
+    };
+    for (const pair<string, MagnitudeMode>& known : modes) {
+        if (known.first == name) {
+            *mode = known.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+@function RefuseOptions
+Prints an error if one of options is given together with option, whose path doesn't support it
+@param cmd is the parsed (@ref ArgvParser)
+@param option is the option which chooses the path
+@param options are the options the path doesn't support
+@return true if an unsupported option is given
+*/
+bool RefuseOptions(const ArgvParser& cmd, const string& option, const vector<string>& options) {
+    for (const string& other : options) {
+        if (cmd.foundOption(other)) {
+            cerr << "Error! --" << option << " doesn't support --" << other << endl;
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
 @function main
 The main function
@@ -272,7 +804,60 @@ int main(int argc, char** argv) {
         ArgvParser::OptionRequiresValue);
     cmd.defineOption("train", "Train classifier");
     cmd.defineOption("predict", "Predict dataset");
+    cmd.defineOption("detect", "Detect objects in images of dataset, detections are saved to predicted_labels");
+    cmd.defineOption("threshold", "Minimal score of detection (default 0)",
+        ArgvParser::OptionRequiresValue);
     cmd.defineOption("sse", "Use sse");
+    cmd.defineOption("quantize", "Predict with quantized features: uint8 (and int8 weights) or fp16",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("online", "Train by averaged SGD while images are read, value is the number of passes",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("threads", "Number of threads of training and prediction (default 1)",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("max-iter", "Maximal number of passes of the solver over samples (default 1000)",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("budget", "Seconds of training, then the solver stops with the model it has reached",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("checkpoint", "Save the model trained so far to <model>.checkpoint every this many seconds",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("init-model", "Model to resume training from, its weights are the starting point",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("kernel", "Train the exact intersection kernel SVM compiled to lookup tables: hik",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("full", "Full features: HOG of the image and its quadrants mapped by HI kernel, and colors");
+    cmd.defineOption("lazy", "Predict extracting only cells with weights above value times the largest weight, 0 skips zero weights",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("cascade", "Coarse model of the first stage of the cascade: trained with --train, used by --predict",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("margin", "Confidence of the coarse model below which the cascade uses the model (default 1)",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("shard", "Only extract features of shard i/N of the images to the file of --features",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("merge", "Train on comma separated feature shards instead of images",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("workers", "Extract features for training in this many forked processes",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("features", "File of features for training: mapped if it exists, written otherwise",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("coordinate", "Coordinate training by workers which hold parts of samples, value is unix:PATH or HOST:PORT",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("peers", "Number of workers of --coordinate (default 2)",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("rounds", "Maximal number of rounds of --coordinate (default 50)",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("join", "Train as a worker of the coordinator at unix:PATH or HOST:PORT on samples of the data set",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("knn", "Index images for the vote of this many nearest neighbours instead of training the SVM (default 5)",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("lists", "Number of lists of the --knn index (default square root of the number of images)",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("probes", "Number of lists of the --knn index a query scans (default 4)",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("insert", "Add images of the data set to the --knn index of the model");
+    cmd.defineOption("reduce", "Reduce features before training to pca:K principal components or random:K projections",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("magnitude", "Gradient magnitude: float (default), l1, alphabeta or isqrt (16-bit integers)",
+        ArgvParser::OptionRequiresValue);
         // Add options aliases
     cmd.defineOptionAlternative("data_set", "d");
     cmd.defineOptionAlternative("model", "m");
@@ -294,7 +879,103 @@ int main(int argc, char** argv) {
     string model_file = cmd.optionValue("model");
     bool train = cmd.foundOption("train");
     bool predict = cmd.foundOption("predict");
+    bool detect = cmd.foundOption("detect");
     bool useSse = cmd.foundOption("sse");
+    bool full = cmd.foundOption("full");
+    MagnitudeMode mode = MAGNITUDE_FLOAT;
+    if (cmd.foundOption("magnitude") && !ParseMagnitudeMode(cmd.optionValue("magnitude"), &mode)) {
+        cerr << "Error! Unknown magnitude " << cmd.optionValue("magnitude") << endl;
+        return 1;
+    }
+    string quantize;
+    if (cmd.foundOption("quantize")) {
+        quantize = cmd.optionValue("quantize");
+        if (quantize != "uint8" && quantize != "fp16") {
+            cerr << "Error! Unknown quantization " << quantize << endl;
+            return 1;
+        }
+    }
+    if (cmd.foundOption("kernel") && cmd.optionValue("kernel") != "hik") {
+        cerr << "Error! Unknown kernel " << cmd.optionValue("kernel") << endl;
+        return 1;
+    }
+    string reduce;
+    size_t reduce_dims = 0;
+    if (cmd.foundOption("reduce")) {
+        string value = cmd.optionValue("reduce");
+        size_t colon = value.find(':');
+        reduce = value.substr(0, colon);
+        if (colon != string::npos)
+            reduce_dims = std::max(atoi(value.c_str() + colon + 1), 0);
+        if ((reduce != "pca" && reduce != "random") || !reduce_dims) {
+            cerr << "Error! Unknown reduction " << value << endl;
+            return 1;
+        }
+    }
+    double lazy = -1;
+    if (cmd.foundOption("lazy"))
+        lazy = std::max(atof(cmd.optionValue("lazy").c_str()), 0.0);
+        // Threads, budget and checkpoints of the solver
+    TClassifierParams settings;
+    if (cmd.foundOption("threads"))
+        settings.nr_thread = atoi(cmd.optionValue("threads").c_str());
+    if (cmd.foundOption("max-iter"))
+        settings.max_iter = atoi(cmd.optionValue("max-iter").c_str());
+    if (cmd.foundOption("budget"))
+        settings.max_seconds = atof(cmd.optionValue("budget").c_str());
+    if (cmd.foundOption("checkpoint")) {
+        settings.checkpoint_file = model_file + ".checkpoint";
+        settings.checkpoint_seconds = atof(cmd.optionValue("checkpoint").c_str());
+        if (settings.checkpoint_seconds <= 0) {
+            cerr << "Error! Checkpoint interval must be positive" << endl;
+            return 1;
+        }
+    }
+        // Nearest neighbours index
+    TKnnParams knn;
+    knn.threads = std::max(settings.nr_thread, 1);
+    knn.useSse = useSse;
+    if (cmd.foundOption("knn"))
+        knn.k = std::max(atoi(cmd.optionValue("knn").c_str()), 1);
+    if (cmd.foundOption("lists"))
+        knn.lists = std::max(atoi(cmd.optionValue("lists").c_str()), 1);
+    if (cmd.foundOption("probes"))
+        knn.probes = std::max(atoi(cmd.optionValue("probes").c_str()), 1);
+        // Training paths other than the SVM solver refuse its options instead of ignoring them,
+        // threads are refused only without --predict, which uses them
+    if (train && cmd.foundOption("kernel") &&
+            (RefuseOptions(cmd, "kernel", {"online", "reduce", "init-model", "max-iter", "budget", "checkpoint"}) ||
+            (!predict && RefuseOptions(cmd, "kernel", {"threads"}))))
+        return 1;
+    if (train && cmd.foundOption("knn") &&
+            RefuseOptions(cmd, "knn", {"kernel", "online", "init-model", "max-iter", "budget", "checkpoint"}))
+        return 1;
+    if (train && cmd.foundOption("online") &&
+            (RefuseOptions(cmd, "online", {"features", "merge", "workers", "reduce", "init-model", "max-iter",
+                "budget", "checkpoint"}) ||
+            (!predict && RefuseOptions(cmd, "online", {"threads"}))))
+        return 1;
+        // Coordinator only averages weights of workers, workers train the SVM on their features
+    if (train && cmd.foundOption("coordinate") && cmd.foundOption("join")) {
+        cerr << "Error! --coordinate and --join can't be given together" << endl;
+        return 1;
+    }
+    if (train && cmd.foundOption("coordinate") &&
+            (RefuseOptions(cmd, "coordinate", {"features", "merge", "workers", "kernel", "knn", "online", "reduce",
+                "init-model", "max-iter", "budget", "checkpoint"}) ||
+            (!predict && RefuseOptions(cmd, "coordinate", {"threads"}))))
+        return 1;
+    if (train && cmd.foundOption("join") &&
+            RefuseOptions(cmd, "join", {"kernel", "knn", "online", "reduce", "init-model", "checkpoint"}))
+        return 1;
+        // Cascade predicts image by image with the float SVM
+    if (predict && cmd.foundOption("cascade") && RefuseOptions(cmd, "cascade", {"quantize", "lazy", "threads"}))
+        return 1;
+        // Detector scores windows on plain HOG cells with float magnitudes
+    if (detect && (full || mode != MAGNITUDE_FLOAT || !reduce.empty() || !quantize.empty() || lazy >= 0)) {
+        cerr << "Error! Detection doesn't support --full, --magnitude, --reduce, --quantize or --lazy" << endl;
+        return 1;
+    }
     if (useSse) {
         std::cout << "Using sse" << std::endl;
     }
@@ -302,20 +983,111 @@ int main(int argc, char** argv) {
         std::cout << "Not using sse" << std::endl;   
     }
 
-        // If we need to train classifier
+    try {
+            // If we need to extract one shard of features
+        if (cmd.foundOption("shard")) {
+            unsigned shard, shards;
+            if (sscanf(cmd.optionValue("shard").c_str(), "%u/%u", &shard, &shards) != 2 || shard >= shards) {
+                cerr << "Error! Shard must be i/N with i < N" << endl;
+                return 1;
+            }
+            if (!cmd.foundOption("features")) {
+                cerr << "Error! Option --features not found!" << endl;
+                return 1;
+            }
+                // List of image file names and its labels
+            TFileList file_list;
+            LoadFileList(data_file, &file_list);
+            ExtractShard(file_list, cmd.optionValue("features"), shard, shards, useSse, mode, full);
+            return 0;
+        }
+            // Feature shards to train on
+        vector<string> shard_files;
+            // Shards of workers are temporary, they are removed also when training throws
+        TTemporaryFiles worker_shards;
+        if (train && cmd.foundOption("merge")) {
+            std::istringstream merge(cmd.optionValue("merge"));
+            string shard_file;
+            while (std::getline(merge, shard_file, ','))
+                if (!shard_file.empty())
+                    shard_files.push_back(shard_file);
+        }
+        else if (train && cmd.foundOption("workers")) {
+            int workers = std::max(atoi(cmd.optionValue("workers").c_str()), 1);
+                // List of image file names and its labels
+            TFileList file_list;
+            LoadFileList(data_file, &file_list);
+            worker_shards.files = ExtractInWorkers(file_list, model_file + ".features", workers, useSse, mode, full);
+            shard_files = worker_shards.files;
+        }
+
+            // If we need to train classifier
 
-    if (train)
-        TrainClassifier(data_file, model_file, useSse);
-        // If we need to predict data
-    if (predict) {
-            // You must declare file to save images
-        if (!cmd.foundOption("predicted_labels")) {
-            cerr << "Error! Option --predicted_labels not found!" << endl;
-            return 1;
+        if (train && cmd.foundOption("coordinate")) {
+            int peers = cmd.foundOption("peers") ? std::max(atoi(cmd.optionValue("peers").c_str()), 1) : 2;
+            CoordinateTraining(cmd.optionValue("coordinate"), model_file, peers,
+                cmd.foundOption("rounds") ? atoi(cmd.optionValue("rounds").c_str()) : 0);
+        }
+        else if (train && cmd.foundOption("join"))
+            TrainWorker(cmd.optionValue("join"), data_file, useSse, mode, full, settings,
+                cmd.foundOption("features") ? cmd.optionValue("features") : string(), shard_files);
+        else if (train && cmd.foundOption("knn"))
+            TrainIndex(data_file, model_file, useSse, mode, full, knn,
+                cmd.foundOption("features") ? cmd.optionValue("features") : string(), shard_files, reduce, reduce_dims);
+        else if (train && cmd.foundOption("kernel"))
+            TrainIntersection(data_file, model_file, useSse, mode, full,
+                cmd.foundOption("features") ? cmd.optionValue("features") : string(), shard_files);
+        else if (train && cmd.foundOption("online"))
+            TrainOnline(data_file, model_file, useSse, mode, full, std::max(atoi(cmd.optionValue("online").c_str()), 1));
+        else if (train)
+            TrainClassifier(data_file, model_file, useSse, mode, full, settings,
+                cmd.foundOption("init-model") ? cmd.optionValue("init-model") : string(),
+                cmd.foundOption("features") ? cmd.optionValue("features") : string(), shard_files,
+                reduce, reduce_dims);
+        if (cmd.foundOption("insert"))
+            InsertToIndex(data_file, model_file, useSse, mode, full, knn);
+        if (train && cmd.foundOption("cascade"))
+            TrainCoarse(data_file, cmd.optionValue("cascade"), useSse);
+            // If we need to predict data
+        if (predict) {
+                // You must declare file to save images
+            if (!cmd.foundOption("predicted_labels")) {
+                cerr << "Error! Option --predicted_labels not found!" << endl;
+                return 1;
+            }
+                // File to save predictions
+            string prediction_file = cmd.optionValue("predicted_labels");
+                // Predict data
+            if (cmd.foundOption("cascade")) {
+                double margin = CASCADE_MARGIN;
+                if (cmd.foundOption("margin"))
+                    margin = atof(cmd.optionValue("margin").c_str());
+                PredictCascade(data_file, model_file, cmd.optionValue("cascade"), prediction_file,
+                    useSse, mode, full, margin);
+            }
+            else {
+                PredictData(data_file, model_file, prediction_file, useSse, mode, full, quantize, lazy, knn, settings);
+            }
         }
-            // File to save predictions
-        string prediction_file = cmd.optionValue("predicted_labels");
-            // Predict data
-        PredictData(data_file, model_file, prediction_file, useSse);
+            // If we need to find objects
+        if (detect) {
+            if (!cmd.foundOption("predicted_labels")) {
+                cerr << "Error! Option --predicted_labels not found!" << endl;
+                return 1;
+            }
+            float threshold = 0;
+            if (cmd.foundOption("threshold"))
+                threshold = atof(cmd.optionValue("threshold").c_str());
+            DetectData(data_file, model_file, cmd.optionValue("predicted_labels"), threshold, useSse);
+        }
+    }
+    catch (const string& error) {
+        cerr << "Error! " << error << endl;
+        return 1;
+    }
+    catch (const std::exception& error) {
+            // Threads which can't be started, memory which can't be allocated
+        cerr << "Error! " << error.what() << endl;
+        return 1;
     }
 }
\ No newline at end of file
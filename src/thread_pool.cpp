@@ -0,0 +1,88 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+/**
+@file thread_pool.cpp
+Implementation of (@ref TThreadPool)
+*/
+
+TThreadPool::TThreadPool(size_t threads)
+    : body_(NULL),
+      count_(0),
+      chunk_(1),
+      next_(0),
+      generation_(0),
+      busy_(0),
+      stop_(false) {
+    for (size_t thread = 0; thread + 1 < threads; ++thread)
+        workers_.push_back(std::thread(&TThreadPool::Work, this, thread));
+}
+
+TThreadPool::~TThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (size_t thread = 0; thread < workers_.size(); ++thread)
+        workers_[thread].join();
+}
+
+void TThreadPool::Run(size_t count, size_t chunk, const std::function<void(size_t, size_t, size_t)>& body) {
+    std::lock_guard<std::mutex> run(run_mutex_);
+    if (count == 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        body_ = &body;
+        count_ = count;
+        chunk_ = std::max<size_t>(chunk, 1);
+        next_ = 0;
+        error_ = std::exception_ptr();
+        busy_ = workers_.size();
+        ++generation_;
+    }
+    if (!workers_.empty())
+        start_.notify_all();
+    RunRanges(workers_.size());
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return busy_ == 0; });
+    body_ = NULL;
+    if (error_)
+        std::rethrow_exception(error_);
+}
+
+void TThreadPool::Work(size_t thread) {
+    size_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+            if (stop_)
+                return;
+            seen = generation_;
+        }
+        RunRanges(thread);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--busy_ == 0)
+            done_.notify_all();
+    }
+}
+
+void TThreadPool::RunRanges(size_t thread) {
+    for (;;) {
+        size_t first = next_.fetch_add(chunk_);
+        if (first >= count_)
+            return;
+        try {
+            (*body_)(first, std::min(first + chunk_, count_), thread);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_)
+                error_ = std::current_exception();
+            next_ = count_;
+        }
+    }
+}